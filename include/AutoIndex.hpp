@@ -0,0 +1,218 @@
+#pragma once
+
+#include "BodyProducer.hpp"
+#include "RootDir.hpp"
+#include <string>
+#include <vector>
+#include <map>
+#include <list>
+#include <utility>
+#include <sys/types.h>
+#include <ctime>
+#include <cstddef>
+
+/**
+ * Renders directory listings for the "autoindex" option.
+ *
+ * Listings are cached by directory (device, inode and modification time,
+ * as StatCache has them, so a cached listing costs no syscall)
+ * and sort order, the least recently used one is dropped
+ * once `_MAX_CACHED_DIRS` are kept.
+ * A listing that isn't cached is built by `produce()` calls,
+ * so a huge directory never stalls the event loop: each call reads
+ * one getdents64() batch (stat()'ing its entries, if needed)
+ * or makes one bounded step of sorting them (a bottom-up merge sort
+ * of the batches). Once built, only one page of the listing
+ * is rendered, a batch of entries at a time (see `render_next()`),
+ * and the batches are pulled as the response is being sent
+ * (see BodyProducer).
+ * @warning	Sizes and modification times of the entries
+ * 		are cached as well: they're refreshed only after
+ * 		the directory itself is modified.
+ */
+class AutoIndex : public BodyProducer
+{
+	public:
+		enum e_format
+		{
+			FORMAT_HTML,
+			FORMAT_JSON
+		};
+
+		enum e_sort
+		{
+			SORT_NONE,	// Order returned by getdents64().
+			SORT_NAME,
+			SORT_SIZE,	// Biggest first.
+			SORT_MTIME	// Most recent first.
+		};
+
+		// Per-location "autoindex_*" options.
+		struct Options
+		{
+			enum e_format	format;
+			enum e_sort	sort;
+			// Show (and stat()) sizes and modification times.
+			bool		details;
+			// Maximum amount of entries on one page.
+			size_t		page_size;
+
+			Options();
+		};
+
+		struct Entry
+		{
+			std::string	name;
+			bool		is_dir;
+			off_t		size;
+			time_t		mtime;
+		};
+
+		/**
+		 * Takes the listing of the directory from the cache,
+		 * if it's still valid according to \p sb, or opens
+		 * the directory beneath \p root (see RootDir) to build it
+		 * (see `produce()`).
+		 * @throw	std::ios_base::failure	Got IO error.
+		 * @param	root		Root directory of the location.
+		 * @param	relative_path	Directory to list,
+		 * 				relative to \p root.
+		 * @param	sb		Its stat() result (as looked up
+		 * 				in StatCache).
+		 * @param	request_path	Request path of the directory
+		 * 				(used for the title only).
+		 * @param	query		Request query ("page=N" selects
+		 * 				the page, the first one is 1).
+		 * @param	options		Listing options.
+		 */
+		AutoIndex(const RootDir &root,
+				const std::string &relative_path,
+				const struct stat &sb,
+				const std::string &request_path,
+				const std::string &query,
+				const Options &options);
+		virtual ~AutoIndex();
+
+		/**
+		 * Renders the next batch of entries of the page
+		 * (the first call also renders the header,
+		 * the last one the footer).
+		 * @param	out	Where to append rendered data.
+		 * @return	true, if something was appended to \p out;
+		 * 		false, if the page is fully rendered.
+		 */
+		bool		render_next(std::string &out);
+
+		/**
+		 * Makes the next step of building the listing
+		 * (appending nothing), then renders the next batch
+		 * with `render_next()`.
+		 * @param	out	Where to append rendered data.
+		 * @return	PRODUCE_MORE, if the listing is still being built
+		 * 		or something was appended to \p out;
+		 * 		PRODUCE_DONE, if the page is fully rendered;
+		 * 		PRODUCE_ERROR, if the directory couldn't be read.
+		 */
+		virtual enum e_produce_status	produce(std::string &out);
+
+		/**
+		 * Get the "Content-Type" of the rendered listing.
+		 * @return	MIME type of the rendered listing.
+		 */
+		const char	*get_content_type() const;
+
+	private:
+		enum e_state
+		{
+			STATE_READING,	// Reading the directory.
+			STATE_SORTING,	// Merging sorted batches.
+			STATE_RENDERING	// Listing is built.
+		};
+
+		// Directory and the order its entries are sorted in.
+		typedef std::pair<std::string, enum e_sort>	CacheKey;
+
+		// Cached content of a directory.
+		struct Listing
+		{
+			dev_t				dev;
+			ino_t				ino;
+			struct timespec			mtime;
+			bool				have_stat;
+			std::vector<Entry>		entries;
+			// Place in `_lru`.
+			std::list<CacheKey>::iterator	lru;
+		};
+
+		// Entries rendered per `render_next()` call.
+		static const size_t			_RENDER_BATCH = 256;
+		// Bytes of directory entries read per `produce()` call.
+		static const size_t			_READ_BATCH = 16384;
+		// Entries moved per `produce()` call while sorting.
+		static const size_t			_SORT_BATCH = 8192;
+		// Maximum amount of listings kept in `_cache`.
+		static const size_t			_MAX_CACHED_DIRS = 64;
+		static std::map<CacheKey, Listing>	_cache;
+		// Keys of `_cache`, the most recently used first.
+		static std::list<CacheKey>		_lru;
+
+		Options			_options;
+		std::string		_request_path;
+		std::vector<Entry>	_entries;	// Entries of `_page`.
+		size_t			_page;		// Starts at 1.
+		size_t			_page_count;
+		size_t			_next;		// Next entry to render.
+		bool			_header_rendered;
+		bool			_footer_rendered;
+
+		// Listing being built.
+		enum e_state		_state;
+		CacheKey		_key;
+		int			_dir_fd;
+		bool			_need_stat;
+		Listing			_listing;
+		bool			(*_compare)(const Entry &, const Entry &);
+		// Merge sort of `_listing.entries`: boundaries of its sorted
+		// runs, of the runs merged so far in this pass (into `_merged`)
+		// and where the merge of the next two runs is.
+		std::vector<size_t>	_runs;
+		std::vector<size_t>	_merged_runs;
+		std::vector<Entry>	_merged;
+		size_t			_run_index;
+		size_t			_left;
+		size_t			_right;
+
+		// AutoIndex is a one-shot renderer.
+		AutoIndex(const AutoIndex &other);
+		AutoIndex &operator=(const AutoIndex &other);
+
+		/**
+		 * Reads the next batch of entries into `_listing`,
+		 * sorting the batch.
+		 * @return	1, if there is more to read; 0, if the directory
+		 * 		was fully read; -1, if reading it failed.
+		 */
+		int			read_next();
+
+		/**
+		 * Makes the next step of merging the sorted batches.
+		 * @return	true, if `_listing` is sorted.
+		 */
+		bool			sort_next();
+
+		/**
+		 * Copies the requested page of \p listing.
+		 */
+		void			select_page(const Listing &listing);
+
+		/**
+		 * Copies the requested page of the built listing
+		 * and moves the listing to the cache.
+		 */
+		void			finish_listing();
+
+		void			render_header(std::string &out) const;
+		void			render_entry(std::string &out,
+				const Entry &entry, bool first) const;
+		void			render_footer(std::string &out) const;
+};
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <string>
+
+/**
+ * Source of a response body that isn't known in advance
+ * (or is too big to be kept in memory at once).
+ *
+ * HTTPResponse sends the headers first and then pulls
+ * the body from the producer whenever the previous part
+ * was written to the socket, framing every part
+ * as a chunk ("Transfer-Encoding: chunked").
+ * Each `produce()` call is expected to append a bounded amount of data,
+ * so memory per response doesn't depend on the response size.
+ */
+class BodyProducer
+{
+	public:
+		enum e_produce_status
+		{
+			PRODUCE_MORE,	// Appended data, call again.
+			PRODUCE_DONE,	// Body is complete (data may be appended).
+			PRODUCE_AGAIN,	// Nothing available right now, retry later.
+			PRODUCE_ERROR	// Body can't be completed.
+		};
+
+		virtual ~BodyProducer() {}
+
+		/**
+		 * Appends the next part of the body to \p out.
+		 * @param	out	Where to append the data.
+		 * @return	Status of the body (see `e_produce_status`).
+		 */
+		virtual enum e_produce_status	produce(std::string &out) = 0;
+};
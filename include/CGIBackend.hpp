@@ -0,0 +1,111 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <ctime>
+#include <stdint.h>
+
+/**
+ * Producer of CGI output (header block and body) for a response,
+ * running alongside the event loop: a forked script (CGIProcess)
+ * or a request to a FastCGI application (FastCGIRequest).
+ *
+ * The event loop watches descriptors listed by `get_watched_fds()`
+ * and reports their readiness to `handle_event()`;
+ * descriptors the backend is done with are removed from epoll
+ * and handed back to `close_fd()`.
+ *
+ * Output is taken from `get_output()` while it's being produced.
+ * Once `MAX_BUFFERED_OUTPUT` bytes of it weren't taken yet,
+ * the descriptor it's read from is left out of `get_watched_fds()`
+ * (it's only removed from epoll then, not closed), so a slow client
+ * holds the backend back instead of the server's memory.
+ *
+ * A backend whose output isn't framed (a pipe) may also hand the rest
+ * of it over after the header block (`start_passthrough()`),
+ * so it's spliced to the client without being copied.
+ */
+class CGIBackend
+{
+	public:
+		// Descriptor and epoll events to watch it for.
+		typedef std::pair<int, uint32_t>	Watch;
+
+		enum { MAX_BUFFERED_OUTPUT = 262144 };
+
+		virtual ~CGIBackend() {}
+
+		/**
+		 * Appends descriptors to watch to \p out.
+		 * The list may change after every event.
+		 */
+		virtual void		get_watched_fds(std::vector<Watch> &out) const = 0;
+
+		/**
+		 * Handles readiness of \p fd (one of `get_watched_fds()`).
+		 * @param	fd	Descriptor reported by epoll.
+		 * @return	true, if \p fd should still be watched;
+		 * 		false, if it's not needed anymore
+		 * 		(stop watching it and `close_fd()` it).
+		 */
+		virtual bool		handle_event(int fd) = 0;
+
+		/**
+		 * Closes \p fd, which isn't watched anymore.
+		 */
+		virtual void		close_fd(int fd) = 0;
+
+		/**
+		 * Periodic check for whatever can't be watched.
+		 */
+		virtual void		poll() = 0;
+
+		/**
+		 * Stops producing the output for good.
+		 */
+		virtual void		abort() = 0;
+
+		/**
+		 * Check if the output is complete.
+		 */
+		virtual bool		is_finished() const = 0;
+
+		/**
+		 * Check if the output is complete and may be used.
+		 */
+		virtual bool		succeeded() const = 0;
+
+		/**
+		 * Check if the backend is running past its deadline.
+		 */
+		virtual bool		is_expired(time_t now) const = 0;
+
+		/**
+		 * Get the output produced so far.
+		 */
+		virtual std::string	&get_output() = 0;
+
+		/**
+		 * Stops reading the output into `get_output()`:
+		 * the rest of it is spliced from `get_passthrough_fd()`
+		 * by the caller, `passthrough_available()` bytes at a time.
+		 * What was read before stays in `get_output()`.
+		 * @return	false, if the output can't be passed through
+		 * 		(it's framed, or over already).
+		 */
+		virtual bool		start_passthrough() { return false; }
+
+		/**
+		 * Get the descriptor the output is spliced from.
+		 */
+		virtual int		get_passthrough_fd() const { return -1; }
+
+		/**
+		 * Get the amount of output that can be spliced right now.
+		 * If there's none, the descriptor is listed
+		 * in `get_watched_fds()` again until there is
+		 * (or the output is over, see `is_finished()`).
+		 */
+		virtual size_t		passthrough_available() { return 0; }
+};
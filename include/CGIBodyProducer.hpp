@@ -0,0 +1,34 @@
+#pragma once
+
+#include "BodyProducer.hpp"
+#include "CGIBackend.hpp"
+#include <string>
+
+/**
+ * Response body taken from a CGI backend while it's still running,
+ * so the client gets the output as soon as it's produced
+ * instead of after the script exits.
+ *
+ * Every `produce()` call takes whatever output the backend
+ * buffered so far (the header block was already taken from it).
+ * @warning	Doesn't own the backend: it must outlive the producer.
+ */
+class CGIBodyProducer : public BodyProducer
+{
+	public:
+		CGIBodyProducer(CGIBackend &backend);
+
+		/**
+		 * Takes the buffered output of the backend.
+		 * @return	PRODUCE_AGAIN, if there's none yet;
+		 * 		PRODUCE_ERROR, if the backend failed
+		 * 		(or was aborted) after the header was sent.
+		 */
+		enum e_produce_status	produce(std::string &out);
+
+	private:
+		CGIBackend	&_backend;
+
+		CGIBodyProducer(const CGIBodyProducer &other);
+		CGIBodyProducer &operator=(const CGIBodyProducer &other);
+};
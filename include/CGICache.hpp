@@ -0,0 +1,134 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <ctime>
+#include <cstddef>
+
+class CGICacheWait;
+
+/**
+ * In-memory cache of complete CGI outputs (header block and body,
+ * as the script printed them) for "cgi_cache" locations,
+ * so identical GET requests don't run the script every time.
+ *
+ * A miss makes the request the entry's filler: it runs the script
+ * and ends up in `store()` (the output may be reused),
+ * `pass()` (it may not, skip the cache for a while)
+ * or `abandon()` (the script failed). Requests missing the same entry
+ * in the meantime don't run the script, they wait
+ * (see CGICacheWait) and are handed the stored output,
+ * or told to try again.
+ *
+ * An expired entry is still served for its stale time,
+ * while a single request refreshes it.
+ */
+class CGICache
+{
+	public:
+		enum e_lookup
+		{
+			LOOKUP_HIT,	// Output is fresh (or being refreshed).
+			LOOKUP_STALE,	// Output is stale: serve it and refresh
+					// the entry (caller is its filler now).
+			LOOKUP_MISS,	// Run the script, caller is the filler.
+			LOOKUP_WAIT,	// Another request is filling the entry.
+			LOOKUP_BYPASS	// Run the script, don't cache its output.
+		};
+
+		/**
+		 * Looks \p key up.
+		 * @param	key	Key of the response.
+		 * @param	now	Current time.
+		 * @param	output	Cached CGI output, for hits
+		 * 			(and stale ones).
+		 */
+		static enum e_lookup	lookup(const std::string &key, time_t now,
+						std::string &output);
+
+		/**
+		 * Stores \p output of the filled entry and hands it
+		 * to the waiting requests.
+		 * @param	key	Key of the entry.
+		 * @param	output	Complete CGI output.
+		 * @param	now	Current time.
+		 * @param	ttl	Seconds it's fresh.
+		 * @param	stale	Seconds it may be served stale after that.
+		 */
+		static void		store(const std::string &key, const std::string &output,
+						time_t now, time_t ttl, time_t stale);
+
+		/**
+		 * Marks \p key as not cacheable for \p ttl seconds:
+		 * requests run the script without waiting for each other.
+		 * Waiting requests are told to try again.
+		 */
+		static void		pass(const std::string &key, time_t now, time_t ttl);
+
+		/**
+		 * Gives up on filling \p key (what's stored stays).
+		 * Waiting requests are told to try again.
+		 */
+		static void		abandon(const std::string &key);
+
+		/**
+		 * Adds \p waiter to the requests waiting for \p key.
+		 */
+		static void		wait(const std::string &key, CGICacheWait *waiter);
+
+		/**
+		 * Removes \p waiter from the requests waiting for \p key.
+		 */
+		static void		cancel(const std::string &key, CGICacheWait *waiter);
+
+		/**
+		 * Parses "Cache-Control" of a CGI response.
+		 * @param	value	Value of the field.
+		 * @param	ttl	Set to "s-maxage" or "max-age",
+		 * 			if there is one.
+		 * @param	stale	Set to "stale-while-revalidate",
+		 * 			if there is one.
+		 * @return	false, if the response may not be cached
+		 * 		("no-store", "no-cache", "private").
+		 */
+		static bool		parse_cache_control(const std::string &value,
+						time_t &ttl, time_t &stale);
+
+	private:
+		// Limits of what's kept, past them new outputs aren't stored.
+		enum { MAX_ENTRIES = 1024 };
+		enum { MAX_SIZE = 64 * 1024 * 1024 };
+
+		struct Entry
+		{
+			// Stored output; empty if there's none.
+			std::string			output;
+			// Output (or passing) expires then,
+			// stale output is served until `stale_until`.
+			time_t				fresh_until;
+			time_t				stale_until;
+			// Requests skip the cache until `fresh_until`.
+			bool				pass;
+			// A request runs the script to fill the entry.
+			bool				filling;
+			std::vector<CGICacheWait *>	waiters;
+
+			Entry();
+		};
+
+		static std::map<std::string, Entry>	_entries;
+		// Sum of the lengths of stored outputs.
+		static size_t				_size;
+
+		/**
+		 * Hands \p output (NULL: try again) to the requests
+		 * waiting for \p entry.
+		 */
+		static void		wake(Entry &entry, const std::string *output);
+
+		/**
+		 * Drops entries that can't be served anymore.
+		 */
+		static void		purge(time_t now);
+};
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "CGIBackend.hpp"
+#include <string>
+#include <vector>
+#include <ctime>
+
+/**
+ * Request waiting for another one to fill a CGICache entry,
+ * driven by the event loop like the backends it stands in for.
+ *
+ * Only its eventfd is watched: the cache signals it once the entry
+ * is stored (the stored CGI output becomes this backend's output,
+ * so it's handled like the script's own) or given up on
+ * (then it fails, see `should_retry()`).
+ * @warning	Descriptors are closed by `close_fd()`
+ * 		or when the object is destroyed:
+ * 		remove them from epoll before that.
+ */
+class CGICacheWait : public CGIBackend
+{
+	public:
+		CGICacheWait();
+		/**
+		 * Leaves the entry's waiters, if it's still waiting.
+		 */
+		~CGICacheWait();
+
+		/**
+		 * Starts waiting for \p key.
+		 * @throw	std::runtime_error	eventfd() failed.
+		 * @param	key	Key of the entry being filled.
+		 * @param	timeout	Seconds to wait at most.
+		 */
+		void		start(const std::string &key, time_t timeout);
+
+		/**
+		 * Hands the entry's output over. Called by CGICache.
+		 * @param	output	Stored CGI output;
+		 * 			NULL, if the entry wasn't filled.
+		 */
+		void		deliver(const std::string *output);
+
+		/**
+		 * Check if the entry wasn't filled after all,
+		 * so the request should be handled again.
+		 */
+		bool		should_retry() const;
+
+		/**
+		 * Lists the eventfd until it's signaled.
+		 */
+		void		get_watched_fds(std::vector<Watch> &out) const;
+
+		bool		handle_event(int fd);
+		void		close_fd(int fd);
+
+		/**
+		 * Nothing to poll: the eventfd is watched.
+		 */
+		void		poll();
+
+		/**
+		 * Stops waiting.
+		 */
+		void		abort();
+
+		bool		is_finished() const;
+
+		/**
+		 * Check if the entry's output was handed over.
+		 */
+		bool		succeeded() const;
+
+		bool		is_expired(time_t now) const;
+
+		/**
+		 * Get the entry's output.
+		 */
+		std::string	&get_output();
+
+	private:
+		std::string	_key;
+		// Signaled by `deliver()`.
+		int		_wake_fd;
+		// `deliver()` was called, or waiting was aborted.
+		bool		_done;
+		bool		_delivered;
+		time_t		_deadline;
+		std::string	_output;
+
+		CGICacheWait(const CGICacheWait &other);
+		CGICacheWait &operator=(const CGICacheWait &other);
+};
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <string>
+#include <deque>
+#include <map>
+#include <cstddef>
+
+struct EffectiveLocation;
+class CGISlotWait;
+
+/**
+ * Slots of "cgi_max_concurrent" locations: at most that many
+ * of their scripts run at once.
+ *
+ * A request that doesn't get a slot waits in the location's queue
+ * (see CGISlotWait), first come, first served, and is handed the slot
+ * of the next script to end. Once the queue is full too,
+ * requests are turned away right away (503).
+ *
+ * Running scripts, queue depth, turned away and timed out requests
+ * and time spent waiting are kept in Stats, by location path.
+ */
+class CGILimiter
+{
+	public:
+		/**
+		 * Takes a slot of \p location, if one is free.
+		 * @return	false, if every slot is taken.
+		 */
+		static bool	acquire(const EffectiveLocation *location);
+
+		/**
+		 * Queues \p waiter for a slot of \p location.
+		 * Called by CGISlotWait.
+		 * @return	false, if the queue is full.
+		 */
+		static bool	wait(const EffectiveLocation *location, CGISlotWait *waiter);
+
+		/**
+		 * Removes \p waiter from the queue of \p location.
+		 * @param	expired	It waited for too long.
+		 */
+		static void	cancel(const EffectiveLocation *location, CGISlotWait *waiter,
+					bool expired);
+
+		/**
+		 * Gives a slot of \p location back: it goes to the first
+		 * request in the queue, if there is one.
+		 */
+		static void	release(const EffectiveLocation *location);
+
+	private:
+		struct Limit
+		{
+			size_t				running;
+			std::deque<CGISlotWait *>	queue;
+			// Stats labels of the location.
+			std::string			labels;
+
+			Limit();
+		};
+
+		static std::map<const EffectiveLocation *, Limit>	_limits;
+
+		/**
+		 * Get the slots of \p location, set up the first time.
+		 */
+		static Limit	&get(const EffectiveLocation *location);
+
+		/**
+		 * Updates the gauges of \p limit.
+		 */
+		static void	update_stats(const Limit &limit);
+
+		CGILimiter();
+};
@@ -0,0 +1,267 @@
+#pragma once
+
+#include "CGIBackend.hpp"
+#include <string>
+#include <ctime>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+struct EffectiveLocation;
+
+/**
+ * CGI script running in a child process,
+ * driven by the event loop instead of being waited for.
+ *
+ * The parent ends of the script's stdin, stdout and stderr are non-blocking:
+ * input is written whenever stdin becomes writable
+ * (one bounded block at a time, read from a spooled file if there's one),
+ * output is read whenever stdout becomes readable (`handle_event()`),
+ * and so is stderr, whose lines are logged through LogChannel.
+ * The child is reaped once its pidfd becomes readable
+ * (or, if pidfd_open() isn't available, by `poll()`).
+ * Nothing here ever blocks, except for reaping
+ * a child that was just killed.
+ * @warning	Descriptors are closed by `close_fd()`
+ * 		or when the object is destroyed:
+ * 		remove them from epoll before that.
+ */
+class CGIProcess : public CGIBackend
+{
+	public:
+		/**
+		 * Resource limits of the child ("cgi_rlimit_*");
+		 * 0 leaves the server's own limit.
+		 */
+		struct Rlimits
+		{
+			// Seconds of CPU time.
+			rlim_t	cpu;
+			// Bytes of address space.
+			rlim_t	as;
+			// Open descriptors.
+			rlim_t	nofile;
+
+			Rlimits();
+		};
+
+		CGIProcess();
+		/**
+		 * Kills the child, if it's still running, and reaps it.
+		 */
+		~CGIProcess();
+
+		/**
+		 * Forks and execve()'s into \p path with \p argv and \p envp.
+		 * \p input (or the content of \p input_fd) is fed
+		 * to the child's stdin by `handle_event()`.
+		 * @throw	std::runtime_error	pipe(), fork(), etc. failed.
+		 * @param	path		Executable to execve() into.
+		 * @param	argv		NULL-terminated arguments of \p path.
+		 * @param	envp		NULL-terminated environment of \p path.
+		 * @param	input		Data for the child's stdin,
+		 * 				if \p input_fd is -1.
+		 * @param	input_fd	File with data for the child's stdin,
+		 * 				read from its beginning
+		 * 				(it's duplicated); -1 if none.
+		 * @param	timeout		Seconds the child may run for.
+		 */
+		void		start(const std::string &path, char **argv,
+					char **envp, const std::string &input,
+					int input_fd, time_t timeout);
+
+		/**
+		 * Sets the limits the child of `start()` runs with
+		 * (limits can only be lowered).
+		 */
+		void		set_rlimits(const Rlimits &rlimits);
+
+		/**
+		 * Sets the script the child runs: resources it used
+		 * (CPU time, max RSS, wall time) are recorded in Stats
+		 * under its path once it's reaped, and lines it writes
+		 * to its stderr are logged with its path and \p request_id
+		 * (rate-limited per script).
+		 */
+		void		set_script(const std::string &script, size_t request_id);
+
+		/**
+		 * Starts \p path with \p argv and \p envp using posix_spawn()
+		 * (the parent's memory isn't copied, so it doesn't get slower
+		 * as the server grows); \p stdin_fd, \p stdout_fd and \p stderr_fd
+		 * become the child's stdin, stdout and stderr
+		 * (-1 for \p stderr_fd leaves the server's).
+		 * With \p rlimits, the child is started with clone()
+		 * instead, sharing the parent's memory as well,
+		 * and sets them before it execve()'s.
+		 * @warning	Every other descriptor the child
+		 * 		shouldn't inherit must be close-on-exec.
+		 * @return	PID of the child;
+		 * 		-1 with errno set, if it couldn't be started
+		 * 		(\p path not being executable included).
+		 */
+		static pid_t	spawn(const std::string &path, char **argv,
+					char **envp, int stdin_fd, int stdout_fd,
+					int stderr_fd, const Rlimits *rlimits = NULL);
+
+		/**
+		 * Lists the child's stdin (for EPOLLOUT, while there is
+		 * input to feed), stdout, stderr and pidfd (for EPOLLIN).
+		 */
+		void		get_watched_fds(std::vector<Watch> &out) const;
+
+		/**
+		 * Handles readiness of \p fd (one of the child's descriptors):
+		 * writes the next part of the input, reads the next part
+		 * of the output or reaps the child.
+		 * @param	fd	Descriptor reported by epoll.
+		 * @return	true, if \p fd should still be watched;
+		 * 		false, if it's not needed anymore
+		 * 		(stop watching it and `close_fd()` it).
+		 */
+		bool		handle_event(int fd);
+
+		/**
+		 * Closes \p fd (one of the child's descriptors).
+		 * Closing stdin signals the end of the input to the child.
+		 */
+		void		close_fd(int fd);
+
+		/**
+		 * Reaps the child, if it exited.
+		 * Only needed if there is no pidfd.
+		 */
+		void		poll();
+
+		/**
+		 * Kills the child with SIGKILL and reaps it.
+		 */
+		void		abort();
+
+		/**
+		 * Check if the output is complete and the child was reaped.
+		 */
+		bool		is_finished() const;
+
+		/**
+		 * Check if the child exited by itself with exit code 0.
+		 */
+		bool		succeeded() const;
+
+		/**
+		 * Check if the child is running past its deadline.
+		 */
+		bool		is_expired(time_t now) const;
+
+		/**
+		 * Get everything the child wrote to its stdout so far.
+		 */
+		std::string	&get_output();
+
+		/**
+		 * Grows the stdout pipe (so the child is woken up less often)
+		 * and leaves reading it to the caller.
+		 */
+		bool		start_passthrough();
+
+		int		get_passthrough_fd() const;
+
+		/**
+		 * Get the amount of unread data in the stdout pipe.
+		 * Once it's empty and the child closed its end,
+		 * the output is complete.
+		 */
+		size_t		passthrough_available();
+
+		/**
+		 * Makes the child hold a slot of \p location
+		 * (see CGILimiter), given back once it's reaped.
+		 */
+		void		hold_slot(const EffectiveLocation *location);
+
+	private:
+		// Size the stdout pipe is grown to for passthrough
+		// (default limit for unprivileged processes).
+		enum { PASSTHROUGH_PIPE_SIZE = 1048576 };
+		// Longer stderr lines are cut.
+		enum { MAX_STDERR_LINE = 1024 };
+
+		pid_t		_pid;
+		int		_pidfd;
+		int		_stdin_fd;
+		int		_stdout_fd;
+		int		_stderr_fd;
+		// Stderr read so far after its last complete line.
+		std::string	_stderr_line;
+		// Part of the input being written to `_stdin_fd`
+		// and how much of it was written.
+		std::string	_input;
+		size_t		_input_pos;
+		// Spooled input, read from `_input_offset` on.
+		int		_input_fd;
+		off_t		_input_offset;
+		// Child's stdout was closed.
+		bool		_output_done;
+		// Child was reaped, `_wait_status` is valid.
+		bool		_exited;
+		int		_wait_status;
+		time_t		_deadline;
+		std::string	_output;
+		// Output is spliced by the caller (see `start_passthrough()`).
+		bool		_passthrough;
+		// Stdout pipe has data to splice (or was closed by the child):
+		// it isn't watched until it's drained.
+		bool		_passthrough_ready;
+		// Location whose slot the child holds; NULL, if none.
+		const EffectiveLocation	*_slot;
+		Rlimits		_rlimits;
+		// Stats labels of the script; empty, if not accounted for.
+		std::string	_stats_labels;
+		// LogChannel source of the script ("CGI <path>")
+		// and the prefix of its lines; empty, if not set.
+		std::string	_log_source;
+		std::string	_log_tag;
+		struct timespec	_started_at;
+
+		/**
+		 * Gives the slot back (see `hold_slot()`), if it's held.
+		 */
+		void		release_slot();
+
+		/**
+		 * Records \p usage of the reaped child and how long it ran.
+		 */
+		void		record_usage(const struct rusage &usage) const;
+
+		/**
+		 * Reaps the child without blocking.
+		 * @return	true, if the child was reaped.
+		 */
+		bool		try_reap();
+
+		/**
+		 * Reads the next part of stderr, logging its complete lines.
+		 * @return	false, if the child closed it.
+		 */
+		bool		read_stderr();
+
+		/**
+		 * Logs what's left in the stderr pipe, without blocking.
+		 */
+		void		drain_stderr();
+
+		/**
+		 * Logs \p line the script wrote to its stderr.
+		 */
+		void		log_stderr(const std::string &line) const;
+
+		/**
+		 * Writes the next part of the input to `_stdin_fd`.
+		 * @return	false, if the input is over
+		 * 		(or the child doesn't read it anymore).
+		 */
+		bool		feed_input();
+
+		CGIProcess(const CGIProcess &other);
+		CGIProcess &operator=(const CGIProcess &other);
+};
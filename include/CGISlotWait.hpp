@@ -0,0 +1,105 @@
+#pragma once
+
+#include "CGIBackend.hpp"
+#include <string>
+#include <vector>
+#include <ctime>
+
+struct EffectiveLocation;
+
+/**
+ * Request waiting in the queue of a "cgi_max_concurrent" location
+ * (see CGILimiter), driven by the event loop like the script
+ * it will run.
+ *
+ * Only its eventfd is watched: the limiter signals it once a slot
+ * is handed over; then it succeeds without any output
+ * and the script is run (see `take_slot()`).
+ * @warning	Descriptors are closed by `close_fd()`
+ * 		or when the object is destroyed:
+ * 		remove them from epoll before that.
+ */
+class CGISlotWait : public CGIBackend
+{
+	public:
+		CGISlotWait();
+		/**
+		 * Leaves the queue, or gives the slot back
+		 * if it wasn't taken.
+		 */
+		~CGISlotWait();
+
+		/**
+		 * Starts waiting for a slot of \p location.
+		 * @throw	std::runtime_error	eventfd() failed.
+		 * @param	location	Limited location.
+		 * @param	timeout		Seconds to wait at most.
+		 * @return	false, if the queue is full.
+		 */
+		bool		start(const EffectiveLocation *location, time_t timeout);
+
+		/**
+		 * Hands a slot over. Called by CGILimiter.
+		 */
+		void		grant();
+
+		/**
+		 * Get the seconds it's been waiting.
+		 */
+		double		waited() const;
+
+		/**
+		 * Takes the slot it was handed: the caller gives it back
+		 * (see `CGILimiter::release()`).
+		 * @return	false, if there is no slot to take.
+		 */
+		bool		take_slot();
+
+		/**
+		 * Lists the eventfd until it's signaled.
+		 */
+		void		get_watched_fds(std::vector<Watch> &out) const;
+
+		bool		handle_event(int fd);
+		void		close_fd(int fd);
+
+		/**
+		 * Nothing to poll: the eventfd is watched.
+		 */
+		void		poll();
+
+		/**
+		 * Stops waiting.
+		 */
+		void		abort();
+
+		bool		is_finished() const;
+
+		/**
+		 * Check if a slot was handed over.
+		 */
+		bool		succeeded() const;
+
+		bool		is_expired(time_t now) const;
+
+		/**
+		 * Get the (always empty) output.
+		 */
+		std::string	&get_output();
+
+	private:
+		const EffectiveLocation	*_location;
+		// Signaled by `grant()`.
+		int			_wake_fd;
+		// `grant()` was called, or waiting was aborted.
+		bool			_done;
+		bool			_granted;
+		// Slot was taken by `take_slot()`.
+		bool			_taken;
+		struct timespec		_queued_at;
+		time_t			_deadline;
+		std::string		_output;
+
+		CGISlotWait(const CGISlotWait &other);
+		CGISlotWait &operator=(const CGISlotWait &other);
+};
@@ -0,0 +1,169 @@
+#pragma once
+
+#include "CGIProcess.hpp"
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <cstddef>
+#include <sys/types.h>
+
+class PooledCGIRequest;
+
+/**
+ * CGI script process serving requests one after another
+ * (see CGIWorkerPool).
+ */
+struct CGIWorker
+{
+	pid_t		pid;
+	// Parent ends of the worker's stdin, stdout and stderr,
+	// non-blocking and close-on-exec.
+	int		stdin_fd;
+	int		stdout_fd;
+	int		stderr_fd;
+	// Stderr read so far after its last complete line.
+	std::string	stderr_line;
+	// LogChannel source of its stderr lines ("CGI <script>").
+	std::string	log_source;
+	// Requests handed to it so far.
+	size_t		served;
+};
+
+/**
+ * Warm processes of CGI scripts in "cgi_pool" locations,
+ * so a request doesn't pay for fork(), execve()
+ * and the interpreter's startup.
+ *
+ * Every script gets its own pool of up to `max_workers` processes
+ * (locations running it with other settings get pools of their own),
+ * started as "<interpreter> <script>" when requests need them
+ * and kept running afterwards. A worker gets one request at a time
+ * and is replaced after `max_requests` of them;
+ * requests coming while every worker is busy wait in a queue.
+ *
+ * Workers loop over length-prefixed frames on stdin and stdout
+ * (lengths in decimal ASCII, each followed by '\n'):
+ *
+ *	request:	<length>\n<"NAME=value\0" CGI variables>
+ *			<length>\n<request body>
+ *	response:	<length>\n<CGI output>
+ *
+ * Their own environment is the server's one. Lines they write
+ * to their stderr are logged through LogChannel, like the ones
+ * of other scripts, while they have a request
+ * (see `read_stderr()`) and when they're released.
+ */
+class CGIWorkerPool
+{
+	public:
+		/**
+		 * Script a pool runs and how: workers are only shared
+		 * by locations that agree on all of it.
+		 */
+		struct Key
+		{
+			// Interpreter of `script`.
+			std::string	interpreter;
+			// Path to the script.
+			std::string	script;
+			// Size of the pool.
+			size_t		max_workers;
+			// Requests a worker serves before it's replaced;
+			// 0 for no limit.
+			size_t		max_requests;
+			// Limits workers are started with ("cgi_rlimit_*");
+			// CPU time adds up over the requests a worker serves.
+			CGIProcess::Rlimits	rlimits;
+
+			Key();
+			bool	operator<(const Key &other) const;
+		};
+
+		/**
+		 * Takes an idle worker of pool \p key, starts a new one
+		 * (if there are less than `max_workers` of them)
+		 * or queues \p request until one is released.
+		 * Queued requests get their worker
+		 * with `PooledCGIRequest::assign()`.
+		 * @throw	std::runtime_error	Couldn't start a worker.
+		 * @param	key		Pool to take the worker from.
+		 * @param	request		Request to queue,
+		 * 				if no worker is available.
+		 * @return	Worker to send the request to;
+		 * 		NULL, if \p request was queued.
+		 */
+		static CGIWorker	*acquire(const Key &key,
+					PooledCGIRequest *request);
+
+		/**
+		 * Gives \p worker back to pool \p key: to the first queued
+		 * request, or to the idle ones. A worker that can't be
+		 * trusted with another request (or served enough of them)
+		 * is stopped instead, and a new one is started
+		 * for the queued request, if there is one.
+		 * @param	key		Pool \p worker is from.
+		 * @param	worker		Worker to give back.
+		 * @param	reusable	false, if a request was left
+		 * 				half-way on it.
+		 */
+		static void		release(const Key &key,
+					CGIWorker *worker, bool reusable);
+
+		/**
+		 * Removes queued \p request from the queue of pool \p key.
+		 */
+		static void		cancel(const Key &key,
+					PooledCGIRequest *request);
+
+		/**
+		 * Reads the next part of the stderr of \p worker,
+		 * logging its complete lines.
+		 * @return	false, if the worker closed it.
+		 */
+		static bool		read_stderr(CGIWorker *worker);
+
+		/**
+		 * Stops every worker.
+		 */
+		static void		shutdown();
+
+	private:
+		struct Pool
+		{
+			// Running workers, idle or not.
+			size_t					workers;
+			std::vector<CGIWorker *>		idle;
+			std::deque<PooledCGIRequest *>		queue;
+
+			Pool();
+		};
+
+		// Longer stderr lines are cut.
+		enum { MAX_STDERR_LINE = 1024 };
+
+		static std::map<Key, Pool>	_pools;
+
+		/**
+		 * Starts a worker in \p pool of \p key.
+		 * @throw	std::runtime_error	pipe(), fork(), etc. failed.
+		 */
+		static CGIWorker	*spawn(const Key &key, Pool &pool);
+
+		/**
+		 * Kills \p worker, reaps it and frees it.
+		 */
+		static void		stop(CGIWorker *worker);
+
+		/**
+		 * Logs what's left in the stderr pipe of \p worker,
+		 * without blocking.
+		 */
+		static void		drain_stderr(CGIWorker *worker);
+
+		/**
+		 * Logs \p line \p worker wrote to its stderr.
+		 */
+		static void		log_stderr(const CGIWorker *worker,
+					const std::string &line);
+};
@@ -4,6 +4,7 @@
 #include <string>
 #include "HTTPRequest.hpp"
 #include "HTTPResponse.hpp"
+#include "VirtualHosts.hpp"
 
 /**
  * @brief Represents a single client connection.
@@ -17,6 +18,9 @@ private:
 	int                     _client_socket;
 	struct sockaddr_in      _client_address;
 	ServerConfig*           _server;
+	// Servers sharing the listening address, `_server` is chosen
+	// among them by the "Host" of each request.
+	const VirtualHosts*	_vhosts;
 	time_t                  _last_msg_time;
 	bool                    _request_error;
 	bool		    	_msg_sent; // Indicates if the request is fully sent
@@ -47,17 +51,17 @@ private:
 
 	/**
 	 * Determines the max body size of content sent to us
-	 * depending on \p request_path.
+	 * depending on the Location cached in `_request`.
 	 * @warning	Permission to save (append, if talking about "POST")
 	 * 		is determined whether the request's method is allowed.
 	 * 		This method doesn't check allowance
 	 * 		of either "POST" or "PUT" methods.
 	 * 		You should check it on later stages
 	 * 		when processing the request.
-	 * @param	request_path	Request path parsed in request header.
+	 * @throw	runtime_error	Request's header isn't parsed yet.
 	 * @return	Max body size for received content.
 	 */
-	size_t			getMaxBodySize(const std::string &request_path) const;
+	size_t			getMaxBodySize() const;
 
 	ClientConnection & operator =(const ClientConnection &other);
 
@@ -89,6 +93,12 @@ public:
 	// This is for _client_address.
 	void                    setAddress(const struct sockaddr_in &addr);
 	void                    setServer(ServerConfig &server);
+	/**
+	 * Set servers the connection's listening address is shared by.
+	 * Their default one handles the connection until the "Host"
+	 * of a request is known.
+	 */
+	void			setVirtualHosts(const VirtualHosts &vhosts);
 	void                    updateTime();
 
 	// Logic.
@@ -22,6 +22,15 @@ class ConfigParser {
 		 * @param content String containing the configuration.
 		 */
 		void 				removeComments(std::string &content);
+
+		/**
+		 * @brief Replaces every 'include <file>;' directive
+		 *        with the content of <file> (relative to the working directory).
+		 * @param content Configuration content (modified in place).
+		 * @param depth Current nesting level of included files.
+		 * @throws ErrorException If the file can't be read or includes nest too deep.
+		 */
+		void 				expandIncludes(std::string &content, size_t depth);
 		
 		/**
 		 * @brief Extracts all 'server { ... }' blocks into _serverBlocks.
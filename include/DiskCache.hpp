@@ -0,0 +1,242 @@
+#pragma once
+
+#include <string>
+#include <map>
+#include <set>
+#include <list>
+#include <utility>
+#include <ctime>
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+ * Directory of "cache_path" keeping CGI cache entries (see CGICache)
+ * across restarts, for responses that stay valid for hours.
+ *
+ * Every entry is a file named by the hash of its key
+ * (16 hex digits) holding the key, length-prefixed like the frames
+ * of CGIWorkerPool, then the complete CGI output:
+ *
+ *	<key length>\n<key><CGI output>
+ *
+ * Entries are found through "index", a fixed-size open-addressing
+ * table (linear probing) of key hash -> size, expiry and last use,
+ * mmap()'ed so it's up to date on disk without any write() of ours.
+ * Least recently used entries are evicted once the files would take
+ * more than the max size (or the table would get too full);
+ * they're found through `_by_use`, not by scanning the table.
+ *
+ * Stored entries are queued and written by `write_next()`
+ * a bounded block at a time, which the event loop calls while
+ * some are `pending()`, so a big entry doesn't stall it;
+ * an entry is found only once it's fully written.
+ *
+ * A directory is used by one server process at a time (the index
+ * is locked); an index that doesn't look like ours is started anew,
+ * and the files it doesn't know about are removed.
+ */
+class DiskCache
+{
+	public:
+		/**
+		 * Get the cache in \p path, opened the first time
+		 * (later calls share it, whatever their \p max_size).
+		 * @throw	std::runtime_error	Couldn't open, lock
+		 * 					or map the index.
+		 * @param	path		Existing directory.
+		 * @param	max_size	Most bytes the entries may take.
+		 */
+		static DiskCache	*open(const std::string &path, uint64_t max_size);
+
+		/**
+		 * Unmaps and closes every cache.
+		 */
+		static void		shutdown();
+
+		/**
+		 * Check if stored entries are still being written.
+		 */
+		static bool		pending();
+
+		/**
+		 * Writes the next block of the queued entries.
+		 */
+		static void		write_next();
+
+		/**
+		 * Looks \p key up.
+		 * @param	key	Key of the entry (see CGICache).
+		 * @param	now	Current time.
+		 * @param	expires	Set to the time the entry expires at.
+		 * @param	offset	Set to where the CGI output starts
+		 * 			in the file.
+		 * @param	length	Set to the length of the CGI output.
+		 * @return	Read-only descriptor of the entry's file
+		 * 		(the caller closes it);
+		 * 		-1, if there's no fresh entry.
+		 */
+		int			lookup(const std::string &key, time_t now,
+					time_t &expires, off_t &offset, size_t &length);
+
+		/**
+		 * Queues the entry of \p key to be written (replacing
+		 * the previous one), evicting least recently used entries
+		 * to make room. It isn't kept if too much is queued already.
+		 * Failures are only logged: the entry isn't kept then.
+		 * @param	key	Key of the entry.
+		 * @param	output	Complete CGI output.
+		 * @param	expires	Time the entry expires at.
+		 */
+		void			store(const std::string &key,
+					const std::string &output, time_t expires);
+
+	private:
+		// Slots of the table; it's rehashed (or entries are evicted)
+		// once more than 3/4 of them are taken.
+		enum { CAPACITY = 8192 };
+		// `Slot::hash` values that aren't hashes.
+		enum { SLOT_EMPTY = 0, SLOT_REMOVED = 1 };
+		// Bumped whenever the layout of the index changes.
+		enum { VERSION = 1 };
+		// Bytes written per `write_next()` call.
+		enum { WRITE_BLOCK_SIZE = 262144 };
+		// Most bytes queued to be written, entries over that
+		// aren't stored.
+		enum { MAX_QUEUED = 33554432 };
+
+		struct Header
+		{
+			char		magic[8];
+			uint32_t	version;
+			uint32_t	capacity;
+			// Counter `Slot::used` is taken from.
+			uint64_t	clock;
+		};
+
+		struct Slot
+		{
+			uint64_t	hash;
+			// Length of the file.
+			uint64_t	size;
+			uint64_t	expires;
+			// `Header::clock` of the last lookup (or store).
+			uint64_t	used;
+		};
+
+		// Entry being written.
+		struct Write
+		{
+			DiskCache	*cache;
+			uint64_t	hash;
+			// Key prefix and CGI output, written up to `written`
+			// to the temporary file `fd`.
+			std::string	data;
+			size_t		written;
+			int		fd;
+			time_t		expires;
+		};
+
+		// Directory, with trailing '/'.
+		std::string		_path;
+		uint64_t		_max_size;
+		int			_index_fd;
+		// mmap()'ed index: header, then `CAPACITY` slots.
+		void			*_index;
+		Header			*_header;
+		Slot			*_slots;
+		// Taken and removed slots, total size of the files
+		// (counted when the index is opened), including
+		// the ones being written.
+		size_t			_live;
+		size_t			_removed;
+		uint64_t		_size;
+		// `Slot::used` and index of the taken slots,
+		// the least recently used first.
+		std::set<std::pair<uint64_t, size_t> >	_by_use;
+
+		// Directory path -> its cache.
+		static std::map<std::string, DiskCache *>	_caches;
+		// Entries being written, in the order they were stored,
+		// and the bytes of them left to write.
+		static std::list<Write>				_writes;
+		static size_t					_queued;
+
+		DiskCache(const std::string &path, uint64_t max_size);
+		~DiskCache();
+
+		/**
+		 * Opens, locks and maps the index, starting it anew
+		 * if it isn't a valid one.
+		 * @throw	std::runtime_error	Some of it failed.
+		 */
+		void			load();
+
+		/**
+		 * Removes files of the directory that aren't entries
+		 * of the index (leftovers of crashed writes,
+		 * and every entry, if \p all is set).
+		 */
+		void			remove_files(bool all);
+
+		/**
+		 * Get the slot of \p hash; NULL, if there is none.
+		 */
+		Slot			*find(uint64_t hash);
+
+		/**
+		 * Takes a free slot for \p hash.
+		 * @warning	There must be one (see `make_room()`).
+		 */
+		Slot			*take(uint64_t hash);
+
+		/**
+		 * Evicts least recently used entries until
+		 * \p size more bytes and another slot fit.
+		 */
+		void			make_room(uint64_t size);
+
+		/**
+		 * Removes the entry of \p slot and its file.
+		 */
+		void			evict(Slot &slot);
+
+		/**
+		 * Marks \p slot as just used.
+		 */
+		void			touch(Slot &slot);
+
+		/**
+		 * Drops the queued entry of \p hash, if there's one.
+		 */
+		void			cancel(uint64_t hash);
+
+		/**
+		 * Drops \p write, removing its temporary file.
+		 */
+		static void		cancel(std::list<Write>::iterator write);
+
+		/**
+		 * Adds the written entry of \p write to the index.
+		 */
+		void			commit(const Write &write);
+
+		/**
+		 * Reinserts taken slots, dropping removed ones
+		 * (and rebuilds `_by_use`).
+		 */
+		void			rehash();
+
+		/**
+		 * Get the path of the file of \p hash.
+		 */
+		std::string		file_path(uint64_t hash) const;
+
+		/**
+		 * 64-bit FNV-1a of \p key, never `SLOT_EMPTY`
+		 * or `SLOT_REMOVED`.
+		 */
+		static uint64_t		hash(const std::string &key);
+
+		DiskCache(const DiskCache &other);
+		DiskCache &operator=(const DiskCache &other);
+};
@@ -0,0 +1,140 @@
+#pragma once
+
+#include "HTTPRequest.hpp"
+#include "AutoIndex.hpp"
+#include "PerfectHash.hpp"
+#include "UpstreamPool.hpp"
+#include "CGIProcess.hpp"
+#include <string>
+#include <vector>
+#include <ctime>
+#include <stdint.h>
+
+class ServerConfig;
+class Location;
+class RootDir;
+class DiskCache;
+
+/**
+ * Settings a request is handled with, flattened once at startup
+ * from a Location and the ServerConfig it belongs to
+ * (or from the server alone, for requests no location matched).
+ *
+ * Everything a location inherits from its server
+ * (index list, body limit, error pages) is already resolved here,
+ * so handling a request takes array and bit lookups only.
+ * @warning	Points into the ServerConfig it was built from
+ * 		(error responses, directories, Location):
+ * 		rebuild it whenever that one moves or changes
+ * 		(see `ServerConfig::compileEffectiveLocations()`).
+ */
+struct EffectiveLocation
+{
+	// Location it was built from; NULL for the server's default one.
+	const Location			*location;
+	// Location path ("/" for the server's default one;
+	// up to the last '/' for exact ones).
+	std::string			path;
+	// Root (or alias), always ends with '/'.
+	std::string			root;
+	const RootDir			*root_dir;
+	// Upload path, always ends with '/'; empty if not set.
+	std::string			upload_root;
+	const RootDir			*upload_dir;
+	std::vector<std::string>	index;
+	// Bit (1 << HTTPRequest::e_method) is set for every allowed method.
+	unsigned int			methods;
+	uint64_t			max_body_size;
+	bool				autoindex;
+	AutoIndex::Options		autoindex_options;
+	// Prepared error responses indexed by
+	// (status code - MIN_ERROR_STATUS_CODE), NULL if there is none.
+	std::vector<const std::string *>	error_responses;
+	// "try_files" URIs, the last one is the fallback.
+	std::vector<std::string>	try_files;
+	// Only reachable by redirects of the server itself.
+	bool				internal;
+	// "return" status code, 0 if not set.
+	int				return_code;
+	// Serialized "return" redirect; empty for error codes.
+	std::string			return_response;
+	// CGI extension (e.g. ".py") -> interpreter path.
+	PerfectHash<std::string>	cgi_interpreters;
+	// "cgi_pool" workers per script (0: fork a process per request)
+	// and requests per worker (0 for no limit).
+	size_t				cgi_pool_workers;
+	size_t				cgi_pool_max_requests;
+	// FastCGI application every request is passed to;
+	// empty name, if not set.
+	UpstreamAddress			fastcgi_pass;
+	// HTTP server every request is forwarded to (see ProxyRequest);
+	// empty name, if not set.
+	UpstreamAddress			proxy_pass;
+	// "cgi_cache" seconds responses are fresh (0: not cached)
+	// and may be served stale, and its key items
+	// (the default ones, if "cgi_cache_key" isn't set).
+	time_t				cgi_cache_ttl;
+	time_t				cgi_cache_stale;
+	std::vector<std::string>	cgi_cache_key;
+	// "cache_path" the entries are also kept in; NULL, if not set.
+	DiskCache			*disk_cache;
+	// "cgi_max_concurrent" scripts (0: no limit), requests that may
+	// wait for one of them and seconds they may wait (see CGILimiter).
+	size_t				cgi_max_concurrent;
+	size_t				cgi_queue_size;
+	time_t				cgi_queue_timeout;
+	// 503 response (with "Retry-After") of requests the limit turns
+	// away; only prepared for limited locations.
+	std::string			cgi_busy_response;
+	// Serves the server's stats (see Stats) to clients
+	// of these networks (address and mask, host byte order).
+	bool				stub_status;
+	std::vector<std::pair<uint32_t, uint32_t> >	stub_status_allow;
+	// "cgi_rlimit_*" limits of forked CGI scripts.
+	CGIProcess::Rlimits		cgi_rlimits;
+	// Server's environment without anything named like
+	// a CGI meta-variable; only set up for CGI locations.
+	std::vector<std::string>	cgi_environment;
+	// "NAME=value" CGI variables that are the same for every request
+	// (SERVER_SOFTWARE, GATEWAY_INTERFACE, etc.).
+	std::vector<std::string>	cgi_static_vars;
+
+	EffectiveLocation();
+
+	/**
+	 * Flattens \p location of \p server.
+	 * @warning	Call this only after `ServerConfig::openRootDirs()`
+	 * 		and `ServerConfig::prepareErrorResponses()`.
+	 * @throw	std::runtime_error	Couldn't build CGI lookup table
+	 * 					or open "cache_path".
+	 * @param	server		Server \p location belongs to.
+	 * @param	location	Location to flatten;
+	 * 				NULL to build the server's default one.
+	 */
+	EffectiveLocation(const ServerConfig &server, const Location *location);
+
+	/**
+	 * Check if \p method is allowed here.
+	 */
+	bool				allows(enum HTTPRequest::e_method method) const;
+
+	/**
+	 * Check if a client at \p address may get the stats.
+	 */
+	bool				allows_stub_status(struct in_addr address) const;
+
+	/**
+	 * Get the prepared error response for \p status_code.
+	 * @return	Pointer to the serialized response;
+	 * 		NULL, if none was prepared.
+	 */
+	const std::string		*getErrorResponse(int status_code) const;
+
+	/**
+	 * Get the interpreter of CGI scripts with \p ext extension.
+	 * @param	ext	Extension, including the dot.
+	 * @return	Pointer to the interpreter path;
+	 * 		NULL, if \p ext isn't a CGI extension here.
+	 */
+	const std::string		*getCgiInterpreter(const std::string &ext) const;
+};
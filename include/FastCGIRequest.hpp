@@ -0,0 +1,175 @@
+#pragma once
+
+#include "CGIBackend.hpp"
+#include "UpstreamPool.hpp"
+#include <string>
+#include <vector>
+#include <ctime>
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+ * Request to a FastCGI application server (responder role),
+ * driven by the event loop like CGIProcess.
+ *
+ * The connection is taken from UpstreamPool and asks the application
+ * to keep it open (FCGI_KEEP_CONN), so it's given back to the pool
+ * once the request ends cleanly: the application stays warm
+ * and no process is forked per request.
+ * Parameters are sent as FCGI_PARAMS, the request body as FCGI_STDIN
+ * (one bounded block at a time, read from a spooled file if there's one),
+ * FCGI_STDOUT is collected as the output and FCGI_STDERR is logged.
+ *
+ * The connection is watched through two duplicates of it:
+ * one for EPOLLOUT until everything is sent, one for EPOLLIN
+ * until FCGI_END_REQUEST is received.
+ * @warning	Descriptors are closed by `close_fd()`
+ * 		or when the object is destroyed:
+ * 		remove them from epoll before that.
+ */
+class FastCGIRequest : public CGIBackend
+{
+	public:
+		FastCGIRequest();
+		/**
+		 * Closes the descriptors; gives the connection back
+		 * to the pool, if the request ended cleanly.
+		 */
+		~FastCGIRequest();
+
+		/**
+		 * Takes a connection to \p upstream and queues the request.
+		 * \p input (or the content of \p input_fd) is sent
+		 * as the request body by `handle_event()`.
+		 * @throw	std::runtime_error	Couldn't connect, etc.
+		 * @param	upstream	Application server.
+		 * @param	params		"NAME=value" parameters
+		 * 				(CGI environment).
+		 * @param	input		Request body,
+		 * 				if \p input_fd is -1.
+		 * @param	input_fd	File with the request body,
+		 * 				read from its beginning
+		 * 				(it's duplicated); -1 if none.
+		 * @param	timeout		Seconds the request may take.
+		 */
+		void		start(const UpstreamAddress &upstream,
+					const std::vector<std::string> &params,
+					const std::string &input, int input_fd,
+					time_t timeout);
+
+		/**
+		 * Lists the connection (for EPOLLOUT, while there is
+		 * something to send, and for EPOLLIN).
+		 */
+		void		get_watched_fds(std::vector<Watch> &out) const;
+
+		/**
+		 * Sends the next part of the request or reads
+		 * the next part of the response.
+		 */
+		bool		handle_event(int fd);
+
+		void		close_fd(int fd);
+
+		/**
+		 * Nothing to poll: everything is watched.
+		 */
+		void		poll();
+
+		/**
+		 * Gives up on the request; the connection is closed.
+		 */
+		void		abort();
+
+		/**
+		 * Check if FCGI_END_REQUEST was received
+		 * (or the request failed).
+		 */
+		bool		is_finished() const;
+
+		/**
+		 * Check if the request completed with application status 0.
+		 */
+		bool		succeeded() const;
+
+		bool		is_expired(time_t now) const;
+
+		/**
+		 * Get FCGI_STDOUT received so far.
+		 */
+		std::string	&get_output();
+
+	private:
+		// Longer FCGI_STDERR lines are cut.
+		enum { MAX_STDERR_LINE = 1024 };
+
+		UpstreamAddress	_upstream;
+		// Pooled connection and its duplicates watched by epoll.
+		int		_conn_fd;
+		int		_write_fd;
+		int		_read_fd;
+		// SO_ERROR of a new connection was checked.
+		bool		_connected;
+		// Records to send and how much of them was sent.
+		std::string	_send;
+		size_t		_send_pos;
+		// Spooled input, read from `_input_offset` on.
+		int		_input_fd;
+		off_t		_input_offset;
+		// Closing (empty) FCGI_STDIN was queued.
+		bool		_input_done;
+		// Everything was sent.
+		bool		_sent;
+		// Received bytes not parsed into records yet.
+		std::string	_recv;
+		// FCGI_STDERR received after its last complete line.
+		std::string	_stderr_line;
+		// FCGI_END_REQUEST was received.
+		bool		_ended;
+		uint32_t	_app_status;
+		unsigned char	_protocol_status;
+		// Connection broke or the request was aborted.
+		bool		_failed;
+		time_t		_deadline;
+		std::string	_output;
+
+		/**
+		 * Sends queued records, refilling them
+		 * from the spooled input as they go.
+		 * @return	false, if everything was sent
+		 * 		(or the connection broke).
+		 */
+		bool		send_records();
+
+		/**
+		 * Reads and parses received records.
+		 * @return	false, if the request ended
+		 * 		(or the connection broke).
+		 */
+		bool		receive_records();
+
+		/**
+		 * Logs the complete lines of FCGI_STDERR \p data
+		 * (everything, if \p end is true) through LogChannel,
+		 * rate-limited per application.
+		 */
+		void		log_stderr(const char *data, size_t length,
+					bool end);
+
+		/**
+		 * Appends a record of \p type with \p length bytes
+		 * of \p data to `_send`.
+		 */
+		void		queue_record(unsigned char type,
+					const char *data, size_t length);
+
+		/**
+		 * Appends \p data as records of \p type to `_send`,
+		 * split to fit in records.
+		 */
+		void		queue_stream(unsigned char type,
+					const std::string &data);
+
+		FastCGIRequest(const FastCGIRequest &other);
+		FastCGIRequest &operator=(const FastCGIRequest &other);
+};
@@ -6,6 +6,9 @@
 #include <string>
 #include <map>
 #include <cstddef>
+#include <stdint.h>
+
+struct EffectiveLocation;
 
 /**
  * A class containing a received and parsed HTTP/1.1 request.
@@ -225,10 +228,41 @@ class HTTPRequest
 		 * (complete or incomplete).
 		 * To check if body is fully processed and complete,
 		 * use the `is_body_complete()` method.
-		 * @return	Request's body.
+		 * @warning	Bodies bigger than `_BODY_MEMORY_LIMIT`
+		 * 		are spooled to a file and aren't here
+		 * 		(see `get_body_fd()` and `write_body_to()`).
+		 * @return	Request's body kept in memory.
 		 */
 		const std::string &get_body() const;
 
+		/**
+		 * Get the file the body was spooled to.
+		 * @return	Descriptor of an unlinked temporary file,
+		 * 		valid until the request is reset;
+		 * 		-1, if the body is kept in memory.
+		 */
+		int get_body_fd() const;
+
+		/**
+		 * Get the amount of body bytes received so far
+		 * (wherever they're stored).
+		 */
+		uint64_t get_body_length() const;
+
+		/**
+		 * Get the number of the request, unique while the server runs
+		 * (tags what its CGI script logs).
+		 */
+		size_t get_id() const;
+
+		/**
+		 * Write the whole body (in memory or spooled) to \p fd.
+		 * Spooled body is copied in bounded blocks.
+		 * @throw	std::ios_base::failure	I/O error.
+		 * @param	fd	Where to write the body.
+		 */
+		void write_body_to(int fd) const;
+
 		/**
 		 * Check if request's header was fully parsed yet.
 		 * @return	true, if yes;
@@ -255,6 +289,27 @@ class HTTPRequest
 		 */
 		bool is_complete() const;
 
+		/**
+		 * Cache the settings of the Location request path corresponds to,
+		 * so it's determined only once per request.
+		 * @param	location	Determined settings.
+		 */
+		void set_location(const EffectiveLocation *location);
+
+		/**
+		 * Check if `set_location()` was called for this request.
+		 * @return	true, if yes;
+		 * 		false otherwise.
+		 */
+		bool is_location_set() const;
+
+		/**
+		 * Get the settings cached with `set_location()`.
+		 * @throw	runtime_error	Location wasn't set yet.
+		 * @return	Cached settings.
+		 */
+		const EffectiveLocation *get_location() const;
+
 		/**
  		* Debug function to print all parsed request fields.
  		*/
@@ -289,6 +344,10 @@ class HTTPRequest
 		std::string _request_target;
 		bool _request_target_is_set;
 
+		// Location of `_request_path_decoded`.
+		const EffectiveLocation *_location;
+		bool _location_is_set;
+
 		// Header fields in format "key:OWS value OWS".
 		//
 		// All requests must contain a "Host" field.
@@ -304,6 +363,24 @@ class HTTPRequest
 
 		std::string _body;		// Should be used only in POST methods.
 		bool _body_complete;
+		// Body bytes received, `_body` holds them
+		// unless they were spooled to `_body_fd`.
+		uint64_t _body_length;
+		int _body_fd;
+		size_t _id;
+		// Number the next request gets (see `get_id()`).
+		static size_t _next_id;
+		// Bodies bigger than that are spooled to a temporary file,
+		// so memory per request doesn't depend on the body size.
+		static const size_t _BODY_MEMORY_LIMIT = 65536;
+
+		/**
+		 * Append \p length bytes of \p buffer from \p pos to the body,
+		 * spooling it to a temporary file once it outgrows
+		 * `_BODY_MEMORY_LIMIT`.
+		 * @throw	std::ios_base::failure	Couldn't spool the body.
+		 */
+		void append_body(const std::string &buffer, size_t pos, size_t length);
 
 		/**
 		 * Parse method, request target and
@@ -3,10 +3,13 @@
 #include <stdexcept>
 #include "ServerConfig.hpp"
 #include "HTTPRequest.hpp"
+#include "BodyProducer.hpp"
+#include "CGIBackend.hpp"
 #include <string>
 #include <map>
 #include <sys/types.h>
 #include <ctime>
+#include <sys/stat.h>
 
 /**
  * The HTTPResponse class is responsible for constructing a
@@ -29,19 +32,6 @@ class HTTPResponse
 		HTTPResponse &operator= (const HTTPResponse &other);
 		~HTTPResponse();
 
-		class directory_traversal_detected : public std::exception
-		{
-			private:
-				const std::string _MSG;
-
-			public:
-				directory_traversal_detected(const char * msg);
-				directory_traversal_detected(const std::string &msg);
-				virtual ~directory_traversal_detected() throw();
-
-				virtual const char * what() const throw();
-		};
-
 		/**
 		 * Set the `_server_cfg`.
 		 * @param	server_cfg	New value for `_server_cfg`.
@@ -76,6 +66,52 @@ class HTTPResponse
 		 */
 		const std::string	&get_response_msg() const;
 
+		/**
+		 * Check if the body is still being produced
+		 * (see `refill_payload()`).
+		 * @return	true, if `get_response_msg()` doesn't contain
+		 * 		the whole response yet.
+		 */
+		bool			has_pending_body() const;
+
+		/**
+		 * Replaces the response message with the next part
+		 * of the body, framed as a chunk
+		 * (unless the body's length was given upfront).
+		 * Call it once the previous message was fully sent.
+		 * @warning	Message may be empty, if producer has nothing
+		 * 		to give yet. Try again later in this case.
+		 * @throw	runtime_error	Body isn't produced on the fly.
+		 * @return	true, if the message was refilled;
+		 * 		false, if the body can't be completed
+		 * 		(connection should be closed).
+		 */
+		bool			refill_payload();
+
+		/**
+		 * Get the amount of body to move from the CGI backend
+		 * (or the file being sent) right after `get_response_msg()`
+		 * is fully sent (see `splice_body()`).
+		 */
+		size_t			get_splice_length() const;
+
+		/**
+		 * Moves up to `get_splice_length()` bytes of the body
+		 * from the CGI backend (with splice())
+		 * or the file (with sendfile()) to \p fd
+		 * without copying them.
+		 * @param	fd	Client's socket.
+		 * @return	Amount of bytes moved;
+		 * 		-1 on error (errno is set, EAGAIN included).
+		 */
+		ssize_t			splice_body(int fd);
+
+		/**
+		 * Check if there's nothing to send
+		 * until the CGI backend produces more of the body.
+		 */
+		bool			waits_for_body() const;
+
 		/**
 		 * Check if connection should be closed or not.
 		 * This will be the case if we're sending either
@@ -89,9 +125,113 @@ class HTTPResponse
 		 */
 		bool			should_close_connection() const;
 
+		/**
+		 * Check if the CGI script or the FastCGI application
+		 * of the response is still running (see `get_cgi()`).
+		 * The response may be ready already, its body
+		 * is then sent while it's being produced.
+		 */
+		bool			has_running_cgi() const;
+
+		/**
+		 * Get the CGI backend launched for the response.
+		 * @return	Backend whose descriptors should be watched
+		 * 		while `has_running_cgi()` is true;
+		 * 		NULL, if there is none.
+		 */
+		const CGIBackend	*get_cgi() const;
+
+		/**
+		 * Handles readiness of \p fd of the running CGI backend.
+		 * The response is prepared as soon as the header block
+		 * of the output is complete (see `process_cgi_output()`),
+		 * or once the backend fails (502).
+		 * @param	fd	Descriptor of `get_cgi()` reported by epoll.
+		 * @return	true, if \p fd should still be watched;
+		 * 		false, if it should be removed from epoll
+		 * 		and `release_cgi_fd()`'ed.
+		 */
+		bool			handle_cgi_event(int fd);
+
+		/**
+		 * Closes \p fd of `get_cgi()`, which isn't watched anymore.
+		 */
+		void			release_cgi_fd(int fd);
+
+		/**
+		 * Periodic check of the running CGI backend:
+		 * aborts it and prepares 504, if it ran for longer
+		 * than `_MAX_CGI_TIME` (see `CGIBackend::poll()`).
+		 * @param	now	Current time.
+		 * @return	true, if the response is prepared
+		 * 		or the backend isn't running anymore.
+		 */
+		bool			check_cgi(time_t now);
+
+		/**
+		 * Aborts the running CGI backend and prepares
+		 * an error response with \p status_code instead.
+		 * If the header was already sent, the body can't be
+		 * completed anymore (`refill_payload()` fails).
+		 */
+		void			abort_cgi(int status_code);
+
+		/**
+		 * Check if the CGI script answered with a local redirect
+		 * (RFC 3875, 6.2.2, or "X-Accel-Redirect")
+		 * that wasn't followed yet.
+		 */
+		bool			has_local_redirect() const;
+
+		/**
+		 * Handles a GET request of the local redirect's URI
+		 * instead, with the header of the original request.
+		 * Redirected request may reach "internal" locations.
+		 * Once the CGI backend's descriptors aren't watched anymore:
+		 * it's destroyed, and another one may be launched.
+		 * @throw	runtime_error	There's no local redirect.
+		 */
+		void			follow_local_redirect();
+
+		/**
+		 * Check if the response was handed a slot of its
+		 * "cgi_max_concurrent" location (see CGISlotWait)
+		 * and its script wasn't run yet.
+		 */
+		bool			has_queued_cgi() const;
+
+		/**
+		 * Runs the script that waited for a slot.
+		 * Once the CGI backend's descriptors aren't watched anymore:
+		 * the waiting one is destroyed.
+		 * @throw	runtime_error	There's no script to run.
+		 */
+		void			start_queued_cgi();
+
+		/**
+		 * Check if the response was served from a stale
+		 * CGI cache entry that should be refreshed now
+		 * (see `refresh_cgi_cache()`).
+		 */
+		bool			needs_cgi_cache_refresh() const;
+
+		/**
+		 * Runs the CGI script of \p stale (see
+		 * `needs_cgi_cache_refresh()`) again in the background,
+		 * as a GET of the same target with the same header:
+		 * its output refills the cache entry, the response itself
+		 * is never sent. The refresh is taken from \p stale.
+		 * @throw	runtime_error	\p stale doesn't need a refresh.
+		 * @param	stale	Response served from the stale entry.
+		 */
+		void			refresh_cgi_cache(HTTPResponse &stale);
+
 	private:
 		ServerConfig				*_server_cfg;
 		int					_status_code;
+		// Reason phrase given by a CGI script;
+		// empty for the standard one of `_status_code`.
+		std::string				_reason_phrase;
 		std::map<std::string, std::string>	_headers;
 		std::string				_response_body;
 		// `_status_code` + `_headers` + `_response_body` combined,
@@ -99,24 +239,93 @@ class HTTPResponse
 		//
 		// If request's path is CGI, then child's output.
 		std::string				_payload;
+		// Immutable response prepared at startup
+		// (see `ServerConfig::prepareErrorResponses()`).
+		// If set, it's sent instead of `_payload`.
+		const std::string			*_prebuilt_payload;
+		// If set, `_payload` contains only the status line and headers,
+		// the body is pulled from it (see `refill_payload()`).
+		// Owned by the response, isn't copied.
+		BodyProducer				*_body_producer;
+		// If set, `_payload` contains only the status line and headers,
+		// the body is sent from this file (see `splice_body()`)
+		// from `_body_offset` on. Owned by the response, isn't copied.
+		int					_body_fd;
+		off_t					_body_offset;
 		// `_payload_ready` should only be set to true
-		// in `prep_payload()`.
+		// in `prep_payload()` or `use_prebuilt_payload()`
+		// (or for NPH output of a CGI script).
 		// Don't set it manually.
 		bool 		  			_payload_ready;
 
-		// Pointer to Location corresponding to request
-		// to process received in `handle_response_routine()`.
-		// If set to NULL, `_server_cfg` ought to be used instead.
-		const Location				*_lp;
-
-		// CGI-related data.
-		pid_t					_cgi_pid;
-		int					_cgi_pipe[2];
-		time_t					_cgi_launch_time;
+		// Settings of the Location corresponding to request
+		// to process received in `handle_response_routine()`
+		// (server's default ones, if no Location matched).
+		// NULL only until the request is routed.
+		const EffectiveLocation			*_elp;
+
+		// Directory request path is resolved in
+		// (root or alias of `_elp`, or upload path).
+		const RootDir				*_root_dir;
+		// Target of the request path looked up in `_root_dir`
+		// by `resolve_target()`.
+		struct stat				_target_stat;
+		bool					_target_exists;
+
+		// CGI script launched by `handle_cgi()`, FastCGI request
+		// sent by `handle_fastcgi()` or HTTP request forwarded
+		// by `handle_proxy()`.
+		// Owned by the response, isn't copied.
+		CGIBackend				*_cgi;
+		// `_cgi` wasn't finished or aborted yet
+		// (its output may still be sent after that).
+		bool					_cgi_running;
+		// Output of `_cgi` is the whole response, not parsed.
+		bool					_cgi_nph;
+		// Rest of the output of `_cgi` is spliced to the client
+		// (see `refill_passthrough()`).
+		bool					_cgi_passthrough;
+		// `_cgi` is a CGISlotWait: the script of `_cgi_script`
+		// waits for a slot (see `queue_cgi()`).
+		bool					_cgi_queued;
+		// Request was turned away by CGILimiter
+		// (its 503 is `cgi_busy_response`).
+		bool					_cgi_busy;
+		// Part of it (or of `_body_fd`) to send after `_payload`.
+		size_t					_splice_length;
+		// Spliced part is a chunk, its CRLF is still to be sent.
+		bool					_splice_chunk_open;
+		// Path to the script, for logging.
+		std::string				_cgi_script;
+		// "Location" of a local redirect to follow.
+		std::string				_local_redirect;
+		// Fields of the CGI response the local redirect keeps
+		// (see "X-Accel-Redirect" in `parse_cgi_header()`).
+		std::map<std::string, std::string>	_redirect_headers;
+		// Request being handled; it's `_redirected_request`
+		// after a local redirect.
+		const HTTPRequest			*_request;
+		// Owned by the response, isn't copied.
+		HTTPRequest				*_redirected_request;
+		int					_local_redirects;
+		// Key of the CGI cache entry of the request ("cgi_cache").
+		std::string				_cache_key;
+		// The response runs the script to fill the entry
+		// (see CGICache). Isn't copied.
+		bool					_cache_leader;
+		// Response was served from the stale entry,
+		// someone should refresh it.
+		bool					_cache_stale;
+		// Response only refreshes the entry, it isn't sent.
+		bool					_cache_refresh;
 		// Time in seconds for maximum CGI execution duration.
 		// If CGI doesn't finish execution within this time,
 		// it will be killed and 504 will be returned.
 		static const time_t			_MAX_CGI_TIME = 10;
+		// Longest header block of CGI output accepted.
+		static const size_t			_MAX_CGI_HEADER_SIZE = 65536;
+		// Maximum amount of "try_files" fallbacks per request.
+		static const int			_MAX_INTERNAL_REDIRECTS = 10;
 
 		/**
 		 * Prepares `_payload` by combining
@@ -127,6 +336,24 @@ class HTTPResponse
 		 */
 		void		prep_payload();
 
+		/**
+		 * Marks the response as ready with \p payload
+		 * sent as is instead of `_payload`.
+		 * Used for responses serialized at startup.
+		 * @throw	runtime_error	Payload is already prepared.
+		 * @param	payload		Serialized response
+		 * 				that outlives this object.
+		 */
+		void		use_prebuilt_payload(const std::string *payload);
+
+		/**
+		 * Makes \p producer the source of the response body,
+		 * which will be sent with chunked transfer coding.
+		 * @param	producer	Producer allocated with new,
+		 * 				the response takes ownership.
+		 */
+		void		set_body_producer(BodyProducer *producer);
+
 		/**
 		 * Appends "Server" and "Content-Length" headers
 		 * to `_headers`.
@@ -137,26 +364,33 @@ class HTTPResponse
 		void		append_required_headers();
 
 		/**
-		 * Resolves the request path by concatenating
-		 * \p root and \p request_relative_path
-		 * while detecting directory traversal.
-		 * @throw	directory_traversal_detected	Detected
-		 * 						an attempt
-		 * 						of directory
-		 * 						traversal.
-		 * @throw	std::invalid_argument		\p
-		 * 						request_relative_path
-		 * 						starts
-		 * 						with '/'.
-		 * @param	root			Location or server root
-		 * 					(may be relative).
+		 * Evaluates "try_files" of `_elp` for \p uri:
+		 * the first candidate that exists in the root
+		 * of its location (as a directory, if it ends with '/')
+		 * is taken, otherwise the fallback is.
+		 * Lookups go through StatCache.
+		 * @param	uri	Request path; replaced with
+		 * 			the picked URI.
+		 * @return	0, if a candidate was picked
+		 * 		(\p uri and `_elp` now point to it);
+		 * 		-1, if \p uri and `_elp` were set to the fallback
+		 * 		URI (its "try_files" apply now);
+		 * 		HTTP status code of the "=code" fallback otherwise.
+		 */
+		int		apply_try_files(std::string &uri);
+
+		/**
+		 * Looks up \p request_relative_path in `_root_dir`
+		 * (through StatCache)
+		 * and saves the result to `_target_exists` and `_target_stat`.
+		 * Paths escaping `_root_dir` are refused by the kernel
+		 * (see RootDir).
 		 * @param	request_relative_path	Request path relative
-		 * 					to \p root (must NOT
-		 * 					start with '/').
-		 * @return	Resolved request path.
+		 * 					to `_root_dir`.
+		 * @return	0, if target was looked up (it may not exist);
+		 * 		HTTP error code otherwise.
 		 */
-		std::string	resolve_path(const std::string &root,
-				const std::string &request_relative_path) const;
+		int		resolve_target(const std::string &request_relative_path);
 
 		/**
 		 * Handles the "GET" method:
@@ -171,16 +405,12 @@ class HTTPResponse
 		 * @warning	Parameters' validity isn't checked.
 		 * 		It's up to the user to ensure their validity.
 		 * @param	request				Request to handle.
-		 * @param	request_dir_root		Root or alias
-		 * 						of `_lp`
-		 * 						or `_server->Root()`
-		 * 						(if p lp is NULL)
+		 * @param	request_dir_root		`root` of `_elp`
 		 * 						with trailing '/'.
 		 * @param	request_dir_relative_to_root	Request path to file
 		 * 						or directory
 		 * 						in \p request_dir_root.
-		 * @param	request_location_path		`getPath()` from `_lp`
-		 * 						or "/" if `_lp` is NULL.
+		 * @param	request_location_path		`path` of `_elp`.
 		 * @param	resolved_path			\p request_dir_root
 		 * 						concatenated with
 		 * 						\p request_dir_relative_to_root
@@ -211,16 +441,12 @@ class HTTPResponse
 		 * @warning	Parameters' validity isn't checked.
 		 * 		It's up to the user to ensure their validity.
 		 * @param	request				Request to handle.
-		 * @param	request_dir_root		Root or alias
-		 * 						of `_lp`
-		 * 						or `_server->Root()`
-		 * 						(if p lp is NULL)
+		 * @param	request_dir_root		`root` of `_elp`
 		 * 						with trailing '/'.
 		 * @param	request_dir_relative_to_root	Request path to file
 		 * 						or directory
 		 * 						in \p request_dir_root.
-		 * @param	request_location_path		`getPath()` from `_lp`
-		 * 						or "/" if `_lp` is NULL.
+		 * @param	request_location_path		`path` of `_elp`.
 		 * @param	resolved_path			\p request_dir_root
 		 * 						concatenated with
 		 * 						\p request_dir_relative_to_root
@@ -259,16 +485,12 @@ class HTTPResponse
 		 * @warning	Parameters' validity isn't checked.
 		 * 		It's up to the user to ensure their validity.
 		 * @param	request				Request to handle.
-		 * @param	request_dir_root		Root or alias
-		 * 						of `_lp`
-		 * 						or `_server->Root()`
-		 * 						(if p lp is NULL)
+		 * @param	request_dir_root		`root` of `_elp`
 		 * 						with trailing '/'.
 		 * @param	request_dir_relative_to_root	Request path to file
 		 * 						or directory
 		 * 						in \p request_dir_root.
-		 * @param	request_location_path		`getPath()` from `_lp`
-		 * 						or "/" if `_lp` is NULL.
+		 * @param	request_location_path		`path` of `_elp`.
 		 * @param	resolved_path			\p request_dir_root
 		 * 						concatenated with
 		 * 						\p request_dir_relative_to_root
@@ -311,16 +533,12 @@ class HTTPResponse
 		 * @warning	Parameters' validity isn't checked.
 		 * 		It's up to the user to ensure their validity.
 		 * @param	request				Request to handle.
-		 * @param	request_dir_root		Root or alias
-		 * 						of `_lp`
-		 * 						or `_server->Root()`
-		 * 						(if p lp is NULL)
+		 * @param	request_dir_root		`root` of `_elp`
 		 * 						with trailing '/'.
 		 * @param	request_dir_relative_to_root	Request path to file
 		 * 						or directory
 		 * 						in \p request_dir_root.
-		 * @param	request_location_path		`getPath()` from `_lp`
-		 * 						or "/" if `_lp` is NULL.
+		 * @param	request_location_path		`path` of `_elp`.
 		 * @param	resolved_path			\p request_dir_root
 		 * 						concatenated with
 		 * 						\p request_dir_relative_to_root
@@ -355,39 +573,70 @@ class HTTPResponse
 		void		generate_204(const std::string &content_location);
 
 		/**
-		 * Iterate through available indexes in `_lp` or
-		 * `_server_cfg` (if \p lp is NULL)
+		 * Iterate through available indexes of `_elp`
 		 * and append the first available to
 		 * \p request_dir_relative_to_root
 		 * (only if that index's file name contains
 		 * file name of \p request_dir_relative_to_root in itself).
-		 * @param	request_dir_root		Root or alias
-		 * 						of `_lp`
-		 * 						or `_server->Root()`
-		 * 						(if `_lp` is NULL)
+		 * @param	request_dir_root		`root` of `_elp`
 		 * 						with trailing '/'.
 		 * @param	request_dir_relative_to_root	Request path to file
 		 * 						or directory
 		 * 						in \p request_dir_root.
-		 * @return	0, if got some index that exists and is readable
+		 * @return	0, if got some index that exists and is a regular file
 		 * 		and that was appended to
 		 * 		\p request_dir_relative_to_root.
 		 * @return	-1, if no such index was found.
 		 */
 		int		find_first_available_index(
 				std::string &request_dir_root,
-				std::string &request_dir_relative_to_root) const;
+				std::string &request_dir_relative_to_root);
 
 		/**
 		 * Generate directory listing page
-		 * with files and directories at \p path (excluding . and ..).
-		 * "Content-Type" will be "text/html"
+		 * with files and directories at \p path (excluding . and ..)
+		 * according to `_elp`'s autoindex options.
+		 * Listing is rendered in batches (see AutoIndex)
+		 * while the response is being sent,
+		 * each of them becomes a chunk.
+		 * "Content-Type" will be set according to the format,
+		 * "Transfer-Encoding" to "chunked"
 		 * and `_status_code` will be 200.
 		 * @throw	std::ios_base::failure	Got IO error.
-		 * @param	dir	Directory to list files
-		 * 			and directories in.
+		 * @param	relative_path	Directory to list files
+		 * 				and directories in,
+		 * 				relative to `_root_dir`.
+		 * @param	request		Request to handle
+		 * 				(its query selects the page).
+		 */
+		void		generate_auto_index(const std::string &relative_path,
+				const HTTPRequest &request);
+
+		/**
+		 * `refill_payload()` for CGI output passed through:
+		 * what was read along with the header block is sent first,
+		 * then whatever the backend has is spliced,
+		 * framed as a chunk by a header in `_payload`
+		 * (and its CRLF sent with the next one).
+		 */
+		bool		refill_passthrough();
+
+		/**
+		 * Appends \p data framed as a chunk
+		 * (chunked transfer coding) to \p out.
+		 * @param	out	Where to append the chunk.
+		 * @param	data	Chunk data. If empty,
+		 * 			the last chunk is appended.
 		 */
-		void		generate_auto_index(const std::string &path);
+		static void	append_chunk(std::string &out,
+				const std::string &data);
+
+		/**
+		 * Appends the size line of a chunk
+		 * of \p length bytes to \p out.
+		 */
+		static void	append_chunk_header(std::string &out,
+				size_t length);
 
 		/**
 		 * Sets the "Connection" header in `_headers`.
@@ -398,61 +647,46 @@ class HTTPResponse
 		void		set_connection_header(const HTTPRequest &request);
 
 		/**
-		 * Handles CGI \p request with fork().
-		 *
-		 * Main process will set up pipes
-		 * and wait at maximum for `_MAX_CGI_TIME` seconds
-		 * for child (CGI) process to finish execution.
-		 *
-		 * Child process will redirect `_request_body` to it's stdin,
-		 * stdout to `_cgi_pipe[1]`,
-		 * and execve() into the the CGI handler
-		 * with the request path as argument for processing.
-		 * All CGI-specific environment variables
+		 * Launches CGI script of \p request (see CGIProcess;
+		 * with "cgi_pool", see `handle_pooled_cgi()` instead):
+		 * \p resolved_path is run by the interpreter
+		 * of its extension in `_elp` with the request body
+		 * on its stdin. All CGI-specific environment variables
 		 * will also be set up.
 		 *
-		 * If any syscall in main or child process fails,
-		 * 500 will be returned.
-		 *
-		 * If child doesn't finish execution within
-		 * it's maximum allowed execution time,
-		 * it will be killed and method will return 504.
-		 *
-		 * If child does finish execution within this time
-		 * and exits with return code 0,
-		 * "Connection" header in `_headers` will be set to "close"
-		 * and `_payload` will contain the data generated by that CGI.
+		 * The script runs alongside the event loop:
+		 * the response is prepared in `handle_cgi_event()`
+		 * once its header is received (see `process_cgi_output()`),
+		 * or in `check_cgi()`, if it's still running
+		 * after `_MAX_CGI_TIME` seconds
+		 * (it's killed then, and 504 is sent).
 		 *
-		 * If child returns with exit code other than zero
+		 * "Connection" header in `_headers` will be set to "close".
+		 * If the script exits with any other code than 0
+		 * before its header is received
 		 * (or CGI handler can't be launched / doesn't exist),
-		 * 502 will be returned.
+		 * 502 will be sent.
 		 * @warning	It's up to you to ensure \p resolved_path
 		 * 		exists as a regular file and can be read.
 		 * @warning	It's up to you to ensure that extension
 		 * 		of \p resolved_path is registered
-		 * 		as CGI extension in `_lp`.
-		 * @warning	Calling this method when `_lp` is NULL
-		 * 		will result in segfault!
-		 * @brief	Handles CGI \p request.
+		 * 		as CGI extension in `_elp`.
+		 * @brief	Launches CGI of \p request.
 		 * @param	request				Request to handle.
-		 * @param	request_dir_root		Root or alias
-		 * 						of `_lp`
-		 * 						or `_server->Root()`
-		 * 						(if p lp is NULL)
+		 * @param	request_dir_root		`root` of `_elp`
 		 * 						with trailing '/'.
 		 * @param	request_dir_relative_to_root	Request path to file
 		 * 						or directory
 		 * 						in \p request_dir_root.
-		 * @param	request_location_path		`getPath()` from `_lp`
-		 * 						or "/" if `_lp` is NULL.
+		 * @param	request_location_path		`path` of `_elp`.
 		 * @param	resolved_path			\p request_dir_root
 		 * 						concatenated with
 		 * 						\p request_dir_relative_to_root
 		 * 						given that it's not
 		 * 						a directory traversal
 		 * 						attempt.
-		 * @return	0, if everything went alright.
-		 * 		In that case, response is prepared.
+		 * @return	0, if the script was launched
+		 * 		(response isn't prepared yet).
 		 * @return	Any other value than 0
 		 * 		signals error code which should be later used
 		 * 		for building error response.
@@ -464,77 +698,207 @@ class HTTPResponse
 				std::string &resolved_path);
 
 		/**
-		 * Copies `_cgi_pipe[0]` to `_payload`.
-		 * @throw	runtime_error	read() fail.
+		 * Runs \p resolved_path (a script of `_elp`, see `handle_cgi()`)
+		 * with the interpreter of its extension.
+		 * @param	request		Request to handle.
+		 * @param	resolved_path	Path to the script.
+		 * @param	slot		Child holds a slot
+		 * 				of `_elp` (see CGILimiter).
+		 * @return	0, if the script was launched;
+		 * 		error status code otherwise
+		 * 		(the slot is given back then).
 		 */
-		void		copy_child_output_to_payload();
+		int		spawn_cgi(const HTTPRequest &request,
+				const std::string &resolved_path, bool slot);
 
 		/**
-		 * Child routine of executing CGI in \p request.
-		 * Redirect `_request_body` to stdin, stdout to `_cgi_pipe[1]`,
-		 * and execve() into the the CGI handler.
-		 * All CGI-specific environment variables
-		 * will also be set up.
+		 * Takes a slot of the "cgi_max_concurrent" location `_elp`
+		 * for the script of \p request, or waits for one
+		 * (see CGISlotWait) if the queue isn't full.
+		 * @param	request		Request to handle.
+		 * @param	resolved_path	Path to the script.
+		 * @return	0, if the script was launched or waits;
+		 * 		error status code otherwise
+		 * 		(503 for a full queue).
+		 */
+		int		queue_cgi(const HTTPRequest &request,
+				const std::string &resolved_path);
+
+		/**
+		 * Hands \p request to a warm worker of \p resolved_path
+		 * (see CGIWorkerPool), for locations with "cgi_pool".
+		 * Like `handle_cgi()`, the response is prepared later.
+		 * @param	request		Request to handle.
+		 * @param	interpreter	Interpreter of the script.
+		 * @param	resolved_path	Path to the script.
+		 * @return	0, if the request was handed over or queued;
+		 * 		error status code otherwise.
+		 */
+		int		handle_pooled_cgi(const HTTPRequest &request,
+				const std::string &interpreter,
+				const std::string &resolved_path);
+
+		/**
+		 * Passes \p request to the FastCGI application of `_elp`
+		 * (see FastCGIRequest) with the same variables a CGI script
+		 * would get, plus SCRIPT_FILENAME (\p resolved_path),
+		 * DOCUMENT_ROOT and REQUEST_URI.
+		 * Whether the script exists is up to the application.
+		 *
+		 * Like `handle_cgi()`, the response is prepared later:
+		 * from the application's output, 502 if it failed,
+		 * or 504 if it didn't respond within `_MAX_CGI_TIME` seconds.
+		 * @brief	Passes \p request to FastCGI application.
+		 * @param	request			Request to handle.
+		 * @param	request_dir_root	`root` of `_elp`
+		 * 					with trailing '/'.
+		 * @param	resolved_path		Path to the script.
+		 * @return	0, if the request was sent
+		 * 		(response isn't prepared yet).
+		 * @return	Any other value than 0
+		 * 		signals error code which should be later used
+		 * 		for building error response.
+		 */
+		int		handle_fastcgi(const HTTPRequest &request,
+				const std::string &request_dir_root,
+				const std::string &resolved_path);
+
+		/**
+		 * Forwards \p request to the HTTP server of `_elp`
+		 * (see ProxyRequest), whatever its path.
 		 *
-		 * If execve() fails, exit()'s with "EXIT_FAILURE".
-		 * @warning	This method never returns.
+		 * Like `handle_fastcgi()`, the response is prepared later:
+		 * from the upstream's response, 502 if it failed,
+		 * or 504 if it stayed silent for `_MAX_CGI_TIME` seconds.
+		 * @brief	Forwards \p request to HTTP upstream.
 		 * @param	request		Request to handle.
-		 * @param	resolved_path	Path to the script to process
-		 * 				with CGI.
+		 * @return	0, if the request was queued
+		 * 		(response isn't prepared yet);
+		 * 		502, if the upstream can't be connected to.
 		 */
-		void		cgi(const HTTPRequest &request,
-				std::string &resolved_path);
+		int		handle_proxy(const HTTPRequest &request);
+
+		/**
+		 * Looks \p request up in the CGI cache of `_elp`
+		 * ("cgi_cache"), before its script \p resolved_path is run.
+		 * Only GET requests of scripts that aren't "nph-" are cached,
+		 * by the key of "cgi_cache_key". A fresh (or stale) output
+		 * is served right away; if another request is running
+		 * the script, the response waits for its output
+		 * (see CGICacheWait).
+		 * @param	request		Request to handle.
+		 * @param	resolved_path	Path to the script.
+		 * @return	0, if the script should be run
+		 * 		(`_cache_leader` is set, if its output
+		 * 		fills the entry);
+		 * 		-1, if the response was served or waits;
+		 * 		error status code otherwise.
+		 */
+		int		lookup_cgi_cache(const HTTPRequest &request,
+				const std::string &resolved_path);
+
+		/**
+		 * Looks the entry the response is the leader of up
+		 * in the "cache_path" directory of `_elp`, if there is one.
+		 * An entry found there is put back in memory
+		 * (for the requests waiting for it) and its body is sent
+		 * with sendfile().
+		 * @param	request	Request to handle.
+		 * @return	0, if the script should be run;
+		 * 		-1, if the response was served.
+		 */
+		int		lookup_disk_cache(const HTTPRequest &request);
+
+		/**
+		 * Fills the entry the response is the leader of
+		 * with the complete \p output of `_cgi`,
+		 * if the script let it be cached: the status is 200, 301
+		 * or 302, there's no "Set-Cookie", and "Cache-Control"
+		 * (which may give other times than "cgi_cache")
+		 * doesn't forbid it (it's written to "cache_path" too,
+		 * if there is one). The entry is skipped for a while
+		 * otherwise, or given up on, if the script failed.
+		 * @param	output		Output of `_cgi`.
+		 * @param	complete	`_cgi` finished successfully;
+		 * 				if not, \p output is only
+		 * 				the beginning of it.
+		 */
+		void		fill_cgi_cache(const std::string &output,
+				bool complete);
 
 		/**
-		 * Get index of extension of \p resolved_path in
-		 * `_lp->_cgi_ext`.
-		 * This is needed for `cgi()` to determine
-		 * the index of CGI interpreter.
-		 * @warning	It's up to you to ensure that
-		 * 		`request_file_ext` exists in `_lp->cgi_ext`.
-		 * 		If it doesn't, no exception will be thrown
-		 * 		and index in `_lp->_cgi_path` will be invalid.
-		 * @param	resolved_path	Path to the script to process
-		 * 				with CGI.
+		 * Prepares the response once the header block
+		 * of `_cgi` output is complete (RFC 3875, 6):
+		 * "Status" gives the status code, a "Location" URI
+		 * makes a redirect (a local one, if it's a path
+		 * and there is no "Status"), other fields are passed on.
+		 * "X-Accel-Redirect" path makes a local redirect
+		 * whatever else there is: the script's body is dropped
+		 * and the path is served instead, usually a static file
+		 * in an "internal" location; "Content-Type",
+		 * "Content-Disposition", "Set-Cookie", "Cache-Control"
+		 * and "Expires" of the script are kept.
+		 * The rest of the output becomes the body:
+		 * with "Content-Length", if the backend is finished
+		 * already (or the script gave it), otherwise chunked,
+		 * and it's sent while it's being produced
+		 * (see CGIBodyProducer).
+		 * NPH output (of "nph-" scripts, or starting
+		 * with a status line) is sent as is.
+		 * The filler of a CGI cache entry waits for the whole
+		 * output first (see `fill_cgi_cache()`).
+		 *
+		 * If the backend fails before the header is complete,
+		 * or the header is malformed, 502 is prepared instead.
 		 */
-		/*
-		size_t		cgi_get_path_index(
-				const std::string &resolved_path) const;
+		void		process_cgi_output();
+
+		/**
+		 * Parses the header block at the beginning of \p output
+		 * to `_status_code`, `_headers` or `_local_redirect`
+		 * and removes it from \p output.
+		 * @param	output	Output of `_cgi` received so far.
+		 * @return	0, if it was parsed;
+		 * 		-1, if it isn't complete yet;
+		 * 		502, if it's malformed.
+		 */
+		int		parse_cgi_header(std::string &output);
+
+		/**
+		 * Sets up the local redirect to "X-Accel-Redirect" \p uri,
+		 * keeping the fields of \p fields that describe
+		 * the content for the redirected response.
+		 * @param	uri	Path to serve instead.
+		 * @param	fields	Other fields of the CGI header.
+		 * @return	0, if it's set up;
+		 * 		502, if \p uri isn't a path.
 		 */
+		int		set_accel_redirect(const std::string &uri,
+				const std::map<std::string, std::string> &fields);
 
 		/**
-		 * Returns an "argv"-like array (that is NULL-terminated)
-		 * of \p interpreter_path and \p script_path
-		 * required for `cgi()` to execve() into interpreter.
-		 * @param	interpreter_path	Path to interpreter
-		 * 					for \p script_path.
-		 * @param	script_path		Path to the script
-		 * 					to process with CGI.
-		 * @return	"argv-like" array of \p interpreter_path
-		 * 		and \p script_path on success.
-		 * @return	NULL on some failure.
+		 * Builds a GET request of \p uri with the header
+		 * (but not the body) of `_request`.
+		 * @return	Request allocated with new;
+		 * 		NULL, if \p uri can't be requested.
 		 */
-		char **		cgi_prep_argv(
-				const std::string &interpreter_path,
-				const std::string &script_path) const;
+		HTTPRequest	*build_get_request(const std::string &uri) const;
 
 		/**
-		 * Returns an "argv"-like array (that is NULL-terminated)
-		 * of `environ` and additionally
-		 * CGI-specific envrionment variables.
+		 * Appends CGI variables ("NAME=value") specific to \p request
+		 * to \p vars; the ones every request of the location gets
+		 * are in `EffectiveLocation::cgi_static_vars`.
 		 * @param	request	CGI request to handle.
-		 * @return	"argv-like" array of `environ`
-		 * 		and additionally CGI-specific
-		 * 		environment variables on success.
-		 * @return	NULL on some failure.
+		 * @param	vars	Where to append the variables.
+		 * @return	true on success; false on some failure.
 		 */
-		char **		cgi_prep_envp(const HTTPRequest & request) const;
+		bool		cgi_prep_vars(const HTTPRequest &request,
+				std::vector<std::string> &vars) const;
 
 		/**
-		 * Helper for `cgi()` to free() \p arr
-		 * in case of a system error.
-		 * @param	arr	"argv"-like (NULL-terminated)
-		 * 			array of C strings.
+		 * Appends C strings of \p strings to \p out.
+		 * @warning	They point into \p strings.
 		 */
-		void		cgi_free_argv_like_array(char ** arr) const;
+		static void	append_c_strings(std::vector<char *> &out,
+				const std::vector<std::string> &strings);
 };
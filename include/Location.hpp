@@ -1,6 +1,10 @@
 #pragma once
 #include "Webserv.hpp"
 #include "ConfigParser.hpp"
+#include "AutoIndex.hpp"
+#include "MimeTypes.hpp"
+#include "RootDir.hpp"
+#include "UpstreamPool.hpp"
 
 /**
  * @class Location
@@ -10,10 +14,24 @@
  * including its root path, allowed HTTP methods, directory listing, index files, CGI handling, and more.
  */
 class Location {
+	public:
+		// Modifier of the location path.
+		enum e_match
+		{
+			MATCH_PREFIX,		// "location /path/"
+			MATCH_EXACT,		// "location = /path"
+			// "location ^~ /path/": the longest prefix
+			// that ends the search (there are no regex
+			// locations yet, so it matches like a plain one).
+			MATCH_PREFERENTIAL
+		};
+
 	private:
 		std::string 			_path;
+		enum e_match			_match;
 		std::string 			_root;
 		bool 				_autoindex;
+		AutoIndex::Options		_autoindex_options;
 		std::vector<std::string> 	_index;
 		std::set<std::string>	 	_methods;
 		std::string 			_alias;
@@ -27,6 +45,54 @@ class Location {
 		std::vector<std::string> 	_cgi_ext;
 		std::map<int, std::string> 	_error_pages;
 		std::string 			_upload_path; // Path for file uploads, if applicable
+		// "try_files" URIs, the last one is the fallback (URI or "=code").
+		std::vector<std::string>	_try_files;
+		// "return" status code (0, if not set) and URL (for 3xx codes).
+		int				_return_code;
+		std::string			_return_url;
+		// "cgi_pool" workers per script (0, if not set)
+		// and requests per worker (0 for no limit).
+		size_t				_cgi_pool_workers;
+		size_t				_cgi_pool_max_requests;
+		// "fastcgi_pass" application server; empty name, if not set.
+		UpstreamAddress			_fastcgi_pass;
+		// "proxy_pass" HTTP upstream; empty name, if not set.
+		UpstreamAddress			_proxy_pass;
+		// "internal": only reachable by redirects of the server itself.
+		bool				_internal;
+		// "cgi_cache" seconds CGI responses are fresh (0, if not set)
+		// and seconds they may be served stale after that.
+		size_t				_cgi_cache_ttl;
+		size_t				_cgi_cache_stale;
+		// "cgi_cache_key" items ("$uri", "$http_<name>", etc.).
+		std::vector<std::string>	_cgi_cache_key;
+		// "cache_path" directory CGI cache entries are also kept in
+		// (empty, if not set) and the most it may hold, in bytes.
+		std::string			_cache_path;
+		uint64_t			_cache_max_size;
+		// "cgi_max_concurrent" scripts running at once (0, if not set),
+		// "cgi_queue_size" requests waiting for one of them to end
+		// and seconds they may wait.
+		size_t				_cgi_max_concurrent;
+		size_t				_cgi_queue_size;
+		size_t				_cgi_queue_timeout;
+		// "stub_status": serve the server's stats (see Stats)
+		// to clients of these networks (address and mask).
+		bool				_stub_status;
+		std::vector<std::pair<uint32_t, uint32_t> >	_stub_status_allow;
+		// "cgi_rlimit_cpu" seconds, "cgi_rlimit_as" bytes
+		// and "cgi_rlimit_nofile" descriptors CGI scripts
+		// may use (0, if not set).
+		uint64_t			_cgi_rlimit_cpu;
+		uint64_t			_cgi_rlimit_as;
+		uint64_t			_cgi_rlimit_nofile;
+		// Serialized responses for codes in `_error_pages`,
+		// see `prepareErrorResponses()`.
+		std::map<int, std::string>	_error_responses;
+		// `_root` (or `_alias`) and `_upload_path` opened at startup,
+		// see `openRootDirs()`.
+		RootDir				_root_dir;
+		RootDir				_upload_dir;
 
 
 	public:
@@ -38,14 +104,21 @@ class Location {
 		// Setters
 		/**
 		 * Set \p path.
-		 * @throw	std::invalid_argument	\p path doesn't begin or end
-		 * 					with '/'.
+		 * @warning	Call `setMatch()` first.
+		 * @throw	std::invalid_argument	\p path doesn't begin with '/'
+		 * 					(or end with it,
+		 * 					unless it's an exact match).
 		 * @param	path	Request path.
 		 */
 		void 						setPath(const std::string& path);
+		void 						setMatch(enum e_match match);
 
 		void 						setRootLocation(const std::string& root);
 		void 						setAutoindex(bool value);
+		void 						setAutoindexFormat(enum AutoIndex::e_format format);
+		void 						setAutoindexSort(enum AutoIndex::e_sort sort);
+		void 						setAutoindexDetails(bool value);
+		void 						setAutoindexPageSize(size_t page_size);
 		void 						addIndexLocation(const std::string& index);
 		void 						setAlias(const std::string& alias);
 		void 						addCgiPath(const std::string& path);
@@ -56,11 +129,29 @@ class Location {
 		void 						setErrorPages(const std::map<int, std::string>& errorPages);
 		void 						setErrorPage(int code, const std::string& path);
 		void 						setUploadPath(const std::string& path);
+		void 						addTryFile(const std::string& item);
+		void 						setReturn(int code, const std::string& url);
+		void 						setFastCGIPass(const UpstreamAddress& upstream);
+		void 						setProxyPass(const UpstreamAddress& upstream);
+		void 						setCgiPool(size_t workers, size_t max_requests);
+		void 						setInternal(bool value);
+		void 						setCgiCache(size_t ttl, size_t stale);
+		void 						addCgiCacheKey(const std::string& item);
+		void 						setCachePath(const std::string& path, uint64_t max_size);
+		void 						setCgiMaxConcurrent(size_t max_concurrent);
+		void 						setCgiQueue(size_t size, size_t timeout);
+		void 						setStubStatus(bool value);
+		void 						addStubStatusAllow(uint32_t network, uint32_t mask);
+		void 						setCgiRlimitCpu(uint64_t seconds);
+		void 						setCgiRlimitAs(uint64_t size);
+		void 						setCgiRlimitNofile(uint64_t count);
 
 		const std::string 				&getPath() const;
+		enum e_match					getMatch() const;
 		const std::string 				&getRootLocation() const;
 		const std::set<std::string>			&getMethods() const;
 		const bool 					&getAutoindex() const;
+		const AutoIndex::Options			&getAutoindexOptions() const;
 		const std::vector<std::string> 			&getIndexLocation() const;
 		const std::string 				&getAlias() const;
 		const std::vector<std::string> 			&getCgiPath() const;
@@ -76,8 +167,67 @@ class Location {
 		const std::map<int, std::string> 		&getErrorPages() const;
 		std::string 					getErrorPage(int code) const;
 		const std::string 				&getUploadPath() const;
+		const std::vector<std::string>			&getTryFiles() const;
+		int						getReturnCode() const;
+		const std::string				&getReturnUrl() const;
+		const UpstreamAddress				&getFastCGIPass() const;
+		const UpstreamAddress				&getProxyPass() const;
+		size_t						getCgiPoolWorkers() const;
+		size_t						getCgiPoolMaxRequests() const;
+		bool						isInternal() const;
+		size_t						getCgiCacheTtl() const;
+		size_t						getCgiCacheStale() const;
+		const std::vector<std::string>			&getCgiCacheKey() const;
+		const std::string				&getCachePath() const;
+		uint64_t					getCacheMaxSize() const;
+		size_t						getCgiMaxConcurrent() const;
+		size_t						getCgiQueueSize() const;
+		size_t						getCgiQueueTimeout() const;
+		bool						isStubStatus() const;
+		const std::vector<std::pair<uint32_t, uint32_t> >	&getStubStatusAllow() const;
+		uint64_t					getCgiRlimitCpu() const;
+		uint64_t					getCgiRlimitAs() const;
+		uint64_t					getCgiRlimitNofile() const;
 
 		void 						validateLocation() const;
 
+		/**
+		 * Reads every page in `_error_pages` (relative to root or alias)
+		 * once and serializes the complete error response for it.
+		 * Codes this location doesn't override are left
+		 * to the server's prepared responses.
+		 * @param	mime_types	Server's MIME types
+		 * 				(for the "Content-Type" of pages).
+		 */
+		void						prepareErrorResponses(const MimeTypes &mime_types);
+
+		/**
+		 * Get the error response prepared by `prepareErrorResponses()`.
+		 * @param	code	Status code of the response.
+		 * @return	Pointer to the serialized response.
+		 * @return	NULL, if this location doesn't override \p code.
+		 */
+		const std::string				*getErrorResponse(int code) const;
+
+		/**
+		 * Opens root (or alias) and upload path directories
+		 * to resolve request paths in.
+		 * Directories that can't be opened are reported and skipped.
+		 */
+		void						openRootDirs();
+		void						closeRootDirs();
+
+		/**
+		 * Get the directory of `_root` (or `_alias`).
+		 * @warning	May be not opened (see `RootDir::is_open()`).
+		 */
+		const RootDir					&getRootDir() const;
+
+		/**
+		 * Get the directory of `_upload_path`.
+		 * @warning	May be not opened (see `RootDir::is_open()`).
+		 */
+		const RootDir					&getUploadDir() const;
+
 		void 						printDebug() const;
 };
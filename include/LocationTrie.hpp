@@ -0,0 +1,66 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+/**
+ * Compressed radix trie of location paths,
+ * built once when the config is loaded.
+ *
+ * Finding the longest location path that is a prefix of a request path
+ * walks the trie along the request path once,
+ * so it takes O(request path length) no matter
+ * how many locations there are.
+ */
+class LocationTrie
+{
+	public:
+		// Returned by `find()` if no location path matched.
+		static const size_t	NOT_FOUND = static_cast<size_t> (-1);
+
+		LocationTrie();
+
+		/**
+		 * Adds \p path that corresponds to location number \p index.
+		 * @param	path	Location path.
+		 * @param	index	Index of the location.
+		 */
+		void		insert(const std::string &path, size_t index);
+
+		/**
+		 * Removes everything.
+		 */
+		void		clear();
+
+		/**
+		 * Find the location whose path is
+		 * the longest prefix of \p request_path.
+		 * @param	request_path	Request path.
+		 * @return	Index of the location;
+		 * 		`NOT_FOUND`, if nothing matched.
+		 */
+		size_t		find(const std::string &request_path) const;
+
+	private:
+		struct Node
+		{
+			// Part of the path between the parent and this node.
+			std::string		label;
+			// Location ending exactly at this node, or `NOT_FOUND`.
+			size_t			index;
+			// Indices in `_nodes`, no two labels start with the same character.
+			std::vector<size_t>	children;
+		};
+
+		// `_nodes[0]` is the root (with empty label).
+		std::vector<Node>	_nodes;
+
+		size_t		add_node(const std::string &label, size_t index);
+
+		/**
+		 * Find the child of \p node whose label starts with \p c.
+		 * @return	Index of the child in `_nodes`, or `NOT_FOUND`.
+		 */
+		size_t		find_child(size_t node, char c) const;
+};
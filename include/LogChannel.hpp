@@ -0,0 +1,112 @@
+#pragma once
+
+#include <string>
+#include <map>
+#include <ctime>
+
+/**
+ * Lines logged to the server's stderr without ever blocking:
+ * what CGI scripts write to their stderr and, while the event loop
+ * runs, messages of the server itself (see `print_log()`).
+ *
+ * Lines are queued and written by `flush()` only while stderr
+ * is writable; the event loop watches it for EPOLLOUT
+ * as long as some are `pending()`. Each write is at most `PIPE_BUF`
+ * bytes of whole lines, so lines of other processes logging
+ * to the same pipe aren't cut through.
+ *
+ * Every source (a script) may log `BURST` lines at once,
+ * then `RATE` lines a second: lines over that are suppressed
+ * and counted, the count is logged with its next line.
+ * Lines that don't fit in the queue (stderr doesn't keep up)
+ * are dropped.
+ */
+class LogChannel
+{
+	public:
+		/**
+		 * Queues lines from now on, instead of them being
+		 * written right away (the event loop flushes them).
+		 */
+		static void		start();
+
+		/**
+		 * Check if lines are queued (see `start()`).
+		 */
+		static bool		is_started();
+
+		/**
+		 * Queues \p line (without its '\n') of the server itself.
+		 */
+		static void		write(const std::string &line);
+
+		/**
+		 * Queues \p line (without its '\n') logged by \p source,
+		 * unless \p source is over its rate.
+		 */
+		static void		write(const std::string &source,
+						const std::string &line);
+
+		/**
+		 * Writes queued lines while stderr is writable.
+		 */
+		static void		flush();
+
+		/**
+		 * Check if some lines are still queued.
+		 */
+		static bool		pending();
+
+		/**
+		 * Writes the queued lines, waiting for stderr if needed
+		 * (the server is exiting); later lines are written
+		 * right away again.
+		 */
+		static void		shutdown();
+
+	private:
+		// Most bytes queued, lines over that are dropped.
+		enum { MAX_QUEUED = 1048576 };
+		// Lines a source may log at once, then a second.
+		enum { BURST = 100, RATE = 20 };
+
+		struct Source
+		{
+			// Lines the source may still log now.
+			size_t		tokens;
+			time_t		refilled;
+			// Lines suppressed since its last logged one.
+			size_t		suppressed;
+
+			Source();
+		};
+
+		// Lines are queued (see `start()`).
+		static bool				_started;
+		// Queued lines, written up to `_written`.
+		static std::string			_queue;
+		static size_t				_written;
+		static std::map<std::string, Source>	_sources;
+		// Last time `_sources` were pruned.
+		static time_t				_pruned;
+
+		/**
+		 * Forgets the sources that could log `BURST` lines
+		 * at \p now and have no suppressed lines to report.
+		 */
+		static void		prune(time_t now);
+
+		/**
+		 * Appends \p line to the queue, unless it's full.
+		 */
+		static void		enqueue(const std::string &line);
+
+		/**
+		 * Writes the next part of the queue.
+		 * @param	wait	Wait for stderr to be writable.
+		 * @return	false, if nothing was written.
+		 */
+		static bool		write_next(bool wait);
+
+		LogChannel();
+};
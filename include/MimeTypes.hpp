@@ -0,0 +1,60 @@
+#pragma once
+
+#include "PerfectHash.hpp"
+#include <string>
+#include <map>
+
+/**
+ * Table of MIME types by file extension,
+ * filled from "types { }" config blocks.
+ *
+ * Extensions are collected with `add()` while the config is parsed
+ * and compiled into a PerfectHash by `compile()`,
+ * so `lookup()` doesn't allocate anything.
+ */
+class MimeTypes
+{
+	public:
+		MimeTypes();
+
+		/**
+		 * Maps \p ext to \p type.
+		 * Redefined extensions are overridden.
+		 * @warning	Takes effect only after `compile()`.
+		 * @param	type	MIME type (e.g. "text/html").
+		 * @param	ext	Extension (any case, leading '.' is optional).
+		 */
+		void			add(const std::string &type, const std::string &ext);
+
+		/**
+		 * Builds the lookup table from what was `add()`ed.
+		 * @throw	std::runtime_error	Couldn't build the table.
+		 */
+		void			compile();
+
+		/**
+		 * Get the MIME type depending on extension of the file in \p path.
+		 * @param	path	Path to a file.
+		 * @return	Appropriate MIME type for file in \p path,
+		 * 		"application/octet-stream" if it's unknown.
+		 */
+		const std::string	&lookup(const std::string &path) const;
+
+		/**
+		 * Check if no types were `add()`ed.
+		 */
+		bool			empty() const;
+
+		/**
+		 * Get the (compiled) table used when config has no "types" blocks.
+		 * @return	Built-in table.
+		 */
+		static const MimeTypes	&getDefault();
+
+	private:
+		static const std::string		_DEFAULT_TYPE;
+
+		// Extension (lowercase, without '.') => MIME type.
+		std::map<std::string, std::string>	_types;
+		PerfectHash<std::string>		_table;
+};
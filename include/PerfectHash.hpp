@@ -0,0 +1,247 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <stdexcept>
+#include <cctype>
+#include <cstddef>
+#include <stdint.h>
+
+/**
+ * Static string table (case-insensitive by default) built once
+ * with the "hash and displace" scheme:
+ * keys are first split into buckets by one hash,
+ * then every bucket gets its own displacement (seed of the second hash)
+ * chosen so that its keys land in slots nobody else took.
+ *
+ * A lookup is therefore always two hashes and one key comparison,
+ * and (unlike with std::map) needs neither an allocation
+ * nor a lowercase copy of the key.
+ * @warning	Table is immutable: to change it, build a new one.
+ */
+template <typename T>
+class PerfectHash
+{
+	public:
+		PerfectHash()
+			: _fold_case(true)
+		{
+		}
+
+		/**
+		 * Builds the table from \p entries.
+		 * @throw	std::runtime_error	Couldn't find displacements
+		 * 					(practically never happens).
+		 * @param	entries		Keys and their values
+		 * 				(keys in lowercase, if \p fold_case).
+		 * @param	fold_case	Ignore case of looked up keys.
+		 */
+		explicit PerfectHash(const std::map<std::string, T> &entries,
+				bool fold_case = true)
+			: _fold_case(fold_case)
+		{
+			build(entries);
+		}
+
+		/**
+		 * Find the value of \p key.
+		 * @param	key	Key (any case, if built with `fold_case`).
+		 * @param	length	Length of \p key.
+		 * @return	Pointer to the value, or NULL if \p key is unknown.
+		 */
+		const T	*find(const char *key, size_t length) const
+		{
+			uint32_t displacement;
+			size_t slot;
+
+			if (_slots.empty())
+			{
+				return NULL;
+			}
+			displacement = _displacements[hash(key, length, 0, _fold_case)
+				% _displacements.size()];
+			slot = _slots[hash(key, length, displacement, _fold_case)
+				% _slots.size()];
+			if (slot == _EMPTY
+				|| !equal(_keys[slot], key, length, _fold_case))
+			{
+				return NULL;
+			}
+			return &_values[slot];
+		}
+
+		const T	*find(const std::string &key) const
+		{
+			return find(key.c_str(), key.length());
+		}
+
+		size_t	size() const
+		{
+			return _keys.size();
+		}
+
+		bool	empty() const
+		{
+			return _keys.empty();
+		}
+
+	private:
+		// Marks a free slot in `_slots`.
+		static const size_t		_EMPTY = static_cast<size_t> (-1);
+		// Give up on a table size after that many displacements
+		// and try a bigger one.
+		static const uint32_t		_MAX_DISPLACEMENT = 1u << 16;
+
+		bool				_fold_case;
+		std::vector<std::string>	_keys;
+		std::vector<T>			_values;
+		// Displacement for each bucket.
+		std::vector<uint32_t>		_displacements;
+		// Index in `_keys` and `_values` for each slot.
+		std::vector<size_t>		_slots;
+
+		/**
+		 * FNV-1a (of lowercased \p key, if \p fold_case)
+		 * with \p seed mixed in and a final avalanche,
+		 * so different seeds produce unrelated hashes.
+		 */
+		static uint32_t	hash(const char *key, size_t length, uint32_t seed,
+				bool fold_case)
+		{
+			uint32_t h = 2166136261u ^ (seed * 0x9E3779B9u);
+
+			for (size_t i = 0; i < length; i++)
+			{
+				unsigned char c = static_cast<unsigned char> (key[i]);
+
+				h ^= static_cast<uint32_t> (fold_case ? std::tolower(c) : c);
+				h *= 16777619u;
+			}
+			h ^= h >> 16;
+			h *= 0x85EBCA6Bu;
+			h ^= h >> 13;
+			h *= 0xC2B2AE35u;
+			h ^= h >> 16;
+			return h;
+		}
+
+		static bool	equal(const std::string &stored,
+				const char *key, size_t length, bool fold_case)
+		{
+			if (stored.length() != length)
+			{
+				return false;
+			}
+			for (size_t i = 0; i < length; i++)
+			{
+				unsigned char c = static_cast<unsigned char> (key[i]);
+
+				if (static_cast<unsigned char> (stored[i])
+					!= (fold_case ? std::tolower(c) : c))
+				{
+					return false;
+				}
+			}
+			return true;
+		}
+
+		void	build(const std::map<std::string, T> &entries)
+		{
+			size_t bucket_count, slot_count;
+
+			_keys.clear();
+			_values.clear();
+			for (typename std::map<std::string, T>::const_iterator it
+				= entries.begin(); it != entries.end(); ++it)
+			{
+				_keys.push_back(it->first);
+				_values.push_back(it->second);
+			}
+			if (_keys.empty())
+			{
+				_displacements.clear();
+				_slots.clear();
+				return;
+			}
+			// ~4 keys per bucket and ~80% load keep the search short.
+			bucket_count = _keys.size() / 4 + 1;
+			for (slot_count = _keys.size() + _keys.size() / 4 + 1;
+				slot_count < _keys.size() * 4 + 16; slot_count *= 2)
+			{
+				if (try_build(bucket_count, slot_count))
+				{
+					return;
+				}
+			}
+			throw std::runtime_error(std::string("PerfectHash::build(): ")
+					+ "Couldn't build the table.");
+		}
+
+		bool	try_build(size_t bucket_count, size_t slot_count)
+		{
+			std::vector<std::vector<size_t> > buckets(bucket_count);
+			std::vector<size_t> taken;
+			uint32_t d;
+			size_t i, k;
+
+			_displacements.assign(bucket_count, 0);
+			_slots.assign(slot_count, _EMPTY);
+			for (i = 0; i < _keys.size(); i++)
+			{
+				buckets[hash(_keys[i].c_str(), _keys[i].length(), 0,
+						_fold_case) % bucket_count].push_back(i);
+			}
+			// Biggest buckets are the hardest to place, so they go first.
+			std::vector<std::pair<size_t, size_t> > order;
+			for (i = 0; i < bucket_count; i++)
+			{
+				order.push_back(std::make_pair(buckets[i].size(), i));
+			}
+			std::sort(order.rbegin(), order.rend());
+			for (size_t b = 0; b < order.size() && order[b].first > 0; b++)
+			{
+				const std::vector<size_t> &bucket = buckets[order[b].second];
+
+				for (d = 1; d < _MAX_DISPLACEMENT; d++)
+				{
+					taken.clear();
+					for (k = 0; k < bucket.size(); k++)
+					{
+						size_t slot = hash(_keys[bucket[k]].c_str(),
+							_keys[bucket[k]].length(), d,
+							_fold_case) % slot_count;
+
+						if (_slots[slot] != _EMPTY
+							|| std::find(taken.begin(), taken.end(), slot)
+								!= taken.end())
+						{
+							break;
+						}
+						taken.push_back(slot);
+					}
+					if (k == bucket.size())
+					{
+						break;
+					}
+				}
+				if (d == _MAX_DISPLACEMENT)
+				{
+					return false;
+				}
+				_displacements[order[b].second] = d;
+				for (k = 0; k < bucket.size(); k++)
+				{
+					_slots[taken[k]] = bucket[k];
+				}
+			}
+			return true;
+		}
+};
+
+template <typename T>
+const size_t PerfectHash<T>::_EMPTY;
+
+template <typename T>
+const uint32_t PerfectHash<T>::_MAX_DISPLACEMENT;
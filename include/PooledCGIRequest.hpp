@@ -0,0 +1,151 @@
+#pragma once
+
+#include "CGIBackend.hpp"
+#include "CGIWorkerPool.hpp"
+#include <string>
+#include <vector>
+#include <ctime>
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+ * Request to a warm CGI worker (see CGIWorkerPool),
+ * driven by the event loop like CGIProcess.
+ *
+ * If every worker is busy, the request waits in the pool's queue
+ * and only its eventfd is watched: the pool signals it once
+ * a worker is assigned, and the worker's stdin and stdout
+ * (duplicates of them) are listed to be watched from then on.
+ * The request frame is written to stdin one bounded block at a time
+ * (reading the body from a spooled file if there's one),
+ * the response frame is read from stdout until it's complete.
+ * @warning	Descriptors are closed by `close_fd()`
+ * 		or when the object is destroyed:
+ * 		remove them from epoll before that.
+ */
+class PooledCGIRequest : public CGIBackend
+{
+	public:
+		PooledCGIRequest();
+		/**
+		 * Leaves the queue, or gives the worker back
+		 * (it's stopped, if the request didn't end cleanly).
+		 */
+		~PooledCGIRequest();
+
+		/**
+		 * Prepares the request frame and takes a worker
+		 * of pool \p pool (or waits for one).
+		 * @throw	std::runtime_error	Couldn't start a worker, etc.
+		 * @param	pool		Pool of the script to run.
+		 * @param	vars		"NAME=value" CGI variables.
+		 * @param	input		Request body,
+		 * 				if \p input_fd is -1.
+		 * @param	input_fd	File with the request body
+		 * 				(it's duplicated); -1 if none.
+		 * @param	input_length	Length of the request body.
+		 * @param	timeout		Seconds the request may take,
+		 * 				waiting in the queue included.
+		 */
+		void		start(const CGIWorkerPool::Key &pool,
+					const std::vector<std::string> &vars,
+					const std::string &input, int input_fd,
+					uint64_t input_length, time_t timeout);
+
+		/**
+		 * Hands \p worker to the queued request.
+		 * Called by CGIWorkerPool.
+		 * @param	worker	Worker to send the request to;
+		 * 			NULL, if none could be started.
+		 */
+		void		assign(CGIWorker *worker);
+
+		/**
+		 * Lists the eventfd (while queued), the worker's stdin
+		 * (for EPOLLOUT, while there's something to send),
+		 * its stdout and, while the worker is held, its stderr.
+		 */
+		void		get_watched_fds(std::vector<Watch> &out) const;
+
+		bool		handle_event(int fd);
+		void		close_fd(int fd);
+
+		/**
+		 * Nothing to poll: everything is watched.
+		 */
+		void		poll();
+
+		/**
+		 * Gives up on the request; the worker is stopped.
+		 */
+		void		abort();
+
+		bool		is_finished() const;
+
+		/**
+		 * Check if the response frame was received completely.
+		 */
+		bool		succeeded() const;
+
+		bool		is_expired(time_t now) const;
+
+		/**
+		 * Get the CGI output received so far.
+		 */
+		std::string	&get_output();
+
+	private:
+		CGIWorkerPool::Key	_pool;
+		CGIWorker	*_worker;
+		// Queued: waiting for `assign()`.
+		bool		_queued;
+		// Signaled by `assign()` while queued.
+		int		_wake_fd;
+		// Duplicates of the worker's stdin, stdout and stderr.
+		int		_write_fd;
+		int		_read_fd;
+		int		_stderr_fd;
+		// Part of the request frame to send and how much of it was sent.
+		std::string	_send;
+		size_t		_send_pos;
+		// Spooled input, read from `_input_offset` on.
+		int		_input_fd;
+		off_t		_input_offset;
+		uint64_t	_input_length;
+		// Whole request frame was sent.
+		bool		_sent;
+		// Length prefix of the response frame, while it's read.
+		std::string	_prefix;
+		// Length of the response frame;
+		// std::string::npos until its prefix is read.
+		size_t		_output_length;
+		// Bytes of the response frame received so far
+		// (`_output` is consumed by the response as it comes).
+		size_t		_frame_received;
+		// Response frame was received completely.
+		bool		_ended;
+		// Worker failed (or died), or the request was aborted.
+		bool		_failed;
+		time_t		_deadline;
+		std::string	_output;
+
+		/**
+		 * Writes the next part of the request frame.
+		 * @return	false, if it was sent (or the worker broke).
+		 */
+		bool		send_frame();
+
+		/**
+		 * Reads the next part of the response frame.
+		 * @return	false, if it was received (or the worker broke).
+		 */
+		bool		receive_frame();
+
+		/**
+		 * Gives `_worker` back to the pool.
+		 */
+		void		release_worker(bool reusable);
+
+		PooledCGIRequest(const PooledCGIRequest &other);
+		PooledCGIRequest &operator=(const PooledCGIRequest &other);
+};
@@ -0,0 +1,204 @@
+#pragma once
+
+#include "CGIBackend.hpp"
+#include "UpstreamPool.hpp"
+#include <string>
+#include <vector>
+#include <ctime>
+#include <stdint.h>
+#include <sys/types.h>
+
+class HTTPRequest;
+
+/**
+ * Request forwarded to an HTTP/1.1 server ("proxy_pass"),
+ * driven by the event loop like FastCGIRequest.
+ *
+ * The connection is taken from UpstreamPool and given back once
+ * the response ended cleanly (and the upstream didn't ask to close it),
+ * so the next request skips connect(). If a reused connection breaks
+ * before any of the response arrives (the upstream closed it meanwhile),
+ * a GET or a request with a spooled body is sent once more on a new one.
+ * The request goes as it was
+ * received, but with hop-by-hop fields dropped, the body framed
+ * by "Content-Length" (it was decoded already) and the client added
+ * to "X-Forwarded-For"; a spooled body is sent one bounded block
+ * at a time, whenever the connection is writable.
+ *
+ * The response is turned into CGI output: a header block
+ * with "Status" and the upstream's end-to-end fields, then the body
+ * (chunks decoded), so HTTPResponse handles it as a script's output
+ * and the client sees it framed by the server. Like any CGIBackend,
+ * the connection isn't read while the client doesn't take the body.
+ *
+ * The connection is watched through two duplicates of it:
+ * one for EPOLLOUT until everything is sent, one for EPOLLIN
+ * until the response ends.
+ * @warning	Descriptors are closed by `close_fd()`
+ * 		or when the object is destroyed:
+ * 		remove them from epoll before that.
+ */
+class ProxyRequest : public CGIBackend
+{
+	public:
+		ProxyRequest();
+		/**
+		 * Closes the descriptors; gives the connection back
+		 * to the pool, if the response ended cleanly.
+		 */
+		~ProxyRequest();
+
+		/**
+		 * Takes a connection to \p upstream and queues \p request.
+		 * @throw	std::runtime_error	Couldn't connect, etc.
+		 * @param	upstream	HTTP server.
+		 * @param	request		Complete request of the client.
+		 * @param	timeout		Seconds the upstream may stay
+		 * 				silent for (not the whole response:
+		 * 				its body may be streamed for longer).
+		 */
+		void		start(const UpstreamAddress &upstream,
+					const HTTPRequest &request, time_t timeout);
+
+		/**
+		 * Lists the connection (for EPOLLOUT, while there is
+		 * something to send, and for EPOLLIN).
+		 */
+		void		get_watched_fds(std::vector<Watch> &out) const;
+
+		/**
+		 * Sends the next part of the request or reads
+		 * the next part of the response.
+		 */
+		bool		handle_event(int fd);
+
+		void		close_fd(int fd);
+
+		/**
+		 * Nothing to poll: everything is watched.
+		 */
+		void		poll();
+
+		/**
+		 * Gives up on the request; the connection is closed.
+		 */
+		void		abort();
+
+		/**
+		 * Check if the response ended (or the request failed).
+		 */
+		bool		is_finished() const;
+
+		/**
+		 * Check if the whole response was received.
+		 */
+		bool		succeeded() const;
+
+		bool		is_expired(time_t now) const;
+
+		/**
+		 * Get the response turned into CGI output so far.
+		 */
+		std::string	&get_output();
+
+	private:
+		// Longest response header the upstream may send.
+		enum { MAX_HEADER_SIZE = 65536 };
+		// Block of the spooled body sent at once.
+		enum { SEND_BLOCK_SIZE = 65536 };
+
+		// What is being received.
+		enum e_state
+		{
+			HEADER,		// Status line and header fields.
+			BODY_LENGTH,	// `_remaining` bytes of the body.
+			BODY_CLOSE,	// Body, until the upstream closes.
+			CHUNK_SIZE,	// Size line of the next chunk.
+			CHUNK_DATA,	// `_remaining` bytes of the chunk.
+			CHUNK_END,	// CRLF after the chunk.
+			TRAILER,	// Trailer fields, until an empty line.
+			DONE		// Response ended.
+		};
+
+		UpstreamAddress	_upstream;
+		// Pooled connection and its duplicates watched by epoll.
+		int		_conn_fd;
+		int		_write_fd;
+		int		_read_fd;
+		// SO_ERROR of a new connection was checked.
+		bool		_connected;
+		// Request head (then blocks of the body) to send
+		// and how much of it was sent.
+		std::string	_send;
+		size_t		_send_pos;
+		// Spooled body, read from `_input_offset` on.
+		int		_input_fd;
+		off_t		_input_offset;
+		// Everything was sent.
+		bool		_sent;
+		// Received bytes not parsed yet.
+		std::string	_recv;
+		enum e_state	_state;
+		uint64_t	_remaining;
+		// Upstream keeps the connection open after the response.
+		bool		_keep_alive;
+		// Connection broke, the response was malformed
+		// or the request was aborted.
+		bool		_failed;
+		// Connection was reused and nothing was received on it yet,
+		// so the request may be sent again (see `retry()`).
+		bool		_retry;
+		// What was queued to send first (the request head,
+		// or the whole request without a spooled body), kept
+		// while it may be sent again.
+		std::string	_request;
+		// Duplicates of a broken connection, left for the event loop
+		// to stop watching.
+		std::vector<int>	_stale_fds;
+		time_t		_timeout;
+		time_t		_deadline;
+		std::string	_output;
+
+		/**
+		 * Sends the queued part of the request, refilling it
+		 * from the spooled body as it goes.
+		 * @return	false, if everything was sent
+		 * 		(or the connection broke).
+		 */
+		bool		send_request();
+
+		/**
+		 * Reads and parses the next part of the response.
+		 * @return	false, if the response ended
+		 * 		(or the connection broke).
+		 */
+		bool		receive_response();
+
+		/**
+		 * Sends the request again on a new connection,
+		 * the reused one broke before the response started.
+		 * @return	false (the broken connection isn't read anymore).
+		 */
+		bool		retry();
+
+		/**
+		 * Parses the status line and header fields in `_recv`
+		 * up to \p end (the empty line), appending them
+		 * to the output as CGI header fields.
+		 * Interim (1xx) responses are skipped.
+		 * @return	false, if the header is malformed
+		 * 		(the request failed).
+		 */
+		bool		parse_header(size_t end);
+
+		/**
+		 * Moves body bytes from `_recv` to the output,
+		 * decoding chunks.
+		 * @return	false, if a chunk is malformed
+		 * 		(the request failed).
+		 */
+		bool		parse_body();
+
+		ProxyRequest(const ProxyRequest &other);
+		ProxyRequest &operator=(const ProxyRequest &other);
+};
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <string>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/**
+ * Directory (root, alias or upload path) opened once at startup,
+ * request paths are then resolved relative to it
+ * with openat2(RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS).
+ *
+ * The kernel refuses every path (including ".." and symlinks)
+ * escaping the directory with EXDEV,
+ * so we don't have to scan request paths for traversal ourselves,
+ * and there's no window between checking a path and opening it.
+ * @warning	Copies share the descriptor: only the owner
+ * 		(ServerConfig, see `ServerConfig::closeRootDirs()`)
+ * 		should call `close()`.
+ */
+class RootDir
+{
+	public:
+		RootDir();
+
+		/**
+		 * Opens \p path as the directory to resolve paths in.
+		 * @throw	std::runtime_error	Couldn't open \p path.
+		 * @param	path	Path to a directory.
+		 */
+		void			open(const std::string &path);
+
+		void			close();
+
+		bool			is_open() const;
+		const std::string	&get_path() const;
+
+		/**
+		 * Get the device and inode of the directory
+		 * (identify it no matter which path it was opened by).
+		 */
+		dev_t			get_dev() const;
+		ino_t			get_ino() const;
+
+		/**
+		 * openat() \p relative_path beneath the directory.
+		 * @param	relative_path	Path relative to the directory
+		 * 				(empty string is the directory itself).
+		 * @param	flags		open() flags (O_CLOEXEC is added).
+		 * @param	mode		Mode of the file, if it's created.
+		 * @return	New file descriptor;
+		 * 		-1 with errno set otherwise
+		 * 		(EXDEV, if \p relative_path escapes the directory).
+		 */
+		int			open_beneath(const std::string &relative_path,
+				int flags, mode_t mode = 0) const;
+
+		/**
+		 * stat() \p relative_path beneath the directory.
+		 * @param	relative_path	Path relative to the directory.
+		 * @param	sb		Where to save the result.
+		 * @return	0 on success; -1 with errno set otherwise.
+		 */
+		int			stat_beneath(const std::string &relative_path,
+				struct stat &sb) const;
+
+		/**
+		 * unlink() \p relative_path beneath the directory.
+		 * @param	relative_path	Path relative to the directory.
+		 * @return	0 on success; -1 with errno set otherwise.
+		 */
+		int			unlink_beneath(const std::string &relative_path) const;
+
+	private:
+		int			_fd;
+		std::string		_path;
+		dev_t			_dev;
+		ino_t			_ino;
+
+		// Set to false once openat2() turned out to be missing
+		// (Linux < 5.6), paths are checked by hand then.
+		static bool		_have_openat2;
+};
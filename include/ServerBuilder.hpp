@@ -22,11 +22,14 @@ private:
 	static void 		handle_root(const std::vector<std::string>& parameters, ServerConfig& server_cfg);
 	static void 		handle_index(const std::vector<std::string>& parameters, ServerConfig& server_cfg);
 	static void 		handle_host(const std::vector<std::string>& parameters, ServerConfig& server_cfg);
+	static void 		handle_server_name(const std::vector<std::string>& parameters, ServerConfig& server_cfg);
 	static void 		handle_mbs(const std::vector<std::string>& parameters, ServerConfig& server_cfg);
 	static void 		handle_autoindex(const std::vector<std::string>& parameters, ServerConfig& server_cfg);
 	static void 		handle_error_page(const std::vector<std::string>& parameters, ServerConfig& server_cfg);
 	static void 		handle_location(const std::vector<std::string>& parameters, ServerConfig& server_cfg);
 	static void		handle_large_client_header_buffers(const std::vector<std::string>& parameters, ServerConfig& server_cfg);
+	static void		handle_types(const std::vector<std::string>& parameters, ServerConfig& server_cfg);
+	static void		handle_redirect_map(const std::vector<std::string>& parameters, ServerConfig& server_cfg);
     	/**
     	 * @brief Retrieves the appropriate handler for a directive.
     	 * @param directive The directive string (e.g., "listen").
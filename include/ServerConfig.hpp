@@ -1,6 +1,10 @@
 #pragma once
 #include "Webserv.hpp"
 #include "Location.hpp"
+#include "MimeTypes.hpp"
+#include "RootDir.hpp"
+#include "LocationTrie.hpp"
+#include "EffectiveLocation.hpp"
 
 class Location;
 
@@ -18,7 +22,10 @@ private:
 	std::vector< std::pair<std::string, uint16_t> > _listen_endpoints; // host + port option
 	std::vector<uint16_t> 		_ports;			// Port number
 	std::vector<std::string>	_hosts;			// IP address (IPv4)
-	// std::vector<std::string>	_server_names;		// Server name / domain
+	std::vector<std::string>	_server_names;		// Server name / domain
+	// Endpoints this server is the default one for ("default_server").
+	// Host is empty for endpoints given by port only.
+	std::set< std::pair<std::string, uint16_t> > _default_endpoints;
 	std::string			_root;			// Root directory path
 	uint64_t			_client_max_body_size;	// Max client body size (bytes)
 	std::vector<std::string>	_index;			// Default index file
@@ -28,6 +35,26 @@ private:
 	std::vector<sockaddr_in>	_server_addresses;	// Full IPv4 socket address struct
 	std::vector<int>		_listen_fds;		// Socket file descriptor
 	std::pair<uint32_t, uint64_t> 	_large_client_header_buffers; // Large client header buffers (for ddos protection)
+	// Serialized error responses indexed by (status code - MIN_ERROR_STATUS_CODE).
+	// Empty string means the response wasn't prepared.
+	std::vector<std::string>	_error_responses;
+	// Filled from "types { }" blocks.
+	MimeTypes			_mime_types;
+	// Paths of `_locations`, see `compileLocations()`:
+	// exact ("location =") ones are hashed, prefixes go to the trie.
+	PerfectHash<size_t>		_exact_locations;
+	LocationTrie			_location_trie;
+	// Serialized redirect responses of "redirect_map" by request path,
+	// hashed by `compileRedirects()`.
+	std::map<std::string, std::string>	_redirect_responses;
+	PerfectHash<std::string>	_redirects;
+	// `_root` opened by `openRootDirs()`.
+	RootDir				_root_dir;
+	// Flattened `_locations` (same order) and the record for requests
+	// no location matched, see `compileEffectiveLocations()`.
+	// Not copied: they point into the config they were built from.
+	std::vector<EffectiveLocation>	_effective_locations;
+	EffectiveLocation		_effective_default;
 
 	// Internal helper for initializeSockets server
 	int createListeningSocket(const std::string& host, uint16_t port, sockaddr_in& out_addr);
@@ -44,7 +71,7 @@ public:
 	const std::vector<std::pair<std::string, uint16_t> >& getListenEndpoints() const;
 	const std::vector<uint16_t>& 	getPorts() const;
 	const std::vector<std::string>& getHosts() const;
-	// const std::vector<std::string>& getServerNames() const;
+	const std::vector<std::string>& getServerNames() const;
 	const std::string& 		getRoot() const;
 	uint64_t 			getClientMaxBodySize() const;
 	const std::vector<std::string>& getIndex() const;
@@ -64,8 +91,9 @@ public:
 	void 				addPort(uint16_t port);
 	void 				setHosts(const std::vector<std::string>& hosts);
 	void 				addHost(const std::string& host);
-	// void 				setServerNames(const std::vector<std::string>& names);
-	// void 				addServerName(const std::string& name);
+	void 				setServerNames(const std::vector<std::string>& names);
+	void 				addServerName(const std::string& name);
+	void 				addDefaultEndpoint(const std::pair<std::string, uint16_t>& endpoint);
 	void 				setRoot(const std::string& root);
 	void 				setClientMaxBodySize(uint64_t size);
 	void 				setIndex(const std::vector<std::string>& index);
@@ -80,22 +108,130 @@ public:
 	void 				setListenFds(const std::vector<int>& fds);
 	void 				addListenFd(int fd);
 	void 				setLargeClientHeaderBuffers(uint32_t count, uint64_t sizeInBytes);
+	void 				addMimeType(const std::string& type, const std::string& ext);
 
 	// helpers
 	bool 				alreadyAddedHost(const std::string& host) const;
 	void 				resetIndex(void);
 
 	/**
-	 * Determines which Location corresponds to \p request_path.
-	 * @throw	out_of_range	Location with such target
-	 * 				isn't defined.
+	 * Get every address this server listens on
+	 * (explicit endpoints and all host x port combinations).
+	 */
+	std::vector<std::pair<std::string, uint16_t> > getAllListenEndpoints(void) const;
+
+	/**
+	 * Check if "default_server" was given for \p endpoint.
+	 */
+	bool				isDefaultServer(const std::pair<std::string, uint16_t>& endpoint) const;
+
+	/**
+	 * Builds the lookup tables of `_locations` paths
+	 * used by `findLocation()`.
+	 * @warning	Call it again after `_locations` change.
+	 * @throw	std::runtime_error	Couldn't build the tables.
+	 */
+	void				compileLocations(void);
+
+	/**
+	 * Flattens every location (and the server itself)
+	 * into an EffectiveLocation used by `findLocation()`.
+	 * @warning	Call this after `openRootDirs()`
+	 * 		and `prepareErrorResponses()`, once the config
+	 * 		is in its final place (it isn't copied).
+	 * @throw	std::runtime_error	Couldn't build CGI lookup table.
+	 */
+	void				compileEffectiveLocations(void);
+
+	/**
+	 * Determines the settings \p request_path is handled with:
+	 * of the exact ("=") Location with that path, if any;
+	 * of the Location with the longest path that is a prefix of it otherwise.
+	 * @throw	std::runtime_error	`compileEffectiveLocations()`
+	 * 					wasn't called.
 	 * @param	request_path	Request path parsed in request header.
-	 * @return	Determined Location.
+	 * @return	Settings of the determined Location;
+	 * 		server's default ones, if no Location matched.
+	 */
+	const EffectiveLocation		*findLocation(const std::string &request_path) const;
+
+	/**
+	 * Serializes a redirect of requests to \p path.
+	 * @param	path		Exact request path.
+	 * @param	status_code	Redirect status code (3xx).
+	 * @param	url		Where to redirect to.
+	 * @return	false, if \p path already redirects somewhere.
+	 */
+	bool				addRedirect(const std::string &path, int status_code,
+						const std::string &url);
+
+	/**
+	 * Hashes redirects added with `addRedirect()` for `findRedirect()`.
+	 * @throw	std::runtime_error	Couldn't build the table.
+	 */
+	void				compileRedirects(void);
+
+	/**
+	 * Get the redirect response of \p request_path.
+	 * @return	Pointer to the serialized response;
+	 * 		NULL, if \p request_path isn't redirected.
 	 */
-	const Location			&determineLocation(const std::string &request_path) const;
+	const std::string		*findRedirect(const std::string &request_path) const;
 
 
-	void				initServerSocket(void);
+	/**
+	 * Renders every error response this server (and each of its locations)
+	 * may send into immutable buffers: configured error pages
+	 * are read from the disk once, default ones are generated.
+	 * @warning	Call this only after `initServerSocket()`,
+	 * 		since the default root is resolved there.
+	 */
+	void				prepareErrorResponses(void);
+
+	/**
+	 * Get the error response prepared by `prepareErrorResponses()`.
+	 * @param	status_code	Status code of the response.
+	 * @return	Pointer to the serialized response.
+	 * @return	NULL, if no response was prepared for \p status_code.
+	 */
+	const std::string		*getErrorResponse(int status_code) const;
+
+	/**
+	 * Compiles types added with `addMimeType()` into a lookup table.
+	 * @throw	std::runtime_error	Couldn't build the table.
+	 */
+	void				compileMimeTypes(void);
+
+	/**
+	 * Get the MIME type of the file in \p path
+	 * from the "types" blocks of this server
+	 * (or from the built-in table, if there were none).
+	 * @param	path	Path to a file.
+	 * @return	Appropriate MIME type for file in \p path.
+	 */
+	const std::string		&getMimeType(const std::string &path) const;
+
+	/**
+	 * Get the table of `getMimeType()`.
+	 */
+	const MimeTypes			&getMimeTypes() const;
+
+	/**
+	 * Opens the server's root and every location's root (or alias)
+	 * and upload path as directory descriptors
+	 * (see RootDir). They're closed in `cleanupSocket()`.
+	 * @warning	Call this only after `initServerSocket()`,
+	 * 		since the default root is resolved there.
+	 */
+	void				openRootDirs(void);
+
+	/**
+	 * Get the directory of `_root`.
+	 * @warning	May be not opened (see `RootDir::is_open()`).
+	 */
+	const RootDir			&getRootDir() const;
+
+	void				initServerSocket(std::map<std::pair<std::string, uint16_t>, int> &bound_fds);
 	void 				cleanupSocket(void);
 
 	public:
@@ -2,6 +2,9 @@
 #include "Webserv.hpp"
 #include "ServerConfig.hpp"
 #include "ClientConnection.hpp"
+#include "VirtualHosts.hpp"
+#include "CGIWorkerPool.hpp"
+#include "DiskCache.hpp"
 
 /**
  * @class ServerManager
@@ -14,14 +17,21 @@
  * - Cleaning up resources on shutdown.
  *
  * It supports handling multiple servers, each with potentially multiple listening sockets,
- * and maps each file descriptor to its associated server configuration.
+ * and maps each file descriptor to the servers sharing it (see VirtualHosts).
  */
 class ServerManager {
 private:
 	std::vector<ServerConfig> 	_servers;  		// Configurations for all servers.
 	int 				_epoll_fd;		// Epoll instance file descriptor.
-	std::map<int, ServerConfig*> 	_fd_to_server;  	// Map of socket FD to server config.
+	std::map<int, VirtualHosts> 	_fd_to_vhosts;  	// Map of socket FD to servers sharing it.
 	std::map<int, ClientConnection> _client_connections;	// Map of client FD to connection object.
+	std::map<int, int>		_cgi_fd_to_client;	// Map of CGI pipe / pidfd / FastCGI connection to client FD.
+	int				_next_refresh_id;	// Negative id of the next CGI cache refresh (see `startCgiCacheRefresh()`).
+	bool				_log_watched;		// Stderr is watched for EPOLLOUT (see `syncLogChannel()`).
+
+	// Milliseconds epoll_wait() may sleep while CGI scripts run,
+	// so their deadlines are checked in time.
+	static const int		_CGI_CHECK_INTERVAL = 1000;
 
 	/**
 	 * @brief Accepts and registers a new client connection for a server socket.
@@ -37,6 +47,60 @@ private:
         void 				handleClientEvent(int client_fd, uint32_t eventFlag);
 
 
+	/**
+	 * @brief Handles an event on a descriptor of a running CGI backend.
+	 * @param fd CGI descriptor (see `_cgi_fd_to_client`).
+	 */
+	void				handleCgiEvent(int fd);
+
+	/**
+	 * @brief Starts watching descriptors of the CGI backend launched
+	 * for \p client_fd; the client itself is only watched for hangups
+	 * until the response is ready.
+	 * @param client_fd File descriptor of the client.
+	 */
+	void				watchCgi(int client_fd);
+
+	/**
+	 * @brief Watches the descriptors the CGI backend of \p client_fd
+	 * lists now, and only them (its output may be paused).
+	 * @param client_fd File descriptor of the client.
+	 * @return false, if a descriptor couldn't be added.
+	 */
+	bool				syncCgiFds(int client_fd);
+
+	/**
+	 * @brief Stops watching descriptors of the CGI backend of \p client_fd.
+	 * @param client_fd File descriptor of the client.
+	 */
+	void				unwatchCgi(int client_fd);
+
+	/**
+	 * @brief Aborts CGI backends that ran out of time (see `HTTPResponse::check_cgi()`).
+	 */
+	void				checkCgiTimeouts();
+
+	/**
+	 * @brief Syncs (or stops) watching the CGI backend of \p client_fd,
+	 * runs its queued script, follows its local redirect and switches the client back
+	 * to reading and writing once its response is ready.
+	 * @param client_fd File descriptor of the client.
+	 */
+	void				updateCgi(int client_fd);
+
+	/**
+	 * @brief Writes lines queued in LogChannel (what CGI scripts
+	 * log to their stderr) while stderr is writable.
+	 */
+	void				syncLogChannel();
+
+	/**
+	 * @brief Runs the CGI script again in the background, if the response
+	 * of \p client_fd was served from a stale CGI cache entry.
+	 * @param client_fd File descriptor of the client.
+	 */
+	void				startCgiCacheRefresh(int client_fd);
+
 	/**
 	 * @brief Registers a file descriptor with the epoll instance.
 	 *
@@ -54,6 +118,15 @@ private:
 	 */
 	bool 				removeFdFromEpoll(int fd);
 
+	/**
+	 * @brief Changes events watched on a file descriptor.
+	 *
+	 * @param fd File descriptor to modify.
+	 * @param events New events to watch for.
+	 * @return true if successful, false otherwise.
+	 */
+	bool				modifyFdInEpoll(int fd, uint32_t events);
+
 	/**
 	 * @brief Closes a client connection, cleans up its socket, and removes it from epoll.
 	 * @param client_fd File descriptor of the client to close.
@@ -87,7 +160,8 @@ public:
 	/**
 	 * @brief Initializes server sockets and registers them with epoll.
 	 *
-	 * Also sets non-blocking mode and maps sockets to their ServerConfig.
+	 * Also sets non-blocking mode and maps sockets to the servers
+	 * listening on them (one socket per address, shared by name).
 	 * @throws std::runtime_error if epoll fails or no servers are valid.
 	 */
 	void 				initializeSockets();
@@ -0,0 +1,118 @@
+#pragma once
+
+#include "RootDir.hpp"
+#include "MimeTypes.hpp"
+#include <string>
+#include <map>
+#include <list>
+#include <utility>
+#include <ctime>
+#include <cstddef>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/**
+ * Short-lived cache of stat() results beneath root directories,
+ * including misses ("negative" entries for ENOENT and ENOTDIR).
+ *
+ * Request handling probes the same paths over and over:
+ * "try_files" chains, index files, the request target itself.
+ * With the cache a path is stat()'ed at most once per `_TTL`,
+ * no matter how many requests (or fallbacks of one request) look at it.
+ * The MIME type of a found file is kept with it as well
+ * (see `content_type()`).
+ * Entries are keyed by the directory's device and inode,
+ * so every RootDir opened on the same directory shares them.
+ * Misses are kept apart from the found paths, each in a table
+ * of its own size that drops its oldest entry when it's full:
+ * a flood of requests for paths that don't exist can't push out
+ * the ones that do. Hits and misses are counted
+ * in `stat_cache_lookups_total` (see Stats).
+ * @warning	Changes made by someone else than this server
+ * 		are seen after `_TTL` at most.
+ * 		Own changes must be reported with `invalidate()`.
+ */
+class StatCache
+{
+	public:
+		/**
+		 * stat() \p relative_path beneath \p dir,
+		 * or take the result from the cache.
+		 * @param	dir		Directory to look in.
+		 * @param	relative_path	Path relative to \p dir.
+		 * @param	sb		Where to save the result.
+		 * @return	0 on success; -1 with errno set otherwise
+		 * 		(see `RootDir::stat_beneath()`).
+		 */
+		static int	lookup(const RootDir &dir,
+				const std::string &relative_path, struct stat &sb);
+
+		/**
+		 * Get the MIME type of \p relative_path beneath \p dir,
+		 * looked up in \p types only once while the path is cached
+		 * (see `lookup()`).
+		 * @return	Type from \p types (see `MimeTypes::lookup()`).
+		 */
+		static const std::string	&content_type(const RootDir &dir,
+				const std::string &relative_path,
+				const MimeTypes &types);
+
+		/**
+		 * Drop the cached result of \p relative_path beneath \p dir.
+		 * Call it after the file was created, modified or removed.
+		 */
+		static void	invalidate(const RootDir &dir,
+				const std::string &relative_path);
+
+	private:
+		typedef std::pair<std::pair<dev_t, ino_t>, std::string>	Key;
+
+		struct Entry
+		{
+			int		error;	// 0, if the path exists.
+			struct stat	sb;
+			time_t		expires;
+			// Type of the file, once `content_type()` asked
+			// for it, and the table it's from.
+			const MimeTypes		*types;
+			const std::string	*type;
+			// Place in `Table::order`.
+			std::list<Key>::iterator	age;
+		};
+
+		// Entries of one kind, the oldest one is dropped
+		// for a new one once `max_entries` are kept.
+		struct Table
+		{
+			std::map<Key, Entry>	entries;
+			std::list<Key>		order;	// Oldest first.
+			size_t			max_entries;
+
+			Table(size_t max_entries);
+		};
+
+		// Seconds an entry stays valid.
+		static const time_t		_TTL = 1;
+		static const size_t		_MAX_FOUND = 4096;
+		static const size_t		_MAX_MISSING = 1024;
+		static Table			_found;
+		// ENOENT and ENOTDIR results.
+		static Table			_missing;
+
+		static Key	make_key(const RootDir &dir,
+				const std::string &relative_path);
+		/**
+		 * Get the entry of \p key in \p table, if it's still valid.
+		 * @return	NULL, if there is none.
+		 */
+		static Entry	*find(Table &table, const Key &key, time_t now);
+
+		/**
+		 * Saves \p entry as the newest one of \p table,
+		 * dropping the oldest one if the table is full.
+		 */
+		static Entry	&store(Table &table, const Key &key,
+				const Entry &entry);
+
+		static void	erase(Table &table, const Key &key);
+};
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <stdint.h>
+
+/**
+ * Counters, gauges and histograms of the server, rendered
+ * in the Prometheus text format by "stub_status" locations.
+ *
+ * A series is a metric name and its labels, already formatted
+ * (see `label()`), e.g. `location="/cgi-bin/"`; empty for none.
+ * Series are created the first time they're updated.
+ */
+class Stats
+{
+	public:
+		// What histogram values measure (their buckets differ).
+		enum e_unit
+		{
+			SECONDS,	// 1 ms to 10 s.
+			BYTES		// 1 MiB to 1 GiB.
+		};
+
+		/**
+		 * Adds \p value to a counter.
+		 */
+		static void		add(const std::string &name, const std::string &labels,
+						uint64_t value = 1);
+
+		/**
+		 * Sets a gauge to \p value.
+		 */
+		static void		set(const std::string &name, const std::string &labels,
+						uint64_t value);
+
+		/**
+		 * Counts \p value in a histogram, its sum is the total
+		 * (the unit of a histogram is the one it was created with).
+		 */
+		static void		observe(const std::string &name, const std::string &labels,
+						double value, enum e_unit unit = SECONDS);
+
+		/**
+		 * Get `name="value"`, with \p value escaped.
+		 */
+		static std::string	label(const std::string &name, const std::string &value);
+
+		/**
+		 * Get every series, grouped by metric.
+		 */
+		static std::string	render();
+
+	private:
+		struct Histogram
+		{
+			// Upper bounds of the buckets (the last one, +Inf,
+			// isn't listed) and observations up to each
+			// of them (not cumulative).
+			const double		*bounds;
+			size_t			bound_count;
+			std::vector<uint64_t>	buckets;
+			uint64_t		count;
+			double			sum;
+
+			Histogram(enum e_unit unit);
+		};
+
+		// Metric name -> labels -> value.
+		static std::map<std::string, std::map<std::string, uint64_t> >	_counters;
+		static std::map<std::string, std::map<std::string, uint64_t> >	_gauges;
+		static std::map<std::string, std::map<std::string, Histogram> >	_histograms;
+
+		static const double	SECONDS_BUCKETS[];
+		static const double	BYTES_BUCKETS[];
+
+		/**
+		 * Appends `name{labels} value` lines of \p series to \p out.
+		 */
+		static void		render_values(std::string &out, const std::string &type,
+						const std::map<std::string, std::map<std::string,
+						uint64_t> > &series);
+
+		Stats();
+};
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <cstddef>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+/**
+ * Address of an application server the requests are passed to.
+ */
+struct UpstreamAddress
+{
+	// As written in the config ("unix:/path" or "host:port"),
+	// identifies the upstream in the pool.
+	std::string		name;
+	struct sockaddr_storage	addr;
+	socklen_t		length;
+
+	UpstreamAddress();
+};
+
+/**
+ * Keep-alive connections to upstreams, shared by every request.
+ *
+ * Connections are non-blocking stream sockets. A request takes one
+ * with `acquire()` (an idle one, if there is any, or a new one)
+ * and gives it back with `release()` once the upstream is done with it,
+ * so the next request skips connect() (and, for TCP, the handshake).
+ * Idle connections aren't watched: one the upstream closed meanwhile
+ * is noticed and dropped by the next `acquire()`.
+ */
+class UpstreamPool
+{
+	public:
+		/**
+		 * Parses \p spec ("unix:/path/to.sock", "host:port",
+		 * where host is an IPv4 address or "localhost").
+		 * @param	spec	Address to parse.
+		 * @param	out	Where to save the address.
+		 * @return	true on success; false if \p spec is invalid.
+		 */
+		static bool	parse_address(const std::string &spec,
+				UpstreamAddress &out);
+
+		/**
+		 * Takes an idle connection to \p upstream or opens a new one.
+		 * A new connection may still be in progress:
+		 * wait for EPOLLOUT and check SO_ERROR before using it.
+		 * @param	upstream	Upstream to connect to.
+		 * @param	reused		Where to save whether an idle
+		 * 				connection was taken; NULL if not needed.
+		 * @return	Connected (or connecting) socket;
+		 * 		-1 with errno set, if socket() or connect() failed.
+		 */
+		static int	acquire(const UpstreamAddress &upstream,
+				bool *reused = NULL);
+
+		/**
+		 * Opens a new connection to \p upstream, like `acquire()`
+		 * does when there is no idle one; for a request to retry
+		 * on, once a reused connection turned out to be closed.
+		 * @param	upstream	Upstream to connect to.
+		 * @return	Connected (or connecting) socket;
+		 * 		-1 with errno set, if socket() or connect() failed.
+		 */
+		static int	connect_new(const UpstreamAddress &upstream);
+
+		/**
+		 * Gives \p fd back to be reused for \p upstream
+		 * (or closes it, if there are enough idle ones already).
+		 * @warning	Only release connections in a clean state:
+		 * 		nothing sent or received half-way.
+		 */
+		static void	release(const UpstreamAddress &upstream, int fd);
+
+	private:
+		// Maximum amount of idle connections kept per upstream.
+		static const size_t				_MAX_IDLE = 16;
+		// Upstream name -> idle connections, the most recent last.
+		static std::map<std::string, std::vector<int> >	_idle;
+};
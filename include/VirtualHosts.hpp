@@ -0,0 +1,83 @@
+#pragma once
+
+#include "PerfectHash.hpp"
+#include <string>
+#include <map>
+#include <netinet/in.h>
+
+class ServerConfig;
+
+/**
+ * Servers sharing one listening address,
+ * chosen per request by the "Host" header field ("server_name").
+ *
+ * Names are kept in three hash tables built once at startup:
+ * exact ones ("example.com"), leading wildcards ("*.example.com")
+ * and trailing wildcards ("www.example.*").
+ * As in nginx, an exact name wins over the longest leading wildcard,
+ * which wins over the longest trailing wildcard;
+ * anything else goes to the default server.
+ * A lookup costs one hash probe per dot in the host at most,
+ * no matter how many servers share the address.
+ */
+class VirtualHosts
+{
+	public:
+		VirtualHosts();
+
+		/**
+		 * Registers \p server on this address.
+		 * The first server added (or the first one with
+		 * "default_server" in its "listen") becomes the default one.
+		 * Names already taken by an earlier server are ignored.
+		 * @param	server		Server listening on this address.
+		 * @param	is_default	Server has "default_server"
+		 * 				for this address.
+		 */
+		void			add(ServerConfig *server, bool is_default);
+
+		/**
+		 * Builds the lookup tables of the servers added so far.
+		 * @throw	std::runtime_error	Couldn't build the tables.
+		 */
+		void			compile();
+
+		/**
+		 * Find the server that should handle requests for \p host.
+		 * @param	host	Value of the "Host" header field
+		 * 			(port and letter case are ignored).
+		 * @return	Matched server, or the default one.
+		 */
+		ServerConfig		*find(const std::string &host) const;
+
+		ServerConfig		*getDefault() const;
+
+		void			setAddress(const struct sockaddr_in &address);
+		const struct sockaddr_in	&getAddress() const;
+
+	private:
+		enum e_name_type
+		{
+			NAME_EXACT,
+			NAME_LEADING,	// "*.example.com", stored as ".example.com".
+			NAME_TRAILING	// "www.example.*", stored as "www.example.".
+		};
+
+		// Stripped names of every type, see `classify()`.
+		std::map<std::string, ServerConfig *>	_names[3];
+		ServerConfig				*_default;
+		bool					_default_is_explicit;
+		PerfectHash<ServerConfig *>		_exact;
+		PerfectHash<ServerConfig *>		_leading;
+		PerfectHash<ServerConfig *>		_trailing;
+		struct sockaddr_in			_address;
+
+		/**
+		 * Classify \p name and strip its wildcard.
+		 * @param	name	Server name (in lowercase).
+		 * @param	key	Where to store the stripped name.
+		 * @return	Type of \p name.
+		 */
+		static enum e_name_type	classify(const std::string &name,
+				std::string &key);
+};
@@ -34,6 +34,8 @@
 #define MAX_HEADER_CONTENT_LENGTH 40960 //5*8k
 #define DEFAULT_LARGE_CLIENT_HEADER_BUFFERS 4
 #define DEFAULT_LARGE_CLIENT_HEADER_BUFFER_SIZE 8096 //8k
+#define MIN_ERROR_STATUS_CODE 400
+#define MAX_ERROR_STATUS_CODE 599
 #define RESET   "\033[0m"
 #define RED     "\033[31m"
 #define GREEN   "\033[32m"
@@ -115,6 +117,22 @@ std::string read_file(const std::string &path);
  */
 void append_file(const std::string &path, const std::string &with_what);
 
+/**
+ * Read everything from \p fd.
+ * @throw	std::ios_base::failure	Got IO error.
+ * @param	fd	Opened file descriptor (isn't closed).
+ * @return	Read content.
+ */
+std::string read_fd(int fd);
+
+/**
+ * Write the whole \p data to \p fd.
+ * @throw	std::ios_base::failure	Got IO error.
+ * @param	fd	Opened file descriptor (isn't closed).
+ * @param	data	Content to write.
+ */
+void write_fd(int fd, const std::string &data);
+
 /**
  * Gets the extension in lowercase of \p path.
  * @param	path	Path to some file.
@@ -126,14 +144,6 @@ void append_file(const std::string &path, const std::string &with_what);
  */
 std::string get_file_ext(const std::string &path);
 
-/**
- * Gets the mime type depending on extension
- * of the file in \p path.
- * @param	path	Path to a file.
- * @return	Appropriate mime type for file in \p path.
- */
-std::string get_mime_type(const std::string &path);
-
 /**
  * Our implementation of inet_ntop() for AF_INET.
  * @param	src	Pointer to uint32_t from `struct sockaddr_in`.
@@ -148,9 +158,29 @@ const char * our_inet_ntop4(const void * src, char * dst, socklen_t size);
 // Errors.
 std::string getReasonPhrase(int status_code);
 std::string generateErrorPage(int status_code);
-std::string generateErrorHeader(int status_code, size_t content_length);
+std::string generateErrorHeader(int status_code, size_t content_length,
+		const std::string &content_type);
 std::string generateErrorBody(int status_code);
 
+/**
+ * Serializes a complete error response (start line, headers and \p body)
+ * with the same header set `HTTPResponse` emits for error responses.
+ * @param	status_code	Status code of the response.
+ * @param	body		Response body.
+ * @param	content_type	"Content-Type" header's value.
+ * @return	Response ready to be sent with send().
+ */
+std::string generateErrorResponse(int status_code, const std::string &body,
+		const std::string &content_type);
+
+/**
+ * Serializes a complete redirect response to \p location.
+ * @param	status_code	Status code of the response (3xx).
+ * @param	location	"Location" header's value.
+ * @return	Response ready to be sent with send().
+ */
+std::string generateRedirectResponse(int status_code, const std::string &location);
+
 // Debug.
 class ServerConfig;
 void printServerConfig(const ServerConfig& config);
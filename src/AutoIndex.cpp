@@ -0,0 +1,623 @@
+#include "AutoIndex.hpp"
+#include "Webserv.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <ios>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Layout of `struct linux_dirent64` (see getdents64(2)).
+// It ends with a flexible array member, which C++98 doesn't have,
+// so let's just parse the records ourselves.
+enum
+{
+	DIRENT64_RECLEN_OFFSET = 16,
+	DIRENT64_TYPE_OFFSET = 18,
+	DIRENT64_NAME_OFFSET = 19
+};
+
+const size_t AutoIndex::_RENDER_BATCH;
+const size_t AutoIndex::_READ_BATCH;
+const size_t AutoIndex::_SORT_BATCH;
+const size_t AutoIndex::_MAX_CACHED_DIRS;
+std::map<AutoIndex::CacheKey, AutoIndex::Listing> AutoIndex::_cache;
+std::list<AutoIndex::CacheKey> AutoIndex::_lru;
+
+AutoIndex::Options::Options()
+	: format(FORMAT_HTML),
+	  sort(SORT_NONE),
+	  details(false),
+	  page_size(1000)
+{
+}
+
+/**
+ * Escapes \p str to be safely put in HTML.
+ */
+static std::string html_escape(const std::string &str)
+{
+	std::string ret;
+
+	for (size_t i = 0; i < str.length(); i++)
+	{
+		switch (str[i])
+		{
+			case '&': ret += "&amp;"; break;
+			case '<': ret += "&lt;"; break;
+			case '>': ret += "&gt;"; break;
+			case '"': ret += "&quot;"; break;
+			default: ret.push_back(str[i]); break;
+		}
+	}
+	return ret;
+}
+
+/**
+ * Escapes \p str to be safely put in a JSON string.
+ */
+static std::string json_escape(const std::string &str)
+{
+	char buf[7];	// "\u001f" + '\0'.
+	std::string ret;
+
+	for (size_t i = 0; i < str.length(); i++)
+	{
+		if (str[i] == '"' || str[i] == '\\')
+		{
+			ret.push_back('\\');
+			ret.push_back(str[i]);
+		}
+		else if (static_cast<unsigned char> (str[i]) < 0x20)
+		{
+			(void) snprintf(buf, sizeof(buf), "\\u%04x",
+				static_cast<unsigned> (static_cast<unsigned char> (str[i])));
+			ret += buf;
+		}
+		else
+		{
+			ret.push_back(str[i]);
+		}
+	}
+	return ret;
+}
+
+/**
+ * Percent-encodes \p str to be used as a relative link.
+ */
+static std::string url_encode(const std::string &str)
+{
+	const char *HEX = "0123456789ABCDEF";
+	std::string ret;
+
+	for (size_t i = 0; i < str.length(); i++)
+	{
+		unsigned char c = static_cast<unsigned char> (str[i]);
+
+		if (std::isalnum(c) || std::strchr("-_.~", c) != NULL)
+		{
+			ret.push_back(static_cast<char> (c));
+		}
+		else
+		{
+			ret.push_back('%');
+			ret.push_back(HEX[c >> 4]);
+			ret.push_back(HEX[c & 0xF]);
+		}
+	}
+	return ret;
+}
+
+/**
+ * Formats \p t as an HTTP date (e.g. "Sun, 06 Nov 1994 08:49:37 GMT").
+ */
+static std::string format_mtime(time_t t)
+{
+	char buf[64];
+	struct tm tm;
+
+	if (gmtime_r(&t, &tm) == NULL
+		|| strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tm) == 0)
+	{
+		return "-";
+	}
+	return buf;
+}
+
+/**
+ * Get the value of "page" parameter in \p query.
+ * @return	Requested page, or 1 if it's missing or invalid.
+ */
+static size_t parse_page(const std::string &query)
+{
+	const std::string KEY = "page=";
+	size_t pos = 0;
+	unsigned long ret;
+	char *end;
+
+	while (pos < query.length())
+	{
+		if (query.compare(pos, KEY.length(), KEY) == 0)
+		{
+			errno = 0;
+			ret = std::strtoul(query.c_str() + pos + KEY.length(), &end, 10);
+			if (errno != 0 || ret == 0 || (*end != '\0' && *end != '&'))
+			{
+				return 1;
+			}
+			return static_cast<size_t> (ret);
+		}
+		pos = query.find('&', pos);
+		if (pos == std::string::npos)
+		{
+			break;
+		}
+		pos++;
+	}
+	return 1;
+}
+
+static bool compare_name(const AutoIndex::Entry &a, const AutoIndex::Entry &b)
+{
+	return a.name < b.name;
+}
+
+static bool compare_size(const AutoIndex::Entry &a, const AutoIndex::Entry &b)
+{
+	if (a.size != b.size)
+	{
+		return a.size > b.size;
+	}
+	return a.name < b.name;
+}
+
+static bool compare_mtime(const AutoIndex::Entry &a, const AutoIndex::Entry &b)
+{
+	if (a.mtime != b.mtime)
+	{
+		return a.mtime > b.mtime;
+	}
+	return a.name < b.name;
+}
+
+/**
+ * Moves \p entry to the end of \p out
+ * (the name is swapped, not copied).
+ */
+static void move_entry(std::vector<AutoIndex::Entry> &out,
+		AutoIndex::Entry &entry)
+{
+	out.push_back(AutoIndex::Entry());
+	out.back().name.swap(entry.name);
+	out.back().is_dir = entry.is_dir;
+	out.back().size = entry.size;
+	out.back().mtime = entry.mtime;
+}
+
+AutoIndex::AutoIndex(const RootDir &root,
+		const std::string &relative_path,
+		const struct stat &sb,
+		const std::string &request_path,
+		const std::string &query,
+		const Options &options)
+	: _options(options),
+	  _request_path(request_path),
+	  _page(parse_page(query)),
+	  _page_count(1),
+	  _next(0),
+	  _header_rendered(false),
+	  _footer_rendered(false),
+	  _state(STATE_READING),
+	  _key(root.get_path() + '/' + relative_path, options.sort),
+	  _dir_fd(-1),
+	  _need_stat(options.details
+		|| options.sort == SORT_SIZE || options.sort == SORT_MTIME),
+	  _compare(NULL),
+	  _run_index(0),
+	  _left(0),
+	  _right(0)
+{
+	struct stat opened;
+	std::map<CacheKey, Listing>::iterator it;
+
+	if (_options.page_size == 0)
+	{
+		_options.page_size = Options().page_size;
+	}
+	it = _cache.find(_key);
+	if (it != _cache.end()
+		&& it->second.dev == sb.st_dev && it->second.ino == sb.st_ino
+		&& it->second.mtime.tv_sec == sb.st_mtim.tv_sec
+		&& it->second.mtime.tv_nsec == sb.st_mtim.tv_nsec
+		&& (it->second.have_stat || !_need_stat))
+	{
+		// Same directory, same content.
+		_lru.splice(_lru.begin(), _lru, it->second.lru);
+		this->select_page(it->second);
+		_state = STATE_RENDERING;
+		return;
+	}
+	// Symlinks leading out of the root are refused by the kernel.
+	_dir_fd = root.open_beneath(relative_path, O_RDONLY | O_DIRECTORY);
+	if (_dir_fd == -1 || fstat(_dir_fd, &opened) == -1)
+	{
+		throw std::ios_base::failure(std::string("AutoIndex::AutoIndex(): ")
+				+ "Couldn't open the directory at: " + _key.first);
+	}
+	// What is read now: `sb` may be a second old (see StatCache).
+	_listing.dev = opened.st_dev;
+	_listing.ino = opened.st_ino;
+	_listing.mtime = opened.st_mtim;
+	_listing.have_stat = _need_stat;
+	_runs.push_back(0);
+	switch (_options.sort)
+	{
+		case SORT_NAME:
+			_compare = compare_name;
+			break;
+		case SORT_SIZE:
+			_compare = compare_size;
+			break;
+		case SORT_MTIME:
+			_compare = compare_mtime;
+			break;
+		case SORT_NONE:
+			break;
+	}
+}
+
+AutoIndex::~AutoIndex()
+{
+	if (_dir_fd != -1)
+	{
+		(void) close(_dir_fd);
+	}
+}
+
+bool AutoIndex::render_next(std::string &out)
+{
+	size_t last;
+
+	if (_footer_rendered)
+	{
+		return false;
+	}
+	else if (!_header_rendered)
+	{
+		render_header(out);
+		_header_rendered = true;
+		return true;
+	}
+	else if (_next >= _entries.size())
+	{
+		render_footer(out);
+		_footer_rendered = true;
+		return true;
+	}
+	last = std::min(_next + _RENDER_BATCH, _entries.size());
+	for (; _next < last; _next++)
+	{
+		render_entry(out, _entries[_next], _next == 0);
+	}
+	return true;
+}
+
+enum BodyProducer::e_produce_status AutoIndex::produce(std::string &out)
+{
+	int status;
+
+	if (_state == STATE_READING)
+	{
+		if ((status = this->read_next()) == -1)
+		{
+			return PRODUCE_ERROR;
+		}
+		else if (status == 0)
+		{
+			(void) close(_dir_fd);
+			_dir_fd = -1;
+			_state = STATE_SORTING;
+			_merged_runs.push_back(0);
+			_left = 0;
+			_right = (_runs.size() > 1) ? _runs[1] : 0;
+		}
+		// Nothing to send yet, the next call goes on.
+		return PRODUCE_MORE;
+	}
+	else if (_state == STATE_SORTING)
+	{
+		if (_compare == NULL || this->sort_next())
+		{
+			this->finish_listing();
+		}
+		return PRODUCE_MORE;
+	}
+	if (render_next(out))
+	{
+		return PRODUCE_MORE;
+	}
+	return PRODUCE_DONE;
+}
+
+const char *AutoIndex::get_content_type() const
+{
+	if (_options.format == FORMAT_JSON)
+	{
+		return "application/json";
+	}
+	return "text/html";
+}
+
+int AutoIndex::read_next()
+{
+	char buffer[_READ_BATCH];
+	std::vector<Entry> &entries = _listing.entries;
+	size_t first = entries.size();
+	unsigned short reclen;
+	long n;
+	struct stat sb;
+	Entry entry;
+
+	n = syscall(SYS_getdents64, _dir_fd, buffer, sizeof(buffer));
+	if (n == -1)
+	{
+		print_warning("AutoIndex::read_next(): Couldn't read the directory at: ",
+			_key.first, std::string(": ") + strerror(errno));
+		return -1;
+	}
+	else if (n == 0)
+	{
+		return 0;
+	}
+	for (long pos = 0; pos < n; pos += reclen)
+	{
+		const char *record = buffer + pos;
+		const char *name = record + DIRENT64_NAME_OFFSET;
+		unsigned char type = static_cast<unsigned char> (
+				record[DIRENT64_TYPE_OFFSET]);
+
+		(void) memcpy(&reclen, record + DIRENT64_RECLEN_OFFSET,
+			sizeof(reclen));
+		// Let's skip those, ok?
+		if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+		{
+			continue;
+		}
+		entry.name = name;
+		entry.is_dir = (type == DT_DIR);
+		entry.size = 0;
+		entry.mtime = 0;
+		if (_need_stat || type == DT_UNKNOWN)
+		{
+			if (fstatat(_dir_fd, name, &sb, 0) == 0)
+			{
+				entry.is_dir = S_ISDIR(sb.st_mode);
+				entry.size = sb.st_size;
+				entry.mtime = sb.st_mtim.tv_sec;
+			}
+		}
+		entries.push_back(entry);
+	}
+	// Every batch becomes a sorted run, `sort_next()` merges them.
+	if (_compare != NULL && entries.size() > first)
+	{
+		std::sort(entries.begin() + static_cast<std::ptrdiff_t> (first),
+			entries.end(), _compare);
+		_runs.push_back(entries.size());
+	}
+	return 1;
+}
+
+bool AutoIndex::sort_next()
+{
+	std::vector<Entry> &entries = _listing.entries;
+	size_t moved = 0;
+	size_t mid;
+	size_t end;
+
+	// Until there is one run left.
+	while (_runs.size() > 2 && moved < _SORT_BATCH)
+	{
+		mid = _runs[_run_index + 1];
+		// Odd run out is just moved.
+		end = (_run_index + 2 < _runs.size()) ? _runs[_run_index + 2] : mid;
+		for (; (_left < mid || _right < end) && moved < _SORT_BATCH; moved++)
+		{
+			// Taking the left one on ties keeps the sort stable.
+			if (_right == end || (_left < mid
+				&& !_compare(entries[_right], entries[_left])))
+			{
+				move_entry(_merged, entries[_left++]);
+			}
+			else
+			{
+				move_entry(_merged, entries[_right++]);
+			}
+		}
+		if (_left < mid || _right < end)
+		{
+			break;
+		}
+		_merged_runs.push_back(end);
+		_run_index += 2;
+		if (_run_index + 1 >= _runs.size())
+		{
+			// Pass is over, next one merges twice as long runs.
+			entries.swap(_merged);
+			_merged.clear();
+			_runs.swap(_merged_runs);
+			_merged_runs.assign(1, 0);
+			_run_index = 0;
+		}
+		_left = _runs[_run_index];
+		_right = _runs[_run_index + 1];
+	}
+	return _runs.size() <= 2;
+}
+
+void AutoIndex::select_page(const Listing &listing)
+{
+	size_t first;
+
+	if (listing.entries.size() > 0)
+	{
+		_page_count = (listing.entries.size() + _options.page_size - 1)
+			/ _options.page_size;
+	}
+	if (_page > _page_count)
+	{
+		_page = _page_count;
+	}
+	// Copying only the requested page,
+	// so the cached listing may be freely rebuilt.
+	first = (_page - 1) * _options.page_size;
+	if (first < listing.entries.size())
+	{
+		_entries.assign(listing.entries.begin()
+				+ static_cast<std::ptrdiff_t> (first),
+			listing.entries.begin() + static_cast<std::ptrdiff_t> (
+				std::min(first + _options.page_size,
+					listing.entries.size())));
+	}
+}
+
+void AutoIndex::finish_listing()
+{
+	std::map<CacheKey, Listing>::iterator it;
+
+	this->select_page(_listing);
+	_state = STATE_RENDERING;
+	_runs.clear();
+	_merged_runs.clear();
+	it = _cache.find(_key);
+	if (it == _cache.end())
+	{
+		if (_cache.size() >= _MAX_CACHED_DIRS)
+		{
+			_cache.erase(_lru.back());
+			_lru.pop_back();
+		}
+		_lru.push_front(_key);
+		_listing.lru = _lru.begin();
+		it = _cache.insert(std::make_pair(_key, Listing())).first;
+	}
+	else
+	{
+		// Someone else rebuilt it meanwhile, this one is as recent.
+		_lru.splice(_lru.begin(), _lru, it->second.lru);
+		_listing.lru = it->second.lru;
+	}
+	it->second.dev = _listing.dev;
+	it->second.ino = _listing.ino;
+	it->second.mtime = _listing.mtime;
+	it->second.have_stat = _listing.have_stat;
+	it->second.lru = _listing.lru;
+	it->second.entries.swap(_listing.entries);
+}
+
+void AutoIndex::render_header(std::string &out) const
+{
+	if (_options.format == FORMAT_JSON)
+	{
+		out += "{\"page\":" + to_string(_page)
+			+ ",\"pages\":" + to_string(_page_count)
+			+ ",\"entries\":[";
+		return;
+	}
+	out += "<html>\n";
+	out += "<head>\n";
+	out += "<title>Index of " + html_escape(_request_path) + "</title>\n";
+	out += "</head>\n";
+	out += "<body>\n";
+	out += "<h1>Index of " + html_escape(_request_path) + "</h1>\n";
+	if (_options.details)
+	{
+		out += "<pre>\n";
+	}
+}
+
+void AutoIndex::render_entry(std::string &out, const Entry &entry,
+		bool first) const
+{
+	std::string name = entry.is_dir ? entry.name + '/' : entry.name;
+
+	if (_options.format == FORMAT_JSON)
+	{
+		if (!first)
+		{
+			out.push_back(',');
+		}
+		out += "\n{\"name\":\"" + json_escape(entry.name) + "\",\"type\":\"";
+		out += entry.is_dir ? "directory\"" : "file\"";
+		if (_options.details)
+		{
+			out += ",\"mtime\":\"" + format_mtime(entry.mtime) + "\"";
+			if (!entry.is_dir)
+			{
+				out += ",\"size\":" + to_string(static_cast<size_t> (entry.size));
+			}
+		}
+		out.push_back('}');
+		return;
+	}
+	out += "<a href=\"" + url_encode(entry.name);
+	if (entry.is_dir)
+	{
+		out.push_back('/');
+	}
+	out += "\">" + html_escape(name) + "</a>";
+	if (_options.details)
+	{
+		// Padding names to keep columns aligned in <pre>.
+		if (name.length() < 50)
+		{
+			out.append(50 - name.length(), ' ');
+		}
+		out += " " + format_mtime(entry.mtime) + " ";
+		out += entry.is_dir ? "-" : to_string(static_cast<size_t> (entry.size));
+		out += "\n";
+	}
+	else
+	{
+		out += "<br />\n";
+	}
+}
+
+void AutoIndex::render_footer(std::string &out) const
+{
+	if (_options.format == FORMAT_JSON)
+	{
+		out += "\n]}\n";
+		return;
+	}
+	if (_options.details)
+	{
+		out += "</pre>\n";
+	}
+	if (_entries.empty())
+	{
+		out += "<b>No entries</b> in this directory.<br />\n";
+	}
+	if (_page_count > 1)
+	{
+		out += "<p>";
+		if (_page > 1)
+		{
+			out += "<a href=\"?page=" + to_string(_page - 1) + "\">Previous</a> ";
+		}
+		out += "Page " + to_string(_page) + " of " + to_string(_page_count);
+		if (_page < _page_count)
+		{
+			out += " <a href=\"?page=" + to_string(_page + 1) + "\">Next</a>";
+		}
+		out += "</p>\n";
+	}
+	out += "</body>\n";
+	out += "</html>\n";
+}
@@ -0,0 +1,33 @@
+#include "CGIBodyProducer.hpp"
+
+CGIBodyProducer::CGIBodyProducer(CGIBackend &backend)
+	: _backend(backend)
+{
+}
+
+enum BodyProducer::e_produce_status CGIBodyProducer::produce(std::string &out)
+{
+	std::string &output = _backend.get_output();
+	bool finished = _backend.is_finished();
+
+	if (finished && !_backend.succeeded())
+	{
+		return PRODUCE_ERROR;
+	}
+	else if (output.empty())
+	{
+		return finished ? PRODUCE_DONE : PRODUCE_AGAIN;
+	}
+	// Backend stops reading once `MAX_BUFFERED_OUTPUT` bytes
+	// are buffered, so it's taken whole.
+	if (out.empty())
+	{
+		out.swap(output);
+	}
+	else
+	{
+		out += output;
+	}
+	output.clear();
+	return finished ? PRODUCE_DONE : PRODUCE_MORE;
+}
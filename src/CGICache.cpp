@@ -0,0 +1,245 @@
+#include "CGICache.hpp"
+#include "CGICacheWait.hpp"
+#include "Webserv.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <strings.h>
+
+std::map<std::string, CGICache::Entry> CGICache::_entries;
+size_t CGICache::_size = 0;
+
+CGICache::Entry::Entry()
+	: fresh_until(0),
+	  stale_until(0),
+	  pass(false),
+	  filling(false)
+{
+}
+
+enum CGICache::e_lookup CGICache::lookup(const std::string &key, time_t now,
+		std::string &output)
+{
+	std::map<std::string, Entry>::iterator it = _entries.find(key);
+
+	if (it == _entries.end())
+	{
+		if (_entries.size() >= MAX_ENTRIES)
+		{
+			purge(now);
+		}
+		if (_entries.size() >= MAX_ENTRIES)
+		{
+			return LOOKUP_BYPASS;
+		}
+		it = _entries.insert(std::make_pair(key, Entry())).first;
+	}
+	Entry &entry = it->second;
+	if (entry.pass && now < entry.fresh_until)
+	{
+		return LOOKUP_BYPASS;
+	}
+	else if (!entry.output.empty() && now < entry.stale_until)
+	{
+		output = entry.output;
+		if (now < entry.fresh_until || entry.filling)
+		{
+			return LOOKUP_HIT;
+		}
+		entry.filling = true;
+		return LOOKUP_STALE;
+	}
+	else if (entry.filling)
+	{
+		return LOOKUP_WAIT;
+	}
+	_size -= entry.output.length();
+	std::string().swap(entry.output);
+	entry.pass = false;
+	entry.filling = true;
+	return LOOKUP_MISS;
+}
+
+void CGICache::store(const std::string &key, const std::string &output,
+		time_t now, time_t ttl, time_t stale)
+{
+	std::map<std::string, Entry>::iterator it = _entries.find(key);
+
+	if (it != _entries.end())
+	{
+		_size -= it->second.output.length();
+		std::string().swap(it->second.output);
+	}
+	if (_size + output.length() > MAX_SIZE)
+	{
+		purge(now);
+	}
+	if (_size + output.length() > MAX_SIZE)
+	{
+		print_warning("CGICache::store(): Cache is full, not storing ", key, "");
+		abandon(key);
+		return;
+	}
+	// Looked up again, purging may have dropped it.
+	Entry &entry = _entries[key];
+	entry.output = output;
+	_size += output.length();
+	entry.fresh_until = now + ttl;
+	entry.stale_until = entry.fresh_until + stale;
+	entry.pass = false;
+	entry.filling = false;
+	wake(entry, &entry.output);
+}
+
+void CGICache::pass(const std::string &key, time_t now, time_t ttl)
+{
+	Entry &entry = _entries[key];
+
+	_size -= entry.output.length();
+	std::string().swap(entry.output);
+	entry.fresh_until = now + ttl;
+	entry.stale_until = entry.fresh_until;
+	entry.pass = true;
+	entry.filling = false;
+	wake(entry, NULL);
+}
+
+void CGICache::abandon(const std::string &key)
+{
+	std::map<std::string, Entry>::iterator it = _entries.find(key);
+
+	if (it == _entries.end())
+	{
+		return;
+	}
+	it->second.filling = false;
+	wake(it->second, NULL);
+	if (it->second.output.empty() && !it->second.pass)
+	{
+		_entries.erase(it);
+	}
+}
+
+void CGICache::wait(const std::string &key, CGICacheWait *waiter)
+{
+	_entries[key].waiters.push_back(waiter);
+}
+
+void CGICache::cancel(const std::string &key, CGICacheWait *waiter)
+{
+	std::map<std::string, Entry>::iterator it = _entries.find(key);
+
+	if (it == _entries.end())
+	{
+		return;
+	}
+	std::vector<CGICacheWait *> &waiters = it->second.waiters;
+	waiters.erase(std::remove(waiters.begin(), waiters.end(), waiter), waiters.end());
+}
+
+void CGICache::wake(Entry &entry, const std::string *output)
+{
+	std::vector<CGICacheWait *> waiters;
+
+	// Waiters don't call back once they're handed something.
+	waiters.swap(entry.waiters);
+	for (size_t i = 0; i < waiters.size(); i++)
+	{
+		waiters[i]->deliver(output);
+	}
+}
+
+void CGICache::purge(time_t now)
+{
+	std::map<std::string, Entry>::iterator it = _entries.begin();
+
+	while (it != _entries.end())
+	{
+		const Entry &entry = it->second;
+
+		if (!entry.filling && entry.waiters.empty()
+			&& now >= entry.stale_until && now >= entry.fresh_until)
+		{
+			_size -= entry.output.length();
+			_entries.erase(it++);
+		}
+		else
+		{
+			++it;
+		}
+	}
+}
+
+/**
+ * Parses the number of seconds after '=' of directive \p directive.
+ * @return	false, if it isn't a number.
+ */
+static bool parse_seconds(const std::string &directive, time_t &out)
+{
+	std::string::size_type eq = directive.find('=');
+	std::string value;
+	char *end;
+	long seconds;
+
+	if (eq == std::string::npos)
+	{
+		return false;
+	}
+	value = trim(directive.substr(eq + 1));
+	if (!value.empty() && value.at(0) == '"' && value.length() > 1
+		&& value.at(value.length() - 1) == '"')
+	{
+		value = value.substr(1, value.length() - 2);
+	}
+	if (value.empty() || value.find_first_not_of("0123456789") != std::string::npos)
+	{
+		return false;
+	}
+	seconds = std::strtol(value.c_str(), &end, 10);
+	out = static_cast<time_t> (seconds);
+	return true;
+}
+
+bool CGICache::parse_cache_control(const std::string &value, time_t &ttl,
+		time_t &stale)
+{
+	std::string::size_type pos = 0;
+	std::string::size_type comma;
+	std::string directive;
+	bool shared_ttl = false;
+	time_t seconds;
+
+	while (pos <= value.length())
+	{
+		comma = value.find(',', pos);
+		if (comma == std::string::npos)
+		{
+			comma = value.length();
+		}
+		directive = trim(value.substr(pos, comma - pos));
+		pos = comma + 1;
+		if (strcasecmp(directive.c_str(), "no-store") == 0
+			|| strcasecmp(directive.c_str(), "no-cache") == 0
+			|| strcasecmp(directive.c_str(), "private") == 0)
+		{
+			return false;
+		}
+		else if (strncasecmp(directive.c_str(), "s-maxage=", 9) == 0
+			&& parse_seconds(directive, seconds))
+		{
+			// Meant for shared caches like this one, it wins.
+			ttl = seconds;
+			shared_ttl = true;
+		}
+		else if (strncasecmp(directive.c_str(), "max-age=", 8) == 0
+			&& !shared_ttl && parse_seconds(directive, seconds))
+		{
+			ttl = seconds;
+		}
+		else if (strncasecmp(directive.c_str(), "stale-while-revalidate=", 23) == 0
+			&& parse_seconds(directive, seconds))
+		{
+			stale = seconds;
+		}
+	}
+	return true;
+}
@@ -0,0 +1,125 @@
+#include "CGICacheWait.hpp"
+#include "CGICache.hpp"
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+CGICacheWait::CGICacheWait()
+	: _wake_fd(-1),
+	  _done(false),
+	  _delivered(false),
+	  _deadline(0)
+{
+}
+
+CGICacheWait::~CGICacheWait()
+{
+	this->abort();
+	this->close_fd(_wake_fd);
+}
+
+void CGICacheWait::start(const std::string &key, time_t timeout)
+{
+	if (!_key.empty())
+	{
+		throw std::runtime_error(std::string("CGICacheWait::start(): ")
+				+ "Already waiting.");
+	}
+	if ((_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1)
+	{
+		throw std::runtime_error(std::string("CGICacheWait::start(): ")
+				+ "eventfd() fail: " + strerror(errno));
+	}
+	_key = key;
+	_deadline = std::time(NULL) + timeout;
+	CGICache::wait(_key, this);
+}
+
+void CGICacheWait::deliver(const std::string *output)
+{
+	uint64_t one = 1;
+
+	if (output != NULL)
+	{
+		_output = *output;
+		_delivered = true;
+	}
+	_done = true;
+	if (_wake_fd != -1)
+	{
+		(void) write(_wake_fd, &one, sizeof(one));
+	}
+}
+
+bool CGICacheWait::should_retry() const
+{
+	return _done && !_delivered && !_key.empty();
+}
+
+void CGICacheWait::get_watched_fds(std::vector<Watch> &out) const
+{
+	if (_wake_fd != -1)
+	{
+		out.push_back(Watch(_wake_fd, EPOLLIN));
+	}
+}
+
+bool CGICacheWait::handle_event(int fd)
+{
+	uint64_t value;
+
+	if (fd == _wake_fd && _wake_fd != -1)
+	{
+		(void) read(_wake_fd, &value, sizeof(value));
+	}
+	return false;
+}
+
+void CGICacheWait::close_fd(int fd)
+{
+	if (fd == -1 || fd != _wake_fd)
+	{
+		return;
+	}
+	_wake_fd = -1;
+	(void) close(fd);
+}
+
+void CGICacheWait::poll()
+{
+}
+
+void CGICacheWait::abort()
+{
+	if (_done)
+	{
+		return;
+	}
+	CGICache::cancel(_key, this);
+	_key.clear();
+	_done = true;
+}
+
+bool CGICacheWait::is_finished() const
+{
+	return _done;
+}
+
+bool CGICacheWait::succeeded() const
+{
+	return _delivered;
+}
+
+bool CGICacheWait::is_expired(time_t now) const
+{
+	return !_done && now > _deadline;
+}
+
+std::string &CGICacheWait::get_output()
+{
+	return _output;
+}
@@ -0,0 +1,100 @@
+#include "CGILimiter.hpp"
+#include "CGISlotWait.hpp"
+#include "EffectiveLocation.hpp"
+#include "Stats.hpp"
+#include <algorithm>
+
+std::map<const EffectiveLocation *, CGILimiter::Limit> CGILimiter::_limits;
+
+CGILimiter::Limit::Limit()
+	: running(0)
+{
+}
+
+CGILimiter::Limit &CGILimiter::get(const EffectiveLocation *location)
+{
+	std::map<const EffectiveLocation *, Limit>::iterator it = _limits.find(location);
+
+	if (it == _limits.end())
+	{
+		it = _limits.insert(std::make_pair(location, Limit())).first;
+		it->second.labels = Stats::label("location", location->path);
+	}
+	return it->second;
+}
+
+void CGILimiter::update_stats(const Limit &limit)
+{
+	Stats::set("cgi_running", limit.labels, limit.running);
+	Stats::set("cgi_queue_depth", limit.labels, limit.queue.size());
+}
+
+bool CGILimiter::acquire(const EffectiveLocation *location)
+{
+	Limit &limit = get(location);
+
+	// Queued requests come first.
+	if (limit.running >= location->cgi_max_concurrent || !limit.queue.empty())
+	{
+		return false;
+	}
+	limit.running++;
+	Stats::observe("cgi_queue_wait_seconds", limit.labels, 0);
+	update_stats(limit);
+	return true;
+}
+
+bool CGILimiter::wait(const EffectiveLocation *location, CGISlotWait *waiter)
+{
+	Limit &limit = get(location);
+
+	if (limit.queue.size() >= location->cgi_queue_size)
+	{
+		Stats::add("cgi_rejected_total", limit.labels);
+		return false;
+	}
+	limit.queue.push_back(waiter);
+	update_stats(limit);
+	return true;
+}
+
+void CGILimiter::cancel(const EffectiveLocation *location, CGISlotWait *waiter,
+		bool expired)
+{
+	Limit &limit = get(location);
+	std::deque<CGISlotWait *>::iterator it
+		= std::find(limit.queue.begin(), limit.queue.end(), waiter);
+
+	if (it == limit.queue.end())
+	{
+		return;
+	}
+	limit.queue.erase(it);
+	if (expired)
+	{
+		Stats::add("cgi_queue_timeouts_total", limit.labels);
+	}
+	update_stats(limit);
+}
+
+void CGILimiter::release(const EffectiveLocation *location)
+{
+	Limit &limit = get(location);
+	CGISlotWait *waiter;
+
+	if (limit.queue.empty())
+	{
+		if (limit.running > 0)
+		{
+			limit.running--;
+		}
+		update_stats(limit);
+		return;
+	}
+	// Slot goes straight to the next request, still taken.
+	waiter = limit.queue.front();
+	limit.queue.pop_front();
+	Stats::observe("cgi_queue_wait_seconds", limit.labels, waiter->waited());
+	waiter->grant();
+	update_stats(limit);
+}
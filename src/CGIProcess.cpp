@@ -0,0 +1,818 @@
+#include "CGIProcess.hpp"
+#include "CGILimiter.hpp"
+#include "LogChannel.hpp"
+#include "Stats.hpp"
+#include "Webserv.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <csignal>
+#include <stdexcept>
+#include <unistd.h>
+#include <spawn.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+
+CGIProcess::Rlimits::Rlimits()
+	: cpu(0),
+	  as(0),
+	  nofile(0)
+{
+}
+
+CGIProcess::CGIProcess()
+	: _pid(-1),
+	  _pidfd(-1),
+	  _stdin_fd(-1),
+	  _stdout_fd(-1),
+	  _stderr_fd(-1),
+	  _input_pos(0),
+	  _input_fd(-1),
+	  _input_offset(0),
+	  _output_done(false),
+	  _exited(false),
+	  _wait_status(0),
+	  _deadline(0),
+	  _passthrough(false),
+	  _passthrough_ready(false),
+	  _slot(NULL)
+{
+	_started_at.tv_sec = 0;
+	_started_at.tv_nsec = 0;
+}
+
+CGIProcess::~CGIProcess()
+{
+	this->abort();
+	// Child that was never started.
+	this->release_slot();
+	this->close_fd(_stdin_fd);
+	this->close_fd(_stdout_fd);
+	this->drain_stderr();
+	this->close_fd(_stderr_fd);
+	this->close_fd(_pidfd);
+	if (_input_fd != -1)
+	{
+		(void) close(_input_fd);
+	}
+}
+
+/**
+ * Lowers \p resource to \p limit (unless it's 0), with \p extra more
+ * for the hard limit; unprivileged processes can't raise their hard limits,
+ * so neither goes above the current one.
+ */
+static void lowered_rlimit(int resource, rlim_t limit, rlim_t extra,
+		struct rlimit &out)
+{
+	out.rlim_cur = RLIM_INFINITY;
+	out.rlim_max = RLIM_INFINITY;
+	(void) getrlimit(resource, &out);
+	if (limit == 0)
+	{
+		return;
+	}
+	if (out.rlim_max == RLIM_INFINITY || limit + extra < out.rlim_max)
+	{
+		out.rlim_max = limit + extra;
+	}
+	out.rlim_cur = (limit < out.rlim_max) ? limit : out.rlim_max;
+}
+
+/**
+ * What the child of `clone_limited()` needs, prepared by the parent:
+ * the child runs on the parent's memory until it execve()'s.
+ */
+struct LimitedChild
+{
+	const char	*path;
+	char		**argv;
+	char		**envp;
+	// Its stdin, stdout and stderr (-1 for stderr leaves the server's).
+	int		fds[3];
+	struct rlimit	cpu;
+	struct rlimit	as;
+	struct rlimit	nofile;
+	// Parent's signal mask, restored right before execve().
+	sigset_t	mask;
+	// errno of what failed before execve(); 0 if nothing did.
+	int		error;
+};
+
+/**
+ * Child of `clone_limited()`: sets up its descriptors, signals and limits
+ * and execve()'s; on failure, reports errno and exits with 127.
+ */
+static int limited_child(void *arg)
+{
+	LimitedChild &child = *static_cast<LimitedChild *> (arg);
+	struct sigaction action;
+	int sig;
+	int fd;
+
+	// Handlers would run on the parent's memory: none is left once
+	// signals are unblocked. The server ignores SIGPIPE,
+	// the script shouldn't inherit that.
+	for (sig = 1; sig < NSIG; sig++)
+	{
+		if (sigaction(sig, NULL, &action) == 0 && (sig == SIGPIPE
+			|| (action.sa_handler != SIG_IGN && action.sa_handler != SIG_DFL)))
+		{
+			(void) sigemptyset(&action.sa_mask);
+			action.sa_flags = 0;
+			action.sa_handler = SIG_DFL;
+			(void) sigaction(sig, &action, NULL);
+		}
+	}
+	for (fd = STDIN_FILENO; fd <= STDERR_FILENO && child.error == 0; fd++)
+	{
+		if (child.fds[fd] == fd)
+		{
+			// Already in place, it only has to survive execve().
+			(void) fcntl(fd, F_SETFD, 0);
+		}
+		else if (child.fds[fd] != -1 && dup2(child.fds[fd], fd) == -1)
+		{
+			child.error = errno;
+		}
+	}
+	for (fd = STDIN_FILENO; fd <= STDERR_FILENO; fd++)
+	{
+		if (child.fds[fd] > STDERR_FILENO
+			&& (fd < 1 || child.fds[fd] != child.fds[0])
+			&& (fd < 2 || child.fds[fd] != child.fds[1]))
+		{
+			(void) close(child.fds[fd]);
+		}
+	}
+	if (child.error == 0 && (setrlimit(RLIMIT_CPU, &child.cpu) == -1
+		|| setrlimit(RLIMIT_AS, &child.as) == -1
+		|| setrlimit(RLIMIT_NOFILE, &child.nofile) == -1))
+	{
+		child.error = errno;
+	}
+	if (child.error == 0)
+	{
+		(void) sigprocmask(SIG_SETMASK, &child.mask, NULL);
+		(void) execve(child.path, child.argv, child.envp);
+		child.error = errno;
+	}
+	_exit(127);
+}
+
+/**
+ * Starts \p path like `CGIProcess::spawn()` does, with \p rlimits set
+ * in the child before it execve()'s. The child shares the parent's memory
+ * and the parent is suspended until the execve() (CLONE_VM | CLONE_VFORK),
+ * so it's as cheap as posix_spawn(), which has no way to set limits.
+ * @return	PID of the child; -1 with errno set, if it couldn't be started.
+ */
+static pid_t clone_limited(const std::string &path, char **argv, char **envp,
+		int stdin_fd, int stdout_fd, int stderr_fd,
+		const CGIProcess::Rlimits &rlimits)
+{
+	// Child's stack, only used until it execve()'s.
+	enum { STACK_SIZE = 65536 };
+	char stack[STACK_SIZE];
+	LimitedChild child;
+	sigset_t all;
+	pid_t pid;
+	int error;
+
+	child.path = path.c_str();
+	child.argv = argv;
+	child.envp = envp;
+	child.fds[STDIN_FILENO] = stdin_fd;
+	child.fds[STDOUT_FILENO] = stdout_fd;
+	child.fds[STDERR_FILENO] = stderr_fd;
+	// Scripts that handle SIGXCPU are killed a second later.
+	lowered_rlimit(RLIMIT_CPU, rlimits.cpu, 1, child.cpu);
+	lowered_rlimit(RLIMIT_AS, rlimits.as, 0, child.as);
+	lowered_rlimit(RLIMIT_NOFILE, rlimits.nofile, 0, child.nofile);
+	child.error = 0;
+	// No handler may run in the child before it resets them.
+	(void) sigfillset(&all);
+	(void) sigprocmask(SIG_SETMASK, &all, &child.mask);
+	pid = clone(limited_child, stack + STACK_SIZE, CLONE_VM | CLONE_VFORK | SIGCHLD,
+			&child);
+	error = errno;
+	(void) sigprocmask(SIG_SETMASK, &child.mask, NULL);
+	if (pid == -1)
+	{
+		errno = error;
+		return -1;
+	}
+	if (child.error != 0)
+	{
+		while (waitpid(pid, NULL, 0) == -1 && errno == EINTR)
+			;
+		errno = child.error;
+		return -1;
+	}
+	return pid;
+}
+
+pid_t CGIProcess::spawn(const std::string &path, char **argv, char **envp,
+		int stdin_fd, int stdout_fd, int stderr_fd, const Rlimits *rlimits)
+{
+	posix_spawn_file_actions_t actions;
+	posix_spawnattr_t attr;
+	sigset_t default_signals;
+	short flags = POSIX_SPAWN_SETSIGDEF;
+	pid_t pid = -1;
+	int error;
+
+	if (rlimits != NULL && (rlimits->cpu != 0 || rlimits->as != 0 || rlimits->nofile != 0))
+	{
+		return clone_limited(path, argv, envp, stdin_fd, stdout_fd, stderr_fd, *rlimits);
+	}
+	if ((error = posix_spawn_file_actions_init(&actions)) != 0)
+	{
+		errno = error;
+		return -1;
+	}
+	if ((error = posix_spawnattr_init(&attr)) != 0)
+	{
+		(void) posix_spawn_file_actions_destroy(&actions);
+		errno = error;
+		return -1;
+	}
+#ifdef POSIX_SPAWN_USEVFORK
+	// Parent's memory isn't copied, so spawning doesn't get slower
+	// as the server grows (glibc does that anyway since 2.24).
+	flags |= POSIX_SPAWN_USEVFORK;
+#endif
+	// The server ignores SIGPIPE, the script shouldn't inherit that.
+	(void) sigemptyset(&default_signals);
+	(void) sigaddset(&default_signals, SIGPIPE);
+	if ((error = posix_spawn_file_actions_adddup2(&actions, stdin_fd, STDIN_FILENO)) == 0
+		&& (error = posix_spawn_file_actions_adddup2(&actions, stdout_fd, STDOUT_FILENO)) == 0
+		&& (stdin_fd <= STDERR_FILENO
+			|| (error = posix_spawn_file_actions_addclose(&actions, stdin_fd)) == 0)
+		&& (stdout_fd <= STDERR_FILENO || stdout_fd == stdin_fd
+			|| (error = posix_spawn_file_actions_addclose(&actions, stdout_fd)) == 0)
+		&& (stderr_fd == -1
+			|| (error = posix_spawn_file_actions_adddup2(&actions, stderr_fd, STDERR_FILENO)) == 0)
+		&& (stderr_fd <= STDERR_FILENO || stderr_fd == stdin_fd || stderr_fd == stdout_fd
+			|| (error = posix_spawn_file_actions_addclose(&actions, stderr_fd)) == 0)
+		&& (error = posix_spawnattr_setsigdefault(&attr, &default_signals)) == 0
+		&& (error = posix_spawnattr_setflags(&attr, flags)) == 0)
+	{
+		// execve() failure is reported here too.
+		error = posix_spawn(&pid, path.c_str(), &actions, &attr, argv, envp);
+	}
+	(void) posix_spawnattr_destroy(&attr);
+	(void) posix_spawn_file_actions_destroy(&actions);
+	if (error != 0)
+	{
+		errno = error;
+		return -1;
+	}
+	return pid;
+}
+
+/**
+ * Makes \p fd non-blocking and close-on-exec.
+ * @return	0 on success; -1 otherwise.
+ */
+static int set_parent_end_flags(int fd)
+{
+	if (fcntl(fd, F_SETFL, O_NONBLOCK) == -1
+		|| fcntl(fd, F_SETFD, FD_CLOEXEC) == -1)
+	{
+		return -1;
+	}
+	return 0;
+}
+
+void CGIProcess::start(const std::string &path, char **argv, char **envp,
+		const std::string &input, int input_fd, time_t timeout)
+{
+	int in[2];
+	int out[2];
+	int err[2];
+
+	if (_pid != -1 || _exited)
+	{
+		throw std::runtime_error(std::string("CGIProcess::start(): ")
+				+ "Process was already started.");
+	}
+	if (pipe(in) == -1)
+	{
+		throw std::runtime_error(std::string("CGIProcess::start(): ")
+				+ "pipe() fail: " + strerror(errno));
+	}
+	if (pipe(out) == -1)
+	{
+		(void) close(in[0]);
+		(void) close(in[1]);
+		throw std::runtime_error(std::string("CGIProcess::start(): ")
+				+ "pipe() fail: " + strerror(errno));
+	}
+	if (pipe(err) == -1)
+	{
+		(void) close(in[0]);
+		(void) close(in[1]);
+		(void) close(out[0]);
+		(void) close(out[1]);
+		throw std::runtime_error(std::string("CGIProcess::start(): ")
+				+ "pipe() fail: " + strerror(errno));
+	}
+	// Parent's ends must neither block the event loop
+	// nor leak into other CGI children.
+	if (set_parent_end_flags(in[1]) == -1 || set_parent_end_flags(out[0]) == -1
+		|| set_parent_end_flags(err[0]) == -1
+		|| (input_fd != -1 && (_input_fd = dup(input_fd)) == -1))
+	{
+		(void) close(in[0]);
+		(void) close(in[1]);
+		(void) close(out[0]);
+		(void) close(out[1]);
+		(void) close(err[0]);
+		(void) close(err[1]);
+		throw std::runtime_error(std::string("CGIProcess::start(): ")
+				+ "fcntl() or dup() fail: " + strerror(errno));
+	}
+	if (_input_fd != -1)
+	{
+		(void) fcntl(_input_fd, F_SETFD, FD_CLOEXEC);
+	}
+	if ((_pid = spawn(path, argv, envp, in[0], out[1], err[1], &_rlimits)) == -1)
+	{
+		(void) close(in[0]);
+		(void) close(in[1]);
+		(void) close(out[0]);
+		(void) close(out[1]);
+		(void) close(err[0]);
+		(void) close(err[1]);
+		throw std::runtime_error(std::string("CGIProcess::start(): ")
+				+ "spawn() fail: " + strerror(errno));
+	}
+	(void) clock_gettime(CLOCK_MONOTONIC, &_started_at);
+	(void) close(in[0]);
+	(void) close(out[1]);
+	(void) close(err[1]);
+	_stdin_fd = in[1];
+	_stdout_fd = out[0];
+	_stderr_fd = err[0];
+	if (_input_fd == -1)
+	{
+		_input = input;
+	}
+	if (_input_fd == -1 && _input.empty())
+	{
+		// Nothing to feed: the child gets EOF right away.
+		this->close_fd(_stdin_fd);
+	}
+	_deadline = std::time(NULL) + timeout;
+#ifdef SYS_pidfd_open
+	_pidfd = static_cast<int> (syscall(SYS_pidfd_open, _pid, 0));
+#endif
+	if (_pidfd == -1)
+	{
+		print_warning("CGIProcess::start(): pidfd_open() isn't available, ",
+			"polling for exit of the child", "");
+	}
+}
+
+void CGIProcess::set_rlimits(const Rlimits &rlimits)
+{
+	_rlimits = rlimits;
+}
+
+void CGIProcess::set_script(const std::string &script, size_t request_id)
+{
+	_stats_labels = Stats::label("script", script);
+	_log_source = "CGI " + script;
+	_log_tag = _log_source + " #" + to_string(request_id) + ": ";
+}
+
+/**
+ * Get the seconds in \p tv.
+ */
+static double to_seconds(const struct timeval &tv)
+{
+	return static_cast<double> (tv.tv_sec) + static_cast<double> (tv.tv_usec) / 1e6;
+}
+
+void CGIProcess::record_usage(const struct rusage &usage) const
+{
+	struct timespec now;
+
+	if (_stats_labels.empty())
+	{
+		return;
+	}
+	(void) clock_gettime(CLOCK_MONOTONIC, &now);
+	Stats::observe("cgi_cpu_user_seconds", _stats_labels, to_seconds(usage.ru_utime));
+	Stats::observe("cgi_cpu_system_seconds", _stats_labels, to_seconds(usage.ru_stime));
+	Stats::observe("cgi_wall_seconds", _stats_labels,
+		static_cast<double> (now.tv_sec - _started_at.tv_sec)
+		+ static_cast<double> (now.tv_nsec - _started_at.tv_nsec) / 1e9);
+	// Kilobytes on Linux.
+	Stats::observe("cgi_max_rss_bytes", _stats_labels,
+		static_cast<double> (usage.ru_maxrss) * 1024, Stats::BYTES);
+	if (_wait_status != -1 && WIFSIGNALED(_wait_status))
+	{
+		Stats::add("cgi_signaled_total", _stats_labels + ","
+			+ Stats::label("signal", to_string(WTERMSIG(_wait_status))));
+	}
+}
+
+void CGIProcess::get_watched_fds(std::vector<Watch> &out) const
+{
+	if (_stdin_fd != -1)
+	{
+		out.push_back(Watch(_stdin_fd, EPOLLOUT));
+	}
+	if (_stdout_fd != -1 && !_output_done && (_passthrough
+		? !_passthrough_ready : _output.length() < MAX_BUFFERED_OUTPUT))
+	{
+		out.push_back(Watch(_stdout_fd, EPOLLIN));
+	}
+	if (_stderr_fd != -1)
+	{
+		out.push_back(Watch(_stderr_fd, EPOLLIN));
+	}
+	if (_pidfd != -1)
+	{
+		out.push_back(Watch(_pidfd, EPOLLIN));
+	}
+}
+
+bool CGIProcess::handle_event(int fd)
+{
+	// Output is read in parts, so one busy script
+	// doesn't hold the event loop.
+	enum { BUFFER_SIZE = 65536 };
+	char buffer[BUFFER_SIZE];
+	ssize_t n;
+
+	if (fd == _stdin_fd && _stdin_fd != -1)
+	{
+		return this->feed_input();
+	}
+	else if (fd == _stdout_fd && !_output_done && _passthrough)
+	{
+		// Caller splices it; the pipe is left alone until it's drained.
+		_passthrough_ready = true;
+		return true;
+	}
+	else if (fd == _stdout_fd && !_output_done)
+	{
+		n = read(_stdout_fd, buffer, BUFFER_SIZE);
+		if (n > 0)
+		{
+			_output.append(buffer, static_cast<size_t> (n));
+			return true;
+		}
+		else if (n == -1 && (errno == EAGAIN || errno == EINTR))
+		{
+			return true;
+		}
+		else if (n == -1)
+		{
+			print_warning("CGIProcess::handle_event(): read() fail: ",
+				strerror(errno), "");
+		}
+		_output_done = true;
+		if (_pidfd == -1)
+		{
+			(void) try_reap();
+		}
+		return false;
+	}
+	else if (fd == _stderr_fd && _stderr_fd != -1)
+	{
+		return this->read_stderr();
+	}
+	else if (fd == _pidfd && _pidfd != -1)
+	{
+		return !try_reap();
+	}
+	return false;
+}
+
+bool CGIProcess::read_stderr()
+{
+	// Lines of a script are logged at a limited rate anyway,
+	// so a chatty one gets only this much read per event.
+	enum { BUFFER_SIZE = 4096 };
+	char buffer[BUFFER_SIZE];
+	ssize_t n;
+	size_t start = 0;
+	size_t end;
+
+	n = read(_stderr_fd, buffer, BUFFER_SIZE);
+	if (n == -1 && (errno == EAGAIN || errno == EINTR))
+	{
+		return true;
+	}
+	else if (n <= 0)
+	{
+		// Last line may lack its '\n'.
+		if (!_stderr_line.empty())
+		{
+			this->log_stderr(_stderr_line);
+			_stderr_line.clear();
+		}
+		return false;
+	}
+	_stderr_line.append(buffer, static_cast<size_t> (n));
+	while ((end = _stderr_line.find('\n', start)) != std::string::npos)
+	{
+		this->log_stderr(_stderr_line.substr(start, end - start));
+		start = end + 1;
+	}
+	_stderr_line.erase(0, start);
+	if (_stderr_line.length() >= MAX_STDERR_LINE)
+	{
+		this->log_stderr(_stderr_line);
+		_stderr_line.clear();
+	}
+	return true;
+}
+
+void CGIProcess::drain_stderr()
+{
+	int available = 0;
+
+	// Bounded by the size of the pipe: the child can't refill it
+	// anymore, unless it left something running.
+	while (_stderr_fd != -1 && ioctl(_stderr_fd, FIONREAD, &available) == 0
+		&& available > 0 && this->read_stderr())
+		;
+	if (!_stderr_line.empty())
+	{
+		this->log_stderr(_stderr_line);
+		_stderr_line.clear();
+	}
+}
+
+void CGIProcess::log_stderr(const std::string &line) const
+{
+	size_t length = std::min(line.length(), static_cast<size_t> (MAX_STDERR_LINE));
+
+	if (length != 0 && line[length - 1] == '\r')
+	{
+		length--;
+	}
+	if (length == 0)
+	{
+		return;
+	}
+	else if (_log_source.empty())
+	{
+		LogChannel::write("CGI", "CGI: " + line.substr(0, length));
+		return;
+	}
+	LogChannel::write(_log_source, _log_tag + line.substr(0, length));
+}
+
+bool CGIProcess::feed_input()
+{
+	// Block of the spooled input held in memory at once.
+	enum { BUFFER_SIZE = 65536 };
+	char buffer[BUFFER_SIZE];
+	ssize_t n;
+
+	if (_input_pos == _input.length())
+	{
+		_input.clear();
+		_input_pos = 0;
+		if (_input_fd == -1)
+		{
+			return false;
+		}
+		n = pread(_input_fd, buffer, BUFFER_SIZE, _input_offset);
+		if (n == -1 && errno == EINTR)
+		{
+			return true;
+		}
+		else if (n <= 0)
+		{
+			if (n == -1)
+			{
+				print_warning("CGIProcess::feed_input(): pread() fail: ",
+					strerror(errno), "");
+			}
+			return false;
+		}
+		_input.assign(buffer, static_cast<size_t> (n));
+		_input_offset += n;
+	}
+	n = write(_stdin_fd, _input.c_str() + _input_pos, _input.length() - _input_pos);
+	if (n == -1 && (errno == EAGAIN || errno == EINTR))
+	{
+		return true;
+	}
+	else if (n == -1)
+	{
+		// EPIPE: the script exited (or closed its stdin)
+		// without reading everything, that's up to it.
+		print_log("CGIProcess::feed_input(): Input isn't read anymore: ",
+			strerror(errno), "");
+		return false;
+	}
+	_input_pos += static_cast<size_t> (n);
+	return true;
+}
+
+bool CGIProcess::start_passthrough()
+{
+	if (_stdout_fd == -1 || _output_done)
+	{
+		return false;
+	}
+#ifdef F_SETPIPE_SZ
+	// Not growing it only costs more wakeups.
+	(void) fcntl(_stdout_fd, F_SETPIPE_SZ, PASSTHROUGH_PIPE_SIZE);
+#endif
+	_passthrough = true;
+	// There may be unread data already.
+	_passthrough_ready = true;
+	return true;
+}
+
+int CGIProcess::get_passthrough_fd() const
+{
+	return _stdout_fd;
+}
+
+size_t CGIProcess::passthrough_available()
+{
+	int available = 0;
+	struct pollfd pfd;
+
+	if (!_passthrough || _output_done)
+	{
+		return 0;
+	}
+	// Hangup is checked first: whatever the child wrote
+	// before closing its end is counted below.
+	pfd.fd = _stdout_fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	(void) ::poll(&pfd, 1, 0);
+	if (ioctl(_stdout_fd, FIONREAD, &available) == -1)
+	{
+		print_warning("CGIProcess::passthrough_available(): ioctl() fail: ",
+			strerror(errno), "");
+		available = 0;
+		pfd.revents = POLLERR;
+	}
+	if (available > 0)
+	{
+		return static_cast<size_t> (available);
+	}
+	else if ((pfd.revents & (POLLHUP | POLLERR)) != 0)
+	{
+		_output_done = true;
+		if (_pidfd == -1)
+		{
+			(void) try_reap();
+		}
+		return 0;
+	}
+	_passthrough_ready = false;
+	return 0;
+}
+
+void CGIProcess::close_fd(int fd)
+{
+	if (fd == -1)
+	{
+		return;
+	}
+	else if (fd == _stdin_fd)
+	{
+		_stdin_fd = -1;
+		// Input isn't needed anymore.
+		std::string().swap(_input);
+		_input_pos = 0;
+	}
+	else if (fd == _stdout_fd)
+	{
+		_stdout_fd = -1;
+	}
+	else if (fd == _stderr_fd)
+	{
+		_stderr_fd = -1;
+	}
+	else if (fd == _pidfd)
+	{
+		_pidfd = -1;
+	}
+	else
+	{
+		return;
+	}
+	(void) close(fd);
+}
+
+void CGIProcess::poll()
+{
+	if (_pidfd == -1)
+	{
+		(void) try_reap();
+	}
+}
+
+bool CGIProcess::try_reap()
+{
+	struct rusage usage;
+	pid_t ret;
+
+	if (_pid == -1)
+	{
+		return _exited;
+	}
+	ret = wait4(_pid, &_wait_status, WNOHANG, &usage);
+	if (ret == 0 || (ret == -1 && errno == EINTR))
+	{
+		return false;
+	}
+	else if (ret == -1)
+	{
+		print_warning("CGIProcess::try_reap(): wait4() fail: ",
+			strerror(errno), "");
+		// Nothing to wait for anymore, treating it as failure.
+		_wait_status = -1;
+	}
+	else
+	{
+		this->record_usage(usage);
+	}
+	_pid = -1;
+	_exited = true;
+	this->release_slot();
+	return true;
+}
+
+void CGIProcess::abort()
+{
+	struct rusage usage;
+	pid_t ret;
+
+	if (_pid == -1)
+	{
+		return;
+	}
+	// SIGKILL is better than SIGTERM,
+	// since it may kill the process
+	// if it's frozen and doesn't respond to SIGTERM.
+	(void) ::kill(_pid, SIGKILL);
+	while ((ret = wait4(_pid, &_wait_status, 0, &usage)) == -1 && errno == EINTR)
+		;
+	if (ret == _pid)
+	{
+		this->record_usage(usage);
+	}
+	_pid = -1;
+	_exited = true;
+	_output_done = true;
+	this->release_slot();
+}
+
+void CGIProcess::hold_slot(const EffectiveLocation *location)
+{
+	_slot = location;
+}
+
+void CGIProcess::release_slot()
+{
+	if (_slot == NULL)
+	{
+		return;
+	}
+	CGILimiter::release(_slot);
+	_slot = NULL;
+}
+
+bool CGIProcess::is_finished() const
+{
+	return _output_done && _exited;
+}
+
+bool CGIProcess::succeeded() const
+{
+	return _exited && _wait_status != -1
+		&& WIFEXITED(_wait_status) && WEXITSTATUS(_wait_status) == 0;
+}
+
+bool CGIProcess::is_expired(time_t now) const
+{
+	return !is_finished() && now > _deadline;
+}
+
+std::string &CGIProcess::get_output()
+{
+	return _output;
+}
@@ -0,0 +1,149 @@
+#include "CGISlotWait.hpp"
+#include "CGILimiter.hpp"
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+CGISlotWait::CGISlotWait()
+	: _location(NULL),
+	  _wake_fd(-1),
+	  _done(false),
+	  _granted(false),
+	  _taken(false),
+	  _deadline(0)
+{
+	_queued_at.tv_sec = 0;
+	_queued_at.tv_nsec = 0;
+}
+
+CGISlotWait::~CGISlotWait()
+{
+	this->abort();
+	if (_granted && !_taken)
+	{
+		// Handed over, but the request went away meanwhile.
+		CGILimiter::release(_location);
+	}
+	this->close_fd(_wake_fd);
+}
+
+bool CGISlotWait::start(const EffectiveLocation *location, time_t timeout)
+{
+	if (_location != NULL)
+	{
+		throw std::runtime_error(std::string("CGISlotWait::start(): ")
+				+ "Already waiting.");
+	}
+	if ((_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1)
+	{
+		throw std::runtime_error(std::string("CGISlotWait::start(): ")
+				+ "eventfd() fail: " + strerror(errno));
+	}
+	(void) clock_gettime(CLOCK_MONOTONIC, &_queued_at);
+	_deadline = std::time(NULL) + timeout;
+	if (!CGILimiter::wait(location, this))
+	{
+		_done = true;
+		return false;
+	}
+	_location = location;
+	return true;
+}
+
+void CGISlotWait::grant()
+{
+	uint64_t one = 1;
+
+	_granted = true;
+	_done = true;
+	if (_wake_fd != -1)
+	{
+		(void) write(_wake_fd, &one, sizeof(one));
+	}
+}
+
+double CGISlotWait::waited() const
+{
+	struct timespec now;
+
+	(void) clock_gettime(CLOCK_MONOTONIC, &now);
+	return static_cast<double> (now.tv_sec - _queued_at.tv_sec)
+		+ static_cast<double> (now.tv_nsec - _queued_at.tv_nsec) / 1e9;
+}
+
+bool CGISlotWait::take_slot()
+{
+	if (!_granted || _taken)
+	{
+		return false;
+	}
+	_taken = true;
+	return true;
+}
+
+void CGISlotWait::get_watched_fds(std::vector<Watch> &out) const
+{
+	if (_wake_fd != -1)
+	{
+		out.push_back(Watch(_wake_fd, EPOLLIN));
+	}
+}
+
+bool CGISlotWait::handle_event(int fd)
+{
+	uint64_t value;
+
+	if (fd == _wake_fd && _wake_fd != -1)
+	{
+		(void) read(_wake_fd, &value, sizeof(value));
+	}
+	return false;
+}
+
+void CGISlotWait::close_fd(int fd)
+{
+	if (fd == -1 || fd != _wake_fd)
+	{
+		return;
+	}
+	_wake_fd = -1;
+	(void) close(fd);
+}
+
+void CGISlotWait::poll()
+{
+}
+
+void CGISlotWait::abort()
+{
+	if (_done)
+	{
+		return;
+	}
+	CGILimiter::cancel(_location, this, std::time(NULL) > _deadline);
+	_done = true;
+}
+
+bool CGISlotWait::is_finished() const
+{
+	return _done;
+}
+
+bool CGISlotWait::succeeded() const
+{
+	return _granted;
+}
+
+bool CGISlotWait::is_expired(time_t now) const
+{
+	return !_done && now > _deadline;
+}
+
+std::string &CGISlotWait::get_output()
+{
+	return _output;
+}
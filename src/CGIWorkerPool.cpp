@@ -0,0 +1,323 @@
+#include "CGIWorkerPool.hpp"
+#include "PooledCGIRequest.hpp"
+#include "CGIProcess.hpp"
+#include "LogChannel.hpp"
+#include "Webserv.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <csignal>
+#include <stdexcept>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <sys/ioctl.h>
+
+std::map<CGIWorkerPool::Key, CGIWorkerPool::Pool> CGIWorkerPool::_pools;
+
+CGIWorkerPool::Key::Key()
+	: max_workers(0),
+	  max_requests(0)
+{
+}
+
+bool CGIWorkerPool::Key::operator<(const Key &other) const
+{
+	if (script != other.script)
+	{
+		return script < other.script;
+	}
+	else if (interpreter != other.interpreter)
+	{
+		return interpreter < other.interpreter;
+	}
+	else if (max_workers != other.max_workers)
+	{
+		return max_workers < other.max_workers;
+	}
+	else if (max_requests != other.max_requests)
+	{
+		return max_requests < other.max_requests;
+	}
+	else if (rlimits.cpu != other.rlimits.cpu)
+	{
+		return rlimits.cpu < other.rlimits.cpu;
+	}
+	else if (rlimits.as != other.rlimits.as)
+	{
+		return rlimits.as < other.rlimits.as;
+	}
+	return rlimits.nofile < other.rlimits.nofile;
+}
+
+CGIWorkerPool::Pool::Pool()
+	: workers(0)
+{
+}
+
+CGIWorker *CGIWorkerPool::acquire(const Key &key, PooledCGIRequest *request)
+{
+	Pool &pool = _pools[key];
+	CGIWorker *worker;
+	int status;
+
+	while (!pool.idle.empty())
+	{
+		worker = pool.idle.back();
+		pool.idle.pop_back();
+		// Worker may have died while idle.
+		if (waitpid(worker->pid, &status, WNOHANG) == 0)
+		{
+			worker->served++;
+			return worker;
+		}
+		print_warning("CGIWorkerPool::acquire(): Worker of ", key.script,
+			" exited while idle");
+		worker->pid = -1;
+		stop(worker);
+		pool.workers--;
+	}
+	if (pool.workers < key.max_workers)
+	{
+		worker = spawn(key, pool);
+		worker->served++;
+		return worker;
+	}
+	pool.queue.push_back(request);
+	return NULL;
+}
+
+void CGIWorkerPool::release(const Key &key, CGIWorker *worker, bool reusable)
+{
+	Pool &pool = _pools[key];
+	PooledCGIRequest *request;
+
+	// Lines of the request it served are logged before the next one.
+	drain_stderr(worker);
+	if (!reusable || (key.max_requests != 0
+		&& worker->served >= key.max_requests))
+	{
+		stop(worker);
+		if (pool.workers > 0)
+		{
+			pool.workers--;
+		}
+		worker = NULL;
+	}
+	if (pool.queue.empty())
+	{
+		if (worker != NULL)
+		{
+			pool.idle.push_back(worker);
+		}
+		return;
+	}
+	request = pool.queue.front();
+	pool.queue.pop_front();
+	if (worker == NULL)
+	{
+		try
+		{
+			worker = spawn(key, pool);
+		}
+		catch (const std::runtime_error &e)
+		{
+			print_warning(e.what(), "", "");
+			request->assign(NULL);
+			return;
+		}
+	}
+	worker->served++;
+	request->assign(worker);
+}
+
+void CGIWorkerPool::cancel(const Key &key, PooledCGIRequest *request)
+{
+	std::map<Key, Pool>::iterator it = _pools.find(key);
+
+	if (it == _pools.end())
+	{
+		return;
+	}
+	for (std::deque<PooledCGIRequest *>::iterator req = it->second.queue.begin();
+		req != it->second.queue.end(); ++req)
+	{
+		if (*req == request)
+		{
+			it->second.queue.erase(req);
+			return;
+		}
+	}
+}
+
+void CGIWorkerPool::shutdown()
+{
+	for (std::map<Key, Pool>::iterator it = _pools.begin();
+		it != _pools.end(); ++it)
+	{
+		for (size_t i = 0; i < it->second.idle.size(); i++)
+		{
+			stop(it->second.idle[i]);
+		}
+	}
+	_pools.clear();
+}
+
+/**
+ * Closes both ends of the first \p count pipes of \p pipes.
+ */
+static void close_pipes(int pipes[][2], size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		(void) close(pipes[i][0]);
+		(void) close(pipes[i][1]);
+	}
+}
+
+CGIWorker *CGIWorkerPool::spawn(const Key &key, Pool &pool)
+{
+	// Worker's stdin, stdout and stderr, and which end of each is ours.
+	enum { PIPES = 3 };
+	static const int parent_end[PIPES] = { 1, 0, 0 };
+	char *argv[3];
+	int pipes[PIPES][2];
+	CGIWorker *worker;
+	int saved_errno;
+
+	for (size_t i = 0; i < PIPES; i++)
+	{
+		if (pipe(pipes[i]) == -1)
+		{
+			saved_errno = errno;
+			close_pipes(pipes, i);
+			throw std::runtime_error(std::string("CGIWorkerPool::spawn(): ")
+					+ "pipe() fail: " + strerror(saved_errno));
+		}
+	}
+	// Parent's ends must neither block the event loop
+	// nor leak into other children.
+	for (size_t i = 0; i < PIPES; i++)
+	{
+		if (fcntl(pipes[i][parent_end[i]], F_SETFL, O_NONBLOCK) == -1
+			|| fcntl(pipes[i][parent_end[i]], F_SETFD, FD_CLOEXEC) == -1)
+		{
+			saved_errno = errno;
+			close_pipes(pipes, PIPES);
+			throw std::runtime_error(std::string("CGIWorkerPool::spawn(): ")
+					+ "fcntl() fail: " + strerror(saved_errno));
+		}
+	}
+	argv[0] = const_cast<char *> (key.interpreter.c_str());
+	argv[1] = const_cast<char *> (key.script.c_str());
+	argv[2] = NULL;
+	worker = new CGIWorker();
+	worker->pid = CGIProcess::spawn(key.interpreter, argv, environ, pipes[0][0],
+			pipes[1][1], pipes[2][1], &key.rlimits);
+	saved_errno = errno;
+	(void) close(pipes[0][0]);
+	(void) close(pipes[1][1]);
+	(void) close(pipes[2][1]);
+	worker->stdin_fd = pipes[0][1];
+	worker->stdout_fd = pipes[1][0];
+	worker->stderr_fd = pipes[2][0];
+	worker->log_source = "CGI " + key.script;
+	worker->served = 0;
+	if (worker->pid == -1)
+	{
+		stop(worker);
+		throw std::runtime_error(std::string("CGIWorkerPool::spawn(): ")
+				+ "CGIProcess::spawn() fail: " + strerror(saved_errno));
+	}
+	pool.workers++;
+	print_log("Started CGI worker for ", key.script, "");
+	return worker;
+}
+
+void CGIWorkerPool::stop(CGIWorker *worker)
+{
+	// Closing stdin alone isn't enough for a worker
+	// stuck in the middle of a request.
+	if (worker->pid != -1)
+	{
+		(void) kill(worker->pid, SIGKILL);
+		while (waitpid(worker->pid, NULL, 0) == -1 && errno == EINTR)
+			;
+	}
+	(void) close(worker->stdin_fd);
+	(void) close(worker->stdout_fd);
+	drain_stderr(worker);
+	if (!worker->stderr_line.empty())
+	{
+		log_stderr(worker, worker->stderr_line);
+	}
+	(void) close(worker->stderr_fd);
+	delete worker;
+}
+
+bool CGIWorkerPool::read_stderr(CGIWorker *worker)
+{
+	// Lines of a script are logged at a limited rate anyway,
+	// so a chatty one gets only this much read per event.
+	enum { BUFFER_SIZE = 4096 };
+	char buffer[BUFFER_SIZE];
+	ssize_t n;
+	size_t start = 0;
+	size_t end;
+
+	n = read(worker->stderr_fd, buffer, BUFFER_SIZE);
+	if (n == -1 && (errno == EAGAIN || errno == EINTR))
+	{
+		return true;
+	}
+	else if (n <= 0)
+	{
+		// Last line may lack its '\n'.
+		if (!worker->stderr_line.empty())
+		{
+			log_stderr(worker, worker->stderr_line);
+			worker->stderr_line.clear();
+		}
+		return false;
+	}
+	worker->stderr_line.append(buffer, static_cast<size_t> (n));
+	while ((end = worker->stderr_line.find('\n', start)) != std::string::npos)
+	{
+		log_stderr(worker, worker->stderr_line.substr(start, end - start));
+		start = end + 1;
+	}
+	worker->stderr_line.erase(0, start);
+	if (worker->stderr_line.length() >= MAX_STDERR_LINE)
+	{
+		log_stderr(worker, worker->stderr_line);
+		worker->stderr_line.clear();
+	}
+	return true;
+}
+
+void CGIWorkerPool::drain_stderr(CGIWorker *worker)
+{
+	int available = 0;
+
+	// Bounded by the size of the pipe, unless the worker
+	// keeps writing: then the rest waits for its next request.
+	for (size_t blocks = 0; worker->stderr_fd != -1 && blocks < 16
+		&& ioctl(worker->stderr_fd, FIONREAD, &available) == 0
+		&& available > 0 && read_stderr(worker); blocks++)
+		;
+}
+
+void CGIWorkerPool::log_stderr(const CGIWorker *worker, const std::string &line)
+{
+	size_t length = std::min(line.length(), static_cast<size_t> (MAX_STDERR_LINE));
+
+	if (length != 0 && line[length - 1] == '\r')
+	{
+		length--;
+	}
+	if (length != 0)
+	{
+		LogChannel::write(worker->log_source, worker->log_source + " (worker "
+			+ to_string(worker->pid) + "): " + line.substr(0, length));
+	}
+}
@@ -4,6 +4,7 @@ ClientConnection::ClientConnection(int fd)
 	: _client_socket(fd),
 	  _client_address(),
 	  _server(NULL),
+	  _vhosts(NULL),
 	  _last_msg_time(std::time(NULL)),
 	  _request_error(false),
 	  _msg_sent(false),
@@ -20,6 +21,7 @@ ClientConnection::ClientConnection()
 	: _client_socket(-1),
 	  _client_address(),
 	  _server(NULL),
+	  _vhosts(NULL),
 	  _last_msg_time(std::time(NULL)),
 	  _request_error(false),
 	  _msg_sent(false),
@@ -40,6 +42,7 @@ ClientConnection::ClientConnection(const ClientConnection &other)
 	: _client_socket(other._client_socket),
 	  _client_address(other._client_address),
 	  _server(other._server),
+	  _vhosts(other._vhosts),
 	  _last_msg_time(other._last_msg_time),
 	  _request_error(other._request_error),
 	  _msg_sent(other._msg_sent),
@@ -102,6 +105,19 @@ int ClientConnection::parseReadEvent(std::string &buffer)
 			}
 			this->_header_buffer_bytes_exhausted += processed_bytes;
 			buffer.erase(0, processed_bytes);
+			if (this->_request.is_header_complete()) {
+				// Picking the virtual host by "Host"
+				// (it's required, so it's set by now).
+				if (this->_vhosts != NULL) {
+					this->_server = this->_vhosts->find(
+						this->_request.get_header_value("Host"));
+					this->_response.set_server_cfg(this->_server);
+				}
+				// Determining the Location only once per request:
+				// it's needed for every body part and for the response.
+				this->_request.set_location(this->_server->findLocation(
+						this->_request.get_request_path_decoded()));
+			}
 			if (this->_header_buffer_bytes_exhausted
 				> this->_server->getLargeClientHeaderTotalBytes()) {
 				// Request's header buffer bytes are exhausted.
@@ -130,6 +146,11 @@ int ClientConnection::parseReadEvent(std::string &buffer)
 				// however chunk isn't fully received yet.
 				return 0;
 			}
+			catch (const std::ios_base::failure &e) {
+				// Couldn't spool the body to a file.
+				print_err("Request's body saving error: ", e.what(), "");
+				return 500;
+			}
 			catch (const std::runtime_error &e) {
 				print_err("Request's body parsing error: ", e.what(), "");
 				return 400;
@@ -142,8 +163,7 @@ int ClientConnection::parseReadEvent(std::string &buffer)
 			}
 			this->_body_buffer_bytes_exhausted += processed_bytes;
 			buffer.erase(0, processed_bytes);
-			max_body_size = this->getMaxBodySize(
-					this->_request.get_request_target());
+			max_body_size = this->getMaxBodySize();
 			if (this->_body_buffer_bytes_exhausted > max_body_size) {
 				// Request's body buffer bytes are exhausted.
 				print_err("Request's body is too large, currently processed: ",
@@ -163,20 +183,9 @@ int ClientConnection::parseReadEvent(std::string &buffer)
 	return 0;
 }
 
-size_t ClientConnection::getMaxBodySize(const std::string &request_path) const {
-	try
-	{
-		const Location &loc = _server->determineLocation(request_path);
-
-		return loc.getMaxBodySize();
-	}
-	catch (...)
-	{
-		// Location with such path wasn't found
-		// or max body wize wasn't defined for that location.
-		// Using a generic one.
-		return this->_server->getClientMaxBodySize();
-	}
+size_t ClientConnection::getMaxBodySize() const {
+	// Location's limit was already resolved against the server's one.
+	return this->_request.get_location()->max_body_size;
 }
 
 const struct sockaddr_in &ClientConnection::getServerAddress()
@@ -201,6 +210,12 @@ void ClientConnection::setAddress(const struct sockaddr_in &addr)
 	_request.set_client_address(addr);
 }
 
+void ClientConnection::setVirtualHosts(const VirtualHosts &vhosts)
+{
+	_vhosts = &vhosts;
+	this->setServer(*vhosts.getDefault());
+}
+
 void ClientConnection::setServer(ServerConfig &server)
 {
 	_server = &server;
@@ -301,13 +316,61 @@ bool ClientConnection::handleReadEvent()
 
 bool	ClientConnection::handleWriteEvent()
 {
+	// Let's send response in packets w/ size of 64 KiB.
+	enum { MAX_BYTES_TO_SEND = 65536 };
+	ssize_t n;
+
+	// Previous part was fully sent, but the body isn't complete yet.
+	if (_bytes_sent == _response.get_response_msg().size()
+		&& _response.get_splice_length() == 0
+		&& _response.has_pending_body())
+	{
+		if (!_response.refill_payload())
+		{
+			print_warning("Couldn't produce the rest of the response body", "", "");
+			return false;
+		}
+		_bytes_sent = 0;
+		if (_response.get_response_msg().empty()
+			&& !_response.has_pending_body())
+		{
+			// Body ended with nothing left to send.
+			_msg_sent = true;
+			return true;
+		}
+		else if (_response.get_response_msg().empty()
+			&& _response.get_splice_length() == 0)
+		{
+			// Nothing to send yet.
+			return true;
+		}
+	}
+	// Part of the body that follows goes from the CGI pipe
+	// (or the file) straight to the socket.
+	if (_bytes_sent == _response.get_response_msg().size()
+		&& _response.get_splice_length() > 0)
+	{
+		n = _response.splice_body(_client_socket);
+		if (n == -1 && (errno == EAGAIN || errno == EINTR))
+		{
+			return true;
+		}
+		else if (n == -1)
+		{
+			print_warning("splice() or sendfile() failed: ", strerror(errno), "");
+			return false;
+		}
+		if (_response.get_splice_length() == 0 && !_response.has_pending_body())
+		{
+			print_log("Response fully sent", "", "");
+			_msg_sent = true;
+		}
+		return true;
+	}
 	const std::string &response_msg = _response.get_response_msg();
 	size_t total_size = response_msg.size();
 	const char * data_ptr = response_msg.c_str() + _bytes_sent;
 	size_t remaining = total_size - _bytes_sent;
-	// Let's send response in packets w/ size of 64 KiB.
-	enum { MAX_BYTES_TO_SEND = 65536 };
-	ssize_t n;
 
 	if (remaining <= MAX_BYTES_TO_SEND)
 	{
@@ -326,7 +389,8 @@ bool	ClientConnection::handleWriteEvent()
 		return false;
 	}
 	_bytes_sent += static_cast<size_t>(n);
-	if (_bytes_sent == total_size) {
+	if (_bytes_sent == total_size && !_response.has_pending_body()
+		&& _response.get_splice_length() == 0) {
 		print_log("Response fully sent", "", "");
 		_msg_sent = true;
 	}
@@ -350,6 +414,8 @@ void ClientConnection::reset()
 	_request.reset();
 	_request.set_server_address(_server_address);
 	_request.set_client_address(_client_address);
+	if (_vhosts != NULL)
+		_server = _vhosts->getDefault();
 	_response = HTTPResponse();
 	_response.set_server_cfg(_server);
 }
@@ -44,6 +44,56 @@ void 	ConfigParser::removeComments(std::string &content) {
 }
 
 
+/**
+ * @brief Expands 'include <file>;' directives with the files' content.
+ *
+ * The expansion is textual, so an included file may contain anything
+ * the place of the directive allows (e.g. a 'types { ... }' block).
+ *
+ * @param content Configuration content without comments (modified in place).
+ * @param depth Current nesting level of included files.
+ * @throws ErrorException If the file can't be read or includes nest too deep.
+ */
+void 	ConfigParser::expandIncludes(std::string &content, size_t depth) {
+	const std::string INCLUDE_KEYWORD = "include";
+	enum { MAX_INCLUDE_DEPTH = 8 };
+	size_t pos = content.find(INCLUDE_KEYWORD);
+
+	while (pos != std::string::npos) {
+		size_t end = pos + INCLUDE_KEYWORD.length();
+		size_t prev = pos;
+		// Must be a whole word at the beginning of a directive.
+		while (prev > 0 && isspace(content[prev - 1]))
+			--prev;
+		if ((prev > 0 && content[prev - 1] != ';' && content[prev - 1] != '{'
+			&& content[prev - 1] != '}')
+			|| end >= content.size() || !isspace(content[end])) {
+			pos = content.find(INCLUDE_KEYWORD, end);
+			continue;
+		}
+		size_t semicolon = content.find(';', end);
+		if (semicolon == std::string::npos)
+			throw ErrorException("Missing ';' after include directive");
+		std::string path = trim(content.substr(end, semicolon - end));
+		if (path.empty() || path.find_first_of(" \t\n{}") != std::string::npos)
+			throw ErrorException("Invalid include directive: include " + path);
+		if (depth >= MAX_INCLUDE_DEPTH)
+			throw ErrorException("Includes are nested too deep: " + path);
+
+		std::string included;
+		try {
+			included = ConfigFile(path).readContent();
+		}
+		catch (const std::runtime_error &e) {
+			throw ErrorException(std::string("Couldn't include: ") + e.what());
+		}
+		removeComments(included);
+		expandIncludes(included, depth + 1);
+		content.replace(pos, semicolon + 1 - pos, included);
+		pos = content.find(INCLUDE_KEYWORD, pos + included.length());
+	}
+}
+
 /**
  * @brief Finds the opening brace of a server block in the config.
  * @param start Starting index to begin searching.
@@ -174,6 +224,7 @@ std::vector<std::string> ConfigParser::splitDirectives(const std::string &block)
  */
 void ConfigParser::parse() {
 	removeComments(_rawContent);
+	expandIncludes(_rawContent, 0);
 	splitIntoServerBlocks(_rawContent);
 	for (size_t i = 0; i < _serverBlocks.size(); ++i) {
 		std::vector<std::string> directives = splitDirectives(_serverBlocks[i]);
@@ -0,0 +1,467 @@
+#include "DiskCache.hpp"
+#include "Webserv.hpp"
+#include <cerrno>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <vector>
+#include <algorithm>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+std::map<std::string, DiskCache *> DiskCache::_caches;
+std::list<DiskCache::Write> DiskCache::_writes;
+size_t DiskCache::_queued = 0;
+
+// First bytes of the index.
+static const char INDEX_MAGIC[8] = { 'W', 'S', 'C', 'A', 'C', 'H', 'E', '\0' };
+
+DiskCache::DiskCache(const std::string &path, uint64_t max_size)
+	: _path(path),
+	  _max_size(max_size),
+	  _index_fd(-1),
+	  _index(MAP_FAILED),
+	  _header(NULL),
+	  _slots(NULL),
+	  _live(0),
+	  _removed(0),
+	  _size(0)
+{
+	if (_path.empty() || _path.at(_path.length() - 1) != '/')
+	{
+		_path += '/';
+	}
+}
+
+DiskCache::~DiskCache()
+{
+	if (_index != MAP_FAILED)
+	{
+		(void) msync(_index, sizeof(Header) + CAPACITY * sizeof(Slot), MS_ASYNC);
+		(void) munmap(_index, sizeof(Header) + CAPACITY * sizeof(Slot));
+	}
+	if (_index_fd != -1)
+	{
+		(void) close(_index_fd);
+	}
+}
+
+DiskCache *DiskCache::open(const std::string &path, uint64_t max_size)
+{
+	std::map<std::string, DiskCache *>::iterator it = _caches.find(path);
+	DiskCache *cache;
+
+	if (it != _caches.end())
+	{
+		return it->second;
+	}
+	cache = new DiskCache(path, max_size);
+	try
+	{
+		cache->load();
+	}
+	catch (const std::runtime_error &e)
+	{
+		delete cache;
+		throw;
+	}
+	_caches[path] = cache;
+	print_log("Opened cache directory ", path, " (" + to_string(cache->_live)
+		+ " entries, " + to_string(static_cast<size_t> (cache->_size)) + " bytes)");
+	return cache;
+}
+
+void DiskCache::shutdown()
+{
+	// Server is exiting, what's queued is written at once.
+	while (!_writes.empty())
+	{
+		write_next();
+	}
+	for (std::map<std::string, DiskCache *>::iterator it = _caches.begin();
+		it != _caches.end(); ++it)
+	{
+		delete it->second;
+	}
+	_caches.clear();
+}
+
+void DiskCache::load()
+{
+	const size_t length = sizeof(Header) + CAPACITY * sizeof(Slot);
+	struct stat sb;
+	bool valid;
+
+	_index_fd = ::open((_path + "index").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (_index_fd == -1)
+	{
+		throw std::runtime_error(std::string("DiskCache::load(): ")
+				+ "Can't open the index in " + _path + ": " + strerror(errno));
+	}
+	if (flock(_index_fd, LOCK_EX | LOCK_NB) == -1)
+	{
+		throw std::runtime_error(std::string("DiskCache::load(): ")
+				+ _path + " is used by another process");
+	}
+	if (fstat(_index_fd, &sb) == -1)
+	{
+		throw std::runtime_error(std::string("DiskCache::load(): ")
+				+ "fstat() fail: " + strerror(errno));
+	}
+	valid = (static_cast<size_t> (sb.st_size) == length);
+	// A new (or truncated) index reads as zeroes.
+	if (!valid && (ftruncate(_index_fd, 0) == -1
+		|| ftruncate(_index_fd, static_cast<off_t> (length)) == -1))
+	{
+		throw std::runtime_error(std::string("DiskCache::load(): ")
+				+ "ftruncate() fail: " + strerror(errno));
+	}
+	_index = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, _index_fd, 0);
+	if (_index == MAP_FAILED)
+	{
+		throw std::runtime_error(std::string("DiskCache::load(): ")
+				+ "mmap() fail: " + strerror(errno));
+	}
+	_header = static_cast<Header *> (_index);
+	_slots = reinterpret_cast<Slot *> (static_cast<char *> (_index) + sizeof(Header));
+	valid = valid && std::memcmp(_header->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) == 0
+		&& _header->version == VERSION && _header->capacity == CAPACITY;
+	if (!valid)
+	{
+		std::memset(_index, 0, length);
+		std::memcpy(_header->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+		_header->version = VERSION;
+		_header->capacity = CAPACITY;
+	}
+	for (size_t i = 0; i < CAPACITY; i++)
+	{
+		if (_slots[i].hash == SLOT_REMOVED)
+		{
+			_removed++;
+		}
+		else if (_slots[i].hash != SLOT_EMPTY)
+		{
+			_live++;
+			_size += _slots[i].size;
+			_by_use.insert(std::make_pair(_slots[i].used, i));
+		}
+	}
+	this->remove_files(!valid);
+}
+
+void DiskCache::remove_files(bool all)
+{
+	DIR *dir;
+	struct dirent *entry;
+	std::string name;
+	uint64_t hash;
+	char *end;
+
+	if ((dir = opendir(_path.c_str())) == NULL)
+	{
+		print_warning("DiskCache::remove_files(): Can't list ", _path, "");
+		return;
+	}
+	while ((entry = readdir(dir)) != NULL)
+	{
+		name = entry->d_name;
+		if (name.length() > 16 && name.compare(16, std::string::npos, ".tmp") == 0)
+		{
+			// Crashed in the middle of a write.
+			(void) unlink((_path + name).c_str());
+			continue;
+		}
+		else if (name.length() != 16
+			|| name.find_first_not_of("0123456789abcdef") != std::string::npos)
+		{
+			continue;
+		}
+		hash = std::strtoul(name.c_str(), &end, 16);
+		if (all || this->find(hash) == NULL)
+		{
+			(void) unlink((_path + name).c_str());
+		}
+	}
+	(void) closedir(dir);
+}
+
+bool DiskCache::pending()
+{
+	return !_writes.empty();
+}
+
+void DiskCache::write_next()
+{
+	std::list<Write>::iterator write = _writes.begin();
+	ssize_t n;
+
+	if (write == _writes.end())
+	{
+		return;
+	}
+	n = ::write(write->fd, write->data.c_str() + write->written,
+		std::min(static_cast<size_t> (WRITE_BLOCK_SIZE),
+			write->data.length() - write->written));
+	if (n == -1 && errno == EINTR)
+	{
+		return;
+	}
+	else if (n == -1)
+	{
+		print_warning("DiskCache::write_next(): Can't write an entry in ",
+			write->cache->_path, std::string(": ") + strerror(errno));
+		cancel(write);
+		return;
+	}
+	write->written += static_cast<size_t> (n);
+	_queued -= static_cast<size_t> (n);
+	if (write->written == write->data.length())
+	{
+		write->cache->commit(*write);
+		_writes.erase(write);
+	}
+}
+
+int DiskCache::lookup(const std::string &key, time_t now, time_t &expires,
+		off_t &offset, size_t &length)
+{
+	const std::string prefix = to_string(key.length()) + "\n" + key;
+	Slot *slot = this->find(hash(key));
+	std::vector<char> head(prefix.length());
+	ssize_t n;
+	int fd;
+
+	if (slot == NULL)
+	{
+		return -1;
+	}
+	else if (static_cast<time_t> (slot->expires) <= now)
+	{
+		this->evict(*slot);
+		return -1;
+	}
+	if ((fd = ::open(file_path(slot->hash).c_str(), O_RDONLY | O_CLOEXEC)) == -1)
+	{
+		// Someone removed it.
+		this->evict(*slot);
+		return -1;
+	}
+	n = pread(fd, &head[0], head.size(), 0);
+	if (n != static_cast<ssize_t> (head.size())
+		|| prefix.compare(0, prefix.length(), &head[0], head.size()) != 0)
+	{
+		// Key of another entry with the same hash.
+		(void) close(fd);
+		return -1;
+	}
+	this->touch(*slot);
+	expires = static_cast<time_t> (slot->expires);
+	offset = static_cast<off_t> (prefix.length());
+	length = static_cast<size_t> (slot->size) - prefix.length();
+	return fd;
+}
+
+void DiskCache::store(const std::string &key, const std::string &output,
+		time_t expires)
+{
+	const std::string prefix = to_string(key.length()) + "\n" + key;
+	const uint64_t size = prefix.length() + output.length();
+	uint64_t key_hash = hash(key);
+	std::string path = file_path(key_hash);
+	Write write;
+	Slot *slot;
+
+	if (size > _max_size || _queued + size > MAX_QUEUED)
+	{
+		return;
+	}
+	this->cancel(key_hash);
+	if ((slot = this->find(key_hash)) != NULL)
+	{
+		this->evict(*slot);
+	}
+	this->make_room(size);
+	write.fd = ::open((path + ".tmp").c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (write.fd == -1)
+	{
+		print_warning("DiskCache::store(): Can't create an entry in ",
+			_path, std::string(": ") + strerror(errno));
+		return;
+	}
+	write.cache = this;
+	write.hash = key_hash;
+	write.written = 0;
+	write.expires = expires;
+	// Queued without data, which is then put together in place:
+	// the output is copied once.
+	_writes.push_back(write);
+	_writes.back().data.reserve(static_cast<size_t> (size));
+	_writes.back().data.append(prefix);
+	_writes.back().data.append(output);
+	// Its room is taken right away.
+	_size += size;
+	_queued += static_cast<size_t> (size);
+}
+
+void DiskCache::cancel(uint64_t hash)
+{
+	for (std::list<Write>::iterator it = _writes.begin(); it != _writes.end(); ++it)
+	{
+		if (it->cache == this && it->hash == hash)
+		{
+			cancel(it);
+			return;
+		}
+	}
+}
+
+void DiskCache::cancel(std::list<Write>::iterator write)
+{
+	(void) close(write->fd);
+	(void) unlink((write->cache->file_path(write->hash) + ".tmp").c_str());
+	write->cache->_size -= write->data.length();
+	_queued -= write->data.length() - write->written;
+	_writes.erase(write);
+}
+
+void DiskCache::commit(const Write &write)
+{
+	std::string path = file_path(write.hash);
+	Slot *slot;
+
+	(void) close(write.fd);
+	// Readers never see a half-written entry.
+	if (std::rename((path + ".tmp").c_str(), path.c_str()) == -1)
+	{
+		print_warning("DiskCache::commit(): rename() fail: ", strerror(errno), "");
+		(void) unlink((path + ".tmp").c_str());
+		_size -= write.data.length();
+		return;
+	}
+	// Its size is counted already, only the slot is missing.
+	_size -= write.data.length();
+	this->make_room(write.data.length());
+	_size += write.data.length();
+	slot = this->take(write.hash);
+	slot->size = write.data.length();
+	slot->expires = static_cast<uint64_t> (write.expires);
+	_live++;
+	this->touch(*slot);
+}
+
+DiskCache::Slot *DiskCache::find(uint64_t hash)
+{
+	for (size_t i = 0; i < CAPACITY; i++)
+	{
+		Slot &slot = _slots[(hash + i) % CAPACITY];
+
+		if (slot.hash == hash)
+		{
+			return &slot;
+		}
+		else if (slot.hash == SLOT_EMPTY)
+		{
+			return NULL;
+		}
+	}
+	return NULL;
+}
+
+DiskCache::Slot *DiskCache::take(uint64_t hash)
+{
+	for (size_t i = 0; ; i++)
+	{
+		Slot &slot = _slots[(hash + i) % CAPACITY];
+
+		if (slot.hash == SLOT_REMOVED)
+		{
+			_removed--;
+		}
+		if (slot.hash == SLOT_EMPTY || slot.hash == SLOT_REMOVED)
+		{
+			slot.hash = hash;
+			return &slot;
+		}
+	}
+}
+
+void DiskCache::make_room(uint64_t size)
+{
+	while (_live > 0 && (_size + size > _max_size || _live + 1 > CAPACITY / 4 * 3))
+	{
+		this->evict(_slots[_by_use.begin()->second]);
+	}
+	if (_live + _removed + 1 > CAPACITY / 4 * 3)
+	{
+		// Probes would run through removed slots for too long.
+		this->rehash();
+	}
+}
+
+void DiskCache::evict(Slot &slot)
+{
+	_by_use.erase(std::make_pair(slot.used, static_cast<size_t> (&slot - _slots)));
+	(void) unlink(file_path(slot.hash).c_str());
+	_live--;
+	_removed++;
+	_size -= slot.size;
+	slot.hash = SLOT_REMOVED;
+	slot.size = 0;
+}
+
+void DiskCache::touch(Slot &slot)
+{
+	size_t i = static_cast<size_t> (&slot - _slots);
+
+	_by_use.erase(std::make_pair(slot.used, i));
+	slot.used = ++_header->clock;
+	_by_use.insert(std::make_pair(slot.used, i));
+}
+
+void DiskCache::rehash()
+{
+	std::vector<Slot> live;
+
+	for (size_t i = 0; i < CAPACITY; i++)
+	{
+		if (_slots[i].hash != SLOT_EMPTY && _slots[i].hash != SLOT_REMOVED)
+		{
+			live.push_back(_slots[i]);
+		}
+	}
+	std::memset(_slots, 0, CAPACITY * sizeof(Slot));
+	_removed = 0;
+	_by_use.clear();
+	for (size_t i = 0; i < live.size(); i++)
+	{
+		Slot *slot = this->take(live[i].hash);
+
+		*slot = live[i];
+		_by_use.insert(std::make_pair(slot->used, static_cast<size_t> (slot - _slots)));
+	}
+}
+
+std::string DiskCache::file_path(uint64_t hash) const
+{
+	char name[17];
+
+	(void) snprintf(name, sizeof(name), "%016lx", static_cast<unsigned long> (hash));
+	return _path + name;
+}
+
+uint64_t DiskCache::hash(const std::string &key)
+{
+	uint64_t hash = static_cast<uint64_t> (14695981039346656037UL);
+
+	for (size_t i = 0; i < key.length(); i++)
+	{
+		hash ^= static_cast<unsigned char> (key[i]);
+		hash *= static_cast<uint64_t> (1099511628211UL);
+	}
+	return (hash < 2) ? hash + 2 : hash;
+}
@@ -0,0 +1,300 @@
+#include "EffectiveLocation.hpp"
+#include "ServerConfig.hpp"
+#include "Location.hpp"
+#include "RootDir.hpp"
+#include "DiskCache.hpp"
+#include "Webserv.hpp"
+#include <cstring>
+#include <unistd.h>
+
+// Seconds clients turned away by "cgi_max_concurrent" are asked to wait.
+static const int CGI_RETRY_AFTER = 1;
+
+static std::string with_trailing_slash(const std::string &path)
+{
+	if (path.empty() || path.at(path.length() - 1) != '/')
+	{
+		return path + '/';
+	}
+	return path;
+}
+
+static unsigned int method_bit(const std::string &method)
+{
+	if (method == "GET")
+		return 1u << HTTPRequest::GET;
+	else if (method == "POST")
+		return 1u << HTTPRequest::POST;
+	else if (method == "DELETE")
+		return 1u << HTTPRequest::DELETE;
+	else if (method == "PUT")
+		return 1u << HTTPRequest::PUT;
+	return 0;
+}
+
+/**
+ * Check if \p var ("NAME=value") of the server's environment
+ * would pass for a CGI meta-variable, which only the request may set.
+ */
+static bool is_cgi_variable(const char *var)
+{
+	static const char *const names[] = {
+		"AUTH_TYPE", "CONTENT_LENGTH", "CONTENT_TYPE", "DOCUMENT_ROOT",
+		"GATEWAY_INTERFACE", "PATH_INFO", "PATH_TRANSLATED",
+		"QUERY_STRING", "REMOTE_ADDR", "REMOTE_HOST", "REMOTE_IDENT",
+		"REMOTE_USER", "REQUEST_METHOD", "REQUEST_URI", "SCRIPT_FILENAME",
+		"SCRIPT_NAME", "SERVER_NAME", "SERVER_PORT", "SERVER_PROTOCOL",
+		"SERVER_SOFTWARE", NULL
+	};
+	size_t length = std::strcspn(var, "=");
+
+	if (std::strncmp(var, "HTTP_", 5) == 0)
+	{
+		return true;
+	}
+	for (size_t i = 0; names[i] != NULL; i++)
+	{
+		if (std::strlen(names[i]) == length
+			&& std::strncmp(var, names[i], length) == 0)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Get \p response (a prepared 503, generated if NULL) telling clients
+ * to come back in `CGI_RETRY_AFTER` seconds.
+ */
+static std::string with_retry_after(const std::string *response)
+{
+	std::string out = (response != NULL) ? *response : generateErrorPage(503);
+	std::string::size_type pos = out.find("\r\nServer: ");
+
+	// Fields stay in alphabetical order, like everywhere else.
+	if (pos == std::string::npos)
+	{
+		pos = out.find("\r\n\r\n");
+	}
+	if (pos != std::string::npos)
+	{
+		out.insert(pos + 2, "Retry-After: " + to_string(CGI_RETRY_AFTER) + "\r\n");
+	}
+	return out;
+}
+
+EffectiveLocation::EffectiveLocation()
+	: location(NULL),
+	  path("/"),
+	  root_dir(NULL),
+	  upload_dir(NULL),
+	  methods(0),
+	  max_body_size(0),
+	  autoindex(false),
+	  internal(false),
+	  return_code(0),
+	  cgi_pool_workers(0),
+	  cgi_pool_max_requests(0),
+	  cgi_cache_ttl(0),
+	  cgi_cache_stale(0),
+	  disk_cache(NULL),
+	  cgi_max_concurrent(0),
+	  cgi_queue_size(0),
+	  cgi_queue_timeout(0),
+	  stub_status(false)
+{
+}
+
+EffectiveLocation::EffectiveLocation(const ServerConfig &server,
+		const Location *location)
+	: location(location),
+	  path("/"),
+	  root_dir(&server.getRootDir()),
+	  upload_dir(NULL),
+	  methods(0),
+	  max_body_size(server.getClientMaxBodySize()),
+	  autoindex(false),
+	  error_responses(MAX_ERROR_STATUS_CODE - MIN_ERROR_STATUS_CODE + 1, NULL),
+	  internal(false),
+	  return_code(0),
+	  cgi_pool_workers(0),
+	  cgi_pool_max_requests(0),
+	  cgi_cache_ttl(0),
+	  cgi_cache_stale(0),
+	  disk_cache(NULL),
+	  cgi_max_concurrent(0),
+	  cgi_queue_size(0),
+	  cgi_queue_timeout(0),
+	  stub_status(false)
+{
+	std::map<std::string, std::string> interpreters;
+
+	for (int code = MIN_ERROR_STATUS_CODE; code <= MAX_ERROR_STATUS_CODE; code++)
+	{
+		const std::string *response = NULL;
+
+		// Location's pages take precedence over the server's ones.
+		if (location != NULL)
+		{
+			response = location->getErrorResponse(code);
+		}
+		if (response == NULL)
+		{
+			response = server.getErrorResponse(code);
+		}
+		error_responses[static_cast<size_t> (code - MIN_ERROR_STATUS_CODE)]
+			= response;
+	}
+	if (location == NULL)
+	{
+		// Requests outside of every location may only be read.
+		root = with_trailing_slash(server.getRoot());
+		index = server.getIndex();
+		methods = 1u << HTTPRequest::GET;
+		return;
+	}
+	path = location->getPath();
+	// Exact path may name a file: only its directory is stripped
+	// from request paths, so "= /favicon.ico" still serves
+	// "favicon.ico" from the root.
+	if (location->getMatch() == Location::MATCH_EXACT)
+	{
+		path.erase(path.rfind('/') + 1);
+	}
+	// In Location, exactly one of `_root` or `_alias` is set.
+	root = with_trailing_slash(location->getRootLocation().empty()
+			? location->getAlias() : location->getRootLocation());
+	root_dir = &location->getRootDir();
+	if (!location->getUploadPath().empty())
+	{
+		upload_root = with_trailing_slash(location->getUploadPath());
+		upload_dir = &location->getUploadDir();
+	}
+	index = location->getIndexLocation();
+	if (index.empty())
+	{
+		index = server.getIndex();
+	}
+	for (std::set<std::string>::const_iterator it = location->getMethods().begin();
+		it != location->getMethods().end(); ++it)
+	{
+		methods |= method_bit(*it);
+	}
+	try
+	{
+		max_body_size = location->getMaxBodySize();
+	}
+	catch (const std::domain_error &e)
+	{
+		// Max body size wasn't defined for that location.
+	}
+	try_files = location->getTryFiles();
+	internal = location->isInternal();
+	return_code = location->getReturnCode();
+	if (!location->getReturnUrl().empty())
+	{
+		return_response = generateRedirectResponse(return_code,
+				location->getReturnUrl());
+	}
+	cgi_pool_workers = location->getCgiPoolWorkers();
+	cgi_pool_max_requests = location->getCgiPoolMaxRequests();
+	fastcgi_pass = location->getFastCGIPass();
+	proxy_pass = location->getProxyPass();
+	cgi_cache_ttl = static_cast<time_t> (location->getCgiCacheTtl());
+	cgi_cache_stale = static_cast<time_t> (location->getCgiCacheStale());
+	cgi_cache_key = location->getCgiCacheKey();
+	if (cgi_cache_key.empty())
+	{
+		cgi_cache_key.push_back("$request_method");
+		cgi_cache_key.push_back("$uri");
+		cgi_cache_key.push_back("$args");
+	}
+	if (!location->getCachePath().empty())
+	{
+		disk_cache = DiskCache::open(location->getCachePath(),
+				location->getCacheMaxSize());
+	}
+	cgi_max_concurrent = location->getCgiMaxConcurrent();
+	cgi_queue_size = location->getCgiQueueSize();
+	cgi_queue_timeout = static_cast<time_t> (location->getCgiQueueTimeout());
+	if (cgi_max_concurrent > 0)
+	{
+		cgi_busy_response = with_retry_after(getErrorResponse(503));
+	}
+	stub_status = location->isStubStatus();
+	stub_status_allow = location->getStubStatusAllow();
+	cgi_rlimits.cpu = static_cast<rlim_t> (location->getCgiRlimitCpu());
+	cgi_rlimits.as = static_cast<rlim_t> (location->getCgiRlimitAs());
+	cgi_rlimits.nofile = static_cast<rlim_t> (location->getCgiRlimitNofile());
+	autoindex = location->getAutoindex();
+	autoindex_options = location->getAutoindexOptions();
+	// "cgi_ext" and "cgi_path" are paired by position;
+	// the first pair wins for a repeated extension.
+	for (size_t i = 0; i < location->getCgiExtension().size()
+		&& i < location->getCgiPath().size(); i++)
+	{
+		std::string ext = location->getCgiExtension()[i];
+
+		for (size_t j = 0; j < ext.length(); j++)
+		{
+			ext[j] = static_cast<char> (std::tolower(
+					static_cast<unsigned char> (ext[j])));
+		}
+		interpreters.insert(std::make_pair(ext, location->getCgiPath()[i]));
+	}
+	cgi_interpreters = PerfectHash<std::string>(interpreters);
+	if (interpreters.empty() && fastcgi_pass.name.empty())
+	{
+		return;
+	}
+	// Scripts inherit the server's environment (PATH, locale, etc.),
+	// but not anything that would pass for a request's variable.
+	for (size_t i = 0; environ[i] != NULL; i++)
+	{
+		if (!is_cgi_variable(environ[i]))
+		{
+			cgi_environment.push_back(environ[i]);
+		}
+	}
+	cgi_static_vars.push_back(std::string("SERVER_SOFTWARE=") + SERVER_NAME + "/1.0");
+	cgi_static_vars.push_back(std::string("SERVER_NAME=") + SERVER_NAME);
+	cgi_static_vars.push_back("GATEWAY_INTERFACE=CGI/1.1");
+	cgi_static_vars.push_back("SERVER_PROTOCOL=HTTP/1.1");
+}
+
+bool EffectiveLocation::allows(enum HTTPRequest::e_method method) const
+{
+	return (methods & (1u << method)) != 0;
+}
+
+bool EffectiveLocation::allows_stub_status(struct in_addr address) const
+{
+	uint32_t host = ntohl(address.s_addr);
+
+	for (size_t i = 0; i < stub_status_allow.size(); i++)
+	{
+		if ((host & stub_status_allow[i].second) == stub_status_allow[i].first)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+const std::string *EffectiveLocation::getErrorResponse(int status_code) const
+{
+	if (status_code < MIN_ERROR_STATUS_CODE || status_code > MAX_ERROR_STATUS_CODE
+		|| error_responses.empty())
+	{
+		return NULL;
+	}
+	return error_responses[static_cast<size_t> (
+			status_code - MIN_ERROR_STATUS_CODE)];
+}
+
+const std::string *EffectiveLocation::getCgiInterpreter(
+		const std::string &ext) const
+{
+	return cgi_interpreters.find(ext);
+}
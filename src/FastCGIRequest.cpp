@@ -0,0 +1,440 @@
+#include "FastCGIRequest.hpp"
+#include "LogChannel.hpp"
+#include "Webserv.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+
+// FastCGI 1.0 protocol constants.
+enum
+{
+	FCGI_VERSION_1 = 1,
+	FCGI_HEADER_LEN = 8,
+	FCGI_BEGIN_REQUEST = 1,
+	FCGI_END_REQUEST = 3,
+	FCGI_PARAMS = 4,
+	FCGI_STDIN = 5,
+	FCGI_STDOUT = 6,
+	FCGI_STDERR = 7,
+	FCGI_RESPONDER = 1,
+	FCGI_KEEP_CONN = 1,
+	FCGI_REQUEST_COMPLETE = 0,
+	// Every connection carries one request at a time.
+	REQUEST_ID = 1,
+	// Largest record content that keeps records 8-byte aligned.
+	MAX_CONTENT = 65528
+};
+
+FastCGIRequest::FastCGIRequest()
+	: _conn_fd(-1),
+	  _write_fd(-1),
+	  _read_fd(-1),
+	  _connected(false),
+	  _send_pos(0),
+	  _input_fd(-1),
+	  _input_offset(0),
+	  _input_done(false),
+	  _sent(false),
+	  _ended(false),
+	  _app_status(0),
+	  _protocol_status(FCGI_REQUEST_COMPLETE),
+	  _failed(false),
+	  _deadline(0)
+{
+}
+
+FastCGIRequest::~FastCGIRequest()
+{
+	this->log_stderr("", 0, true);
+	this->close_fd(_write_fd);
+	this->close_fd(_read_fd);
+	if (_input_fd != -1)
+	{
+		(void) close(_input_fd);
+	}
+	if (_conn_fd == -1)
+	{
+		return;
+	}
+	// Only a connection with no request half-way on it may be reused.
+	if (_ended && _sent && _recv.empty() && !_failed)
+	{
+		UpstreamPool::release(_upstream, _conn_fd);
+	}
+	else
+	{
+		(void) close(_conn_fd);
+	}
+}
+
+/**
+ * Appends FastCGI name-value pair length \p length to \p out.
+ */
+static void append_length(std::string &out, size_t length)
+{
+	if (length < 128)
+	{
+		out += static_cast<char> (length);
+		return;
+	}
+	out += static_cast<char> (((length >> 24) & 0x7f) | 0x80);
+	out += static_cast<char> ((length >> 16) & 0xff);
+	out += static_cast<char> ((length >> 8) & 0xff);
+	out += static_cast<char> (length & 0xff);
+}
+
+void FastCGIRequest::start(const UpstreamAddress &upstream,
+		const std::vector<std::string> &params,
+		const std::string &input, int input_fd, time_t timeout)
+{
+	const char begin_request[FCGI_HEADER_LEN] = {
+		0, FCGI_RESPONDER, FCGI_KEEP_CONN, 0, 0, 0, 0, 0
+	};
+	std::string encoded;
+
+	if (_conn_fd != -1 || _failed)
+	{
+		throw std::runtime_error(std::string("FastCGIRequest::start(): ")
+				+ "Request was already started.");
+	}
+	_upstream = upstream;
+	if ((_conn_fd = UpstreamPool::acquire(_upstream)) == -1)
+	{
+		_failed = true;
+		throw std::runtime_error(std::string("FastCGIRequest::start(): ")
+				+ "Can't connect to " + _upstream.name + ": "
+				+ strerror(errno));
+	}
+	if ((_write_fd = fcntl(_conn_fd, F_DUPFD_CLOEXEC, 0)) == -1
+		|| (_read_fd = fcntl(_conn_fd, F_DUPFD_CLOEXEC, 0)) == -1
+		|| (input_fd != -1
+			&& (_input_fd = fcntl(input_fd, F_DUPFD_CLOEXEC, 0)) == -1))
+	{
+		_failed = true;
+		throw std::runtime_error(std::string("FastCGIRequest::start(): ")
+				+ "fcntl() fail: " + strerror(errno));
+	}
+	queue_record(FCGI_BEGIN_REQUEST, begin_request, sizeof(begin_request));
+	for (size_t i = 0; i < params.size(); i++)
+	{
+		size_t eq = params[i].find('=');
+
+		if (eq == std::string::npos)
+		{
+			continue;
+		}
+		append_length(encoded, eq);
+		append_length(encoded, params[i].length() - eq - 1);
+		encoded.append(params[i], 0, eq);
+		encoded.append(params[i], eq + 1, std::string::npos);
+	}
+	queue_stream(FCGI_PARAMS, encoded);
+	queue_record(FCGI_PARAMS, NULL, 0);
+	if (_input_fd == -1)
+	{
+		queue_stream(FCGI_STDIN, input);
+		queue_record(FCGI_STDIN, NULL, 0);
+		_input_done = true;
+	}
+	_deadline = std::time(NULL) + timeout;
+}
+
+void FastCGIRequest::log_stderr(const char *data, size_t length, bool end)
+{
+	const std::string source = "FastCGI " + _upstream.name;
+	size_t start = 0;
+	size_t line_end;
+	size_t cut;
+
+	_stderr_line.append(data, length);
+	while (start < _stderr_line.length())
+	{
+		line_end = _stderr_line.find('\n', start);
+		if (line_end == std::string::npos && !end
+			&& _stderr_line.length() - start < MAX_STDERR_LINE)
+		{
+			break;
+		}
+		else if (line_end == std::string::npos)
+		{
+			line_end = _stderr_line.length();
+		}
+		cut = std::min(line_end, start + MAX_STDERR_LINE);
+		if (cut > start && _stderr_line[cut - 1] == '\r')
+		{
+			cut--;
+		}
+		if (cut > start)
+		{
+			LogChannel::write(source, source + ": "
+				+ _stderr_line.substr(start, cut - start));
+		}
+		start = line_end + 1;
+	}
+	_stderr_line.erase(0, std::min(start, _stderr_line.length()));
+}
+
+void FastCGIRequest::queue_record(unsigned char type, const char *data,
+		size_t length)
+{
+	size_t padding = (FCGI_HEADER_LEN - length % FCGI_HEADER_LEN) % FCGI_HEADER_LEN;
+
+	_send += static_cast<char> (FCGI_VERSION_1);
+	_send += static_cast<char> (type);
+	_send += static_cast<char> ((REQUEST_ID >> 8) & 0xff);
+	_send += static_cast<char> (REQUEST_ID & 0xff);
+	_send += static_cast<char> ((length >> 8) & 0xff);
+	_send += static_cast<char> (length & 0xff);
+	_send += static_cast<char> (padding);
+	_send += '\0';
+	if (length > 0)
+	{
+		_send.append(data, length);
+	}
+	_send.append(padding, '\0');
+}
+
+void FastCGIRequest::queue_stream(unsigned char type, const std::string &data)
+{
+	for (size_t pos = 0; pos < data.length(); pos += MAX_CONTENT)
+	{
+		queue_record(type, data.c_str() + pos,
+			std::min(static_cast<size_t> (MAX_CONTENT), data.length() - pos));
+	}
+}
+
+void FastCGIRequest::get_watched_fds(std::vector<Watch> &out) const
+{
+	if (_write_fd != -1)
+	{
+		out.push_back(Watch(_write_fd, EPOLLOUT));
+	}
+	if (_read_fd != -1 && _output.length() < MAX_BUFFERED_OUTPUT)
+	{
+		out.push_back(Watch(_read_fd, EPOLLIN));
+	}
+}
+
+bool FastCGIRequest::handle_event(int fd)
+{
+	if (fd == _write_fd && _write_fd != -1)
+	{
+		return this->send_records();
+	}
+	else if (fd == _read_fd && _read_fd != -1)
+	{
+		return this->receive_records();
+	}
+	return false;
+}
+
+bool FastCGIRequest::send_records()
+{
+	char buffer[MAX_CONTENT];
+	ssize_t n;
+	int error = 0;
+	socklen_t error_length = sizeof(error);
+
+	if (!_connected)
+	{
+		if (getsockopt(_write_fd, SOL_SOCKET, SO_ERROR, &error, &error_length) == -1)
+		{
+			error = errno;
+		}
+		if (error != 0)
+		{
+			print_warning("FastCGIRequest::send_records(): Can't connect to ",
+				_upstream.name, std::string(": ") + strerror(error));
+			_failed = true;
+			return false;
+		}
+		_connected = true;
+	}
+	if (_send_pos == _send.length())
+	{
+		_send.clear();
+		_send_pos = 0;
+		if (_input_done)
+		{
+			_sent = true;
+			return false;
+		}
+		// Spooled body is sent one record at a time.
+		n = pread(_input_fd, buffer, MAX_CONTENT, _input_offset);
+		if (n == -1 && errno == EINTR)
+		{
+			return true;
+		}
+		else if (n == -1)
+		{
+			print_warning("FastCGIRequest::send_records(): pread() fail: ",
+				strerror(errno), "");
+			_failed = true;
+			return false;
+		}
+		else if (n == 0)
+		{
+			queue_record(FCGI_STDIN, NULL, 0);
+			_input_done = true;
+		}
+		else
+		{
+			queue_record(FCGI_STDIN, buffer, static_cast<size_t> (n));
+			_input_offset += n;
+		}
+	}
+	n = send(_write_fd, _send.c_str() + _send_pos, _send.length() - _send_pos,
+			MSG_NOSIGNAL);
+	if (n == -1 && (errno == EAGAIN || errno == EINTR))
+	{
+		return true;
+	}
+	else if (n == -1)
+	{
+		// The application may end the request without reading
+		// the whole body; the response is what tells if it failed.
+		print_log("FastCGIRequest::send_records(): Request isn't read anymore: ",
+			strerror(errno), "");
+		return false;
+	}
+	_send_pos += static_cast<size_t> (n);
+	return true;
+}
+
+bool FastCGIRequest::receive_records()
+{
+	// Output is read in parts, so one busy application
+	// doesn't hold the event loop.
+	enum { BUFFER_SIZE = 65536 };
+	char buffer[BUFFER_SIZE];
+	ssize_t n;
+	size_t pos = 0;
+
+	n = read(_read_fd, buffer, BUFFER_SIZE);
+	if (n == -1 && (errno == EAGAIN || errno == EINTR))
+	{
+		return true;
+	}
+	else if (n <= 0)
+	{
+		print_warning("FastCGIRequest::receive_records(): Connection to ",
+			_upstream.name, std::string(" lost: ")
+			+ (n == 0 ? "closed by the application" : strerror(errno)));
+		_failed = true;
+		return false;
+	}
+	_recv.append(buffer, static_cast<size_t> (n));
+	while (_recv.length() - pos >= FCGI_HEADER_LEN)
+	{
+		const unsigned char *header
+			= reinterpret_cast<const unsigned char *> (_recv.data() + pos);
+		size_t content_length = static_cast<size_t> (header[4]) << 8
+			| static_cast<size_t> (header[5]);
+		size_t record_length = FCGI_HEADER_LEN + content_length
+			+ static_cast<size_t> (header[6]);
+		unsigned int request_id = static_cast<unsigned int> (header[2]) << 8
+			| static_cast<unsigned int> (header[3]);
+
+		if (header[0] != FCGI_VERSION_1)
+		{
+			print_warning("FastCGIRequest::receive_records(): ",
+				"Malformed record from ", _upstream.name);
+			_failed = true;
+			return false;
+		}
+		else if (_recv.length() - pos < record_length)
+		{
+			break;
+		}
+		// Management records (request ID 0) aren't asked for.
+		if (request_id == REQUEST_ID && header[1] == FCGI_STDOUT)
+		{
+			_output.append(_recv, pos + FCGI_HEADER_LEN, content_length);
+		}
+		else if (request_id == REQUEST_ID && header[1] == FCGI_STDERR
+			&& content_length > 0)
+		{
+			this->log_stderr(_recv.data() + pos + FCGI_HEADER_LEN,
+				content_length, false);
+		}
+		else if (request_id == REQUEST_ID && header[1] == FCGI_END_REQUEST
+			&& content_length >= 8)
+		{
+			_app_status = static_cast<uint32_t> (header[8]) << 24
+				| static_cast<uint32_t> (header[9]) << 16
+				| static_cast<uint32_t> (header[10]) << 8
+				| static_cast<uint32_t> (header[11]);
+			_protocol_status = header[12];
+			_ended = true;
+			// Last line may lack its '\n'.
+			this->log_stderr("", 0, true);
+			_recv.erase(0, pos + record_length);
+			return false;
+		}
+		pos += record_length;
+	}
+	_recv.erase(0, pos);
+	return true;
+}
+
+void FastCGIRequest::close_fd(int fd)
+{
+	if (fd == -1)
+	{
+		return;
+	}
+	else if (fd == _write_fd)
+	{
+		_write_fd = -1;
+		// Nothing is sent anymore.
+		std::string().swap(_send);
+		_send_pos = 0;
+	}
+	else if (fd == _read_fd)
+	{
+		_read_fd = -1;
+	}
+	else
+	{
+		return;
+	}
+	(void) close(fd);
+}
+
+void FastCGIRequest::poll()
+{
+}
+
+void FastCGIRequest::abort()
+{
+	if (!_ended)
+	{
+		_failed = true;
+	}
+}
+
+bool FastCGIRequest::is_finished() const
+{
+	return _ended || _failed;
+}
+
+bool FastCGIRequest::succeeded() const
+{
+	return _ended && !_failed && _protocol_status == FCGI_REQUEST_COMPLETE
+		&& _app_status == 0;
+}
+
+bool FastCGIRequest::is_expired(time_t now) const
+{
+	return !is_finished() && now > _deadline;
+}
+
+std::string &FastCGIRequest::get_output()
+{
+	return _output;
+}
@@ -10,6 +10,14 @@
 #include <cstdlib>
 #include <iostream>		// Debug.
 #include <iomanip>		// Debug.
+#include <ios>
+#include <cstdio>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+
+const size_t HTTPRequest::_BODY_MEMORY_LIMIT;
+size_t HTTPRequest::_next_id = 1;
 
 HTTPRequest::HTTPRequest()
 	:	_server_address_is_set(false),
@@ -18,8 +26,13 @@ HTTPRequest::HTTPRequest()
 		_request_path_is_set(false),
 		_request_query_is_set(false),
 		_request_target_is_set(false),
+		_location(NULL),
+		_location_is_set(false),
 		_header_complete(false),
-		_body_complete(false)
+		_body_complete(false),
+		_body_length(0),
+		_body_fd(-1),
+		_id(_next_id++)
 {
 	(void) memset(&_server_address, 0, sizeof(struct sockaddr_in));
 	(void) memset(&_client_address, 0, sizeof(struct sockaddr_in));
@@ -27,6 +40,10 @@ HTTPRequest::HTTPRequest()
 
 HTTPRequest::~HTTPRequest()
 {
+	if (_body_fd != -1)
+	{
+		(void) close(_body_fd);
+	}
 }
 
 void HTTPRequest::reset()
@@ -44,10 +61,19 @@ void HTTPRequest::reset()
 	_request_query_is_set = false;
 	_request_target.clear();
 	_request_target_is_set = false;
+	_location = NULL;
+	_location_is_set = false;
 	_header_fields.clear();
 	_header_complete = false;
 	_body.clear();
 	_body_complete = false;
+	_body_length = 0;
+	if (_body_fd != -1)
+	{
+		(void) close(_body_fd);
+		_body_fd = -1;
+	}
+	_id = _next_id++;
 }
 
 HTTPRequest::method_not_allowed::method_not_allowed(const char * msg)
@@ -236,6 +262,27 @@ std::string HTTPRequest::get_request_path_decoded_strip_location_path(
 	return ret;
 }
 
+void HTTPRequest::set_location(const EffectiveLocation *location)
+{
+	this->_location = location;
+	this->_location_is_set = true;
+}
+
+bool HTTPRequest::is_location_set() const
+{
+	return this->_location_is_set;
+}
+
+const EffectiveLocation *HTTPRequest::get_location() const
+{
+	if (!(this->_location_is_set))
+	{
+		throw std::runtime_error(std::string("HTTPRequest::get_location(): ")
+				+ "Location wasn't set yet.");
+	}
+	return this->_location;
+}
+
 const std::string &HTTPRequest::get_request_query_original() const
 {
 	if (!(this->_request_query_is_set))
@@ -309,6 +356,80 @@ const std::string &HTTPRequest::get_body() const
 	return this->_body;
 }
 
+int HTTPRequest::get_body_fd() const
+{
+	return this->_body_fd;
+}
+
+size_t HTTPRequest::get_id() const
+{
+	return this->_id;
+}
+
+uint64_t HTTPRequest::get_body_length() const
+{
+	return this->_body_length;
+}
+
+void HTTPRequest::write_body_to(int fd) const
+{
+	enum { BUFFER_SIZE = 65536 };
+	char buffer[BUFFER_SIZE];
+	off_t offset = 0;
+	ssize_t n;
+
+	if (this->_body_fd == -1)
+	{
+		write_fd(fd, this->_body);
+		return;
+	}
+	while ((n = pread(this->_body_fd, buffer, BUFFER_SIZE, offset)) != 0)
+	{
+		if (n == -1 && errno == EINTR)
+		{
+			continue;
+		}
+		else if (n == -1)
+		{
+			throw std::ios_base::failure(std::string("HTTPRequest::write_body_to(): ")
+					+ "pread() fail: " + strerror(errno));
+		}
+		write_fd(fd, std::string(buffer, static_cast<size_t> (n)));
+		offset += n;
+	}
+}
+
+void HTTPRequest::append_body(const std::string &buffer, size_t pos, size_t length)
+{
+	char path[] = P_tmpdir "/webserv_body_XXXXXX";
+
+	if (this->_body_fd == -1
+		&& this->_body.length() + length > _BODY_MEMORY_LIMIT)
+	{
+		this->_body_fd = mkstemp(path);
+		if (this->_body_fd == -1)
+		{
+			throw std::ios_base::failure(std::string("HTTPRequest::append_body(): ")
+					+ "mkstemp() fail: " + strerror(errno));
+		}
+		// Only the descriptor refers to the file from now on,
+		// so it's gone once the request is.
+		(void) unlink(path);
+		(void) fcntl(this->_body_fd, F_SETFD, FD_CLOEXEC);
+		write_fd(this->_body_fd, this->_body);
+		std::string().swap(this->_body);
+	}
+	if (this->_body_fd != -1)
+	{
+		write_fd(this->_body_fd, buffer.substr(pos, length));
+	}
+	else
+	{
+		this->_body.append(buffer, pos, length);
+	}
+	this->_body_length += length;
+}
+
 bool HTTPRequest::is_header_complete() const
 {
 	return this->_header_complete;
@@ -697,9 +818,13 @@ size_t HTTPRequest::process_body_part_cl(const std::string &buffer)
 	{
 		throw std::runtime_error("HTTPRequest::process_body_part_cl(): \"Content-Length\" header doesn't contain a valid number.");
 	}
-	bytes_to_append = cl_bytes - this->_body.length();	// Underflow should never happen.
-	this->_body.append(buffer, 0, bytes_to_append);
-	if (this->_body.length() == cl_bytes)
+	bytes_to_append = cl_bytes - this->_body_length;	// Underflow should never happen.
+	if (bytes_to_append > buffer.length())
+	{
+		bytes_to_append = buffer.length();
+	}
+	this->append_body(buffer, 0, bytes_to_append);
+	if (this->_body_length == cl_bytes)
 	{
 		this->_body_complete = true;
 		return bytes_to_append;		// We've appended only this part of buffer.
@@ -757,7 +882,7 @@ size_t HTTPRequest::process_body_part_te(const std::string &buffer)
 	{
 		throw std::runtime_error("HTTPRequest::process_body_part_te(): Body part is borked.");
 	}
-	this->_body.append(buffer, pos, bytes_to_append);
+	this->append_body(buffer, pos, bytes_to_append);
 	if (bytes_to_append == 0)
 	{
 		this->_body_complete = true;
@@ -834,7 +959,10 @@ void HTTPRequest::printDebug() const {
 	{
 		std::cout << "Body:" << std::endl;
 		std::cout << "================" << std::endl;
-		std::cout << _body << std::endl;
+		if (_body_fd != -1)
+			std::cout << "[" << _body_length << " bytes spooled to a file]" << std::endl;
+		else
+			std::cout << _body << std::endl;
 		std::cout << "================" << std::endl;
 	}
 	std::cout << "====================================\n" << std::endl;
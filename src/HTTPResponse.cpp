@@ -7,6 +7,19 @@
 #include <csignal>
 #include "Webserv.hpp"
 #include "Location.hpp"
+#include "AutoIndex.hpp"
+#include "StatCache.hpp"
+#include "CGIProcess.hpp"
+#include "FastCGIRequest.hpp"
+#include "ProxyRequest.hpp"
+#include "PooledCGIRequest.hpp"
+#include "CGIBodyProducer.hpp"
+#include "CGICache.hpp"
+#include "CGICacheWait.hpp"
+#include "DiskCache.hpp"
+#include "CGILimiter.hpp"
+#include "CGISlotWait.hpp"
+#include "Stats.hpp"
 #include <cstdio>
 #include <cerrno>
 #include <sys/types.h>
@@ -17,49 +30,102 @@
 #include <sys/wait.h>
 #include <cstdlib>
 #include <cstring>
+#include <strings.h>
 #include <arpa/inet.h>
 #include <fstream>
-
-// To set up envp() for CGI.
-extern char **environ;
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
 
 HTTPResponse::HTTPResponse()
 	: _server_cfg(NULL),
 	  _status_code(100),		// Temporary code.
+	  _prebuilt_payload(NULL),
+	  _body_producer(NULL),
+	  _body_fd(-1),
+	  _body_offset(0),
 	  _payload_ready(false),
-	  _lp(NULL),
-	  _cgi_pid(-1),
-	  _cgi_launch_time(0)
+	  _elp(NULL),
+	  _root_dir(NULL),
+	  _target_exists(false),
+	  _cgi(NULL),
+	  _cgi_running(false),
+	  _cgi_nph(false),
+	  _cgi_passthrough(false),
+	  _cgi_queued(false),
+	  _cgi_busy(false),
+	  _splice_length(0),
+	  _splice_chunk_open(false),
+	  _request(NULL),
+	  _redirected_request(NULL),
+	  _local_redirects(0),
+	  _cache_leader(false),
+	  _cache_stale(false),
+	  _cache_refresh(false)
 {
-	_cgi_pipe[0] = -1;
-	_cgi_pipe[1] = -1;
 }
 
 HTTPResponse::HTTPResponse(int status_code)
 	: _server_cfg(NULL),
 	  _status_code(status_code),
+	  _prebuilt_payload(NULL),
+	  _body_producer(NULL),
+	  _body_fd(-1),
+	  _body_offset(0),
 	  _payload_ready(false),
-	  _lp(NULL),
-	  _cgi_pid(-1),
-	  _cgi_launch_time(0)
+	  _elp(NULL),
+	  _root_dir(NULL),
+	  _target_exists(false),
+	  _cgi(NULL),
+	  _cgi_running(false),
+	  _cgi_nph(false),
+	  _cgi_passthrough(false),
+	  _cgi_queued(false),
+	  _cgi_busy(false),
+	  _splice_length(0),
+	  _splice_chunk_open(false),
+	  _request(NULL),
+	  _redirected_request(NULL),
+	  _local_redirects(0),
+	  _cache_leader(false),
+	  _cache_stale(false),
+	  _cache_refresh(false)
 {
-	_cgi_pipe[0] = -1;
-	_cgi_pipe[1] = -1;
 }
 
 HTTPResponse::HTTPResponse(const HTTPResponse &other)
 	: _server_cfg(other._server_cfg),
 	  _status_code(other._status_code),
+	  _reason_phrase(other._reason_phrase),
 	  _headers(other._headers),
 	  _response_body(other._response_body),
 	  _payload(other._payload),
+	  _prebuilt_payload(other._prebuilt_payload),
+	  // Producer is owned by `other`, so is the file.
+	  _body_producer(NULL),
+	  _body_fd(-1),
+	  _body_offset(0),
 	  _payload_ready(other._payload_ready),
-	  _lp(other._lp),
-	  _cgi_pid(-1),
-	  _cgi_launch_time(0)
+	  _elp(other._elp),
+	  _root_dir(other._root_dir),
+	  _target_stat(other._target_stat),
+	  _target_exists(other._target_exists),
+	  // CGI process is owned by `other`.
+	  _cgi(NULL),
+	  _cgi_running(false),
+	  _cgi_nph(false),
+	  _cgi_passthrough(false),
+	  _cgi_queued(false),
+	  _cgi_busy(false),
+	  _splice_length(0),
+	  _splice_chunk_open(false),
+	  _request(NULL),
+	  _redirected_request(NULL),
+	  _local_redirects(0),
+	  _cache_leader(false),
+	  _cache_stale(false),
+	  _cache_refresh(false)
 {
-	_cgi_pipe[0] = -1;
-	_cgi_pipe[1] = -1;
 }
 
 HTTPResponse& HTTPResponse::operator=(const HTTPResponse &other)
@@ -70,50 +136,92 @@ HTTPResponse& HTTPResponse::operator=(const HTTPResponse &other)
 	}
 	_server_cfg = other._server_cfg;
 	_status_code = other._status_code;
+	_reason_phrase = other._reason_phrase;
 	_headers = other._headers;
 	_response_body = other._response_body;
 	_payload = other._payload;
-	_payload_ready = other._payload_ready;
-	_lp = other._lp;
-	if (_cgi_pid != -1)
-	{
-		kill(_cgi_pid, SIGTERM);
-	}
-	if (_cgi_pipe[0] != -1)
+	_prebuilt_payload = other._prebuilt_payload;
+	// Producer is owned by `other`, so is the file.
+	delete _body_producer;
+	_body_producer = NULL;
+	if (_body_fd != -1)
 	{
-		close(_cgi_pipe[0]);
+		(void) close(_body_fd);
 	}
-	if (_cgi_pipe[1] != -1)
-	{
-		close(_cgi_pipe[1]);
-	}
-	_cgi_launch_time = 0;
+	_body_fd = -1;
+	_body_offset = 0;
+	_payload_ready = other._payload_ready;
+	_elp = other._elp;
+	_root_dir = other._root_dir;
+	_target_stat = other._target_stat;
+	_target_exists = other._target_exists;
+	// CGI process is owned by `other`.
+	delete _cgi;
+	_cgi = NULL;
+	_cgi_running = false;
+	_cgi_nph = false;
+	_cgi_passthrough = false;
+	_cgi_queued = false;
+	_cgi_busy = false;
+	_splice_length = 0;
+	_splice_chunk_open = false;
+	_local_redirect.clear();
+	_redirect_headers.clear();
+	// So is the request of its local redirect.
+	_request = NULL;
+	delete _redirected_request;
+	_redirected_request = NULL;
+	_local_redirects = 0;
+	// Entry `other` may be filling is its business.
+	if (_cache_leader)
+	{
+		CGICache::abandon(_cache_key);
+	}
+	_cache_key.clear();
+	_cache_leader = false;
+	_cache_stale = false;
+	_cache_refresh = false;
 	return *this;
 }
 
 HTTPResponse::~HTTPResponse()
 {
+	// Producer may take the output of `_cgi`.
+	delete _body_producer;
+	if (_body_fd != -1)
+	{
+		(void) close(_body_fd);
+	}
+	delete _cgi;
+	delete _redirected_request;
+	if (_cache_leader)
+	{
+		CGICache::abandon(_cache_key);
+	}
 }
 
-HTTPResponse::directory_traversal_detected::directory_traversal_detected(
-		const char * msg)
-	: _MSG(msg)
-{
-}
-
-HTTPResponse::directory_traversal_detected::directory_traversal_detected(
-		const std::string &msg)
-	: _MSG(msg)
-{
-}
-
-HTTPResponse::directory_traversal_detected::~directory_traversal_detected() throw()
-{
-}
-
-const char * HTTPResponse::directory_traversal_detected::what() const throw()
+/**
+ * Get the status code of a response to a failed file operation.
+ * @param	err	errno of the failed operation.
+ */
+static int errno_to_status_code(int err)
 {
-	return _MSG.c_str();
+	switch (err)
+	{
+		case ENOENT:
+		case ENOTDIR:
+		// Root (alias, upload path) wasn't opened at startup.
+		case EBADF:
+			return 404;
+		// Path escapes the root.
+		case EXDEV:
+		case ELOOP:
+		case EACCES:
+		case EPERM:
+			return 403;
+		default:
+			return 500;
+	}
 }
 
 void HTTPResponse::set_server_cfg(ServerConfig *server_cfg)
@@ -128,9 +236,7 @@ void HTTPResponse::set_server_cfg(ServerConfig *server_cfg)
 
 void HTTPResponse::build_error_response()
 {
-	// `it` is a helper to construct `error_page_path`.
-	std::map<int, std::string>::const_iterator it;
-	std::string error_page_path;
+	const std::string *prebuilt = NULL;
 
 	if (_server_cfg == NULL)
 	{
@@ -142,68 +248,38 @@ void HTTPResponse::build_error_response()
 		throw std::runtime_error(std::string("HTTPResponse::build_error_response(): ")
 				+ "Response message is already prepared.");
 	}
-	// Resolving `error_page_path`.
-	if (_lp != NULL)
+	// Whatever the entry's filler ran into, its output won't come.
+	if (_cache_leader)
 	{
-		it = _lp->getErrorPages().find(_status_code);
-		if (it != _lp->getErrorPages().end())
-		{
-			// This is so stupid, this is actually so stupid.
-			if (_lp->getRootLocation().length() != 0)
-			{
-				error_page_path = _lp->getRootLocation();
-			}
-			else
-			{
-				error_page_path = _lp->getAlias();
-			}
-			if (error_page_path.at(error_page_path.length() - 1)
-				!= '/')
-			{
-				error_page_path.push_back('/');
-			}
-			error_page_path += it->second;
-		}
+		CGICache::abandon(_cache_key);
+		_cache_leader = false;
 	}
-	// Still resolving `error_page_path.
-	if (_lp == NULL || it == _lp->getErrorPages().end())
+	// Error pages were resolved, read and serialized at startup
+	// (location's table already falls back to the server's pages).
+	if (_elp != NULL && _status_code == 503 && _cgi_busy
+		&& !_elp->cgi_busy_response.empty())
 	{
-		it = _server_cfg->getErrorPages().find(_status_code);
-		if (it != _server_cfg->getErrorPages().end())
-		{
-			error_page_path = _server_cfg->getRoot();
-			if (error_page_path.at(error_page_path.length() - 1)
-				!= '/')
-			{
-				error_page_path.push_back('/');
-			}
-			error_page_path += it->second;
-		}
+		// Clients turned away by "cgi_max_concurrent"
+		// are told when to come back.
+		prebuilt = &_elp->cgi_busy_response;
 	}
-	// "Connection" header.
-	if (_headers.find("Connection") == _headers.end())
+	else if (_elp != NULL)
 	{
-		_headers["Connection"] = "close";
+		prebuilt = _elp->getErrorResponse(_status_code);
 	}
-	// Sending the error page itself.
-	if (error_page_path.length() > 0)
+	else
 	{
-		try
-		{
-			_response_body = read_file(error_page_path);
-			// If MIME is not HTML,
-			// then something is definitely wrong.
-			_headers["Content-Type"] = get_mime_type(error_page_path);
-			this->prep_payload();
-			return;
-		}
-		catch (const std::ios_base::failure &e)
-		{
-			print_warning("Couldn't read error page: ", e.what(), "");
-		}
+		prebuilt = _server_cfg->getErrorResponse(_status_code);
+	}
+	// Prepared error responses always close the connection.
+	_headers["Connection"] = "close";
+	if (prebuilt != NULL)
+	{
+		this->use_prebuilt_payload(prebuilt);
+		return;
 	}
-	// Either the error page for this error code doesn't exist,
-	// or file reading failed.
+	// Status code we didn't prepare a response for
+	// (or responses weren't prepared at all).
 	_response_body = generateErrorBody(_status_code);
 	_headers["Content-Type"] = "text/html";
 	this->prep_payload();
@@ -222,6 +298,11 @@ void HTTPResponse::handle_response_routine(const HTTPRequest &request)
 	std::string request_location_path;
 	std::string request_dir_root;
 	std::string resolved_path;
+	std::string uri;
+	bool try_files_done = false;
+	int redirects;
+	int status_code;
+	const std::string *redirect;
 
 	// Checking for usage errors.
 	if (_server_cfg == NULL)
@@ -234,63 +315,90 @@ void HTTPResponse::handle_response_routine(const HTTPRequest &request)
 		throw std::runtime_error(std::string("HTTPResponse::handle_response_routine(): ")
 				+ "Response message is already prepared.");
 	}
-	// Getting Location pointer.
-	try
+	_request = &request;
+	// Exact-path redirects were serialized at startup.
+	if ((redirect = _server_cfg->findRedirect(
+			request.get_request_path_decoded())) != NULL)
 	{
-		const Location &loc = _server_cfg->determineLocation(
-				request.get_request_path_decoded());
-
-		_lp = &loc;
+		_headers["Connection"] = "close";
+		this->use_prebuilt_payload(redirect);
+		return;
+	}
+	// Getting the effective Location
+	// (it was determined right after the request's header was parsed).
+	if (request.is_location_set())
+	{
+		_elp = request.get_location();
+	}
+	else
+	{
+		_elp = _server_cfg->findLocation(request.get_request_path_decoded());
 	}
-	catch (const std::out_of_range &e)
+	// Path is routed again after "try_files" picks another URI.
+	uri = request.get_request_path_decoded();
+	for (redirects = 0; ; redirects++)
 	{
-		_lp = NULL;
+		// Clients don't see internal locations,
+		// only "try_files" and local redirects lead there.
+		if (_elp->internal && redirects == 0 && &request != _redirected_request)
+		{
+			_status_code = 404;
+			build_error_response();
+			return;
+		}
+		if (!_elp->return_response.empty())
+		{
+			_headers["Connection"] = "close";
+			this->use_prebuilt_payload(&_elp->return_response);
+			return;
+		}
+		else if (_elp->return_code != 0)
+		{
+			_status_code = _elp->return_code;
+			build_error_response();
+			return;
+		}
+		if (!_elp->allows(request.get_method()))
+		{
+			_status_code = 405;
+			build_error_response();
+			return;
+		}
+		if (try_files_done || _elp->try_files.empty()
+			|| request.get_method() != HTTPRequest::GET)
+		{
+			break;
+		}
+		else if (redirects == _MAX_INTERNAL_REDIRECTS)
+		{
+			print_err("Internal redirection cycle while processing ",
+				request.get_request_path_decoded(), "");
+			_status_code = 500;
+			build_error_response();
+			return;
+		}
+		status_code = apply_try_files(uri);
+		if (status_code > 0)
+		{
+			_status_code = status_code;
+			build_error_response();
+			return;
+		}
+		try_files_done = (status_code == 0);
 	}
 	// Setting handler.
 	switch (request.get_method())
 	{
 		case HTTPRequest::GET:
-			if (_lp != NULL
-				&& _lp->getMethods().find("GET")
-					== _lp->getMethods().end())
-			{
-				_status_code = 405;
-				build_error_response();
-				return;
-			}
 			handler = &HTTPResponse::handle_get;
 			break;
 		case HTTPRequest::POST:
-			if (_lp == NULL
-				|| _lp->getMethods().find("POST")
-					== _lp->getMethods().end())
-			{
-				_status_code = 405;
-				build_error_response();
-				return;
-			}
 			handler = &HTTPResponse::handle_post;
 			break;
 		case HTTPRequest::DELETE:
-			if (_lp == NULL
-				|| _lp->getMethods().find("DELETE")
-					== _lp->getMethods().end())
-			{
-				_status_code = 405;
-				build_error_response();
-				return;
-			}
 			handler = &HTTPResponse::handle_delete;
 			break;
 		case HTTPRequest::PUT:
-			if (_lp == NULL
-				|| _lp->getMethods().find("PUT")
-					== _lp->getMethods().end())
-			{
-				_status_code = 405;
-				build_error_response();
-				return;
-			}
 			handler = &HTTPResponse::handle_put;
 			break;
 		default:
@@ -300,46 +408,53 @@ void HTTPResponse::handle_response_routine(const HTTPRequest &request)
 			return;
 	}
 	// Resolving request dirs, paths, etc.
-	// Ideally, this should be in it's own method...
-	if (_lp != NULL)
+	// Everything inherited from the server was resolved at startup.
+	// `_elp` was routed by `uri`, so its path is a prefix of it.
+	request_location_path = _elp->path;
+	request_dir_relative_to_root = uri.substr(request_location_path.length());
+	request_dir_root = _elp->root;
+	resolved_path = request_dir_root + request_dir_relative_to_root;
+	_root_dir = _elp->root_dir;
+	if (_elp->stub_status && !_elp->allows_stub_status(
+			request.get_client_address().sin_addr))
 	{
-		request_dir_relative_to_root = request.get_request_path_decoded_strip_location_path(
-				_lp->getPath());
-		request_location_path = _lp->getPath();
-		// In Location, at least one of `_root` or `_alias`
-		// must be defined.
-		if (!(_lp->getRootLocation().empty()))
-		{
-			request_dir_root = _lp->getRootLocation();
-		}
-		else
-		{
-			request_dir_root = _lp->getAlias();
-		}
+		_status_code = 403;
+		this->build_error_response();
+		return;
 	}
-	else
+	else if (_elp->stub_status)
 	{
-		request_dir_relative_to_root = request.get_request_path_decoded();
-		// Request path initial '/'.
-		request_dir_relative_to_root.erase(0, 1);
-		request_location_path = '/';
-		request_dir_root = _server_cfg->getRoot();
+		_status_code = 200;
+		_response_body = Stats::render();
+		_headers["Content-Type"] = "text/plain; version=0.0.4";
+		set_connection_header(request);
+		prep_payload();
+		return;
 	}
-	if (request_dir_root.length() <= 0
-		|| request_dir_root.at(request_dir_root.length() - 1) != '/')
+	if (!_elp->proxy_pass.name.empty())
 	{
-			request_dir_root.push_back('/');
+		// Paths are the upstream's business, not ours.
+		if ((status_code = handle_proxy(request)) != 0)
+		{
+			_status_code = status_code;
+			build_error_response();
+		}
+		return;
 	}
-	try
+	if (!_elp->fastcgi_pass.name.empty())
 	{
-		resolved_path = this->resolve_path(request_dir_root,
-				request_dir_relative_to_root);
+		// Scripts are the application's business, not ours.
+		if ((status_code = handle_fastcgi(request, request_dir_root,
+				resolved_path)) != 0)
+		{
+			_status_code = status_code;
+			build_error_response();
+		}
+		return;
 	}
-	catch (const directory_traversal_detected &e)
+	if ((status_code = resolve_target(request_dir_relative_to_root)) != 0)
 	{
-		print_err("Detected directory traversal attempt: ", e.what(), "");
-		// I guess 403 or 406 is good in this case?
-		_status_code = 403;
+		_status_code = status_code;
 		build_error_response();
 		return;
 	}
@@ -360,9 +475,165 @@ const std::string &HTTPResponse::get_response_msg() const
 		throw std::runtime_error(std::string("HTTPResponse::get_response_msg(): ")
 				+ "Response payload isn't ready yet.");
 	}
+	else if (_prebuilt_payload != NULL)
+	{
+		return *_prebuilt_payload;
+	}
 	return _payload;
 }
 
+bool HTTPResponse::has_pending_body() const
+{
+	return _body_producer != NULL || _cgi_passthrough;
+}
+
+bool HTTPResponse::refill_payload()
+{
+	std::string data;
+	enum BodyProducer::e_produce_status status;
+	// Body of a known length (or NPH output) is sent as is.
+	bool chunked = _headers.find("Transfer-Encoding") != _headers.end();
+
+	if (_cgi_passthrough)
+	{
+		return this->refill_passthrough();
+	}
+	else if (_body_producer == NULL)
+	{
+		throw std::runtime_error(std::string("HTTPResponse::refill_payload(): ")
+				+ "Response body isn't produced on the fly.");
+	}
+	_payload.clear();
+	status = _body_producer->produce(data);
+	if (status == BodyProducer::PRODUCE_ERROR)
+	{
+		// Headers are already sent,
+		// the only thing we can do is to drop the connection.
+		delete _body_producer;
+		_body_producer = NULL;
+		return false;
+	}
+	else if (data.length() > 0 && !chunked)
+	{
+		_payload.swap(data);
+	}
+	else if (data.length() > 0)
+	{
+		append_chunk(_payload, data);
+	}
+	if (status == BodyProducer::PRODUCE_DONE)
+	{
+		if (chunked)
+		{
+			append_chunk(_payload, "");
+		}
+		delete _body_producer;
+		_body_producer = NULL;
+	}
+	return true;
+}
+
+bool HTTPResponse::refill_passthrough()
+{
+	std::string &output = _cgi->get_output();
+	bool chunked = _headers.find("Transfer-Encoding") != _headers.end();
+	size_t available;
+
+	if (_splice_length > 0)
+	{
+		throw std::runtime_error(std::string("HTTPResponse::refill_passthrough(): ")
+				+ "Previous part wasn't spliced yet.");
+	}
+	_payload.clear();
+	if (_splice_chunk_open)
+	{
+		_payload = "\r\n";
+		_splice_chunk_open = false;
+	}
+	if (!output.empty())
+	{
+		// Read along with the header block.
+		if (chunked)
+		{
+			append_chunk(_payload, output);
+		}
+		else
+		{
+			_payload += output;
+		}
+		std::string().swap(output);
+		return true;
+	}
+	available = _cgi->passthrough_available();
+	if (available > 0)
+	{
+		if (chunked)
+		{
+			append_chunk_header(_payload, available);
+			_splice_chunk_open = true;
+		}
+		_splice_length = available;
+		return true;
+	}
+	else if (!_cgi->is_finished())
+	{
+		return true;
+	}
+	_cgi_passthrough = false;
+	if (!_cgi->succeeded())
+	{
+		return false;
+	}
+	else if (chunked)
+	{
+		append_chunk(_payload, "");
+	}
+	return true;
+}
+
+size_t HTTPResponse::get_splice_length() const
+{
+	return _splice_length;
+}
+
+ssize_t HTTPResponse::splice_body(int fd)
+{
+	ssize_t n;
+
+	if (_splice_length == 0)
+	{
+		throw std::runtime_error(std::string("HTTPResponse::splice_body(): ")
+				+ "Nothing to splice.");
+	}
+	if (_body_fd != -1)
+	{
+		n = sendfile(fd, _body_fd, &_body_offset, _splice_length);
+	}
+	else
+	{
+		n = splice(_cgi->get_passthrough_fd(), NULL, fd, NULL, _splice_length,
+				SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	}
+	if (n == 0)
+	{
+		// Whatever was counted can't vanish from the pipe;
+		// the file may be truncated while it's sent, though.
+		errno = EPIPE;
+		return -1;
+	}
+	else if (n > 0)
+	{
+		_splice_length -= static_cast<size_t> (n);
+	}
+	return n;
+}
+
+bool HTTPResponse::waits_for_body() const
+{
+	return _payload_ready && this->has_pending_body() && _splice_length == 0
+		&& this->get_response_msg().empty();
+}
+
 bool HTTPResponse::should_close_connection() const
 {
 	if (!_payload_ready)
@@ -388,7 +659,9 @@ void HTTPResponse::prep_payload()
 				+ "Response payload is already prepared.");
 	}
 	// Start line.
-	payload << "HTTP/1.1 " << _status_code << " " << getReasonPhrase(_status_code) << "\r\n";
+	payload << "HTTP/1.1 " << _status_code << " "
+		<< (_reason_phrase.empty() ? getReasonPhrase(_status_code) : _reason_phrase)
+		<< "\r\n";
 	// Taking care of header fields that must always be present,
 	// but that may be not set by `build_error_response()`
 	// or `handle_response_routine()`.
@@ -405,59 +678,100 @@ void HTTPResponse::prep_payload()
 	_payload_ready = true;
 }
 
-void HTTPResponse::append_required_headers()
+void HTTPResponse::use_prebuilt_payload(const std::string *payload)
 {
-	_headers["Server"] = SERVER_NAME;
-	_headers["Content-Length"] = to_string(_response_body.length());
+	if (_payload_ready)
+	{
+		throw std::runtime_error(std::string("HTTPResponse::use_prebuilt_payload(): ")
+				+ "Response payload is already prepared.");
+	}
+	_prebuilt_payload = payload;
+	_payload_ready = true;
 }
 
-std::string HTTPResponse::resolve_path(const std::string &root,
-		const std::string &request_relative_path) const
+void HTTPResponse::set_body_producer(BodyProducer *producer)
 {
-	// Checking for possible directory traversal in `request_relative_path`.
-	size_t depth = 0;
-	bool in_directory = false;
+	delete _body_producer;
+	_body_producer = producer;
+	_headers["Transfer-Encoding"] = "chunked";
+	_response_body.clear();
+}
 
-	if (request_relative_path.length() > 0
-		&& request_relative_path.at(0) == '/')
+void HTTPResponse::append_required_headers()
+{
+	_headers["Server"] = SERVER_NAME;
+	// Chunked body carries its own framing;
+	// length of a produced one is set by whoever knows it.
+	// 204 and 304 responses have no body to frame (RFC 9110, 8.6).
+	if (_headers.find("Transfer-Encoding") == _headers.end()
+		&& _body_producer == NULL && !_cgi_passthrough && _body_fd == -1
+		&& _status_code != 204 && _status_code != 304)
 	{
-		throw std::invalid_argument(std::string("HTTPResponse::resolve_path(): ")
-				+ "Provided request path is not relative: "
-				+ request_relative_path);
+		_headers["Content-Length"] = to_string(_response_body.length());
 	}
-	for (size_t i = 0; i < request_relative_path.length(); i++)
+}
+
+int HTTPResponse::apply_try_files(std::string &uri)
+{
+	const std::vector<std::string> &items = _elp->try_files;
+	const EffectiveLocation *candidate_elp;
+	std::string candidate;
+	std::string::size_type pos;
+	struct stat sb;
+
+	for (size_t i = 0; i < items.size(); i++)
 	{
-		if (request_relative_path.at(i) == '.'
-			&& !in_directory
-			&& (i + 1 < request_relative_path.length()
-				&& request_relative_path.at(i + 1) == '.'))
+		candidate = items[i];
+		while ((pos = candidate.find("$uri")) != std::string::npos)
 		{
-			// More than 3 levels of indentation is bad.
-			// Still, let's proceed as is...
-			if (depth-- == 0)
-			{
-				throw directory_traversal_detected(std::string("HTTPResponse::resolve_path(): ")
-						+ "Detected directory traversal.");
-			}
-			i++;	// Skip the second dot.
+			candidate.replace(pos, 4, uri);
 		}
-		else if (request_relative_path.at(i) == '/')
+		if (i == items.size() - 1)
 		{
-			// Not checking for double slashes.
-			// Double slashes in the request path
-			// are already checked for during HTTPRequest parsing.
-			if (in_directory)
+			if (candidate[0] == '=')
 			{
-				depth++;
+				return std::atoi(candidate.c_str() + 1);
 			}
-			in_directory = false;
+			// Fallback is an internal redirect.
+			uri = candidate;
+			_elp = _server_cfg->findLocation(uri);
+			return -1;
 		}
-		else
+		// Each candidate is looked up in the root
+		// of the location it belongs to.
+		candidate_elp = _server_cfg->findLocation(candidate);
+		if (StatCache::lookup(*candidate_elp->root_dir,
+				candidate.substr(candidate_elp->path.length()), sb) == 0
+			&& (candidate[candidate.length() - 1] == '/'
+				? S_ISDIR(sb.st_mode) : !S_ISDIR(sb.st_mode)))
 		{
-			in_directory = true;
+			uri = candidate;
+			_elp = candidate_elp;
+			return 0;
 		}
 	}
-	return root + request_relative_path;
+	// Unreachable: config requires a fallback.
+	return 404;
+}
+
+int HTTPResponse::resolve_target(const std::string &request_relative_path)
+{
+	_target_exists = false;
+	if (StatCache::lookup(*_root_dir, request_relative_path, _target_stat) == 0)
+	{
+		_target_exists = true;
+		return 0;
+	}
+	else if (errno == ENOENT || errno == ENOTDIR)
+	{
+		return 0;
+	}
+	else if (errno == EXDEV || errno == ELOOP)
+	{
+		print_err("Detected directory traversal attempt: ",
+			request_relative_path, "");
+	}
+	return errno_to_status_code(errno);
 }
 
 void HTTPResponse::handle_get(const HTTPRequest &request,
@@ -467,8 +781,10 @@ void HTTPResponse::handle_get(const HTTPRequest &request,
 		std::string &resolved_path)
 {
 	int cgi_status;
+	int fd;
+	struct stat sb;
 
-	if (isDirectory(resolved_path))
+	if (_target_exists && S_ISDIR(_target_stat.st_mode))
 	{
 		if (request_dir_relative_to_root.length() > 0
 			&& request_dir_relative_to_root.at(
@@ -494,11 +810,11 @@ void HTTPResponse::handle_get(const HTTPRequest &request,
 				+ request_dir_relative_to_root;
 		}
 		// No available index was found.
-		else if (_lp != NULL && _lp->getAutoindex() == true)
+		else if (_elp->autoindex)
 		{
 			try
 			{
-				generate_auto_index(resolved_path);
+				generate_auto_index(request_dir_relative_to_root, request);
 			}
 			catch (const std::ios_base::failure &e)
 			{
@@ -523,7 +839,7 @@ void HTTPResponse::handle_get(const HTTPRequest &request,
 			return;
 		}
 	}
-	if (!pathExists(resolved_path))
+	if (!_target_exists)
 	{
 		_status_code = 404;
 		build_error_response();
@@ -531,20 +847,17 @@ void HTTPResponse::handle_get(const HTTPRequest &request,
 	}
 	// At this point, `resolved_path` must be a file
 	// (at least not a directory).
-	else if (access(resolved_path.c_str(), R_OK) == -1)
-	{
-		_status_code = 403;
-		print_log("HTTPResponse::handle_get(): Can't read file at: ",
-			resolved_path, "");
-		build_error_response();
-		return;
-	}
-	if (_lp != NULL
-		&& std::find(_lp->getCgiExtension().begin(),
-			_lp->getCgiExtension().end(),
-			get_file_ext(resolved_path))
-			!= _lp->getCgiExtension().end())
+	if (_elp->getCgiInterpreter(get_file_ext(resolved_path)) != NULL)
 	{
+		// Interpreter opens the script by path itself.
+		if (access(resolved_path.c_str(), R_OK) == -1)
+		{
+			_status_code = 403;
+			print_log("HTTPResponse::handle_get(): Can't read file at: ",
+				resolved_path, "");
+			build_error_response();
+			return;
+		}
 		cgi_status = handle_cgi(request,
 				request_dir_root, request_dir_relative_to_root,
 				request_location_path, resolved_path);
@@ -555,34 +868,63 @@ void HTTPResponse::handle_get(const HTTPRequest &request,
 		}
 		return;
 	}
-	try
-	{
-		_response_body = read_file(resolved_path);
-	}
-	catch (const std::ios_base::failure &e)
+	fd = _root_dir->open_beneath(request_dir_relative_to_root, O_RDONLY);
+	if (fd == -1)
 	{
-		_status_code = 500;
-		print_warning("HTTPResponse::handle_get(): I/O error: ",
-			e.what(), "");
+		_status_code = errno_to_status_code(errno);
+		print_log("HTTPResponse::handle_get(): Can't read file at: ",
+			resolved_path, "");
 		build_error_response();
 		return;
 	}
-	_status_code = 200;
-	_headers["Content-Type"] = get_mime_type(resolved_path);
-	set_connection_header(request);
-	prep_payload();
-	print_log("Sending ", resolved_path, " to the server");
-}
-
-void HTTPResponse::handle_post(const HTTPRequest &request,
-		std::string &request_dir_root,
-		std::string &request_dir_relative_to_root,
-		std::string &request_location_path,
-		std::string &resolved_path)
-{
-	int cgi_status;
-
-	if (isDirectory(resolved_path))
+	if (fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode) && sb.st_size > 0)
+	{
+		// Body goes from the page cache to the socket
+		// with sendfile(), it's never read in here.
+		_body_fd = fd;
+		_body_offset = 0;
+		_splice_length = static_cast<size_t> (sb.st_size);
+		_headers["Content-Length"] = to_string(_splice_length);
+	}
+	else
+	{
+		try
+		{
+			_response_body = read_fd(fd);
+		}
+		catch (const std::ios_base::failure &e)
+		{
+			(void) close(fd);
+			_status_code = 500;
+			print_warning("HTTPResponse::handle_get(): I/O error: ",
+				e.what(), "");
+			build_error_response();
+			return;
+		}
+		(void) close(fd);
+	}
+	_status_code = 200;
+	// "X-Accel-Redirect" may have set it already.
+	if (_headers.find("Content-Type") == _headers.end())
+	{
+		_headers["Content-Type"] = StatCache::content_type(*_root_dir,
+			request_dir_relative_to_root, _server_cfg->getMimeTypes());
+	}
+	set_connection_header(request);
+	prep_payload();
+	print_log("Sending ", resolved_path, " to the server");
+}
+
+void HTTPResponse::handle_post(const HTTPRequest &request,
+		std::string &request_dir_root,
+		std::string &request_dir_relative_to_root,
+		std::string &request_location_path,
+		std::string &resolved_path)
+{
+	int cgi_status;
+	int fd;
+
+	if (_target_exists && S_ISDIR(_target_stat.st_mode))
 	{
 		if (request_dir_relative_to_root.length() > 0
 			&& request_dir_relative_to_root.at(
@@ -617,7 +959,7 @@ void HTTPResponse::handle_post(const HTTPRequest &request,
 			return;
 		}
 	}
-	if (!pathExists(resolved_path))
+	if (!_target_exists)
 	{
 		// Should it be 404 in this case?
 		generate_204('/' + request_dir_relative_to_root);
@@ -628,20 +970,17 @@ void HTTPResponse::handle_post(const HTTPRequest &request,
 	}
 	// At this point, `resolved_path` must be a file
 	// (at least not a directory).
-	else if (access(resolved_path.c_str(), R_OK) == -1)
-	{
-		_status_code = 403;
-		print_log("HTTPResponse::handle_post(): Can't read file at: ",
-			resolved_path, "");
-		build_error_response();
-		return;
-	}
-	if (_lp != NULL
-		&& std::find(_lp->getCgiExtension().begin(),
-			_lp->getCgiExtension().end(),
-			get_file_ext(resolved_path))
-			!= _lp->getCgiExtension().end())
+	if (_elp->getCgiInterpreter(get_file_ext(resolved_path)) != NULL)
 	{
+		// Interpreter opens the script by path itself.
+		if (access(resolved_path.c_str(), R_OK) == -1)
+		{
+			_status_code = 403;
+			print_log("HTTPResponse::handle_post(): Can't read file at: ",
+				resolved_path, "");
+			build_error_response();
+			return;
+		}
 		cgi_status = handle_cgi(request,
 				request_dir_root, request_dir_relative_to_root,
 				request_location_path, resolved_path);
@@ -652,20 +991,26 @@ void HTTPResponse::handle_post(const HTTPRequest &request,
 		}
 		return;
 	}
-	else if (access(resolved_path.c_str(), W_OK) == -1)
+	fd = _root_dir->open_beneath(request_dir_relative_to_root,
+			O_WRONLY | O_APPEND);
+	if (fd == -1)
 	{
-		_status_code = 403;
+		_status_code = errno_to_status_code(errno);
 		print_log("HTTPResponse::handle_post(): Can't write to file at: ",
 			resolved_path, "");
 		build_error_response();
 		return;
 	}
+	// File is about to change, its cached stat() is stale.
+	StatCache::invalidate(*_root_dir, request_dir_relative_to_root);
 	try
 	{
-		append_file(resolved_path, request.get_body());
+		request.write_body_to(fd);
+		(void) close(fd);
 	}
 	catch (const std::ios_base::failure &e)
 	{
+		(void) close(fd);
 		_status_code = 500;
 		print_warning("HTTPResponse::handle_post(): I/O error: ",
 			e.what(), "");
@@ -694,9 +1039,8 @@ void HTTPResponse::handle_delete(const HTTPRequest &request,
 		std::string &resolved_path)
 {
 	(void) request_dir_root;
-	int remove_status;
 
-	if (isDirectory(resolved_path))
+	if (_target_exists && S_ISDIR(_target_stat.st_mode))
 	{
 		if (request_dir_relative_to_root.length() > 0
 			&& request_dir_relative_to_root.at(
@@ -736,7 +1080,7 @@ void HTTPResponse::handle_delete(const HTTPRequest &request,
 			return;
 		}
 	}
-	if (!pathExists(resolved_path))
+	if (!_target_exists)
 	{
 		// Should it be 204 in this case?
 		_status_code = 404;
@@ -745,26 +1089,15 @@ void HTTPResponse::handle_delete(const HTTPRequest &request,
 		build_error_response();
 		return;
 	}
-	errno = 0;
-	if ((remove_status = std::remove(resolved_path.c_str())) != 0)
+	if (_root_dir->unlink_beneath(request_dir_relative_to_root) != 0)
 	{
-		if (remove_status == EACCES || errno == EACCES)
-		{
-			_status_code = 403;
-			print_log("Got DELETE request to delete: ",
-				resolved_path, " - permission denied");
-			build_error_response();
-			return;
-		}
-		else
-		{
-			_status_code = 500;
-			print_log("Got DELETE request to delete: ",
-				resolved_path, " - error other than EACCES");
-			build_error_response();
-			return;
-		}
+		_status_code = errno_to_status_code(errno);
+		print_log("Got DELETE request to delete: ", resolved_path,
+			std::string(" - ") + strerror(errno));
+		build_error_response();
+		return;
 	}
+	StatCache::invalidate(*_root_dir, request_dir_relative_to_root);
 	generate_204('/' + request_dir_relative_to_root);
 	set_connection_header(request);
 	prep_payload();
@@ -778,35 +1111,26 @@ void HTTPResponse::handle_put(const HTTPRequest &request,
 		std::string &resolved_path)
 {
 	bool file_exists = false;
-	std::ofstream file;
+	int status_code;
+	int fd;
 
 	// Handling "upload_path" config directive.
-	if (_lp != NULL && !_lp->getUploadPath().empty())
+	if (!_elp->upload_root.empty())
 	{
 		// This is kinda weird to set
-		// `request_dir_root` to `_lp->_upload_path`,
+		// `request_dir_root` to the upload path,
 		// but everything works, so...
-		request_dir_root = _lp->getUploadPath();
-		if (request_dir_root.at(request_dir_root.length() - 1) != '/')
+		request_dir_root = _elp->upload_root;
+		resolved_path = request_dir_root + request_dir_relative_to_root;
+		_root_dir = _elp->upload_dir;
+		if ((status_code = resolve_target(request_dir_relative_to_root)) != 0)
 		{
-			request_dir_root.push_back('/');
-		}
-		try
-		{
-			resolved_path = this->resolve_path(request_dir_root,
-					request_dir_relative_to_root);
-		}
-		catch (const directory_traversal_detected &e)
-		{
-			print_err("Detected directory traversal attempt: ",
-				e.what(), "");
-			// I guess 403 or 406 is good in this case?
-			_status_code = 403;
+			_status_code = status_code;
 			build_error_response();
 			return;
 		}
 	}
-	if (isDirectory(resolved_path))
+	if (_target_exists && S_ISDIR(_target_stat.st_mode))
 	{
 		if (request_dir_relative_to_root.length() > 0
 			&& request_dir_relative_to_root.at(
@@ -828,38 +1152,33 @@ void HTTPResponse::handle_put(const HTTPRequest &request,
 			return;
 		}
 	}
-	if (pathExists(resolved_path))
+	file_exists = _target_exists;
+	fd = _root_dir->open_beneath(request_dir_relative_to_root,
+			O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1)
 	{
-		file_exists = true;
-		if (access(resolved_path.c_str(), W_OK) == -1)
-		{
-			_status_code = 403;
-			print_log("Got PUT request to: ",
-				resolved_path.c_str(),
-				" - insufficient permissions");
-				build_error_response();
-			return;
-		}
-	}
-	file.open(resolved_path.c_str(), std::ios::trunc);
-	if (!file.is_open())
-	{
-		_status_code = 500;
-		print_warning("PUT: Couldn't create or write open w/ trunc: ",
-			resolved_path.c_str(), "");
+		_status_code = errno_to_status_code(errno);
+		print_log("Got PUT request to: ", resolved_path,
+			std::string(" - ") + strerror(errno));
 		build_error_response();
 		return;
 	}
-	file << request.get_body();
-	if (!file.good())
+	// File is about to change, its cached stat() is stale.
+	StatCache::invalidate(*_root_dir, request_dir_relative_to_root);
+	try
+	{
+		request.write_body_to(fd);
+		(void) close(fd);
+	}
+	catch (const std::ios_base::failure &e)
 	{
+		(void) close(fd);
 		_status_code = 500;
 		print_warning("PUT: Got I/O error while writing to: ",
 			resolved_path.c_str(), "");
 		build_error_response();
 		return;
 	}
-	file.close();
 	generate_204('/' + request_dir_relative_to_root);
 	if (!file_exists)
 	{
@@ -889,36 +1208,25 @@ void HTTPResponse::generate_204(const std::string &content_location)
 
 int HTTPResponse::find_first_available_index(
 		std::string &request_dir_root,
-		std::string &request_dir_relative_to_root) const
+		std::string &request_dir_relative_to_root)
 {
-	const std::vector<std::string> *indexes = NULL;
-	std::string index_path;
+	const std::vector<std::string> *indexes = &(_elp->index);
+	struct stat sb;
 
-	if (_lp != NULL)
-	{
-		indexes = &(_lp->getIndexLocation());
-		if (indexes->size() == 0)
-		{
-			indexes = &(_server_cfg->getIndex());
-		}
-	}
-	else
-	{
-		indexes = &(_server_cfg->getIndex());
-	}
+	(void) request_dir_root;
 	for (size_t i = 0; i < indexes->size(); i++)
 	{
 		if ((indexes->at(i)).compare(0,
 				request_dir_relative_to_root.length(),
 				request_dir_relative_to_root) == 0)
 		{
-			index_path = request_dir_root + indexes->at(i);
-			if (isRegFile(index_path)
-				&& access(index_path.c_str(), R_OK) == 0)
+			if (StatCache::lookup(*_root_dir, indexes->at(i), sb) == 0
+				&& S_ISREG(sb.st_mode))
 			{
 				// Instead of writing an append logic,
 				// it's easier just to copy the whole index path.
 				request_dir_relative_to_root = indexes->at(i);
+				_target_stat = sb;
 				return 0;
 			}
 		}
@@ -926,59 +1234,50 @@ int HTTPResponse::find_first_available_index(
 	return -1;
 }
 
-void HTTPResponse::generate_auto_index(const std::string &path)
+void HTTPResponse::generate_auto_index(const std::string &relative_path,
+		const HTTPRequest &request)
 {
-	DIR *dir;
-	struct dirent *dir_ent;
-	// If there are no available entries (file or directories)
-	// in `path`, state that in the response clearly.
-	bool have_at_least_one_entry = false;
+	std::string query;
+	AutoIndex *index;
 
-	_status_code = 200;
-	_headers["Content-Type"] = "text/html";
-	dir = opendir(path.c_str());
-	if (dir == NULL)
-	{
-		throw std::ios_base::failure(std::string("HTTPResponse::generate_auto_index: ")
-				+ "Couldn't open the directory at: " + path);
-	}
-	errno = 0;
-	_response_body = "<html>\n";
-	_response_body += "<head>\n";
-	_response_body += "<title>Index</title>\n";
-	_response_body += "</head>\n";
-	_response_body += "<body>\n";
-	while ((dir_ent = readdir(dir)) != NULL)
-	{
-		// Let's skip those, ok?
-		if (strcmp(dir_ent->d_name, ".") == 0
-			|| strcmp(dir_ent->d_name, "..") == 0)
-		{
-			continue;
-		}
-		_response_body += "<a href=\"";
-		_response_body += + dir_ent->d_name;
-		_response_body += "\">";
-		_response_body += dir_ent->d_name;
-		_response_body += "</a><br />\n";
-		have_at_least_one_entry = true;
-	}
-	if (errno != 0)
+	try
 	{
-		throw std::ios_base::failure(std::string("HTTPResponse::generate_auto_index: ")
-				+ "Couldn't read the directory at: " + path);
+		query = request.get_request_query_original();
 	}
-	else if (closedir(dir) == -1)
+	catch (const std::runtime_error &e)
 	{
-		throw std::ios_base::failure(std::string("HTTPResponse::generate_auto_index: ")
-				+ "Couldn't close the directory at: " + path);
+		// There is no query in the request.
 	}
-	if (!have_at_least_one_entry)
+	index = new AutoIndex(*_root_dir, relative_path, _target_stat,
+		request.get_request_path_decoded(),
+		query, _elp->autoindex_options);
+	_status_code = 200;
+	_headers["Content-Type"] = index->get_content_type();
+	// Batches of the listing are rendered as the response is being sent.
+	this->set_body_producer(index);
+}
+
+void HTTPResponse::append_chunk(std::string &out, const std::string &data)
+{
+	std::ostringstream size;
+
+	size << std::hex << data.length();
+	out += size.str() + "\r\n";
+	out += data;
+	// Last chunk (of size 0) is followed by an empty trailer.
+	out += "\r\n";
+	if (data.empty())
 	{
-		_response_body += "<b>No entries</b> in this directory.<br />\n";
+		out += "\r\n";
 	}
-	_response_body += "</body>\n";
-	_response_body += "</html>\n";
+}
+
+void HTTPResponse::append_chunk_header(std::string &out, size_t length)
+{
+	std::ostringstream size;
+
+	size << std::hex << length;
+	out += size.str() + "\r\n";
 }
 
 void HTTPResponse::set_connection_header(const HTTPRequest &request)
@@ -1019,290 +1318,981 @@ int HTTPResponse::handle_cgi(const HTTPRequest &request,
 		std::string &request_location_path,
 		std::string &resolved_path)
 {
-	time_t current_time;
-	pid_t waitpid_code;
-	int waitpid_status;
-	int child_exit_status;
+	int status_code;
 
-	if (pipe(_cgi_pipe) == -1)
+	(void) request_dir_root;
+	(void) request_dir_relative_to_root;
+	(void) request_location_path;
+	// RFC 3875, 5: output of "nph-" scripts is the whole response.
+	_cgi_nph = resolved_path.compare(resolved_path.rfind('/') + 1, 4, "nph-") == 0;
+	if ((status_code = lookup_cgi_cache(request, resolved_path)) != 0)
 	{
-		print_warning("HTTPResponse::handle_cgi(): pipe() fail", "", "");
-		return 500;
+		return (status_code == -1) ? 0 : status_code;
 	}
-	_cgi_launch_time = std::time(NULL);
-	if ((_cgi_pid = fork()) == -1)
+	if (_elp->cgi_pool_workers > 0)
 	{
-		print_warning("HTTPResponse::handle_cgi(): fork() fail", "", "");
-		(void) close(_cgi_pipe[0]);
-		(void) close(_cgi_pipe[1]);
-		return 500;
+		// We don't check if `getCgiInterpreter()` returns NULL
+		// to us, since this method should only be called when
+		// it's found out that the extension of a file at
+		// \p resolved_path is a CGI extension of `_elp`.
+		return handle_pooled_cgi(request,
+				*_elp->getCgiInterpreter(get_file_ext(resolved_path)),
+				resolved_path);
 	}
-	else if (_cgi_pid == 0)
-	{
-		(void) request_dir_root;
-		(void) close(_cgi_pipe[0]);
-		_cgi_pipe[0] = -1;
-		this->cgi(request, resolved_path);
-	}
-	(void) close(_cgi_pipe[1]);
-	_cgi_pipe[1] = -1;
-	for (;;)
-	{
-		current_time = std::time(NULL);
-		waitpid_code = waitpid(_cgi_pid, &waitpid_status, WNOHANG);
-		// waitpid() fail.
-		if (waitpid_code == -1)
-		{
-			print_warning("HTTPResponse::handle_cgi(): waitpid() fail",
-				"", "");
-			// SIGKILL is better than SIGTERM,
-			// since it may kill the process
-			// if it's frozen and doesn't respond to SIGTERM.
-			(void) kill(_cgi_pid, SIGKILL);
-			_cgi_pid = -1;
-			(void) close(_cgi_pipe[0]);
-			_cgi_pipe[0] = -1;
-			return 500;
-		}
-		// Child exited.
-		else if (waitpid_code == _cgi_pid
-			&& WIFEXITED(waitpid_status))
+	else if (_elp->cgi_max_concurrent > 0)
+	{
+		return queue_cgi(request, resolved_path);
+	}
+	return spawn_cgi(request, resolved_path, false);
+}
+
+int HTTPResponse::spawn_cgi(const HTTPRequest &request,
+		const std::string &resolved_path, bool slot)
+{
+	const std::string *interpreter
+		= _elp->getCgiInterpreter(get_file_ext(resolved_path));
+	CGIProcess *process;
+	std::vector<std::string> vars;
+	std::vector<char *> argv;
+	std::vector<char *> envp;
+
+	if (!cgi_prep_vars(request, vars))
+	{
+		print_warning("HTTPResponse::spawn_cgi(): cgi_prep_vars() fail", "", "");
+		if (slot)
 		{
-			_cgi_pid = -1;
-			child_exit_status = WEXITSTATUS(waitpid_status);
-			if (child_exit_status != 0)
-			{
-				(void) close(_cgi_pipe[0]);
-				return 502;
-			}
-			break;
+			CGILimiter::release(_elp);
 		}
-		// Child is running for longer than it's allowed to.
-		else if (current_time - _cgi_launch_time > _MAX_CGI_TIME)
+		return 500;
+	}
+	// posix_spawn() copies them into the child,
+	// so they may point into strings owned by someone else.
+	argv.push_back(const_cast<char *> (interpreter->c_str()));
+	argv.push_back(const_cast<char *> (resolved_path.c_str()));
+	argv.push_back(NULL);
+	// Only request's own variables are added
+	// to what was prepared for the location at startup.
+	envp.reserve(_elp->cgi_environment.size()
+		+ _elp->cgi_static_vars.size() + vars.size() + 1);
+	append_c_strings(envp, _elp->cgi_environment);
+	append_c_strings(envp, _elp->cgi_static_vars);
+	append_c_strings(envp, vars);
+	envp.push_back(NULL);
+	delete _cgi;
+	_cgi = NULL;
+	process = new CGIProcess();
+	process->set_rlimits(_elp->cgi_rlimits);
+	process->set_script(resolved_path, request.get_id());
+	if (slot)
+	{
+		// Given back even if the script can't be started.
+		process->hold_slot(_elp);
+	}
+	try
+	{
+		// Big bodies are fed from the file they were spooled to.
+		process->start(*interpreter, &argv[0], &envp[0], request.get_body(),
+			request.get_body_fd(), _MAX_CGI_TIME);
+	}
+	catch (const std::runtime_error &e)
+	{
+		// Including an interpreter that can't be executed.
+		print_warning(e.what(), "", "");
+		delete process;
+		return 502;
+	}
+	_cgi = process;
+	_cgi_running = true;
+	_cgi_script = resolved_path;
+	return 0;
+}
+
+int HTTPResponse::queue_cgi(const HTTPRequest &request,
+		const std::string &resolved_path)
+{
+	CGISlotWait *wait;
+
+	if (CGILimiter::acquire(_elp))
+	{
+		return spawn_cgi(request, resolved_path, true);
+	}
+	delete _cgi;
+	_cgi = NULL;
+	wait = new CGISlotWait();
+	try
+	{
+		if (!wait->start(_elp, _elp->cgi_queue_timeout))
 		{
-			print_warning("HTTPResponse::handle_cgi(): CGI hangup at script: ",
-				 request_location_path + request_dir_relative_to_root,
-				 "");
-			(void) kill(_cgi_pid, SIGKILL);
-			_cgi_pid = -1;
-			(void) close(_cgi_pipe[0]);
-			_cgi_pipe[0] = -1;
-			return 504;
+			// Turned away right away (see `build_error_response()`).
+			delete wait;
+			_cgi_busy = true;
+			return 503;
 		}
 	}
+	catch (const std::runtime_error &e)
+	{
+		print_warning(e.what(), "", "");
+		delete wait;
+		return 500;
+	}
+	_cgi = wait;
+	_cgi_running = true;
+	_cgi_queued = true;
+	_cgi_script = resolved_path;
+	return 0;
+}
+
+int HTTPResponse::handle_pooled_cgi(const HTTPRequest &request,
+		const std::string &interpreter, const std::string &resolved_path)
+{
+	std::vector<std::string> vars(_elp->cgi_static_vars);
+	CGIWorkerPool::Key pool;
+	PooledCGIRequest *pooled;
+
+	if (!cgi_prep_vars(request, vars))
+	{
+		print_warning("HTTPResponse::handle_pooled_cgi(): cgi_prep_vars() fail", "", "");
+		return 500;
+	}
+	delete _cgi;
+	_cgi = NULL;
+	pool.interpreter = interpreter;
+	pool.script = resolved_path;
+	pool.max_workers = _elp->cgi_pool_workers;
+	pool.max_requests = _elp->cgi_pool_max_requests;
+	pool.rlimits = _elp->cgi_rlimits;
+	pooled = new PooledCGIRequest();
 	try
 	{
-		this->copy_child_output_to_payload();
+		pooled->start(pool, vars, request.get_body(),
+			request.get_body_fd(), request.get_body_length(), _MAX_CGI_TIME);
 	}
 	catch (const std::runtime_error &e)
 	{
-		print_warning("Couldn't copy child's output to payload: ", e.what(), "");
-		(void) close(_cgi_pipe[0]);
+		print_warning(e.what(), "", "");
+		delete pooled;
 		return 500;
 	}
-	(void) close(_cgi_pipe[0]);
-	_cgi_pipe[0] = -1;
-	_headers["Connection"] = "close";
-	_payload_ready = true;
+	_cgi = pooled;
+	_cgi_running = true;
+	_cgi_script = resolved_path;
+	return 0;
+}
+
+int HTTPResponse::handle_fastcgi(const HTTPRequest &request,
+		const std::string &request_dir_root,
+		const std::string &resolved_path)
+{
+	std::vector<std::string> params(_elp->cgi_static_vars);
+	FastCGIRequest *fastcgi;
+	int status_code;
+
+	if ((status_code = lookup_cgi_cache(request, resolved_path)) != 0)
+	{
+		return (status_code == -1) ? 0 : status_code;
+	}
+	else if (!cgi_prep_vars(request, params))
+	{
+		print_warning("HTTPResponse::handle_fastcgi(): cgi_prep_vars() fail", "", "");
+		return 500;
+	}
+	params.push_back("SCRIPT_FILENAME=" + resolved_path);
+	params.push_back("DOCUMENT_ROOT=" + request_dir_root);
+	params.push_back("REQUEST_URI=" + request.get_request_target());
+	delete _cgi;
+	_cgi = NULL;
+	fastcgi = new FastCGIRequest();
+	try
+	{
+		fastcgi->start(_elp->fastcgi_pass, params, request.get_body(),
+			request.get_body_fd(), _MAX_CGI_TIME);
+	}
+	catch (const std::runtime_error &e)
+	{
+		print_warning(e.what(), "", "");
+		delete fastcgi;
+		return 502;
+	}
+	_cgi = fastcgi;
+	_cgi_running = true;
+	_cgi_script = resolved_path;
+	print_log("Passing ", resolved_path, " to " + _elp->fastcgi_pass.name);
 	return 0;
 }
 
-void HTTPResponse::copy_child_output_to_payload()
+int HTTPResponse::handle_proxy(const HTTPRequest &request)
 {
-	// 2 KiB buffer to copy child's output to payload.
-	enum { BUFFER_SIZE = 2048 };
-	char buffer[BUFFER_SIZE];
+	ProxyRequest *proxy;
+
+	delete _cgi;
+	_cgi = NULL;
+	proxy = new ProxyRequest();
+	try
+	{
+		proxy->start(_elp->proxy_pass, request, _MAX_CGI_TIME);
+	}
+	catch (const std::runtime_error &e)
+	{
+		print_warning(e.what(), "", "");
+		delete proxy;
+		return 502;
+	}
+	_cgi = proxy;
+	_cgi_running = true;
+	// Named in warnings about the output.
+	_cgi_script = _elp->proxy_pass.name;
+	print_log("Passing ", request.get_request_target(), " to " + _elp->proxy_pass.name);
+	return 0;
+}
+
+/**
+ * Get the value of \p item of "cgi_cache_key" for \p request.
+ */
+static std::string cgi_cache_key_item(const HTTPRequest &request,
+		const std::string &item)
+{
+	const std::map<std::string, std::string> &fields = request.get_header_fields();
+	std::string name;
+
+	if (item == "$request_method")
+	{
+		return (request.get_method() == HTTPRequest::GET) ? "GET" : "";
+	}
+	else if (item == "$uri")
+	{
+		return request.get_request_path_decoded();
+	}
+	else if (item == "$args")
+	{
+		try
+		{
+			return request.get_request_query_original();
+		}
+		catch (const std::runtime_error &e)
+		{
+			// There is no query in the request.
+			return "";
+		}
+	}
+	// "$http_accept_language" is "Accept-Language".
+	name = item.substr(6);
+	std::replace(name.begin(), name.end(), '_', '-');
+	for (std::map<std::string, std::string>::const_iterator it = fields.begin();
+		it != fields.end(); ++it)
+	{
+		if (strcasecmp(it->first.c_str(), name.c_str()) == 0)
+		{
+			return it->second;
+		}
+	}
+	return "";
+}
+
+int HTTPResponse::lookup_cgi_cache(const HTTPRequest &request,
+		const std::string &resolved_path)
+{
+	CGICacheWait *wait;
+	std::string output;
+	std::string key;
+
+	if (_elp->cgi_cache_ttl == 0 || _cgi_nph
+		|| request.get_method() != HTTPRequest::GET)
+	{
+		return 0;
+	}
+	_cgi_script = resolved_path;
+	key = resolved_path;
+	for (size_t i = 0; i < _elp->cgi_cache_key.size(); i++)
+	{
+		key += '\n' + cgi_cache_key_item(request, _elp->cgi_cache_key[i]);
+	}
+	if (_cache_refresh)
+	{
+		// Entry was given to the refresh already
+		// (unless the request is routed elsewhere now).
+		if (_cache_leader && key != _cache_key)
+		{
+			CGICache::abandon(_cache_key);
+		}
+		_cache_key = key;
+		_cache_leader = true;
+		return 0;
+	}
+	_cache_key = key;
+	switch (CGICache::lookup(_cache_key, std::time(NULL), output))
+	{
+		case CGICache::LOOKUP_MISS:
+			_cache_leader = true;
+			return this->lookup_disk_cache(request);
+		case CGICache::LOOKUP_BYPASS:
+			return 0;
+		case CGICache::LOOKUP_WAIT:
+			delete _cgi;
+			_cgi = NULL;
+			wait = new CGICacheWait();
+			try
+			{
+				wait->start(_cache_key, _MAX_CGI_TIME);
+			}
+			catch (const std::runtime_error &e)
+			{
+				print_warning(e.what(), "", "");
+				delete wait;
+				return 500;
+			}
+			// Stored output is handled like the script's own.
+			_cgi = wait;
+			_cgi_running = true;
+			return -1;
+		case CGICache::LOOKUP_STALE:
+			_cache_stale = true;
+			break;
+		case CGICache::LOOKUP_HIT:
+			break;
+	}
+	// Only complete outputs with a valid header are stored.
+	if (parse_cgi_header(output) != 0 || !_local_redirect.empty())
+	{
+		_local_redirect.clear();
+		return 502;
+	}
+	_headers.erase("Content-Length");
+	_response_body.swap(output);
+	this->set_connection_header(request);
+	this->prep_payload();
+	return -1;
+}
+
+int HTTPResponse::lookup_disk_cache(const HTTPRequest &request)
+{
+	// Header block (and whole small entries) fits in one read.
+	enum { READ_BLOCK_SIZE = 16384 };
+	char buffer[READ_BLOCK_SIZE];
+	time_t now = std::time(NULL);
+	time_t expires;
+	off_t offset;
+	size_t length;
+	std::string output;
+	std::string body;
 	ssize_t n;
+	int fd;
+	int status = -1;
+
+	if (_elp->disk_cache == NULL
+		|| (fd = _elp->disk_cache->lookup(_cache_key, now, expires, offset,
+				length)) == -1)
+	{
+		return 0;
+	}
+	// Only the header block is read, the body goes from the file.
+	while (status == -1 && output.length() < length
+		&& output.length() <= _MAX_CGI_HEADER_SIZE)
+	{
+		n = pread(fd, buffer, std::min(sizeof(buffer), length - output.length()),
+			offset + static_cast<off_t> (output.length()));
+		if (n <= 0)
+		{
+			print_warning("HTTPResponse::lookup_disk_cache(): Can't read the entry of ",
+				_cgi_script, std::string(": ")
+				+ ((n == 0) ? "It's truncated" : strerror(errno)));
+			(void) close(fd);
+			return 0;
+		}
+		output.append(buffer, static_cast<size_t> (n));
+		body = output;
+		status = parse_cgi_header(body);
+	}
+	if (status != 0 || !_local_redirect.empty())
+	{
+		_local_redirect.clear();
+		(void) close(fd);
+		return 0;
+	}
+	_cache_leader = false;
+	_headers.erase("Content-Length");
+	if (output.length() == length)
+	{
+		// Entry was read whole: requests waiting for it
+		// (and the later ones) take it from memory.
+		(void) close(fd);
+		CGICache::store(_cache_key, output, now, expires - now, _elp->cgi_cache_stale);
+		_response_body.swap(body);
+	}
+	else
+	{
+		// Waiting requests find it on disk as well.
+		CGICache::abandon(_cache_key);
+		// Body goes from the page cache to the socket, like static files.
+		_body_fd = fd;
+		_body_offset = offset + static_cast<off_t> (output.length() - body.length());
+		_splice_length = length - (output.length() - body.length());
+		_headers["Content-Length"] = to_string(_splice_length);
+	}
+	this->set_connection_header(request);
+	this->prep_payload();
+	return -1;
+}
+
+void HTTPResponse::fill_cgi_cache(const std::string &output, bool complete)
+{
+	HTTPResponse parsed;
+	std::string body(output);
+	time_t now = std::time(NULL);
+	time_t ttl = _elp->cgi_cache_ttl;
+	time_t stale = _elp->cgi_cache_stale;
+	bool cacheable = true;
+	std::map<std::string, std::string>::const_iterator it;
 
-	for (;;)
+	_cache_leader = false;
+	if (!complete && _cgi->is_finished())
+	{
+		CGICache::abandon(_cache_key);
+		return;
+	}
+	else if (!complete || _cgi_nph || output.compare(0, 5, "HTTP/") == 0)
+	{
+		// Too big to keep in memory, or not ours to parse.
+		CGICache::pass(_cache_key, now, ttl);
+		return;
+	}
+	// Response itself is prepared from `output` later.
+	parsed._cgi_script = _cgi_script;
+	if (parsed.parse_cgi_header(body) != 0)
+	{
+		CGICache::abandon(_cache_key);
+		return;
+	}
+	cacheable = parsed._local_redirect.empty() && (parsed._status_code == 200
+		|| parsed._status_code == 301 || parsed._status_code == 302);
+	for (it = parsed._headers.begin(); cacheable && it != parsed._headers.end(); ++it)
 	{
-		n = read(_cgi_pipe[0], buffer, BUFFER_SIZE);
-		if (n == -1)
+		if (strcasecmp(it->first.c_str(), "Set-Cookie") == 0)
 		{
-			throw std::runtime_error(std::string("HTTPResponse::copy_child_output_to_payload(): ")
-					+ "read() fail.");
+			cacheable = false;
 		}
-		_payload.append(buffer, static_cast<size_t> (n));
-		if (n < BUFFER_SIZE)
+		else if (strcasecmp(it->first.c_str(), "Cache-Control") == 0)
 		{
-			// Finished reading.
-			return;
+			cacheable = CGICache::parse_cache_control(it->second, ttl, stale);
 		}
 	}
+	if (!cacheable || ttl <= 0)
+	{
+		CGICache::pass(_cache_key, now, _elp->cgi_cache_ttl);
+		return;
+	}
+	CGICache::store(_cache_key, output, now, ttl, stale);
+	if (_elp->disk_cache != NULL)
+	{
+		_elp->disk_cache->store(_cache_key, output, now + ttl);
+	}
+}
+
+bool HTTPResponse::has_running_cgi() const
+{
+	return _cgi != NULL && _cgi_running;
+}
+
+const CGIBackend *HTTPResponse::get_cgi() const
+{
+	return _cgi;
+}
+
+bool HTTPResponse::handle_cgi_event(int fd)
+{
+	bool watch;
+
+	if (!has_running_cgi())
+	{
+		return false;
+	}
+	watch = _cgi->handle_event(fd);
+	this->process_cgi_output();
+	return watch;
 }
 
-void HTTPResponse::cgi(const HTTPRequest &request, std::string &resolved_path)
+void HTTPResponse::release_cgi_fd(int fd)
 {
-	// To redirect `_response_body` to stdin.
-	int redir_stdin[2];
-	ssize_t n = 0, written;
-	// Actual data required for CGI execution.
-	size_t cgi_path_index;
-	// std::auto_ptr may be unreliable
-	// and std::unique_ptr in unavailable in C++98.
-	char ** argv, ** envp;
-
-	if (pipe(redir_stdin) == -1)
-	{
-		print_err("HTTPResponse::cgi(): pipe() failed", "", "");
-		(void) close(_cgi_pipe[1]);
-		std::exit(EXIT_FAILURE);
-	}
-	while (static_cast<size_t> (n) < request.get_body().length())
-	{
-		written = write(redir_stdin[1], request.get_body().c_str() + n,
-				request.get_body().length() -
-					static_cast<size_t> (n));
-		if (written == -1)
-		{
-			print_err("HTTPResponse::cgi(): write() failed: ",
-				"Couldn't copy _response_body to stdin", "");
-			(void) close(_cgi_pipe[1]);
-			(void) close(redir_stdin[0]);
-			(void) close(redir_stdin[1]);
-			std::exit(EXIT_FAILURE);
-		}
-		n += written;
-	}
-	(void) close(redir_stdin[1]);
-	if (dup2(redir_stdin[0], STDIN_FILENO) == -1
-		|| dup2(_cgi_pipe[1], STDOUT_FILENO) == -1)
-	{
-		print_err("HTTPResponse::cgi(): dup2() failed", "", "");
-		(void) close(_cgi_pipe[1]);
-		(void) close(redir_stdin[0]);
-		std::exit(EXIT_FAILURE);
-	}
-	(void) close(_cgi_pipe[1]);
-	(void) close(redir_stdin[0]);
-	// We don't check if std::find() returns `_lp->getCgiExtension().end()`
-	// to us, since this method is called by `handle_cgi()`,
-	// which in turn should only be called when it's found out
-	// that the extension of a file at \p resolved_path
-	// belongs to `_lp->_cgi_ext`.
-	cgi_path_index = static_cast<size_t> (
-			std::find(_lp->getCgiExtension().begin(),
-				_lp->getCgiExtension().end(),
-				get_file_ext(resolved_path))
-			- _lp->getCgiExtension().begin());
-	argv = cgi_prep_argv(_lp->getCgiPath().at(cgi_path_index), resolved_path);
-	print_log("About to execve() from child. Bye-bye world!", "", "");
-	if (argv == NULL)
-	{
-		print_err("HTTPResponse::cgi(): cgi_prep_argv() failed", "", "");
-		std::exit(EXIT_FAILURE);
-	}
-	else if ((envp = cgi_prep_envp(request)) == NULL)
-	{
-		print_err("HTTPResponse::cgi(): cgi_prep_envp() failed", "", "");
-		this->cgi_free_argv_like_array(argv);
-		std::exit(EXIT_FAILURE);
-	}
-	else if (execve(_lp->getCgiPath().at(cgi_path_index).c_str(),
-			argv, envp) == -1)
-	{
-		print_err("HTTPResponse::cgi(): execve() failed", "", "");
-		this->cgi_free_argv_like_array(argv);
-		this->cgi_free_argv_like_array(envp);
-		std::exit(EXIT_FAILURE);
+	if (_cgi != NULL)
+	{
+		_cgi->close_fd(fd);
 	}
 }
 
-/*
-size_t HTTPResponse::cgi_get_path_index(const std::string &resolved_path) const
+bool HTTPResponse::check_cgi(time_t now)
 {
-	std::string request_file_ext;
-	size_t ret;
+	if (!has_running_cgi())
+	{
+		return false;
+	}
+	_cgi->poll();
+	if (_cgi->is_expired(now) && _cgi_queued)
+	{
+		print_warning("HTTPResponse::check_cgi(): No CGI slot in time for script: ",
+			_cgi_script, "");
+		_cgi_busy = true;
+		this->abort_cgi(503);
+	}
+	else if (_cgi->is_expired(now))
+	{
+		print_warning("HTTPResponse::check_cgi(): CGI hangup at script: ",
+			_cgi_script, "");
+		this->abort_cgi(504);
+	}
+	else
+	{
+		this->process_cgi_output();
+	}
+	return !has_running_cgi() || _payload_ready;
+}
 
-	request_file_ext = get_file_ext(resolved_path);
-	// It's up to you to ensure that `request_file_ext`
-	// exists in `_lp->_cgi_ext`.
-	for (ret= 0; ret < _lp->getCgiExtension().size(); ret++)
+void HTTPResponse::abort_cgi(int status_code)
+{
+	if (!has_running_cgi())
+	{
+		return;
+	}
+	_cgi->abort();
+	_cgi_running = false;
+	if (_payload_ready)
 	{
-		const std::string &current_cgi_ext = _lp->getCgiExtension().at(
-				ret);
+		// Header is sent already: the body producer fails
+		// and the connection is dropped.
+		return;
+	}
+	_status_code = status_code;
+	build_error_response();
+}
+
+void HTTPResponse::process_cgi_output()
+{
+	std::string &output = _cgi->get_output();
+	bool finished = _cgi->is_finished();
+	int status_code;
 
-		if (current_cgi_ext.compare(0, request_file_ext.length(),
-					request_file_ext) == 0)
+	if (finished)
+	{
+		_cgi_running = false;
+	}
+	if (_cgi_queued)
+	{
+		// There's no output, the script is run
+		// once the slot is handed over (see `start_queued_cgi()`).
+		return;
+	}
+	if (_payload_ready || !_local_redirect.empty())
+	{
+		// The rest of the body is pulled by the producer.
+		return;
+	}
+	if (_cache_leader)
+	{
+		if (!finished && output.length() < CGIBackend::MAX_BUFFERED_OUTPUT)
+		{
+			// Whole output is stored at once.
+			return;
+		}
+		this->fill_cgi_cache(output, finished && _cgi->succeeded());
+		if (_cache_refresh && !finished)
+		{
+			// Nobody would take the rest of it.
+			_cgi->abort();
+			_cgi_running = false;
+			return;
+		}
+	}
+	else if (finished && !_cgi->succeeded()
+		&& dynamic_cast<CGICacheWait *> (_cgi) != NULL
+		&& dynamic_cast<CGICacheWait *> (_cgi)->should_retry())
+	{
+		// Entry wasn't filled after all: the request is handled
+		// again (the script may be run this time).
+		_local_redirect = _request->get_request_target();
+		return;
+	}
+	if (finished && !_cgi->succeeded())
+	{
+		_status_code = 502;
+		build_error_response();
+		return;
+	}
+	else if (!finished && output.length() < 5)
+	{
+		// Too short to tell whether it starts with "HTTP/".
+		return;
+	}
+	// Scripts written for servers that pass their output as is
+	// print the status line themselves.
+	if (_cgi_nph || output.compare(0, 5, "HTTP/") == 0)
+	{
+		_headers["Connection"] = "close";
+		_payload.clear();
+		_cgi_passthrough = _cgi->start_passthrough();
+		if (!_cgi_passthrough)
+		{
+			_body_producer = new CGIBodyProducer(*_cgi);
+		}
+		_payload_ready = true;
+		return;
+	}
+	status_code = parse_cgi_header(output);
+	if (status_code == -1 && (finished || output.length() > _MAX_CGI_HEADER_SIZE))
+	{
+		print_warning("HTTPResponse::process_cgi_output(): No header from script: ",
+			_cgi_script, "");
+		status_code = 502;
+	}
+	if (status_code == -1)
+	{
+		return;
+	}
+	else if (status_code != 0 || !_local_redirect.empty())
+	{
+		// Nothing else of the script's output is needed.
+		_cgi->abort();
+		_cgi_running = false;
+		if (status_code != 0)
+		{
+			_status_code = status_code;
+			build_error_response();
+		}
+		return;
+	}
+	_headers["Connection"] = "close";
+	if (finished)
+	{
+		// Whole body is here already.
+		_headers.erase("Content-Length");
+		_response_body.swap(output);
+		this->prep_payload();
+		return;
+	}
+	if (_cgi->start_passthrough())
+	{
+		// Rest of the output is spliced to the client as it comes.
+		_cgi_passthrough = true;
+		_headers["Transfer-Encoding"] = "chunked";
+	}
+	else
+	{
+		this->set_body_producer(new CGIBodyProducer(*_cgi));
+	}
+	if (_headers.find("Content-Length") != _headers.end())
+	{
+		// Script knows the length, no need for chunks.
+		_headers.erase("Transfer-Encoding");
+	}
+	this->prep_payload();
+}
+
+int HTTPResponse::parse_cgi_header(std::string &output)
+{
+	std::map<std::string, std::string> fields;
+	std::string::size_type pos = 0;
+	std::string::size_type eol;
+	std::string::size_type colon;
+	std::string line;
+	std::string name;
+	std::string value;
+	std::string location;
+	std::string accel_redirect;
+	std::string reason;
+	int status_code = 0;
+	char *end;
+
+	// Lines end with "\n" (or "\r\n"), the header with an empty one.
+	while ((eol = output.find('\n', pos)) != std::string::npos)
+	{
+		line = output.substr(pos, eol - pos);
+		pos = eol + 1;
+		if (!line.empty() && line.at(line.length() - 1) == '\r')
+		{
+			line.erase(line.length() - 1);
+		}
+		if (line.empty())
 		{
 			break;
 		}
+		colon = line.find(':');
+		if (colon == 0 || colon == std::string::npos)
+		{
+			print_warning("HTTPResponse::parse_cgi_header(): Malformed header line from ",
+				_cgi_script, ": " + line);
+			return 502;
+		}
+		name = line.substr(0, colon);
+		value = trim(line.substr(colon + 1));
+		if (strcasecmp(name.c_str(), "Status") == 0)
+		{
+			status_code = static_cast<int> (std::strtol(value.c_str(), &end, 10));
+			if (end != value.c_str() + 3 || status_code < 100 || status_code > 599
+				|| (*end != '\0' && *end != ' '))
+			{
+				print_warning("HTTPResponse::parse_cgi_header(): Bad status from ",
+					_cgi_script, ": " + value);
+				return 502;
+			}
+			reason = trim(end);
+			continue;
+		}
+		else if (strcasecmp(name.c_str(), "Content-Length") == 0
+			&& (value.empty() || value.find_first_not_of("0123456789") != std::string::npos))
+		{
+			print_warning("HTTPResponse::parse_cgi_header(): Bad length from ",
+				_cgi_script, ": " + value);
+			return 502;
+		}
+		else if (strcasecmp(name.c_str(), "X-Accel-Redirect") == 0)
+		{
+			accel_redirect = value;
+			continue;
+		}
+		else if (strcasecmp(name.c_str(), "Connection") == 0
+			|| strcasecmp(name.c_str(), "Transfer-Encoding") == 0
+			|| strcasecmp(name.c_str(), "Keep-Alive") == 0)
+		{
+			// Framing of the response is ours.
+			continue;
+		}
+		// Fields the server looks at are named as it expects.
+		if (strcasecmp(name.c_str(), "Content-Type") == 0)
+			name = "Content-Type";
+		else if (strcasecmp(name.c_str(), "Content-Length") == 0)
+			name = "Content-Length";
+		else if (strcasecmp(name.c_str(), "Location") == 0)
+		{
+			name = "Location";
+			location = value;
+		}
+		if (fields.find(name) == fields.end())
+		{
+			fields[name] = value;
+		}
+		else
+		{
+			// Repeated field (e.g. "Set-Cookie") can't be joined with ',',
+			// it's serialized as another line of the same entry.
+			fields[name] += "\r\n" + name + ": " + value;
+		}
+	}
+	if (eol == std::string::npos)
+	{
+		return -1;
+	}
+	else if (fields.empty() && status_code == 0 && accel_redirect.empty())
+	{
+		print_warning("HTTPResponse::parse_cgi_header(): Empty header from ",
+			_cgi_script, "");
+		return 502;
+	}
+	output.erase(0, pos);
+	if (!accel_redirect.empty())
+	{
+		return this->set_accel_redirect(accel_redirect, fields);
+	}
+	// RFC 3875, 6.2.2: local redirect, the server fetches it instead.
+	if (!location.empty() && location.at(0) == '/' && status_code == 0)
+	{
+		_local_redirect = location;
+		return 0;
 	}
-	return ret;
+	if (status_code == 0)
+	{
+		status_code = location.empty() ? 200 : 302;
+	}
+	_status_code = status_code;
+	_reason_phrase = reason;
+	for (std::map<std::string, std::string>::const_iterator it = fields.begin();
+		it != fields.end(); ++it)
+	{
+		_headers[it->first] = it->second;
+	}
+	return 0;
 }
- */
 
-char ** HTTPResponse::cgi_prep_argv(const std::string &interpreter_path,
-		const std::string &script_path) const
+int HTTPResponse::set_accel_redirect(const std::string &uri,
+		const std::map<std::string, std::string> &fields)
 {
-	// `interpreter_path`, `script_path` and terminating NULL.
-	enum { POINTERS_IN_RET = 3 };
-	char ** ret;
+	// Fields describing the content, not the script's response.
+	static const char *kept[] = {
+		"Content-Type", "Content-Disposition", "Set-Cookie",
+		"Cache-Control", "Expires", NULL
+	};
 
-	try
+	if (uri.at(0) != '/')
 	{
-		ret = new char * [POINTERS_IN_RET];
+		print_warning("HTTPResponse::set_accel_redirect(): Bad X-Accel-Redirect from ",
+			_cgi_script, ": " + uri);
+		return 502;
 	}
-	catch (const std::bad_alloc &e)
+	_local_redirect = uri;
+	_redirect_headers.clear();
+	for (std::map<std::string, std::string>::const_iterator it = fields.begin();
+		it != fields.end(); ++it)
 	{
-		return NULL;
+		for (size_t i = 0; kept[i] != NULL; i++)
+		{
+			if (strcasecmp(it->first.c_str(), kept[i]) == 0)
+			{
+				_redirect_headers[it->first] = it->second;
+				break;
+			}
+		}
 	}
-	ret[0] = NULL;
-	ret[1] = NULL;
-	ret[2] = NULL;
-	// `interpreter_path`.
-	try
+	return 0;
+}
+
+bool HTTPResponse::has_local_redirect() const
+{
+	return !_local_redirect.empty() && !_payload_ready;
+}
+
+void HTTPResponse::follow_local_redirect()
+{
+	HTTPRequest *request;
+
+	if (!has_local_redirect())
+	{
+		throw std::runtime_error(std::string("HTTPResponse::follow_local_redirect(): ")
+				+ "There is no local redirect to follow.");
+	}
+	delete _cgi;
+	_cgi = NULL;
+	_cgi_running = false;
+	_cgi_queued = false;
+	_cgi_nph = false;
+	_headers.swap(_redirect_headers);
+	_redirect_headers.clear();
+	_reason_phrase.clear();
+	if (++_local_redirects > _MAX_INTERNAL_REDIRECTS)
+	{
+		print_err("Local redirection cycle while processing ", _cgi_script, "");
+		_local_redirect.clear();
+		_status_code = 500;
+		build_error_response();
+		return;
+	}
+	// Redirected request is a GET of the new URI
+	// with the header (but not the body) of the original one.
+	if ((request = build_get_request(_local_redirect)) == NULL)
 	{
-		ret[0] = new char [interpreter_path.length() + 1];
+		print_warning("HTTPResponse::follow_local_redirect(): Bad location from ",
+			_cgi_script, ": " + _local_redirect);
+		_local_redirect.clear();
+		_status_code = 502;
+		build_error_response();
+		return;
 	}
-	catch (const std::bad_alloc &e)
+	_local_redirect.clear();
+	// Previous redirected request (if any) isn't needed anymore.
+	delete _redirected_request;
+	_redirected_request = request;
+	this->handle_response_routine(*_redirected_request);
+}
+
+bool HTTPResponse::has_queued_cgi() const
+{
+	return _cgi_queued && !_cgi_running && !_payload_ready;
+}
+
+void HTTPResponse::start_queued_cgi()
+{
+	int status_code;
+
+	if (!has_queued_cgi())
 	{
-		delete [] ret;
-		return NULL;
+		throw std::runtime_error(std::string("HTTPResponse::start_queued_cgi(): ")
+				+ "There is no queued script to run.");
+	}
+	_cgi_queued = false;
+	if (!dynamic_cast<CGISlotWait *> (_cgi)->take_slot())
+	{
+		// Waiting was aborted without a response (can't happen).
+		_status_code = 503;
+		build_error_response();
+		return;
+	}
+	if ((status_code = spawn_cgi(*_request, _cgi_script, true)) != 0)
+	{
+		_status_code = status_code;
+		build_error_response();
+	}
+}
+
+bool HTTPResponse::needs_cgi_cache_refresh() const
+{
+	return _cache_stale;
+}
+
+void HTTPResponse::refresh_cgi_cache(HTTPResponse &stale)
+{
+	if (!stale._cache_stale)
+	{
+		throw std::runtime_error(std::string("HTTPResponse::refresh_cgi_cache(): ")
+				+ "Response doesn't need a refresh.");
+	}
+	stale._cache_stale = false;
+	_server_cfg = stale._server_cfg;
+	_request = stale._request;
+	_cgi_script = stale._cgi_script;
+	delete _redirected_request;
+	if ((_redirected_request = build_get_request(_request->get_request_target())) == NULL)
+	{
+		CGICache::abandon(stale._cache_key);
+		return;
 	}
-	(void) memcpy(ret[0], interpreter_path.c_str(), interpreter_path.length());
-	ret[0][interpreter_path.length()] = '\0';
-	// `script_path`.
+	// Lookup gives the entry to this response, whatever's in it.
+	_cache_refresh = true;
+	_cache_key = stale._cache_key;
+	_cache_leader = true;
+	this->handle_response_routine(*_redirected_request);
+	if (!has_running_cgi() && _cache_leader)
+	{
+		CGICache::abandon(_cache_key);
+		_cache_leader = false;
+	}
+}
+
+HTTPRequest *HTTPResponse::build_get_request(const std::string &uri) const
+{
+	const std::map<std::string, std::string> &fields = _request->get_header_fields();
+	HTTPRequest *request = new HTTPRequest();
+
 	try
 	{
-		ret[1] = new char [script_path.length() + 1];
+		(void) request->process_header_line("GET " + uri + " HTTP/1.1\r\n");
+		for (std::map<std::string, std::string>::const_iterator it = fields.begin();
+			it != fields.end(); ++it)
+		{
+			if (strcasecmp(it->first.c_str(), "Content-Length") != 0
+				&& strcasecmp(it->first.c_str(), "Transfer-Encoding") != 0)
+			{
+				(void) request->process_header_line(it->first + ": "
+						+ it->second + "\r\n");
+			}
+		}
+		(void) request->process_header_line("\r\n");
 	}
-	catch (const std::bad_alloc &e)
+	catch (const std::exception &e)
 	{
-		delete [] ret[0];
-		delete [] ret;
+		delete request;
 		return NULL;
 	}
-	(void) memcpy(ret[1], script_path.c_str(), script_path.length());
-	ret[1][script_path.length()] = '\0';
-	// Terminating NULL.
-	ret[2] = NULL;
-	return ret;
+	request->set_server_address(_request->get_server_address());
+	request->set_client_address(_request->get_client_address());
+	return request;
 }
 
-char ** HTTPResponse::cgi_prep_envp(const HTTPRequest & request) const
+bool HTTPResponse::cgi_prep_vars(const HTTPRequest &request,
+		std::vector<std::string> &vars) const
 {
-	// We'll first append all variables to std::vector of std::strings
-	// and later convert them to char **.
-	std::vector<std::string> vars;
 	char client_ip[INET_ADDRSTRLEN];
 	std::string header_key;	// For `request`'s header fields.
-	char ** ret;
 
-	for (size_t i = 0; environ[i] != NULL; i++)
-	{
-		vars.push_back(std::string(environ[i]));
-	}
-	// CGI-specific variables.
-	// Not the most elegant solution, but stil...
-	// Environment variables for all CGI requests:
-	vars.push_back(std::string("SERVER_SOFTWARE=") + SERVER_NAME + "/1.0");
-	vars.push_back(std::string("SERVER_NAME=") + SERVER_NAME);
-	vars.push_back(std::string("GATEWAY_INERFACE=CGI/1.1"));
-	// Environment variables for specific CGI requests:
-	vars.push_back(std::string("SERVER_PROTOCOL=HTTP/1.1"));
+	// Variables for all CGI requests are prepared at startup
+	// (see `EffectiveLocation::cgi_static_vars`).
+	// Server may listen on several ports, so this one is per request.
 	vars.push_back(std::string("SERVER_PORT=")
-		+ to_string(htons(request.get_server_address().sin_port)));
+		+ to_string(ntohs(request.get_server_address().sin_port)));
 	switch (request.get_method())
 	{
 		case HTTPRequest::GET:
@@ -1344,9 +2334,9 @@ char ** HTTPResponse::cgi_prep_envp(const HTTPRequest & request) const
 		INET_ADDRSTRLEN)
 		== NULL)
 	{
-		print_err("HTTPResponse::cgi_prep_env(): ",
+		print_err("HTTPResponse::cgi_prep_vars(): ",
 			"our_inet_ntop4() fail", "");
-		return NULL;
+		return false;
 	}
 	vars.push_back(std::string("REMOTE_ADDR=") + client_ip);
 	// CONTENT_TYPE and CONTENT_LENGTH.
@@ -1361,23 +2351,15 @@ char ** HTTPResponse::cgi_prep_envp(const HTTPRequest & request) const
 		}
 		catch (const std::range_error &e)
 		{
-			print_warning("HTTPResponse::cgi_prep_env(): ",
+			print_warning("HTTPResponse::cgi_prep_vars(): ",
 				"Request method is POST, but \"Content-Type\" isn't set",
 				"");
 			vars.push_back(std::string("CONTENT_TYPE="));
 		}
-		try
-		{
-			vars.push_back(std::string("CONTENT_LENGTH=")
-				+ request.get_header_value("Content-Length"));
-		}
-		catch (const std::range_error &e)
-		{
-			print_warning("HTTPResponse::cgi_prep_env(): ",
-				"Request method is POST, but \"Content-Length\" isn't set",
-				"");
-			vars.push_back(std::string("CONTENT_LENGTH="));
-		}
+		// Chunked bodies are already decoded,
+		// so the received length is what the script gets on stdin.
+		vars.push_back(std::string("CONTENT_LENGTH=")
+			+ to_string(request.get_body_length()));
 	}
 	// `request`'s header fields.
 	for (std::map<std::string, std::string>::const_iterator it = request.get_header_fields().begin();
@@ -1404,44 +2386,14 @@ char ** HTTPResponse::cgi_prep_envp(const HTTPRequest & request) const
 		header_key.insert(0, "HTTP_");
 		vars.push_back(header_key + "=" + it->second);
 	}
-	// Building "envp".
-	try
-	{
-		// +1 for trailing NULL.
-		ret = new char * [vars.size() + 1];
-	}
-	catch (const std::bad_alloc &e)
-	{
-		return NULL;
-	}
-	for (size_t i = 0; i < vars.size(); i++)
-	{
-		// +1 for '\0' in each string.
-		try
-		{
-			ret[i] = new char [vars.at(i).length() + 1];
-		}
-		catch (const std::bad_alloc &e)
-		{
-			for (size_t j = 0; j < i; j++)
-			{
-				delete [] ret[j];
-				delete [] ret;
-				return NULL;
-			}
-		}
-		(void) memcpy(ret[i], vars.at(i).c_str(), vars.at(i).length());
-		ret[i][vars.at(i).length()] = '\0';
-	}
-	ret[vars.size()] = NULL;
-	return ret;
+	return true;
 }
 
-void HTTPResponse::cgi_free_argv_like_array(char ** argv) const
+void HTTPResponse::append_c_strings(std::vector<char *> &out,
+		const std::vector<std::string> &strings)
 {
-	for (size_t i = 0; argv[i] != NULL; i++)
+	for (size_t i = 0; i < strings.size(); i++)
 	{
-		delete [] argv[i];
+		out.push_back(const_cast<char *> (strings[i].c_str()));
 	}
-	delete [] argv;
 }
@@ -3,8 +3,10 @@
 
 Location::Location()
         : _path(""),
+          _match(MATCH_PREFIX),
           _root(""),
           _autoindex(false),
+          _autoindex_options(),
           _index(),
           _methods(),
           _alias(""),
@@ -13,15 +15,41 @@ Location::Location()
           _cgi_path(),
           _cgi_ext(),
           _error_pages(),
-          _upload_path("") {
+          _upload_path(""),
+          _try_files(),
+          _return_code(0),
+          _return_url(),
+          _cgi_pool_workers(0),
+          _cgi_pool_max_requests(0),
+          _fastcgi_pass(),
+          _proxy_pass(),
+          _internal(false),
+          _cgi_cache_ttl(0),
+          _cgi_cache_stale(0),
+          _cgi_cache_key(),
+          _cache_path(),
+          _cache_max_size(0),
+          _cgi_max_concurrent(0),
+          _cgi_queue_size(0),
+          _cgi_queue_timeout(0),
+          _stub_status(false),
+          _stub_status_allow(),
+          _cgi_rlimit_cpu(0),
+          _cgi_rlimit_as(0),
+          _cgi_rlimit_nofile(0),
+          _error_responses(),
+          _root_dir(),
+          _upload_dir() {
 }
 
 
 Location& Location::operator=(const Location& other) {
         if (this != &other) {
                 _path = other._path;
+                _match = other._match;
                 _root = other._root;
                 _autoindex = other._autoindex;
+                _autoindex_options = other._autoindex_options;
                 _index = other._index;
                 _methods = other._methods;
                 _alias = other._alias;
@@ -31,6 +59,30 @@ Location& Location::operator=(const Location& other) {
                 _cgi_ext = other._cgi_ext;
                 _error_pages = other._error_pages;
                 _upload_path = other._upload_path;
+                _try_files = other._try_files;
+                _return_code = other._return_code;
+                _return_url = other._return_url;
+                _cgi_pool_workers = other._cgi_pool_workers;
+                _cgi_pool_max_requests = other._cgi_pool_max_requests;
+                _fastcgi_pass = other._fastcgi_pass;
+                _proxy_pass = other._proxy_pass;
+                _internal = other._internal;
+                _cgi_cache_ttl = other._cgi_cache_ttl;
+                _cgi_cache_stale = other._cgi_cache_stale;
+                _cgi_cache_key = other._cgi_cache_key;
+                _cache_path = other._cache_path;
+                _cache_max_size = other._cache_max_size;
+                _cgi_max_concurrent = other._cgi_max_concurrent;
+                _cgi_queue_size = other._cgi_queue_size;
+                _cgi_queue_timeout = other._cgi_queue_timeout;
+                _stub_status = other._stub_status;
+                _stub_status_allow = other._stub_status_allow;
+                _cgi_rlimit_cpu = other._cgi_rlimit_cpu;
+                _cgi_rlimit_as = other._cgi_rlimit_as;
+                _cgi_rlimit_nofile = other._cgi_rlimit_nofile;
+                _error_responses = other._error_responses;
+                _root_dir = other._root_dir;
+                _upload_dir = other._upload_dir;
         }
         return *this;
 }
@@ -38,8 +90,10 @@ Location& Location::operator=(const Location& other) {
 
 Location::Location(const Location& other)
         : _path(other._path),
+          _match(other._match),
           _root(other._root),
           _autoindex(other._autoindex),
+          _autoindex_options(other._autoindex_options),
           _index(other._index),
           _methods(other._methods),
           _alias(other._alias),
@@ -48,7 +102,31 @@ Location::Location(const Location& other)
           _cgi_path(other._cgi_path),
           _cgi_ext(other._cgi_ext),
           _error_pages(other._error_pages),
-          _upload_path(other._upload_path) {
+          _upload_path(other._upload_path),
+          _try_files(other._try_files),
+          _return_code(other._return_code),
+          _return_url(other._return_url),
+          _cgi_pool_workers(other._cgi_pool_workers),
+          _cgi_pool_max_requests(other._cgi_pool_max_requests),
+          _fastcgi_pass(other._fastcgi_pass),
+          _proxy_pass(other._proxy_pass),
+          _internal(other._internal),
+          _cgi_cache_ttl(other._cgi_cache_ttl),
+          _cgi_cache_stale(other._cgi_cache_stale),
+          _cgi_cache_key(other._cgi_cache_key),
+          _cache_path(other._cache_path),
+          _cache_max_size(other._cache_max_size),
+          _cgi_max_concurrent(other._cgi_max_concurrent),
+          _cgi_queue_size(other._cgi_queue_size),
+          _cgi_queue_timeout(other._cgi_queue_timeout),
+          _stub_status(other._stub_status),
+          _stub_status_allow(other._stub_status_allow),
+          _cgi_rlimit_cpu(other._cgi_rlimit_cpu),
+          _cgi_rlimit_as(other._cgi_rlimit_as),
+          _cgi_rlimit_nofile(other._cgi_rlimit_nofile),
+          _error_responses(other._error_responses),
+          _root_dir(other._root_dir),
+          _upload_dir(other._upload_dir) {
 }
 
 
@@ -58,16 +136,25 @@ Location::~Location() {}
 // Setters
 void Location::setPath(const std::string& path)
 {
-	if (path.length() == 0 || path.at(0) != '/'
-		|| path.at(path.length() - 1) != '/')
+	if (path.length() == 0 || path.at(0) != '/')
 	{
 		throw std::invalid_argument(std::string("Location::setPath(): ")
-				+ path + " doesn't begin or end with '/'.");
+				+ path + " doesn't begin with '/'.");
+	}
+	else if (_match != MATCH_EXACT && path.at(path.length() - 1) != '/')
+	{
+		throw std::invalid_argument(std::string("Location::setPath(): ")
+				+ path + " doesn't end with '/'.");
 	}
 	_path = path;
 }
+void 					Location::setMatch(enum e_match match) { _match = match; }
 void 					Location::setRootLocation(const std::string& root) { _root = root; }
 void 					Location::setAutoindex(bool value) { _autoindex = value; }
+void 					Location::setAutoindexFormat(enum AutoIndex::e_format format) { _autoindex_options.format = format; }
+void 					Location::setAutoindexSort(enum AutoIndex::e_sort sort) { _autoindex_options.sort = sort; }
+void 					Location::setAutoindexDetails(bool value) { _autoindex_options.details = value; }
+void 					Location::setAutoindexPageSize(size_t page_size) { _autoindex_options.page_size = page_size; }
 void 					Location::addIndexLocation(const std::string& index) { _index.push_back(index); }
 void 					Location::setAlias(const std::string& alias) { _alias = alias; }
 void 					Location::addCgiPath(const std::string& path) { _cgi_path.push_back(path); }
@@ -90,12 +177,30 @@ void 					Location::addMethod(const std::string& method) { _methods.insert(metho
 void 					Location::setErrorPages(const std::map<int, std::string>& errorPages) { _error_pages = errorPages; }
 void 					Location::setErrorPage(int code, const std::string& path) { _error_pages[code] = path; }
 void 					Location::setUploadPath(const std::string& path) { _upload_path = path; }
+void 					Location::addTryFile(const std::string& item) { _try_files.push_back(item); }
+void 					Location::setReturn(int code, const std::string& url) { _return_code = code; _return_url = url; }
+void 					Location::setFastCGIPass(const UpstreamAddress& upstream) { _fastcgi_pass = upstream; }
+void 					Location::setProxyPass(const UpstreamAddress& upstream) { _proxy_pass = upstream; }
+void 					Location::setCgiPool(size_t workers, size_t max_requests) { _cgi_pool_workers = workers; _cgi_pool_max_requests = max_requests; }
+void 					Location::setInternal(bool value) { _internal = value; }
+void 					Location::setCgiCache(size_t ttl, size_t stale) { _cgi_cache_ttl = ttl; _cgi_cache_stale = stale; }
+void 					Location::addCgiCacheKey(const std::string& item) { _cgi_cache_key.push_back(item); }
+void 					Location::setCachePath(const std::string& path, uint64_t max_size) { _cache_path = path; _cache_max_size = max_size; }
+void 					Location::setCgiMaxConcurrent(size_t max_concurrent) { _cgi_max_concurrent = max_concurrent; }
+void 					Location::setCgiQueue(size_t size, size_t timeout) { _cgi_queue_size = size; _cgi_queue_timeout = timeout; }
+void 					Location::setStubStatus(bool value) { _stub_status = value; }
+void 					Location::addStubStatusAllow(uint32_t network, uint32_t mask) { _stub_status_allow.push_back(std::make_pair(network & mask, mask)); }
+void 					Location::setCgiRlimitCpu(uint64_t seconds) { _cgi_rlimit_cpu = seconds; }
+void 					Location::setCgiRlimitAs(uint64_t size) { _cgi_rlimit_as = size; }
+void 					Location::setCgiRlimitNofile(uint64_t count) { _cgi_rlimit_nofile = count; }
 
 // Getters
 const std::string& 			Location::getPath() const { return _path; }
+enum Location::e_match 			Location::getMatch() const { return _match; }
 const std::string& 			Location::getRootLocation() const { return _root; }
 const std::set<std::string>& 		Location::getMethods() const { return _methods; }
 const bool& 				Location::getAutoindex() const { return _autoindex; }
+const AutoIndex::Options& 		Location::getAutoindexOptions() const { return _autoindex_options; }
 const std::vector<std::string>& 	Location::getIndexLocation() const { return _index; }
 const std::string& 			Location::getAlias() const {	return _alias; }
 const std::vector<std::string>& 	Location::getCgiPath() const { return _cgi_path; }
@@ -107,6 +212,27 @@ const uint64_t& 			Location::getMaxBodySize() const {
 	return _client_max_body_size;
 }
 const std::string&			Location::getUploadPath() const{ return _upload_path; }
+const std::vector<std::string>& 	Location::getTryFiles() const { return _try_files; }
+int 					Location::getReturnCode() const { return _return_code; }
+const std::string& 			Location::getReturnUrl() const { return _return_url; }
+const UpstreamAddress& 			Location::getFastCGIPass() const { return _fastcgi_pass; }
+const UpstreamAddress& 			Location::getProxyPass() const { return _proxy_pass; }
+size_t 					Location::getCgiPoolWorkers() const { return _cgi_pool_workers; }
+size_t 					Location::getCgiPoolMaxRequests() const { return _cgi_pool_max_requests; }
+bool 					Location::isInternal() const { return _internal; }
+size_t 					Location::getCgiCacheTtl() const { return _cgi_cache_ttl; }
+size_t 					Location::getCgiCacheStale() const { return _cgi_cache_stale; }
+const std::vector<std::string>& 	Location::getCgiCacheKey() const { return _cgi_cache_key; }
+const std::string& 			Location::getCachePath() const { return _cache_path; }
+uint64_t 				Location::getCacheMaxSize() const { return _cache_max_size; }
+size_t 					Location::getCgiMaxConcurrent() const { return _cgi_max_concurrent; }
+size_t 					Location::getCgiQueueSize() const { return _cgi_queue_size; }
+size_t 					Location::getCgiQueueTimeout() const { return _cgi_queue_timeout; }
+bool 					Location::isStubStatus() const { return _stub_status; }
+const std::vector<std::pair<uint32_t, uint32_t> >	&Location::getStubStatusAllow() const { return _stub_status_allow; }
+uint64_t 				Location::getCgiRlimitCpu() const { return _cgi_rlimit_cpu; }
+uint64_t 				Location::getCgiRlimitAs() const { return _cgi_rlimit_as; }
+uint64_t 				Location::getCgiRlimitNofile() const { return _cgi_rlimit_nofile; }
 const std::map<int, std::string>& 	Location::getErrorPages() const { return _error_pages; }
 
 std::string 				Location::getErrorPage(int code) const {
@@ -116,6 +242,75 @@ std::string 				Location::getErrorPage(int code) const {
     return "";
 }
 
+void					Location::prepareErrorResponses(const MimeTypes &mime_types)
+{
+	std::string page_root, body, content_type;
+
+	_error_responses.clear();
+	// In Location, exactly one of `_root` or `_alias` is set.
+	page_root = _root.empty() ? _alias : _root;
+	if (page_root.empty() || page_root.at(page_root.length() - 1) != '/')
+		page_root.push_back('/');
+	for (std::map<int, std::string>::const_iterator it = _error_pages.begin();
+		it != _error_pages.end(); ++it)
+	{
+		try
+		{
+			body = read_file(page_root + it->second);
+			content_type = mime_types.lookup(it->second);
+		}
+		catch (const std::ios_base::failure &e)
+		{
+			print_warning("Couldn't read error page: ", e.what(), "");
+			body = generateErrorBody(it->first);
+			content_type = "text/html";
+		}
+		_error_responses[it->first] = generateErrorResponse(it->first,
+				body, content_type);
+	}
+}
+
+void					Location::openRootDirs()
+{
+	// Locations with just "return" don't serve files.
+	try
+	{
+		if (!_root.empty() || !_alias.empty())
+			_root_dir.open(_root.empty() ? _alias : _root);
+	}
+	catch (const std::runtime_error &e)
+	{
+		print_warning("Location ", _path, std::string(": ") + e.what());
+	}
+	if (_upload_path.empty())
+		return;
+	try
+	{
+		_upload_dir.open(_upload_path);
+	}
+	catch (const std::runtime_error &e)
+	{
+		print_warning("Location ", _path, std::string(": ") + e.what());
+	}
+}
+
+void					Location::closeRootDirs()
+{
+	_root_dir.close();
+	_upload_dir.close();
+}
+
+const RootDir&				Location::getRootDir() const { return _root_dir; }
+const RootDir&				Location::getUploadDir() const { return _upload_dir; }
+
+const std::string			*Location::getErrorResponse(int code) const
+{
+	std::map<int, std::string>::const_iterator it = _error_responses.find(code);
+
+	if (it == _error_responses.end())
+		return NULL;
+	return &(it->second);
+}
 
 /**
  * @brief Validates a non-empty directory path or throws.
@@ -140,23 +335,33 @@ void  Location::validateLocation() const {
                 throw std::runtime_error("Location validation error: path is empty.");
 
         // root and alias must not be used together
-        if ((!_root.empty() && !_alias.empty()) || (_root.empty() && _alias.empty()))
+        // (locations with just "return", "stub_status" or "proxy_pass" need neither)
+        if ((!_root.empty() && !_alias.empty())
+                || (_root.empty() && _alias.empty() && _return_code == 0 && !_stub_status
+                        && _proxy_pass.name.empty()))
                 throw std::runtime_error("Location '" + _path + "' validation error: either root or alias must be set, but not both.");
 
         // Ensure at least one way to handle the request
         bool has_handler =
                 (!_root.empty() || !_alias.empty()) ||          // static file serving
+                (_return_code != 0) ||                          // return
+                (!_fastcgi_pass.name.empty()) ||                // FastCGI application
+                (!_proxy_pass.name.empty()) ||                  // HTTP upstream
+                _stub_status ||                                 // server's stats
                 (!_cgi_ext.empty() && !_cgi_path.empty());    // CGI handler
 
         if (!has_handler)
-                throw std::runtime_error("Location '" + _path + "' validation error: no valid handling strategy defined (no root, alias, return, cgi, or upload).");
+                throw std::runtime_error("Location '" + _path + "' validation error: no valid handling strategy defined (no root, alias, return, cgi, fastcgi_pass, proxy_pass, or upload).");
+
+        if (!_fastcgi_pass.name.empty() && !_proxy_pass.name.empty())
+                throw std::runtime_error("Location '" + _path + "' validation error: fastcgi_pass and proxy_pass can't be used together.");
 
         // Validate HTTP methods
         std::set<std::string>::const_iterator mit = _methods.begin();
         for (; mit != _methods.end(); ++mit) {
                 if (*mit != "GET" && *mit != "POST" && *mit != "DELETE"  && *mit != "PUT")
                         throw std::runtime_error("Location '" + _path + "' validation error: invalid HTTP method '" + *mit + "'");
-                if  (*mit == "PUT" && _upload_path.empty())
+                if  (*mit == "PUT" && _upload_path.empty() && _proxy_pass.name.empty())
                         throw std::runtime_error("Location '" + _path + "' validation error: PUT method requires a valid upload_path.");
         }
 
@@ -191,10 +396,15 @@ void  Location::validateLocation() const {
 void Location::printDebug() const {
         std::cout << "=== Location Debug Info ===" << std::endl;
 
-        std::cout << "Path: " << _path << std::endl;
+        std::cout << "Path: " << (_match == MATCH_EXACT ? "= " : _match == MATCH_PREFERENTIAL ? "^~ " : "")
+                  << _path << std::endl;
         std::cout << "Root: " << _root << std::endl;
         std::cout << "Alias: " << (_alias.empty() ? "(none)" : _alias) << std::endl;
         std::cout << "Autoindex: " << (_autoindex ? "on" : "off") << std::endl;
+        std::cout << "Internal: " << (_internal ? "yes" : "no") << std::endl;
+        std::cout << "Autoindex Format: " << (_autoindex_options.format == AutoIndex::FORMAT_JSON ? "json" : "html")
+                  << ", Details: " << (_autoindex_options.details ? "on" : "off")
+                  << ", Page Size: " << _autoindex_options.page_size << std::endl;
         std::cout << "Max Body Size: " << _client_max_body_size << std::endl;
 
         // Upload
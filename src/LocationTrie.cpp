@@ -0,0 +1,108 @@
+#include "LocationTrie.hpp"
+
+const size_t LocationTrie::NOT_FOUND;
+
+LocationTrie::LocationTrie()
+{
+	this->clear();
+}
+
+void LocationTrie::clear()
+{
+	_nodes.clear();
+	add_node("", NOT_FOUND);
+}
+
+size_t LocationTrie::add_node(const std::string &label, size_t index)
+{
+	Node node;
+
+	node.label = label;
+	node.index = index;
+	_nodes.push_back(node);
+	return _nodes.size() - 1;
+}
+
+size_t LocationTrie::find_child(size_t node, char c) const
+{
+	const std::vector<size_t> &children = _nodes[node].children;
+
+	for (size_t i = 0; i < children.size(); i++)
+	{
+		if (_nodes[children[i]].label[0] == c)
+		{
+			return children[i];
+		}
+	}
+	return NOT_FOUND;
+}
+
+void LocationTrie::insert(const std::string &path, size_t index)
+{
+	size_t node = 0;
+	size_t pos = 0;
+	size_t child, common, split;
+
+	while (pos < path.length())
+	{
+		child = find_child(node, path[pos]);
+		if (child == NOT_FOUND)
+		{
+			// Careful: `add_node()` may reallocate `_nodes`.
+			child = add_node(path.substr(pos), index);
+			_nodes[node].children.push_back(child);
+			return;
+		}
+		// Length of the common part of the label and the rest of `path`.
+		const std::string &label = _nodes[child].label;
+		for (common = 0; common < label.length()
+			&& pos + common < path.length()
+			&& label[common] == path[pos + common]; common++)
+		{
+		}
+		if (common < label.length())
+		{
+			// Splitting the child: "abc" => "a" -> "bc".
+			split = add_node(_nodes[child].label.substr(0, common), NOT_FOUND);
+			_nodes[child].label.erase(0, common);
+			_nodes[split].children.push_back(child);
+			for (size_t i = 0; i < _nodes[node].children.size(); i++)
+			{
+				if (_nodes[node].children[i] == child)
+				{
+					_nodes[node].children[i] = split;
+				}
+			}
+			child = split;
+		}
+		node = child;
+		pos += common;
+	}
+	_nodes[node].index = index;
+}
+
+size_t LocationTrie::find(const std::string &request_path) const
+{
+	size_t node = 0;
+	size_t pos = 0;
+	size_t ret = _nodes[0].index;
+	size_t child;
+
+	while (pos < request_path.length())
+	{
+		child = find_child(node, request_path[pos]);
+		if (child == NOT_FOUND
+			|| request_path.compare(pos, _nodes[child].label.length(),
+				_nodes[child].label) != 0)
+		{
+			break;
+		}
+		node = child;
+		pos += _nodes[child].label.length();
+		if (_nodes[node].index != NOT_FOUND)
+		{
+			ret = _nodes[node].index;
+		}
+	}
+	return ret;
+}
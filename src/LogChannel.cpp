@@ -0,0 +1,168 @@
+#include "LogChannel.hpp"
+#include "Stats.hpp"
+#include "Webserv.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <poll.h>
+#include <unistd.h>
+
+bool LogChannel::_started = false;
+std::string LogChannel::_queue;
+size_t LogChannel::_written = 0;
+std::map<std::string, LogChannel::Source> LogChannel::_sources;
+time_t LogChannel::_pruned = 0;
+
+LogChannel::Source::Source()
+	: tokens(BURST),
+	  refilled(std::time(NULL)),
+	  suppressed(0)
+{
+}
+
+void LogChannel::start()
+{
+	_started = true;
+}
+
+bool LogChannel::is_started()
+{
+	return _started;
+}
+
+void LogChannel::write(const std::string &line)
+{
+	enqueue(line);
+}
+
+void LogChannel::write(const std::string &source, const std::string &line)
+{
+	time_t now = std::time(NULL);
+
+	if (now > _pruned)
+	{
+		prune(now);
+	}
+	Source &rate = _sources[source];
+
+	if (now > rate.refilled)
+	{
+		rate.tokens = std::min(static_cast<size_t> (BURST),
+			rate.tokens + static_cast<size_t> (now - rate.refilled) * static_cast<size_t> (RATE));
+		rate.refilled = now;
+	}
+	if (rate.tokens == 0)
+	{
+		rate.suppressed++;
+		Stats::add("log_suppressed_lines_total", Stats::label("source", source));
+		return;
+	}
+	rate.tokens--;
+	if (rate.suppressed != 0)
+	{
+		enqueue(source + ": " + to_string(rate.suppressed) + " lines suppressed");
+		rate.suppressed = 0;
+	}
+	enqueue(line);
+}
+
+void LogChannel::prune(time_t now)
+{
+	std::map<std::string, Source>::iterator it = _sources.begin();
+
+	// A full bucket with nothing suppressed is the state
+	// a new source starts in, so forgetting it changes nothing.
+	while (it != _sources.end())
+	{
+		const Source &rate = it->second;
+
+		if (rate.suppressed == 0 && (rate.tokens >= BURST
+			|| static_cast<size_t> (now - rate.refilled) * static_cast<size_t> (RATE)
+				>= BURST - rate.tokens))
+		{
+			_sources.erase(it++);
+		}
+		else
+		{
+			++it;
+		}
+	}
+	_pruned = now;
+}
+
+void LogChannel::enqueue(const std::string &line)
+{
+	if (_queue.length() - _written + line.length() + 1 > MAX_QUEUED)
+	{
+		Stats::add("log_dropped_lines_total", "");
+		return;
+	}
+	_queue += line;
+	_queue += '\n';
+}
+
+bool LogChannel::write_next(bool wait)
+{
+	// Longest a write to stderr may block for at exit.
+	enum { WAIT_TIMEOUT = 1000 };
+	struct pollfd pfd;
+	size_t length = std::min(_queue.length() - _written, static_cast<size_t> (PIPE_BUF));
+	size_t end;
+	ssize_t n;
+
+	pfd.fd = STDERR_FILENO;
+	pfd.events = POLLOUT;
+	pfd.revents = 0;
+	if (::poll(&pfd, 1, wait ? WAIT_TIMEOUT : 0) != 1 || !(pfd.revents & POLLOUT))
+	{
+		return false;
+	}
+	if (_written + length < _queue.length())
+	{
+		// Whole lines only, unless a single one is that long.
+		end = _queue.rfind('\n', _written + length - 1);
+		if (end != std::string::npos && end >= _written)
+		{
+			length = end + 1 - _written;
+		}
+	}
+	n = ::write(STDERR_FILENO, _queue.data() + _written, length);
+	if (n <= 0)
+	{
+		return n == -1 && errno == EINTR;
+	}
+	_written += static_cast<size_t> (n);
+	if (_written == _queue.length())
+	{
+		_queue.clear();
+		_written = 0;
+	}
+	else if (_written >= MAX_QUEUED / 2)
+	{
+		_queue.erase(0, _written);
+		_written = 0;
+	}
+	return true;
+}
+
+void LogChannel::flush()
+{
+	while (pending() && write_next(false))
+	{
+	}
+}
+
+bool LogChannel::pending()
+{
+	return _written < _queue.length();
+}
+
+void LogChannel::shutdown()
+{
+	while (pending() && write_next(true))
+	{
+	}
+	_queue.clear();
+	_written = 0;
+	_started = false;
+}
@@ -0,0 +1,88 @@
+#include "MimeTypes.hpp"
+#include <cctype>
+
+const std::string MimeTypes::_DEFAULT_TYPE = "application/octet-stream";
+
+MimeTypes::MimeTypes()
+{
+}
+
+void MimeTypes::add(const std::string &type, const std::string &ext)
+{
+	std::string ext_lowercase;
+	size_t i = 0;
+
+	if (ext.length() > 0 && ext.at(0) == '.')
+	{
+		i++;
+	}
+	for (; i < ext.length(); i++)
+	{
+		ext_lowercase.push_back(static_cast<char> (std::tolower(
+				static_cast<unsigned char> (ext.at(i)))));
+	}
+	_types[ext_lowercase] = type;
+}
+
+void MimeTypes::compile()
+{
+	_table = PerfectHash<std::string>(_types);
+}
+
+const std::string &MimeTypes::lookup(const std::string &path) const
+{
+	std::string::size_type dot = path.find_last_of("./");
+	const std::string *ret;
+
+	if (dot == std::string::npos || path.at(dot) != '.'
+		|| dot + 1 >= path.length())
+	{
+		return _DEFAULT_TYPE;
+	}
+	ret = _table.find(path.c_str() + dot + 1, path.length() - dot - 1);
+	if (ret == NULL)
+	{
+		return _DEFAULT_TYPE;
+	}
+	return *ret;
+}
+
+bool MimeTypes::empty() const
+{
+	return _types.empty();
+}
+
+const MimeTypes &MimeTypes::getDefault()
+{
+	static MimeTypes ret;
+
+	if (ret.empty())
+	{
+		ret.add("text/html", "html");
+		ret.add("text/html", "htm");
+		ret.add("text/css", "css");
+		ret.add("text/plain", "txt");
+		ret.add("text/javascript", "js");
+		ret.add("text/javascript", "mjs");
+		ret.add("application/json", "json");
+		ret.add("application/xml", "xml");
+		ret.add("application/pdf", "pdf");
+		ret.add("application/wasm", "wasm");
+		ret.add("application/zip", "zip");
+		ret.add("image/png", "png");
+		ret.add("image/jpeg", "jpg");
+		ret.add("image/jpeg", "jpeg");
+		ret.add("image/gif", "gif");
+		ret.add("image/webp", "webp");
+		ret.add("image/avif", "avif");
+		ret.add("image/svg+xml", "svg");
+		ret.add("image/x-icon", "ico");
+		ret.add("font/woff", "woff");
+		ret.add("font/woff2", "woff2");
+		ret.add("audio/mpeg", "mp3");
+		ret.add("video/mp4", "mp4");
+		ret.add("video/webm", "webm");
+		ret.compile();
+	}
+	return ret;
+}
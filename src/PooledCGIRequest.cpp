@@ -0,0 +1,373 @@
+#include "PooledCGIRequest.hpp"
+#include "Webserv.hpp"
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <stdexcept>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+PooledCGIRequest::PooledCGIRequest()
+	: _worker(NULL),
+	  _queued(false),
+	  _wake_fd(-1),
+	  _write_fd(-1),
+	  _read_fd(-1),
+	  _stderr_fd(-1),
+	  _send_pos(0),
+	  _input_fd(-1),
+	  _input_offset(0),
+	  _input_length(0),
+	  _sent(false),
+	  _output_length(std::string::npos),
+	  _frame_received(0),
+	  _ended(false),
+	  _failed(false),
+	  _deadline(0)
+{
+}
+
+PooledCGIRequest::~PooledCGIRequest()
+{
+	if (_queued)
+	{
+		CGIWorkerPool::cancel(_pool, this);
+	}
+	this->release_worker(_ended && _sent);
+	this->close_fd(_wake_fd);
+	this->close_fd(_write_fd);
+	this->close_fd(_read_fd);
+	this->close_fd(_stderr_fd);
+	if (_input_fd != -1)
+	{
+		(void) close(_input_fd);
+	}
+}
+
+void PooledCGIRequest::start(const CGIWorkerPool::Key &pool,
+		const std::vector<std::string> &vars, const std::string &input,
+		int input_fd, uint64_t input_length, time_t timeout)
+{
+	std::string env;
+	CGIWorker *worker;
+
+	if (!_pool.script.empty())
+	{
+		throw std::runtime_error(std::string("PooledCGIRequest::start(): ")
+				+ "Request was already started.");
+	}
+	_pool = pool;
+	for (size_t i = 0; i < vars.size(); i++)
+	{
+		env += vars[i];
+		env += '\0';
+	}
+	_send = to_string(env.length()) + "\n" + env
+		+ to_string(input_length) + "\n";
+	if (input_fd == -1)
+	{
+		_send += input;
+	}
+	else if ((_input_fd = fcntl(input_fd, F_DUPFD_CLOEXEC, 0)) == -1)
+	{
+		throw std::runtime_error(std::string("PooledCGIRequest::start(): ")
+				+ "fcntl() fail: " + strerror(errno));
+	}
+	_input_length = input_length;
+	_deadline = std::time(NULL) + timeout;
+	worker = CGIWorkerPool::acquire(_pool, this);
+	if (worker != NULL)
+	{
+		this->assign(worker);
+		if (_failed)
+		{
+			throw std::runtime_error(std::string("PooledCGIRequest::start(): ")
+					+ "Can't use the pipes of a worker of " + _pool.script);
+		}
+		return;
+	}
+	_queued = true;
+	if ((_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1)
+	{
+		CGIWorkerPool::cancel(_pool, this);
+		_queued = false;
+		throw std::runtime_error(std::string("PooledCGIRequest::start(): ")
+				+ "eventfd() fail: " + strerror(errno));
+	}
+	print_log("All CGI workers are busy, queued request for ", _pool.script, "");
+}
+
+void PooledCGIRequest::assign(CGIWorker *worker)
+{
+	uint64_t one = 1;
+
+	_queued = false;
+	_worker = worker;
+	if (_worker == NULL)
+	{
+		_failed = true;
+	}
+	else if ((_write_fd = fcntl(_worker->stdin_fd, F_DUPFD_CLOEXEC, 0)) == -1
+		|| (_read_fd = fcntl(_worker->stdout_fd, F_DUPFD_CLOEXEC, 0)) == -1
+		|| (_stderr_fd = fcntl(_worker->stderr_fd, F_DUPFD_CLOEXEC, 0)) == -1)
+	{
+		print_warning("PooledCGIRequest::assign(): fcntl() fail: ",
+			strerror(errno), "");
+		_failed = true;
+		this->release_worker(false);
+	}
+	if (_wake_fd != -1)
+	{
+		(void) write(_wake_fd, &one, sizeof(one));
+	}
+}
+
+void PooledCGIRequest::release_worker(bool reusable)
+{
+	CGIWorker *worker = _worker;
+
+	if (worker == NULL)
+	{
+		return;
+	}
+	_worker = NULL;
+	CGIWorkerPool::release(_pool, worker, reusable);
+}
+
+void PooledCGIRequest::get_watched_fds(std::vector<Watch> &out) const
+{
+	if (_wake_fd != -1)
+	{
+		out.push_back(Watch(_wake_fd, EPOLLIN));
+	}
+	if (_write_fd != -1)
+	{
+		out.push_back(Watch(_write_fd, EPOLLOUT));
+	}
+	if (_read_fd != -1 && _output.length() < MAX_BUFFERED_OUTPUT)
+	{
+		out.push_back(Watch(_read_fd, EPOLLIN));
+	}
+	// Once the worker is given back, what's left is logged by the pool.
+	if (_stderr_fd != -1 && _worker != NULL)
+	{
+		out.push_back(Watch(_stderr_fd, EPOLLIN));
+	}
+}
+
+bool PooledCGIRequest::handle_event(int fd)
+{
+	uint64_t value;
+
+	if (fd == _wake_fd && _wake_fd != -1)
+	{
+		// Worker's descriptors (if any) are listed from now on.
+		(void) read(_wake_fd, &value, sizeof(value));
+		return false;
+	}
+	else if (fd == _write_fd && _write_fd != -1)
+	{
+		return this->send_frame();
+	}
+	else if (fd == _read_fd && _read_fd != -1)
+	{
+		return this->receive_frame();
+	}
+	else if (fd == _stderr_fd && _stderr_fd != -1 && _worker != NULL)
+	{
+		return CGIWorkerPool::read_stderr(_worker);
+	}
+	return false;
+}
+
+bool PooledCGIRequest::send_frame()
+{
+	// Block of the spooled input held in memory at once.
+	enum { BUFFER_SIZE = 65536 };
+	char buffer[BUFFER_SIZE];
+	ssize_t n;
+
+	if (_send_pos == _send.length())
+	{
+		_send.clear();
+		_send_pos = 0;
+		n = pread(_input_fd, buffer, BUFFER_SIZE, _input_offset);
+		if (n == -1 && errno == EINTR)
+		{
+			return true;
+		}
+		else if (n <= 0)
+		{
+			// Frame can't be completed anymore.
+			print_warning("PooledCGIRequest::send_frame(): Can't read the body: ",
+				(n == 0) ? "file is shorter than expected" : strerror(errno), "");
+			return false;
+		}
+		_send.assign(buffer, static_cast<size_t> (n));
+		_input_offset += n;
+	}
+	n = write(_write_fd, _send.c_str() + _send_pos, _send.length() - _send_pos);
+	if (n == -1 && (errno == EAGAIN || errno == EINTR))
+	{
+		return true;
+	}
+	else if (n == -1)
+	{
+		// The worker is gone, reading its stdout tells the rest.
+		print_warning("PooledCGIRequest::send_frame(): write() fail: ",
+			strerror(errno), "");
+		return false;
+	}
+	_send_pos += static_cast<size_t> (n);
+	// Known as soon as the last byte is written:
+	// the response may come before the next EPOLLOUT.
+	if (_send_pos == _send.length() && (_input_fd == -1
+		|| static_cast<uint64_t> (_input_offset) >= _input_length))
+	{
+		_sent = true;
+		return false;
+	}
+	return true;
+}
+
+bool PooledCGIRequest::receive_frame()
+{
+	// Output is read in parts, so one busy worker
+	// doesn't hold the event loop.
+	enum { BUFFER_SIZE = 65536 };
+	// Longest length prefix accepted, '\n' included.
+	enum { MAX_PREFIX = 20 };
+	char buffer[BUFFER_SIZE];
+	const char *data;
+	ssize_t n;
+	size_t newline;
+	char *end;
+
+	n = read(_read_fd, buffer, BUFFER_SIZE);
+	if (n == -1 && (errno == EAGAIN || errno == EINTR))
+	{
+		return true;
+	}
+	else if (n <= 0)
+	{
+		print_warning("PooledCGIRequest::receive_frame(): Worker of ",
+			_pool.script, " exited in the middle of a request");
+		_failed = true;
+		this->release_worker(false);
+		return false;
+	}
+	data = buffer;
+	if (_output_length == std::string::npos)
+	{
+		_prefix.append(buffer, static_cast<size_t> (n));
+		newline = _prefix.find('\n');
+		if (newline == std::string::npos && _prefix.length() < MAX_PREFIX)
+		{
+			return true;
+		}
+		else if (newline == std::string::npos || newline == 0
+			|| _prefix.find_first_not_of("0123456789") != newline)
+		{
+			print_warning("PooledCGIRequest::receive_frame(): Worker of ",
+				_pool.script, " sent a malformed frame");
+			_failed = true;
+			this->release_worker(false);
+			return false;
+		}
+		_output_length = std::strtoul(_prefix.c_str(), &end, 10);
+		// What came after the prefix, out of this read.
+		data = buffer + (static_cast<size_t> (n) - (_prefix.length() - newline - 1));
+		n = static_cast<ssize_t> (_prefix.length() - newline - 1);
+		_prefix.clear();
+	}
+	_output.append(data, static_cast<size_t> (n));
+	// `_output` is consumed as it's read: what was received is counted apart.
+	_frame_received += static_cast<size_t> (n);
+	if (_frame_received < _output_length)
+	{
+		return true;
+	}
+	else if (_frame_received > _output_length)
+	{
+		print_warning("PooledCGIRequest::receive_frame(): Worker of ",
+			_pool.script, " sent more than its frame");
+		_failed = true;
+		this->release_worker(false);
+		return false;
+	}
+	_ended = true;
+	// Worker that didn't read the whole request can't take another one.
+	this->release_worker(_sent);
+	return false;
+}
+
+void PooledCGIRequest::close_fd(int fd)
+{
+	if (fd == -1)
+	{
+		return;
+	}
+	else if (fd == _wake_fd)
+	{
+		_wake_fd = -1;
+	}
+	else if (fd == _write_fd)
+	{
+		_write_fd = -1;
+		std::string().swap(_send);
+		_send_pos = 0;
+	}
+	else if (fd == _read_fd)
+	{
+		_read_fd = -1;
+	}
+	else if (fd == _stderr_fd)
+	{
+		_stderr_fd = -1;
+	}
+	else
+	{
+		return;
+	}
+	(void) close(fd);
+}
+
+void PooledCGIRequest::poll()
+{
+}
+
+void PooledCGIRequest::abort()
+{
+	if (_queued)
+	{
+		CGIWorkerPool::cancel(_pool, this);
+		_queued = false;
+	}
+	if (!_ended)
+	{
+		_failed = true;
+		this->release_worker(false);
+	}
+}
+
+bool PooledCGIRequest::is_finished() const
+{
+	return _ended || _failed;
+}
+
+bool PooledCGIRequest::succeeded() const
+{
+	return _ended && !_failed;
+}
+
+bool PooledCGIRequest::is_expired(time_t now) const
+{
+	return !is_finished() && now > _deadline;
+}
+
+std::string &PooledCGIRequest::get_output()
+{
+	return _output;
+}
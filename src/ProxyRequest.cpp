@@ -0,0 +1,712 @@
+#include "ProxyRequest.hpp"
+#include "HTTPRequest.hpp"
+#include "Webserv.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+
+// Longest chunk size or trailer line the upstream may send.
+static const size_t MAX_LINE_SIZE = 4096;
+
+ProxyRequest::ProxyRequest()
+	: _conn_fd(-1),
+	  _write_fd(-1),
+	  _read_fd(-1),
+	  _connected(false),
+	  _send_pos(0),
+	  _input_fd(-1),
+	  _input_offset(0),
+	  _sent(false),
+	  _state(HEADER),
+	  _remaining(0),
+	  _keep_alive(false),
+	  _failed(false),
+	  _retry(false),
+	  _timeout(0),
+	  _deadline(0)
+{
+}
+
+ProxyRequest::~ProxyRequest()
+{
+	this->close_fd(_write_fd);
+	this->close_fd(_read_fd);
+	for (size_t i = 0; i < _stale_fds.size(); i++)
+	{
+		(void) close(_stale_fds[i]);
+	}
+	if (_input_fd != -1)
+	{
+		(void) close(_input_fd);
+	}
+	if (_conn_fd == -1)
+	{
+		return;
+	}
+	// Only a connection with no request half-way on it may be reused.
+	if (_state == DONE && _sent && _recv.empty() && !_failed && _keep_alive)
+	{
+		UpstreamPool::release(_upstream, _conn_fd);
+	}
+	else
+	{
+		(void) close(_conn_fd);
+	}
+}
+
+/**
+ * Check if \p name is one of the comma-separated field names in \p list
+ * (case-insensitive).
+ */
+static bool is_listed(const std::string &name, const std::string &list)
+{
+	size_t pos = 0;
+	size_t comma;
+
+	while (pos <= list.length())
+	{
+		comma = list.find(',', pos);
+		if (comma == std::string::npos)
+		{
+			comma = list.length();
+		}
+		if (strcasecmp(trim(list.substr(pos, comma - pos)).c_str(), name.c_str()) == 0)
+		{
+			return true;
+		}
+		pos = comma + 1;
+	}
+	return false;
+}
+
+/**
+ * Check if field \p name only concerns one connection
+ * (RFC 9110, 7.6.1), so it isn't forwarded; \p connection is
+ * the "Connection" field, which may name more of them.
+ */
+static bool is_hop_by_hop(const std::string &name, const std::string &connection)
+{
+	static const char *const FIELDS[] = {
+		"Connection", "Keep-Alive", "Proxy-Connection", "TE",
+		"Trailer", "Transfer-Encoding", "Upgrade"
+	};
+
+	for (size_t i = 0; i < sizeof(FIELDS) / sizeof(FIELDS[0]); i++)
+	{
+		if (strcasecmp(name.c_str(), FIELDS[i]) == 0)
+		{
+			return true;
+		}
+	}
+	return is_listed(name, connection);
+}
+
+/**
+ * Get the name of \p method as sent in the request line.
+ */
+static const char *method_name(enum HTTPRequest::e_method method)
+{
+	switch (method)
+	{
+		case HTTPRequest::POST:
+			return "POST";
+		case HTTPRequest::DELETE:
+			return "DELETE";
+		case HTTPRequest::PUT:
+			return "PUT";
+		default:
+			return "GET";
+	}
+}
+
+void ProxyRequest::start(const UpstreamAddress &upstream,
+		const HTTPRequest &request, time_t timeout)
+{
+	const std::map<std::string, std::string> &fields = request.get_header_fields();
+	std::string connection;
+	std::string forwarded_for;
+	char client_ip[INET_ADDRSTRLEN];
+	bool reused = false;
+
+	if (_conn_fd != -1 || _failed)
+	{
+		throw std::runtime_error(std::string("ProxyRequest::start(): ")
+				+ "Request was already started.");
+	}
+	_upstream = upstream;
+	if ((_conn_fd = UpstreamPool::acquire(_upstream, &reused)) == -1)
+	{
+		_failed = true;
+		throw std::runtime_error(std::string("ProxyRequest::start(): ")
+				+ "Can't connect to " + _upstream.name + ": "
+				+ strerror(errno));
+	}
+	if ((_write_fd = fcntl(_conn_fd, F_DUPFD_CLOEXEC, 0)) == -1
+		|| (_read_fd = fcntl(_conn_fd, F_DUPFD_CLOEXEC, 0)) == -1
+		|| (request.get_body_fd() != -1
+			&& (_input_fd = fcntl(request.get_body_fd(), F_DUPFD_CLOEXEC, 0)) == -1))
+	{
+		_failed = true;
+		throw std::runtime_error(std::string("ProxyRequest::start(): ")
+				+ "fcntl() fail: " + strerror(errno));
+	}
+	_send = std::string(method_name(request.get_method())) + ' '
+		+ request.get_request_target() + " HTTP/1.1\r\n";
+	for (std::map<std::string, std::string>::const_iterator it = fields.begin();
+		it != fields.end(); ++it)
+	{
+		if (strcasecmp(it->first.c_str(), "Connection") == 0)
+		{
+			connection = it->second;
+		}
+	}
+	for (std::map<std::string, std::string>::const_iterator it = fields.begin();
+		it != fields.end(); ++it)
+	{
+		if (strcasecmp(it->first.c_str(), "X-Forwarded-For") == 0)
+		{
+			forwarded_for = it->second + ", ";
+		}
+		// Body goes decoded, with a length of ours; it was
+		// received already, so there's nothing to "Expect".
+		else if (!is_hop_by_hop(it->first, connection)
+			&& strcasecmp(it->first.c_str(), "Content-Length") != 0
+			&& strcasecmp(it->first.c_str(), "Expect") != 0)
+		{
+			_send += it->first + ": " + it->second + "\r\n";
+		}
+	}
+	if (our_inet_ntop4(&(request.get_client_address().sin_addr), client_ip,
+		INET_ADDRSTRLEN) != NULL)
+	{
+		_send += "X-Forwarded-For: " + forwarded_for + client_ip + "\r\n";
+	}
+	if (request.get_body_length() > 0 || request.get_method() == HTTPRequest::POST
+		|| request.get_method() == HTTPRequest::PUT)
+	{
+		_send += "Content-Length: " + to_string(request.get_body_length()) + "\r\n";
+	}
+	_send += "\r\n";
+	if (_input_fd == -1)
+	{
+		_send += request.get_body();
+	}
+	// Sending it again can't do harm: it's a GET, or its body
+	// was spooled whole (so it can be read again).
+	_retry = reused && (request.get_method() == HTTPRequest::GET || _input_fd != -1);
+	if (_retry)
+	{
+		_request = _send;
+	}
+	_timeout = timeout;
+	_deadline = std::time(NULL) + _timeout;
+}
+
+void ProxyRequest::get_watched_fds(std::vector<Watch> &out) const
+{
+	if (_write_fd != -1)
+	{
+		out.push_back(Watch(_write_fd, EPOLLOUT));
+	}
+	if (_read_fd != -1 && _output.length() < MAX_BUFFERED_OUTPUT)
+	{
+		out.push_back(Watch(_read_fd, EPOLLIN));
+	}
+}
+
+bool ProxyRequest::handle_event(int fd)
+{
+	if (fd == _write_fd && _write_fd != -1)
+	{
+		return this->send_request();
+	}
+	else if (fd == _read_fd && _read_fd != -1)
+	{
+		return this->receive_response();
+	}
+	return false;
+}
+
+bool ProxyRequest::send_request()
+{
+	char buffer[SEND_BLOCK_SIZE];
+	ssize_t n;
+	int error = 0;
+	socklen_t error_length = sizeof(error);
+
+	if (!_connected)
+	{
+		if (getsockopt(_write_fd, SOL_SOCKET, SO_ERROR, &error, &error_length) == -1)
+		{
+			error = errno;
+		}
+		if (error != 0)
+		{
+			print_warning("ProxyRequest::send_request(): Can't connect to ",
+				_upstream.name, std::string(": ") + strerror(error));
+			_failed = true;
+			return false;
+		}
+		_connected = true;
+	}
+	if (_send_pos == _send.length())
+	{
+		_send.clear();
+		_send_pos = 0;
+		if (_input_fd == -1)
+		{
+			_sent = true;
+			return false;
+		}
+		// Spooled body is read only as fast as the upstream takes it.
+		n = pread(_input_fd, buffer, SEND_BLOCK_SIZE, _input_offset);
+		if (n == -1 && errno == EINTR)
+		{
+			return true;
+		}
+		else if (n == -1)
+		{
+			print_warning("ProxyRequest::send_request(): pread() fail: ",
+				strerror(errno), "");
+			_failed = true;
+			return false;
+		}
+		else if (n == 0)
+		{
+			// Left open, to be read again by `retry()`.
+			_sent = true;
+			return false;
+		}
+		_send.assign(buffer, static_cast<size_t> (n));
+		_input_offset += n;
+	}
+	n = send(_write_fd, _send.c_str() + _send_pos, _send.length() - _send_pos,
+			MSG_NOSIGNAL);
+	if (n == -1 && (errno == EAGAIN || errno == EINTR))
+	{
+		return true;
+	}
+	else if (n == -1)
+	{
+		// The upstream may respond without reading
+		// the whole body; the response is what tells if it failed.
+		print_log("ProxyRequest::send_request(): Request isn't read anymore: ",
+			strerror(errno), "");
+		return false;
+	}
+	_send_pos += static_cast<size_t> (n);
+	_deadline = std::time(NULL) + _timeout;
+	return true;
+}
+
+/**
+ * Get the position after the empty line ending the header
+ * at the start of \p data; npos, if it isn't there yet.
+ */
+static size_t find_header_end(const std::string &data)
+{
+	size_t pos = 0;
+	size_t eol;
+
+	while ((eol = data.find('\n', pos)) != std::string::npos)
+	{
+		if (eol == pos || (eol == pos + 1 && data[pos] == '\r'))
+		{
+			return eol + 1;
+		}
+		pos = eol + 1;
+	}
+	return std::string::npos;
+}
+
+bool ProxyRequest::receive_response()
+{
+	// Response is read in parts, so one busy upstream
+	// doesn't hold the event loop.
+	enum { BUFFER_SIZE = 65536 };
+	char buffer[BUFFER_SIZE];
+	ssize_t n;
+	size_t end;
+
+	n = read(_read_fd, buffer, BUFFER_SIZE);
+	if (n == -1 && (errno == EAGAIN || errno == EINTR))
+	{
+		return true;
+	}
+	else if (n == 0 && _state == BODY_CLOSE)
+	{
+		_state = DONE;
+		return false;
+	}
+	else if (n <= 0 && _retry)
+	{
+		return this->retry();
+	}
+	else if (n <= 0)
+	{
+		print_warning("ProxyRequest::receive_response(): Connection to ",
+			_upstream.name, std::string(" lost: ")
+			+ (n == 0 ? "closed by the upstream" : strerror(errno)));
+		_failed = true;
+		return false;
+	}
+	_deadline = std::time(NULL) + _timeout;
+	// The upstream took the request.
+	_retry = false;
+	_recv.append(buffer, static_cast<size_t> (n));
+	while (_state == HEADER)
+	{
+		if ((end = find_header_end(_recv)) != std::string::npos)
+		{
+			if (!this->parse_header(end))
+			{
+				return false;
+			}
+			continue;
+		}
+		else if (_recv.length() > MAX_HEADER_SIZE)
+		{
+			print_warning("ProxyRequest::receive_response(): Header too long from ",
+				_upstream.name, "");
+			_failed = true;
+			return false;
+		}
+		return true;
+	}
+	return this->parse_body() && _state != DONE;
+}
+
+bool ProxyRequest::retry()
+{
+	int fd;
+
+	_retry = false;
+	print_log("ProxyRequest::retry(): Reused connection to ", _upstream.name,
+		" was closed, sending the request on a new one");
+	if ((fd = UpstreamPool::connect_new(_upstream)) == -1)
+	{
+		print_warning("ProxyRequest::retry(): Can't connect to ",
+			_upstream.name, std::string(": ") + strerror(errno));
+		_failed = true;
+		return false;
+	}
+	(void) close(_conn_fd);
+	_conn_fd = fd;
+	// Still watched: they're closed once the event loop dropped them,
+	// so the new duplicates don't get their numbers meanwhile.
+	if (_write_fd != -1)
+	{
+		_stale_fds.push_back(_write_fd);
+	}
+	_stale_fds.push_back(_read_fd);
+	_write_fd = -1;
+	_read_fd = -1;
+	if ((_write_fd = fcntl(_conn_fd, F_DUPFD_CLOEXEC, 0)) == -1
+		|| (_read_fd = fcntl(_conn_fd, F_DUPFD_CLOEXEC, 0)) == -1)
+	{
+		print_warning("ProxyRequest::retry(): fcntl() fail: ", strerror(errno), "");
+		_failed = true;
+		return false;
+	}
+	_connected = false;
+	_send.swap(_request);
+	std::string().swap(_request);
+	_send_pos = 0;
+	_input_offset = 0;
+	_sent = false;
+	_deadline = std::time(NULL) + _timeout;
+	return false;
+}
+
+bool ProxyRequest::parse_header(size_t end)
+{
+	std::string header = _recv.substr(0, end);
+	std::vector<std::pair<std::string, std::string> > fields;
+	std::string connection;
+	std::string transfer_encoding;
+	std::string line;
+	std::string length;
+	size_t pos = 0;
+	size_t eol;
+	size_t colon;
+	int status_code;
+	char *num_end;
+
+	_recv.erase(0, end);
+	// "HTTP/1.x NNN reason"
+	eol = header.find('\n');
+	line = header.substr(0, eol);
+	if (!line.empty() && line[line.length() - 1] == '\r')
+	{
+		line.erase(line.length() - 1);
+	}
+	status_code = (line.length() >= 12) ? static_cast<int> (
+			std::strtol(line.c_str() + 9, &num_end, 10)) : 0;
+	if (status_code < 100 || status_code > 599 || num_end != line.c_str() + 12
+		|| (*num_end != '\0' && *num_end != ' ')
+		|| line.compare(0, 7, "HTTP/1.") != 0 || line[8] != ' ')
+	{
+		print_warning("ProxyRequest::parse_header(): Bad status line from ",
+			_upstream.name, ": " + line);
+		_failed = true;
+		return false;
+	}
+	if (status_code == 101)
+	{
+		print_warning("ProxyRequest::parse_header(): ",
+			_upstream.name, " switched protocols, which isn't supported");
+		_failed = true;
+		return false;
+	}
+	else if (status_code < 200)
+	{
+		// Interim response, the final one follows.
+		return true;
+	}
+	// HTTP/1.0 closes connections, unless asked otherwise.
+	_keep_alive = (line[7] != '0');
+	_output = "Status: " + line.substr(9) + "\r\n";
+	pos = eol + 1;
+	while ((eol = header.find('\n', pos)) != std::string::npos)
+	{
+		line = header.substr(pos, eol - pos);
+		pos = eol + 1;
+		if (!line.empty() && line[line.length() - 1] == '\r')
+		{
+			line.erase(line.length() - 1);
+		}
+		if (line.empty())
+		{
+			break;
+		}
+		colon = line.find(':');
+		if (colon == 0 || colon == std::string::npos || line[0] == ' ' || line[0] == '\t')
+		{
+			print_warning("ProxyRequest::parse_header(): Malformed header line from ",
+				_upstream.name, ": " + line);
+			_failed = true;
+			return false;
+		}
+		fields.push_back(std::make_pair(line.substr(0, colon), trim(line.substr(colon + 1))));
+		if (strcasecmp(fields.back().first.c_str(), "Connection") == 0)
+		{
+			connection += fields.back().second + ',';
+		}
+		else if (strcasecmp(fields.back().first.c_str(), "Transfer-Encoding") == 0)
+		{
+			transfer_encoding = fields.back().second;
+		}
+		else if (strcasecmp(fields.back().first.c_str(), "Content-Length") == 0)
+		{
+			length = fields.back().second;
+		}
+	}
+	if (is_listed("close", connection))
+	{
+		_keep_alive = false;
+	}
+	else if (is_listed("keep-alive", connection))
+	{
+		_keep_alive = true;
+	}
+	for (size_t i = 0; i < fields.size(); i++)
+	{
+		// "Status" would be taken for the status of CGI output.
+		if (!is_hop_by_hop(fields[i].first, connection)
+			&& strcasecmp(fields[i].first.c_str(), "Status") != 0
+			&& (transfer_encoding.empty()
+				|| strcasecmp(fields[i].first.c_str(), "Content-Length") != 0))
+		{
+			_output += fields[i].first + ": " + fields[i].second + "\r\n";
+		}
+	}
+	_output += "\r\n";
+	// RFC 9112, 6.3: how the body ends.
+	if (status_code == 204 || status_code == 304)
+	{
+		_state = DONE;
+	}
+	else if (!transfer_encoding.empty())
+	{
+		_state = (transfer_encoding.length() >= 7 && strcasecmp(transfer_encoding.c_str()
+				+ transfer_encoding.length() - 7, "chunked") == 0)
+			? CHUNK_SIZE : BODY_CLOSE;
+	}
+	else if (!length.empty())
+	{
+		errno = 0;
+		_remaining = std::strtoul(length.c_str(), &num_end, 10);
+		if (length.find_first_not_of("0123456789") != std::string::npos || errno == ERANGE)
+		{
+			print_warning("ProxyRequest::parse_header(): Bad length from ",
+				_upstream.name, ": " + length);
+			_failed = true;
+			return false;
+		}
+		_state = (_remaining == 0) ? DONE : BODY_LENGTH;
+	}
+	else
+	{
+		_state = BODY_CLOSE;
+	}
+	if (_state == BODY_CLOSE)
+	{
+		_keep_alive = false;
+	}
+	return true;
+}
+
+bool ProxyRequest::parse_body()
+{
+	size_t pos = 0;
+	size_t eol;
+	size_t length;
+	std::string line;
+	char *end;
+
+	while (pos < _recv.length() && _state != DONE)
+	{
+		if (_state == BODY_CLOSE)
+		{
+			_output.append(_recv, pos, std::string::npos);
+			pos = _recv.length();
+			continue;
+		}
+		else if (_state == BODY_LENGTH || _state == CHUNK_DATA)
+		{
+			length = static_cast<size_t> (std::min(_remaining,
+					static_cast<uint64_t> (_recv.length() - pos)));
+			_output.append(_recv, pos, length);
+			pos += length;
+			_remaining -= length;
+			if (_remaining == 0)
+			{
+				_state = (_state == BODY_LENGTH) ? DONE : CHUNK_END;
+			}
+			continue;
+		}
+		if ((eol = _recv.find('\n', pos)) == std::string::npos)
+		{
+			if (_recv.length() - pos > MAX_LINE_SIZE)
+			{
+				print_warning("ProxyRequest::parse_body(): Line too long from ",
+					_upstream.name, "");
+				_failed = true;
+				return false;
+			}
+			break;
+		}
+		line = _recv.substr(pos, eol - pos);
+		pos = eol + 1;
+		if (!line.empty() && line[line.length() - 1] == '\r')
+		{
+			line.erase(line.length() - 1);
+		}
+		if (_state == CHUNK_SIZE)
+		{
+			// Chunk extensions are ignored.
+			errno = 0;
+			_remaining = std::strtoul(line.c_str(), &end, 16);
+			if (end == line.c_str() || errno == ERANGE
+				|| (*end != '\0' && *end != ';' && *end != ' ' && *end != '\t'))
+			{
+				print_warning("ProxyRequest::parse_body(): Bad chunk size from ",
+					_upstream.name, ": " + line);
+				_failed = true;
+				return false;
+			}
+			_state = (_remaining == 0) ? TRAILER : CHUNK_DATA;
+		}
+		else if (_state == CHUNK_END && !line.empty())
+		{
+			print_warning("ProxyRequest::parse_body(): Chunk longer than its size from ",
+				_upstream.name, "");
+			_failed = true;
+			return false;
+		}
+		else if (_state == CHUNK_END)
+		{
+			_state = CHUNK_SIZE;
+		}
+		else if (line.empty())
+		{
+			// Trailer fields aren't forwarded.
+			_state = DONE;
+		}
+	}
+	_recv.erase(0, pos);
+	return true;
+}
+
+void ProxyRequest::close_fd(int fd)
+{
+	if (fd == -1)
+	{
+		return;
+	}
+	else if (fd == _write_fd)
+	{
+		_write_fd = -1;
+		// Nothing is sent anymore.
+		std::string().swap(_send);
+		_send_pos = 0;
+	}
+	else if (fd == _read_fd)
+	{
+		_read_fd = -1;
+	}
+	else if (std::find(_stale_fds.begin(), _stale_fds.end(), fd) != _stale_fds.end())
+	{
+		_stale_fds.erase(std::find(_stale_fds.begin(), _stale_fds.end(), fd));
+	}
+	else
+	{
+		return;
+	}
+	(void) close(fd);
+}
+
+void ProxyRequest::poll()
+{
+}
+
+void ProxyRequest::abort()
+{
+	if (_state != DONE)
+	{
+		_failed = true;
+	}
+}
+
+bool ProxyRequest::is_finished() const
+{
+	return _state == DONE || _failed;
+}
+
+bool ProxyRequest::succeeded() const
+{
+	return _state == DONE && !_failed;
+}
+
+bool ProxyRequest::is_expired(time_t now) const
+{
+	// The upstream isn't read while the client doesn't take the body,
+	// its silence doesn't count then.
+	return !is_finished() && _output.length() < MAX_BUFFERED_OUTPUT && now > _deadline;
+}
+
+std::string &ProxyRequest::get_output()
+{
+	if (_output.length() >= MAX_BUFFERED_OUTPUT)
+	{
+		_deadline = std::time(NULL) + _timeout;
+	}
+	return _output;
+}
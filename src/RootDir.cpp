@@ -0,0 +1,195 @@
+#include "RootDir.hpp"
+#include "Webserv.hpp"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/openat2.h>
+#include <stdexcept>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+bool RootDir::_have_openat2 = true;
+
+/**
+ * Checks if \p relative_path goes above the directory it's relative to
+ * with "..". Only used when openat2() isn't available.
+ */
+static bool escapes(const std::string &relative_path)
+{
+	size_t depth = 0;
+	size_t start = 0;
+	size_t end;
+
+	if (relative_path.length() > 0 && relative_path.at(0) == '/')
+	{
+		return true;
+	}
+	while (start <= relative_path.length())
+	{
+		end = relative_path.find('/', start);
+		if (end == std::string::npos)
+		{
+			end = relative_path.length();
+		}
+		if (relative_path.compare(start, end - start, "..") == 0)
+		{
+			if (depth-- == 0)
+			{
+				return true;
+			}
+		}
+		else if (end > start
+			&& relative_path.compare(start, end - start, ".") != 0)
+		{
+			depth++;
+		}
+		start = end + 1;
+	}
+	return false;
+}
+
+RootDir::RootDir()
+	: _fd(-1),
+	  _dev(0),
+	  _ino(0)
+{
+}
+
+void RootDir::open(const std::string &path)
+{
+	struct stat sb;
+	int fd;
+
+	fd = ::open(path.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+	if (fd == -1 || fstat(fd, &sb) == -1)
+	{
+		std::string error = strerror(errno);
+
+		if (fd != -1)
+		{
+			(void) ::close(fd);
+		}
+		throw std::runtime_error(std::string("RootDir::open(): ")
+				+ "Couldn't open " + path + ": " + error);
+	}
+	this->close();
+	_fd = fd;
+	_path = path;
+	_dev = sb.st_dev;
+	_ino = sb.st_ino;
+}
+
+void RootDir::close()
+{
+	if (_fd != -1)
+	{
+		(void) ::close(_fd);
+		_fd = -1;
+	}
+}
+
+bool RootDir::is_open() const
+{
+	return _fd != -1;
+}
+
+const std::string &RootDir::get_path() const
+{
+	return _path;
+}
+
+dev_t RootDir::get_dev() const
+{
+	return _dev;
+}
+
+ino_t RootDir::get_ino() const
+{
+	return _ino;
+}
+
+int RootDir::open_beneath(const std::string &relative_path,
+		int flags, mode_t mode) const
+{
+	const char *path = relative_path.empty() ? "." : relative_path.c_str();
+	struct open_how how;
+	long fd;
+
+	if (_fd == -1)
+	{
+		errno = EBADF;
+		return -1;
+	}
+	if (_have_openat2)
+	{
+		std::memset(&how, 0, sizeof(how));
+		how.flags = static_cast<unsigned int> (flags | O_CLOEXEC);
+		// openat2() is strict: mode must be 0 if the file isn't created.
+		how.mode = (flags & O_CREAT) ? mode : 0;
+		how.resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS;
+		fd = syscall(SYS_openat2, _fd, path, &how, sizeof(how));
+		if (fd != -1 || errno != ENOSYS)
+		{
+			return static_cast<int> (fd);
+		}
+		print_warning("openat2() isn't supported by the kernel, ",
+			"checking request paths by hand", "");
+		_have_openat2 = false;
+	}
+	if (escapes(relative_path))
+	{
+		errno = EXDEV;
+		return -1;
+	}
+	return openat(_fd, path, flags | O_CLOEXEC, mode);
+}
+
+int RootDir::stat_beneath(const std::string &relative_path,
+		struct stat &sb) const
+{
+	int fd, ret, saved_errno;
+
+	// O_PATH doesn't need any permissions on the file itself.
+	fd = this->open_beneath(relative_path, O_PATH);
+	if (fd == -1)
+	{
+		return -1;
+	}
+	ret = fstat(fd, &sb);
+	saved_errno = errno;
+	(void) ::close(fd);
+	errno = saved_errno;
+	return ret;
+}
+
+int RootDir::unlink_beneath(const std::string &relative_path) const
+{
+	std::string::size_type slash = relative_path.find_last_of('/');
+	std::string parent, name;
+	int fd, ret, saved_errno;
+
+	if (slash == std::string::npos)
+	{
+		name = relative_path;
+	}
+	else
+	{
+		parent = relative_path.substr(0, slash);
+		name = relative_path.substr(slash + 1);
+	}
+	if (name.empty() || name == "." || name == "..")
+	{
+		errno = EISDIR;
+		return -1;
+	}
+	fd = this->open_beneath(parent, O_PATH | O_DIRECTORY);
+	if (fd == -1)
+	{
+		return -1;
+	}
+	ret = unlinkat(fd, name.c_str(), 0);
+	saved_errno = errno;
+	(void) ::close(fd);
+	errno = saved_errno;
+	return ret;
+}
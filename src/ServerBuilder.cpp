@@ -92,30 +92,39 @@ void ServerBuilder::handle_root(const std::vector<std::string>& parameters, Serv
     	server_cfg.setRoot(parameters[1]);
 }
 
-// /**
-//  * @brief Processes the 'server_name' directive.
-//  *
-//  * Format: `server_name <name>;`
-//  *
-//  * @param parameters Tokenized directive.
-//  * @param server_cfg Server configuration to update.
-//  * @throws ConfigParser::ErrorException On incorrect syntax.
-//  */
-// void ServerBuilder::handle_server_name(const std::vector<std::string>& parameters, ServerConfig& server_cfg) {
-// 	if (parameters.size() < 3 || parameters.back() != ";")
-// 		throw ConfigParser::ErrorException("Invalid syntax for 'server_name' directive");
+/**
+ * @brief Processes the 'server_name' directive.
+ *
+ * Format: `server_name <name1> <name2> ... ;`
+ * Names may start with "*." or end with ".*" (wildcards).
+ *
+ * @param parameters Tokenized directive.
+ * @param server_cfg Server configuration to update.
+ * @throws ConfigParser::ErrorException On incorrect syntax.
+ */
+void ServerBuilder::handle_server_name(const std::vector<std::string>& parameters, ServerConfig& server_cfg) {
+	if (parameters.size() < 3 || parameters.back() != ";")
+		throw ConfigParser::ErrorException("Invalid syntax for 'server_name' directive");
 
-// 	// Add each name (parameters[1] to parameters[n - 2])
-// 	for (size_t i = 1; i < parameters.size() - 1; ++i) {
-// 		const std::string& name = parameters[i];
+	// Add each name (parameters[1] to parameters[n - 2])
+	for (size_t i = 1; i < parameters.size() - 1; ++i) {
+		const std::string& name = parameters[i];
 
-// 		// Must not be empty, no spaces
-// 		if (name.empty() || name.find(' ') != std::string::npos)
-// 			throw ConfigParser::ErrorException("Invalid server_name: '" + name + "'");
+		// Must not be empty, no spaces
+		if (name.empty() || name.find(' ') != std::string::npos)
+			throw ConfigParser::ErrorException("Invalid server_name: '" + name + "'");
 
-// 		server_cfg.addServerName(name);
-// 	}
-// }
+		// Wildcard is allowed only as the first or the last label
+		std::string::size_type star = name.find('*');
+		if (star != std::string::npos
+			&& !(name.length() > 2 && name.find('*', star + 1) == std::string::npos
+				&& ((star == 0 && name[1] == '.')
+					|| (star == name.length() - 1 && name[star - 1] == '.'))))
+			throw ConfigParser::ErrorException("Invalid wildcard in server_name: '" + name + "'");
+
+		server_cfg.addServerName(name);
+	}
+}
 
 
 /**
@@ -230,6 +239,97 @@ void ServerBuilder::handle_large_client_header_buffers(const std::vector<std::st
 	server_cfg.setLargeClientHeaderBuffers(bufferCount, finalBufferSize);
 }
 
+/**
+ * @brief Processes 'types' block mapping file extensions to MIME types.
+ *
+ * Format:
+ * ```
+ * types {
+ *     <mime type> <ext1> <ext2> ...;
+ * }
+ * ```
+ * Usually it comes from `include mime.types;`.
+ *
+ * @param parameters Tokenized block.
+ * @param server_cfg Server configuration to update.
+ * @throws ConfigParser::ErrorException On syntax error.
+ */
+void ServerBuilder::handle_types(const std::vector<std::string>& parameters, ServerConfig& server_cfg) {
+	if (parameters.size() < 3 || parameters[1] != "{" || parameters.back() != "}")
+		throw ConfigParser::ErrorException("Invalid syntax for types block");
+
+	for (size_t i = 2; i + 1 < parameters.size(); ++i) {
+		const std::string& type = parameters[i];
+		if (type == ";" || type == "{" || type == "}" || type.find('/') == std::string::npos)
+			throw ConfigParser::ErrorException("Invalid MIME type in types block: " + type);
+		size_t ext_count = 0;
+		for (++i; i + 1 < parameters.size() && parameters[i] != ";"; ++i) {
+			server_cfg.addMimeType(type, parameters[i]);
+			++ext_count;
+		}
+		if (i + 1 >= parameters.size())
+			throw ConfigParser::ErrorException("Missing ';' after MIME type " + type + " in types block");
+		if (ext_count == 0)
+			throw ConfigParser::ErrorException("MIME type " + type + " has no extensions in types block");
+	}
+}
+
+/**
+ * @brief Checks if \p code is a status code "return" and "redirect_map" may redirect with.
+ */
+static bool is_redirect_code(int code) {
+	return code == 301 || code == 302 || code == 303 || code == 307 || code == 308;
+}
+
+/**
+ * @brief Processes 'redirect_map' directive loading exact-path redirects from a file.
+ *
+ * Format: `redirect_map <file>;`
+ * Every line of the file is `<path> <url> [<code>]` (code defaults to 301),
+ * empty lines and lines starting with '#' are skipped.
+ * Responses are serialized right away, so redirects never touch the disk.
+ *
+ * @param parameters Tokenized directive.
+ * @param server_cfg Server configuration to update.
+ * @throws ConfigParser::ErrorException On syntax error or unreadable file.
+ */
+void ServerBuilder::handle_redirect_map(const std::vector<std::string>& parameters, ServerConfig& server_cfg) {
+	if (parameters.size() != 3 || parameters[2] != ";")
+		throw ConfigParser::ErrorException("Invalid syntax for redirect_map directive");
+
+	std::string content;
+	try {
+		content = read_file(parameters[1]);
+	}
+	catch (const std::exception &e) {
+		throw ConfigParser::ErrorException(std::string("redirect_map: ") + e.what());
+	}
+	std::istringstream file(content);
+	std::string line;
+	for (size_t line_no = 1; std::getline(file, line); ++line_no) {
+		std::istringstream iss(line);
+		std::string path, url, code_str, extra;
+		int code = 301;
+
+		if (!(iss >> path) || path[0] == '#')
+			continue;
+		std::ostringstream where;
+		where << parameters[1] << ":" << line_no;
+		if (!(iss >> url) || (iss >> code_str && iss >> extra))
+			throw ConfigParser::ErrorException("redirect_map: Invalid syntax at " + where.str());
+		if (path[0] != '/')
+			throw ConfigParser::ErrorException("redirect_map: Path must begin with '/' at " + where.str());
+		if (!code_str.empty()) {
+			code = std::atoi(code_str.c_str());
+			if (code_str.find_first_not_of("0123456789") != std::string::npos
+				|| !is_redirect_code(code))
+				throw ConfigParser::ErrorException("redirect_map: Invalid redirect code at " + where.str());
+		}
+		if (!server_cfg.addRedirect(path, code, url))
+			print_warning("Duplicate redirect of \"", path, "\", ignored");
+	}
+}
+
 /**
  * @brief Processes 'error_page' directive mapping codes to pages.
  *
@@ -265,16 +365,20 @@ void ServerBuilder::handle_error_page(const std::vector<std::string>& parameters
 /**
  * @brief Handles the 'listen' directive defining the port.
  *
- * Format: `listen <port>;` or `listen <ip:port>;`
+ * Format: `listen <port> [default_server];` or `listen <ip:port> [default_server];`
+ * "default_server" makes this server handle requests
+ * whose "Host" matches no "server_name" on that address.
  *
  * @param parameters Tokenized directive.
  * @param server_cfg Server configuration to update.
  * @throws ConfigParser::ErrorException On invalid syntax or value.
  */
 void ServerBuilder::handle_listen(const std::vector<std::string>& parameters, ServerConfig& server_cfg) {
-    	if (parameters.size() != 3 || parameters[2] != ";") {
-        	throw ConfigParser::ErrorException("Invalid syntax for 'listen': expected format 'listen <port>;' or 'listen <ip:port>;'");
+    	if (!(parameters.size() == 3 && parameters[2] == ";")
+		&& !(parameters.size() == 4 && parameters[2] == "default_server" && parameters[3] == ";")) {
+        	throw ConfigParser::ErrorException("Invalid syntax for 'listen': expected format 'listen <port> [default_server];' or 'listen <ip:port> [default_server];'");
    	}
+	bool is_default = (parameters.size() == 4);
 
 	std::string listen_value = parameters[1];
     	std::string host, port_str;
@@ -308,8 +412,12 @@ void ServerBuilder::handle_listen(const std::vector<std::string>& parameters, Se
 
 	if (colon_pos != std::string::npos) {
 		server_cfg.addListenEndpoint(std::make_pair(host, port_val));
+		if (is_default)
+			server_cfg.addDefaultEndpoint(std::make_pair(host, port_val));
 	} else {
 		server_cfg.addPort(port_val);
+		if (is_default)
+			server_cfg.addDefaultEndpoint(std::make_pair(std::string(), port_val));
 	}
 }
 
@@ -370,6 +478,103 @@ static void handle_location_autoindex(Location& loc, const std::vector<std::stri
 }
 
 
+/**
+ * @brief Handles the 'autoindex_format' directive inside a location block.
+ *
+ * @param loc The Location object being configured.
+ * @param tokens Tokenized directive line.
+ * @param i Current index in tokens; updated to skip parsed elements.
+ * @throws ConfigParser::ErrorException if value is not "html" or "json" or syntax is incorrect.
+ */
+static void handle_location_autoindex_format(Location& loc, const std::vector<std::string>& tokens, size_t& i) {
+	if (i + 2 >= tokens.size() || tokens[i + 2] != ";")
+		throw ConfigParser::ErrorException("Invalid syntax for autoindex_format directive in location block");
+
+	const std::string& value = tokens[i + 1];
+	if (value == "html")
+		loc.setAutoindexFormat(AutoIndex::FORMAT_HTML);
+	else if (value == "json")
+		loc.setAutoindexFormat(AutoIndex::FORMAT_JSON);
+	else
+		throw ConfigParser::ErrorException("Invalid value for autoindex_format: " + value);
+	i += 2;
+}
+
+/**
+ * @brief Handles the 'autoindex_sort' directive inside a location block.
+ *
+ * @param loc The Location object being configured.
+ * @param tokens Tokenized directive line.
+ * @param i Current index in tokens; updated to skip parsed elements.
+ * @throws ConfigParser::ErrorException if value is not "none", "name", "size" or "mtime" or syntax is incorrect.
+ */
+static void handle_location_autoindex_sort(Location& loc, const std::vector<std::string>& tokens, size_t& i) {
+	if (i + 2 >= tokens.size() || tokens[i + 2] != ";")
+		throw ConfigParser::ErrorException("Invalid syntax for autoindex_sort directive in location block");
+
+	const std::string& value = tokens[i + 1];
+	if (value == "none")
+		loc.setAutoindexSort(AutoIndex::SORT_NONE);
+	else if (value == "name")
+		loc.setAutoindexSort(AutoIndex::SORT_NAME);
+	else if (value == "size")
+		loc.setAutoindexSort(AutoIndex::SORT_SIZE);
+	else if (value == "mtime")
+		loc.setAutoindexSort(AutoIndex::SORT_MTIME);
+	else
+		throw ConfigParser::ErrorException("Invalid value for autoindex_sort: " + value);
+	i += 2;
+}
+
+/**
+ * @brief Handles the 'autoindex_details' directive inside a location block.
+ *
+ * @param loc The Location object being configured.
+ * @param tokens Tokenized directive line.
+ * @param i Current index in tokens; updated to skip parsed elements.
+ * @throws ConfigParser::ErrorException if value is missing or syntax is incorrect.
+ */
+static void handle_location_autoindex_details(Location& loc, const std::vector<std::string>& tokens, size_t& i) {
+	if (i + 2 >= tokens.size() || tokens[i + 2] != ";")
+		throw ConfigParser::ErrorException("Invalid syntax for autoindex_details directive in location block");
+
+	const std::string& value = tokens[i + 1];
+	if (value == "on")
+		loc.setAutoindexDetails(true);
+	else if (value == "off")
+		loc.setAutoindexDetails(false);
+	else
+		throw ConfigParser::ErrorException("Invalid value for autoindex_details: " + value);
+	i += 2;
+}
+
+/**
+ * @brief Handles the 'autoindex_page_size' directive inside a location block.
+ *
+ * @param loc The Location object being configured.
+ * @param tokens Tokenized directive line.
+ * @param i Current index in tokens; updated to skip parsed elements.
+ * @throws ConfigParser::ErrorException if value isn't a positive number or syntax is incorrect.
+ */
+static void handle_location_autoindex_page_size(Location& loc, const std::vector<std::string>& tokens, size_t& i) {
+	if (i + 2 >= tokens.size() || tokens[i + 2] != ";")
+		throw ConfigParser::ErrorException("Invalid syntax for autoindex_page_size directive in location block");
+
+	const std::string& value = tokens[i + 1];
+	if (value.empty() || value.size() > 9)
+		throw ConfigParser::ErrorException("Invalid value for autoindex_page_size: " + value);
+	for (size_t j = 0; j < value.size(); ++j) {
+		if (!std::isdigit(value[j]))
+			throw ConfigParser::ErrorException("Invalid value for autoindex_page_size: " + value);
+	}
+	long page_size = std::atol(value.c_str());
+	if (page_size == 0)
+		throw ConfigParser::ErrorException("autoindex_page_size can't be 0");
+	loc.setAutoindexPageSize(static_cast<size_t>(page_size));
+	i += 2;
+}
+
+
 /**
  * @brief Handles the 'allow_methods' directive inside a location block.
  *
@@ -530,6 +735,445 @@ static void handle_location_error_page(Location& loc, const std::vector<std::str
         i += 3;
 }
 
+/**
+ * @brief Handles the 'try_files' directive inside a location block.
+ *
+ * Format: `try_files <uri1> [<uri2> ...] <fallback_uri | =code>;`
+ * URIs may contain `$uri` (the request path).
+ *
+ * @param loc The Location object being configured.
+ * @param tokens Tokenized directive line.
+ * @param i Current index in tokens; updated to point to next directive.
+ * @throws ConfigParser::ErrorException if the directive is malformed or terminator is missing.
+ */
+static void handle_location_try_files(Location& loc, const std::vector<std::string>& tokens, size_t& i) {
+	size_t first = ++i;
+
+	while (i < tokens.size() && tokens[i] != ";")
+		++i;
+	if (i >= tokens.size())
+		throw ConfigParser::ErrorException("Missing ';' after try_files directive in location block");
+	if (i - first < 2)
+		throw ConfigParser::ErrorException("try_files requires at least one file and a fallback");
+	for (size_t j = first; j < i; ++j) {
+		const std::string& item = tokens[j];
+
+		if (j == i - 1 && item[0] == '=') {
+			int code = std::atoi(item.c_str() + 1);
+			if (item.find_first_not_of("0123456789", 1) != std::string::npos
+				|| code < 400 || code > 599)
+				throw ConfigParser::ErrorException("Invalid try_files code: " + item);
+		}
+		else if (item[0] != '/' && item.compare(0, 4, "$uri") != 0)
+			throw ConfigParser::ErrorException("try_files URI must begin with '/' or $uri: " + item);
+		loc.addTryFile(item);
+	}
+}
+
+/**
+ * @brief Handles the 'return' directive inside a location block.
+ *
+ * Format: `return <code> <url>;` for redirects (301, 302, 303, 307, 308)
+ * or `return <code>;` for error responses (4xx, 5xx).
+ *
+ * @param loc The Location object being configured.
+ * @param tokens Tokenized directive line.
+ * @param i Current index in tokens; updated to point to next directive.
+ * @throws ConfigParser::ErrorException if the directive is malformed or terminator is missing.
+ */
+static void handle_location_return(Location& loc, const std::vector<std::string>& tokens, size_t& i) {
+	if (i + 2 >= tokens.size())
+		throw ConfigParser::ErrorException("Missing ';' after return directive in location block");
+
+	const std::string& code_str = tokens[++i];
+	int code = std::atoi(code_str.c_str());
+	if (code_str.find_first_not_of("0123456789") != std::string::npos)
+		throw ConfigParser::ErrorException("Invalid return code: " + code_str);
+	if (is_redirect_code(code)) {
+		if (tokens[i + 1] == ";" || i + 2 >= tokens.size() || tokens[i + 2] != ";")
+			throw ConfigParser::ErrorException("return " + code_str + " requires a URL followed by ';'");
+		loc.setReturn(code, tokens[++i]);
+	}
+	else if (code >= 400 && code <= 599) {
+		if (tokens[i + 1] != ";")
+			throw ConfigParser::ErrorException("return " + code_str + " takes no URL");
+		loc.setReturn(code, "");
+	}
+	else
+		throw ConfigParser::ErrorException("Invalid return code: " + code_str);
+	++i;
+}
+
+/**
+ * @brief Handles the 'fastcgi_pass' directive inside a location block.
+ *
+ * Format: `fastcgi_pass unix:<path>;` or `fastcgi_pass <host>:<port>;`
+ * Requests of the location are passed to that FastCGI application server.
+ *
+ * @param loc The Location object being configured.
+ * @param tokens Tokenized directive line.
+ * @param i Current index in tokens; updated to point to next directive.
+ * @throws ConfigParser::ErrorException if the address is invalid or terminator is missing.
+ */
+static void handle_location_fastcgi_pass(Location& loc, const std::vector<std::string>& tokens, size_t& i) {
+	UpstreamAddress upstream;
+
+	if (i + 2 >= tokens.size() || tokens[i + 2] != ";")
+		throw ConfigParser::ErrorException("Invalid fastcgi_pass directive in location block");
+	if (!UpstreamPool::parse_address(tokens[i + 1], upstream))
+		throw ConfigParser::ErrorException("Invalid fastcgi_pass address: " + tokens[i + 1]);
+	loc.setFastCGIPass(upstream);
+	i += 2;
+}
+
+/**
+ * @brief Handles the 'proxy_pass' directive inside a location block.
+ *
+ * Format: `proxy_pass unix:<path>;` or `proxy_pass <host>:<port>;`
+ * Requests of the location are forwarded as they are to that HTTP server.
+ *
+ * @param loc The Location object being configured.
+ * @param tokens Tokenized directive line.
+ * @param i Current index in tokens; updated to point to next directive.
+ * @throws ConfigParser::ErrorException if the address is invalid or terminator is missing.
+ */
+static void handle_location_proxy_pass(Location& loc, const std::vector<std::string>& tokens, size_t& i) {
+	UpstreamAddress upstream;
+
+	if (i + 2 >= tokens.size() || tokens[i + 2] != ";")
+		throw ConfigParser::ErrorException("Invalid proxy_pass directive in location block");
+	if (!UpstreamPool::parse_address(tokens[i + 1], upstream))
+		throw ConfigParser::ErrorException("Invalid proxy_pass address: " + tokens[i + 1]);
+	loc.setProxyPass(upstream);
+	i += 2;
+}
+
+/**
+ * @brief Handles the 'cgi_pool' directive inside a location block.
+ *
+ * Format: `cgi_pool <workers> [<max_requests>];`
+ * CGI scripts of the location are run as up to <workers> persistent
+ * processes each, replaced after <max_requests> requests (0 or none: never).
+ *
+ * @param loc The Location object being configured.
+ * @param tokens Tokenized directive line.
+ * @param i Current index in tokens; updated to point to next directive.
+ * @throws ConfigParser::ErrorException if a number is invalid or terminator is missing.
+ */
+static void handle_location_cgi_pool(Location& loc, const std::vector<std::string>& tokens, size_t& i) {
+	size_t first = ++i;
+	size_t values[2] = { 0, 0 };
+
+	while (i < tokens.size() && tokens[i] != ";")
+		++i;
+	if (i >= tokens.size())
+		throw ConfigParser::ErrorException("Missing ';' after cgi_pool directive in location block");
+	if (i - first < 1 || i - first > 2)
+		throw ConfigParser::ErrorException("cgi_pool takes the amount of workers and, optionally, requests per worker");
+	for (size_t j = first; j < i; ++j) {
+		if (tokens[j].empty() || tokens[j].size() > 9
+			|| tokens[j].find_first_not_of("0123456789") != std::string::npos)
+			throw ConfigParser::ErrorException("Invalid cgi_pool value: " + tokens[j]);
+		values[j - first] = static_cast<size_t>(std::atoi(tokens[j].c_str()));
+	}
+	if (values[0] == 0)
+		throw ConfigParser::ErrorException("cgi_pool needs at least one worker");
+	loc.setCgiPool(values[0], values[1]);
+}
+
+/**
+ * @brief Handles the 'internal' directive inside a location block.
+ *
+ * Format: `internal;`
+ * The location can't be requested by clients (they get 404),
+ * only reached by redirects of the server itself
+ * (CGI local redirects, "X-Accel-Redirect", "try_files").
+ *
+ * @param loc The Location object being configured.
+ * @param tokens Tokenized directive line.
+ * @param i Current index in tokens; updated to point to next directive.
+ * @throws ConfigParser::ErrorException if the directive has arguments or terminator is missing.
+ */
+static void handle_location_internal(Location& loc, const std::vector<std::string>& tokens, size_t& i) {
+	if (i + 1 >= tokens.size() || tokens[i + 1] != ";")
+		throw ConfigParser::ErrorException("internal directive takes no arguments");
+	loc.setInternal(true);
+	++i;
+}
+
+/**
+ * @brief Handles the 'cgi_cache' directive inside a location block.
+ *
+ * Format: `cgi_cache <ttl> [<stale>];`
+ * Complete responses of CGI scripts to GET requests are kept in memory
+ * for <ttl> seconds (unless the script's "Cache-Control" says otherwise),
+ * then served for <stale> more seconds while one request refreshes them.
+ *
+ * @param loc The Location object being configured.
+ * @param tokens Tokenized directive line.
+ * @param i Current index in tokens; updated to point to next directive.
+ * @throws ConfigParser::ErrorException if a number is invalid or terminator is missing.
+ */
+static void handle_location_cgi_cache(Location& loc, const std::vector<std::string>& tokens, size_t& i) {
+	size_t first = ++i;
+	size_t values[2] = { 0, 0 };
+
+	while (i < tokens.size() && tokens[i] != ";")
+		++i;
+	if (i >= tokens.size())
+		throw ConfigParser::ErrorException("Missing ';' after cgi_cache directive in location block");
+	if (i - first < 1 || i - first > 2)
+		throw ConfigParser::ErrorException("cgi_cache takes the seconds responses are fresh and, optionally, stale");
+	for (size_t j = first; j < i; ++j) {
+		if (tokens[j].empty() || tokens[j].size() > 9
+			|| tokens[j].find_first_not_of("0123456789") != std::string::npos)
+			throw ConfigParser::ErrorException("Invalid cgi_cache value: " + tokens[j]);
+		values[j - first] = static_cast<size_t>(std::atoi(tokens[j].c_str()));
+	}
+	if (values[0] == 0)
+		throw ConfigParser::ErrorException("cgi_cache needs responses to be fresh for at least a second");
+	loc.setCgiCache(values[0], values[1]);
+}
+
+/**
+ * @brief Handles the 'cgi_cache_key' directive inside a location block.
+ *
+ * Format: `cgi_cache_key <item> [<item> ...];`
+ * Items are `$request_method`, `$uri`, `$args` and `$http_<name>`
+ * (value of the request's header field); responses of a script are cached
+ * apart for every combination of them.
+ * Default is `$request_method $uri $args`.
+ *
+ * @param loc The Location object being configured.
+ * @param tokens Tokenized directive line.
+ * @param i Current index in tokens; updated to point to next directive.
+ * @throws ConfigParser::ErrorException if an item is unknown or terminator is missing.
+ */
+static void handle_location_cgi_cache_key(Location& loc, const std::vector<std::string>& tokens, size_t& i) {
+	size_t first = ++i;
+
+	while (i < tokens.size() && tokens[i] != ";")
+		++i;
+	if (i >= tokens.size())
+		throw ConfigParser::ErrorException("Missing ';' after cgi_cache_key directive in location block");
+	if (i == first)
+		throw ConfigParser::ErrorException("cgi_cache_key requires at least one item");
+	for (size_t j = first; j < i; ++j) {
+		if (tokens[j] != "$request_method" && tokens[j] != "$uri" && tokens[j] != "$args"
+			&& (tokens[j].compare(0, 6, "$http_") != 0 || tokens[j].size() == 6))
+			throw ConfigParser::ErrorException("Invalid cgi_cache_key item: " + tokens[j]);
+		loc.addCgiCacheKey(tokens[j]);
+	}
+}
+
+/**
+ * @brief Handles the 'cache_path' directive inside a location block.
+ *
+ * Format: `cache_path <directory> [<max_size>];`
+ * Entries of `cgi_cache` are also written to <directory> (which must exist),
+ * so they're still served after a restart; least recently used ones are
+ * evicted past <max_size> (e.g. "64m", default 1g).
+ *
+ * @param loc The Location object being configured.
+ * @param tokens Tokenized directive line.
+ * @param i Current index in tokens; updated to point to next directive.
+ * @throws ConfigParser::ErrorException if the size is invalid or terminator is missing.
+ */
+static void handle_location_cache_path(Location& loc, const std::vector<std::string>& tokens, size_t& i) {
+	size_t first = ++i;
+	uint64_t max_size = 1024UL * 1024UL * 1024UL;
+
+	while (i < tokens.size() && tokens[i] != ";")
+		++i;
+	if (i >= tokens.size())
+		throw ConfigParser::ErrorException("Missing ';' after cache_path directive in location block");
+	if (i - first < 1 || i - first > 2 || tokens[first].empty())
+		throw ConfigParser::ErrorException("cache_path takes a directory and, optionally, its max size");
+	if (i - first == 2)
+		max_size = validateGetMbs(tokens[first + 1]);
+	if (max_size == 0)
+		throw ConfigParser::ErrorException("cache_path max size can't be 0");
+	loc.setCachePath(tokens[first], max_size);
+}
+
+/**
+ * @brief Handles the 'cgi_max_concurrent' directive inside a location block.
+ *
+ * Format: `cgi_max_concurrent <n>;`
+ * At most <n> CGI scripts of the location run at once; other requests
+ * wait in its queue (see `cgi_queue_size`) or get 503.
+ *
+ * @param loc The Location object being configured.
+ * @param tokens Tokenized directive line.
+ * @param i Current index in tokens; updated to point to next directive.
+ * @throws ConfigParser::ErrorException if the number is invalid or terminator is missing.
+ */
+static void handle_location_cgi_max_concurrent(Location& loc, const std::vector<std::string>& tokens, size_t& i) {
+	if (i + 2 >= tokens.size() || tokens[i + 2] != ";")
+		throw ConfigParser::ErrorException("cgi_max_concurrent takes the amount of scripts");
+	if (tokens[i + 1].empty() || tokens[i + 1].size() > 9
+		|| tokens[i + 1].find_first_not_of("0123456789") != std::string::npos)
+		throw ConfigParser::ErrorException("Invalid cgi_max_concurrent value: " + tokens[i + 1]);
+	if (std::atoi(tokens[i + 1].c_str()) == 0)
+		throw ConfigParser::ErrorException("cgi_max_concurrent needs at least one script");
+	loc.setCgiMaxConcurrent(static_cast<size_t>(std::atoi(tokens[i + 1].c_str())));
+	i += 2;
+}
+
+/**
+ * @brief Handles the 'cgi_queue_size' directive inside a location block.
+ *
+ * Format: `cgi_queue_size <n> [<timeout>];`
+ * Up to <n> requests past `cgi_max_concurrent` wait (first come,
+ * first served) for a script to end, for <timeout> seconds at most
+ * (default 10); the rest get 503 with "Retry-After" right away.
+ *
+ * @param loc The Location object being configured.
+ * @param tokens Tokenized directive line.
+ * @param i Current index in tokens; updated to point to next directive.
+ * @throws ConfigParser::ErrorException if a number is invalid or terminator is missing.
+ */
+static void handle_location_cgi_queue_size(Location& loc, const std::vector<std::string>& tokens, size_t& i) {
+	size_t first = ++i;
+	size_t values[2] = { 0, 10 };
+
+	while (i < tokens.size() && tokens[i] != ";")
+		++i;
+	if (i >= tokens.size())
+		throw ConfigParser::ErrorException("Missing ';' after cgi_queue_size directive in location block");
+	if (i - first < 1 || i - first > 2)
+		throw ConfigParser::ErrorException("cgi_queue_size takes the amount of requests and, optionally, seconds they may wait");
+	for (size_t j = first; j < i; ++j) {
+		if (tokens[j].empty() || tokens[j].size() > 9
+			|| tokens[j].find_first_not_of("0123456789") != std::string::npos)
+			throw ConfigParser::ErrorException("Invalid cgi_queue_size value: " + tokens[j]);
+		values[j - first] = static_cast<size_t>(std::atoi(tokens[j].c_str()));
+	}
+	if (values[1] == 0)
+		throw ConfigParser::ErrorException("cgi_queue_size needs requests to wait for at least a second");
+	loc.setCgiQueue(values[0], values[1]);
+}
+
+/**
+ * @brief Handles the 'stub_status' directive inside a location block.
+ *
+ * Format: `stub_status [<address>[/<bits>] ...];`
+ * Requests of the location get the server's counters and histograms
+ * (CGI queues, connections, etc.) in the Prometheus text format,
+ * if they come from one of the listed networks (only loopback,
+ * if none are listed); others get 403.
+ *
+ * @param loc The Location object being configured.
+ * @param tokens Tokenized directive line.
+ * @param i Current index in tokens; updated to point to next directive.
+ * @throws ConfigParser::ErrorException if an address is invalid or terminator is missing.
+ */
+static void handle_location_stub_status(Location& loc, const std::vector<std::string>& tokens, size_t& i) {
+	struct in_addr addr;
+	std::string address;
+	std::string::size_type slash;
+	long bits;
+	char *end;
+
+	loc.setStubStatus(true);
+	for (++i; i < tokens.size() && tokens[i] != ";"; ++i) {
+		address = tokens[i];
+		bits = 32;
+		if ((slash = address.find('/')) != std::string::npos) {
+			bits = std::strtol(address.c_str() + slash + 1, &end, 10);
+			if (slash + 1 == address.length() || *end != '\0' || bits < 0 || bits > 32)
+				throw ConfigParser::ErrorException("Invalid stub_status network: " + tokens[i]);
+			address.erase(slash);
+		}
+		if (inet_pton(AF_INET, address.c_str(), &addr) != 1)
+			throw ConfigParser::ErrorException("Invalid stub_status network: " + tokens[i]);
+		loc.addStubStatusAllow(ntohl(addr.s_addr),
+			(bits == 0) ? 0 : ~static_cast<uint32_t>(0) << (32 - bits));
+	}
+	if (i >= tokens.size())
+		throw ConfigParser::ErrorException("Missing ';' after stub_status directive");
+	if (loc.getStubStatusAllow().empty())
+		loc.addStubStatusAllow(0x7F000000, 0xFF000000);
+}
+
+/**
+ * @brief Parses the single numeric argument of a 'cgi_rlimit_*' directive.
+ *
+ * @param name Directive name, for error messages.
+ * @param tokens Tokenized directive line.
+ * @param i Current index in tokens; updated to point to the terminator.
+ * @param suffixes Whether a k/m/g suffix (KiB, MiB, GiB) is allowed.
+ * @return The value, never 0.
+ * @throws ConfigParser::ErrorException if the value is invalid or terminator is missing.
+ */
+static uint64_t parse_rlimit(const std::string& name, const std::vector<std::string>& tokens, size_t& i, bool suffixes) {
+	std::string value;
+	uint64_t multiplier = 1;
+	char suffix;
+
+	if (i + 2 >= tokens.size() || tokens[i + 2] != ";")
+		throw ConfigParser::ErrorException(name + " takes a single value");
+	value = tokens[i + 1];
+	suffix = value.empty() ? '\0' : static_cast<char>(std::tolower(value[value.size() - 1]));
+	if (suffixes && (suffix == 'k' || suffix == 'm' || suffix == 'g')) {
+		multiplier = (suffix == 'k') ? 1024UL : (suffix == 'm') ? 1024UL * 1024UL : 1024UL * 1024UL * 1024UL;
+		value.erase(value.size() - 1);
+	}
+	if (value.empty() || value.size() > 9 || value.find_first_not_of("0123456789") != std::string::npos
+		|| std::atoi(value.c_str()) == 0)
+		throw ConfigParser::ErrorException("Invalid " + name + " value: " + tokens[i + 1]);
+	i += 2;
+	return static_cast<uint64_t>(std::atoi(value.c_str())) * multiplier;
+}
+
+/**
+ * @brief Handles the 'cgi_rlimit_cpu' directive inside a location block.
+ *
+ * Format: `cgi_rlimit_cpu <seconds>;`
+ * CGI scripts of the location get SIGXCPU after <seconds> of CPU time
+ * (and SIGKILL a second later).
+ *
+ * @param loc The Location object being configured.
+ * @param tokens Tokenized directive line.
+ * @param i Current index in tokens; updated to point to next directive.
+ * @throws ConfigParser::ErrorException if the value is invalid or terminator is missing.
+ */
+static void handle_location_cgi_rlimit_cpu(Location& loc, const std::vector<std::string>& tokens, size_t& i) {
+	loc.setCgiRlimitCpu(parse_rlimit("cgi_rlimit_cpu", tokens, i, false));
+}
+
+/**
+ * @brief Handles the 'cgi_rlimit_as' directive inside a location block.
+ *
+ * Format: `cgi_rlimit_as <size>;`
+ * CGI scripts of the location can't map more than <size> bytes
+ * (e.g. "512m") of address space, allocations past it fail.
+ *
+ * @param loc The Location object being configured.
+ * @param tokens Tokenized directive line.
+ * @param i Current index in tokens; updated to point to next directive.
+ * @throws ConfigParser::ErrorException if the value is invalid or terminator is missing.
+ */
+static void handle_location_cgi_rlimit_as(Location& loc, const std::vector<std::string>& tokens, size_t& i) {
+	loc.setCgiRlimitAs(parse_rlimit("cgi_rlimit_as", tokens, i, true));
+}
+
+/**
+ * @brief Handles the 'cgi_rlimit_nofile' directive inside a location block.
+ *
+ * Format: `cgi_rlimit_nofile <count>;`
+ * CGI scripts of the location can't have more than <count>
+ * descriptors open.
+ *
+ * @param loc The Location object being configured.
+ * @param tokens Tokenized directive line.
+ * @param i Current index in tokens; updated to point to next directive.
+ * @throws ConfigParser::ErrorException if the value is invalid or terminator is missing.
+ */
+static void handle_location_cgi_rlimit_nofile(Location& loc, const std::vector<std::string>& tokens, size_t& i) {
+	loc.setCgiRlimitNofile(parse_rlimit("cgi_rlimit_nofile", tokens, i, false));
+}
+
 /**
  * @brief Returns a map of supported location directive handlers.
  *
@@ -544,6 +1188,10 @@ static const std::map<std::string, LocationHandler>& getLocationHandlers() {
         handlers["root"] = handle_location_root;
         handlers["index"] = handle_location_index;
         handlers["autoindex"] = handle_location_autoindex;
+        handlers["autoindex_format"] = handle_location_autoindex_format;
+        handlers["autoindex_sort"] = handle_location_autoindex_sort;
+        handlers["autoindex_details"] = handle_location_autoindex_details;
+        handlers["autoindex_page_size"] = handle_location_autoindex_page_size;
         handlers["allow_methods"] = handle_location_allow_methods;
         handlers["alias"] = handle_location_alias;
         handlers["cgi_path"] = handle_location_cgi_path;
@@ -551,6 +1199,21 @@ static const std::map<std::string, LocationHandler>& getLocationHandlers() {
         handlers["client_max_body_size"] = handle_location_client_max_body_size;
 	handlers["upload_path"] = handle_location_upload_path;
 	handlers["error_page"] = handle_location_error_page;
+	handlers["try_files"] = handle_location_try_files;
+	handlers["return"] = handle_location_return;
+	handlers["fastcgi_pass"] = handle_location_fastcgi_pass;
+	handlers["proxy_pass"] = handle_location_proxy_pass;
+	handlers["cgi_pool"] = handle_location_cgi_pool;
+	handlers["internal"] = handle_location_internal;
+	handlers["cgi_cache"] = handle_location_cgi_cache;
+	handlers["cgi_cache_key"] = handle_location_cgi_cache_key;
+	handlers["cache_path"] = handle_location_cache_path;
+	handlers["cgi_max_concurrent"] = handle_location_cgi_max_concurrent;
+	handlers["cgi_queue_size"] = handle_location_cgi_queue_size;
+	handlers["stub_status"] = handle_location_stub_status;
+	handlers["cgi_rlimit_cpu"] = handle_location_cgi_rlimit_cpu;
+	handlers["cgi_rlimit_as"] = handle_location_cgi_rlimit_as;
+	handlers["cgi_rlimit_nofile"] = handle_location_cgi_rlimit_nofile;
     }
     return handlers;
 }
@@ -561,28 +1224,41 @@ static const std::map<std::string, LocationHandler>& getLocationHandlers() {
  *
  * Format:
  * ```
- * location <path> {
+ * location [= | ^~] <path> {
  *     directive1 ...
  *     directive2 ...
  * }
  * ```
+ * "=" matches \p path exactly (checked before any prefix),
+ * "^~" is a prefix that stops the search once it's the longest match.
  *
  * @param parameters Full token list for the location block.
  * @param server_cfg Server configuration to update.
  * @throws ConfigParser::ErrorException On unknown directive or syntax error.
  */
 void ServerBuilder::handle_location(const std::vector<std::string>& parameters, ServerConfig& server_cfg) {
-    	if (parameters.size() < 3 || parameters[0] != "location" || parameters[2] != "{")
+    	if (parameters.size() < 3 || parameters[0] != "location")
         	throw ConfigParser::ErrorException("Invalid or missing URI for location block");
 
     	Location location;
-    	location.setPath(parameters[1]);
+	size_t path_index = 1;
+
+	if (parameters[1] == "=" || parameters[1] == "^~") {
+		location.setMatch(parameters[1] == "=" ? Location::MATCH_EXACT : Location::MATCH_PREFERENTIAL);
+		path_index = 2;
+	}
+	if (parameters.size() < path_index + 2 || parameters[path_index + 1] != "{")
+        	throw ConfigParser::ErrorException("Invalid or missing URI for location block");
+    	location.setPath(parameters[path_index]);
 
 	// Check for duplicate location path.
+	// Exact and prefix locations are looked up separately,
+	// so they may share a path.
 	const std::vector<Location>& existing_locations = server_cfg.getLocations(); // Adjust return type as needed.
 	for (std::vector<Location>::const_iterator it = existing_locations.begin(); it != existing_locations.end(); ++it)
 	{
-		if (it->getPath() == location.getPath())
+		if (it->getPath() == location.getPath()
+			&& (it->getMatch() == Location::MATCH_EXACT) == (location.getMatch() == Location::MATCH_EXACT))
 		{
 			throw ConfigParser::ErrorException("Duplicate location path: " + location.getPath());
 		}
@@ -590,7 +1266,7 @@ void ServerBuilder::handle_location(const std::vector<std::string>& parameters,
 
     	const std::map<std::string, LocationHandler>& handlers = getLocationHandlers();
 
-    	for (size_t i = 3; i < parameters.size(); ++i) {
+    	for (size_t i = path_index + 2; i < parameters.size(); ++i) {
         	if (parameters[i] == "}") break;
 
         	std::map<std::string, LocationHandler>::const_iterator it = handlers.find(parameters[i]);
@@ -625,6 +1301,7 @@ HandlerFunc ServerBuilder::getHandler(const std::string& directive) {
 	if (handlers.empty()) {
 		handlers["listen"] = &ServerBuilder::handle_listen;
 		handlers["host"] = &ServerBuilder::handle_host;
+		handlers["server_name"] = &ServerBuilder::handle_server_name;
 		handlers["root"] = &ServerBuilder::handle_root;
 		handlers["client_max_body_size"] = &ServerBuilder::handle_mbs;
 		handlers["autoindex"] = &ServerBuilder::handle_autoindex;
@@ -632,6 +1309,8 @@ HandlerFunc ServerBuilder::getHandler(const std::string& directive) {
 		handlers["error_page"] = &ServerBuilder::handle_error_page;
 		handlers["location"] = &ServerBuilder::handle_location;
 		handlers["large_client_header_buffers"] = &ServerBuilder::handle_large_client_header_buffers;
+		handlers["types"] = &ServerBuilder::handle_types;
+		handlers["redirect_map"] = &ServerBuilder::handle_redirect_map;
 	}
 
 	std::map<std::string, HandlerFunc>::const_iterator it = handlers.find(directive);
@@ -661,6 +1340,9 @@ ServerConfig ServerBuilder::build(const std::vector<std::string>& directives) {
 			handler(tokens, server_cfg);
 		}
 	}
+	server_cfg.compileMimeTypes();
+	server_cfg.compileLocations();
+	server_cfg.compileRedirects();
 	// CGI paths count must correspond to count of CGI extensions.
 	// Basically, we provide a path to a handler to each CGI extension type.
 	for (std::vector<Location>::const_iterator it = server_cfg.getLocations().begin();
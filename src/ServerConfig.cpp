@@ -4,7 +4,7 @@ ServerConfig::ServerConfig()
 	: _listen_endpoints(),
 	  _ports(),
 	  _hosts(),
-	//   _server_names(),
+	  _server_names(),
 	  _root(),
 	  _client_max_body_size(DEFAULT_CONTENT_LENGTH),
 	  _index(),
@@ -21,7 +21,8 @@ ServerConfig::ServerConfig(const ServerConfig& other)
 	: _listen_endpoints(other._listen_endpoints),
 	  _ports(other._ports),
 	  _hosts(other._hosts),
-	//   _server_names(other._server_names),
+	  _server_names(other._server_names),
+	  _default_endpoints(other._default_endpoints),
 	  _root(other._root),
 	  _client_max_body_size(other._client_max_body_size),
 	  _index(other._index),
@@ -30,7 +31,14 @@ ServerConfig::ServerConfig(const ServerConfig& other)
 	  _locations(other._locations),
 	  _server_addresses(other._server_addresses),
 	  _listen_fds(other._listen_fds),
-	  _large_client_header_buffers(other._large_client_header_buffers)
+	  _large_client_header_buffers(other._large_client_header_buffers),
+	  _error_responses(other._error_responses),
+	  _mime_types(other._mime_types),
+	  _exact_locations(other._exact_locations),
+	  _location_trie(other._location_trie),
+	  _redirect_responses(other._redirect_responses),
+	  _redirects(other._redirects),
+	  _root_dir(other._root_dir)
 
 {}
 
@@ -45,7 +53,7 @@ const std::vector<std::pair<std::string, uint16_t> >& ServerConfig::getListenEnd
 
 const std::vector<uint16_t>& 		ServerConfig::getPorts() const { return _ports; }
 const std::vector<std::string>& 	ServerConfig::getHosts() const { return _hosts; }
-// const std::vector<std::string>& 	ServerConfig::getServerNames() const { return _server_names; }
+const std::vector<std::string>& 	ServerConfig::getServerNames() const { return _server_names; }
 const std::string& 			ServerConfig::getRoot() const { return _root; }
 uint64_t 				ServerConfig::getClientMaxBodySize() const { return _client_max_body_size; }
 const std::vector<std::string>& 	ServerConfig::getIndex() const { return _index; }
@@ -76,8 +84,9 @@ void 					ServerConfig::setPorts(const std::vector<uint16_t>& ports) { _ports =
 void 					ServerConfig::addPort(uint16_t port) { _ports.push_back(port); }
 void 					ServerConfig::setHosts(const std::vector<std::string>& hosts) { _hosts = hosts; }
 void 					ServerConfig::addHost(const std::string& host) { _hosts.push_back(host); }
-// void 					ServerConfig::setServerNames(const std::vector<std::string>& names) { _server_names = names; }
-// void 					ServerConfig::addServerName(const std::string& name) { _server_names.push_back(name); }
+void 					ServerConfig::setServerNames(const std::vector<std::string>& names) { _server_names = names; }
+void 					ServerConfig::addServerName(const std::string& name) { _server_names.push_back(name); }
+void 					ServerConfig::addDefaultEndpoint(const std::pair<std::string, uint16_t>& endpoint) { _default_endpoints.insert(endpoint); }
 void 					ServerConfig::setRoot(const std::string& root) { _root = root; }
 void 					ServerConfig::setClientMaxBodySize(uint64_t size) { _client_max_body_size = size; }
 void 					ServerConfig::setIndex(const std::vector<std::string>& index) { _index = index; }
@@ -107,35 +116,182 @@ bool 					ServerConfig::alreadyAddedHost(const std::string& host) const {
 
 void 					ServerConfig::resetIndex() { _index.clear(); }
 
-const Location				&ServerConfig::determineLocation(
+void					ServerConfig::compileLocations()
+{
+	std::map<std::string, size_t> exact;
+
+	_location_trie.clear();
+	for (size_t i = 0; i < _locations.size(); ++i) {
+		if (_locations[i].getMatch() == Location::MATCH_EXACT) {
+			exact[_locations[i].getPath()] = i;
+		} else {
+			_location_trie.insert(_locations[i].getPath(), i);
+		}
+	}
+	// Request paths are case-sensitive.
+	_exact_locations = PerfectHash<size_t>(exact, false);
+}
+
+bool ServerConfig::addRedirect(const std::string &path, int status_code,
+		const std::string &url)
+{
+	return _redirect_responses.insert(std::make_pair(path,
+			generateRedirectResponse(status_code, url))).second;
+}
+
+void ServerConfig::compileRedirects()
+{
+	// Request paths are case-sensitive.
+	_redirects = PerfectHash<std::string>(_redirect_responses, false);
+}
+
+const std::string			*ServerConfig::findRedirect(
+		const std::string &request_path) const
+{
+	return _redirects.find(request_path);
+}
+
+void ServerConfig::compileEffectiveLocations()
+{
+	_effective_locations.clear();
+	for (size_t i = 0; i < _locations.size(); i++) {
+		_effective_locations.push_back(EffectiveLocation(*this, &_locations[i]));
+	}
+	_effective_default = EffectiveLocation(*this, NULL);
+}
+
+const EffectiveLocation			*ServerConfig::findLocation(
 		const std::string &request_path) const
 {
-	std::vector<Location>::const_iterator ret
-		= _locations.end();
-	// The point of `ret_path_len`:
-	// let's say we have defined locations with paths "/" and "/some_path/"
-	// and the `request_path` is "/some_path/some_data".
-	//
-	// We need to keep track of the curent deepest found location path.
-	// If we don't, then if "/" is found as the first location,
-	// it will be returned instead of "/some_path/".
-	size_t ret_path_len = 0;
-
-	for (std::vector<Location>::const_iterator it = _locations.begin();
-		it != _locations.end(); ++it) {
-		const std::string &loc_path = it->getPath();
-		if (request_path.compare(0, loc_path.length(), loc_path) == 0
-			&& ret_path_len < loc_path.length()) {
-			ret = it;
-			ret_path_len = loc_path.length();
+	size_t i;
+
+	if (_effective_default.root_dir == NULL) {
+		throw std::runtime_error(std::string("ServerConfig::findLocation(): ")
+				+ "Effective locations weren't compiled.");
+	}
+	const size_t *exact = _exact_locations.find(request_path);
+	if (exact != NULL) {
+		return &_effective_locations[*exact];
+	}
+	i = _location_trie.find(request_path);
+	if (i == LocationTrie::NOT_FOUND) {
+		return &_effective_default;
+	}
+	return &_effective_locations[i];
+}
+
+
+void ServerConfig::prepareErrorResponses()
+{
+	std::string body, content_type, page_root;
+	std::map<int, std::string>::const_iterator page;
+
+	_error_responses.assign(MAX_ERROR_STATUS_CODE - MIN_ERROR_STATUS_CODE + 1, "");
+	page_root = _root;
+	if (page_root.empty() || page_root.at(page_root.length() - 1) != '/')
+	{
+		page_root.push_back('/');
+	}
+	for (int code = MIN_ERROR_STATUS_CODE; code <= MAX_ERROR_STATUS_CODE; code++)
+	{
+		page = _error_pages.find(code);
+		// No point in preparing responses for codes we never send.
+		if (page == _error_pages.end()
+			&& getReasonPhrase(code) == "Unknown Status")
+		{
+			continue;
+		}
+		body.clear();
+		if (page != _error_pages.end())
+		{
+			try
+			{
+				body = read_file(page_root + page->second);
+				content_type = getMimeType(page->second);
+			}
+			catch (const std::ios_base::failure &e)
+			{
+				print_warning("Couldn't read error page: ", e.what(), "");
+				page = _error_pages.end();
+			}
+		}
+		if (page == _error_pages.end())
+		{
+			body = generateErrorBody(code);
+			content_type = "text/html";
 		}
+		_error_responses.at(static_cast<size_t> (code - MIN_ERROR_STATUS_CODE))
+			= generateErrorResponse(code, body, content_type);
 	}
-	if (ret == _locations.end()) {
-		throw std::out_of_range("ClientConnection::determineLocation: Couldn't determine the Location to which target corresponds to.");
+	for (std::vector<Location>::iterator it = _locations.begin();
+		it != _locations.end(); ++it)
+	{
+		it->prepareErrorResponses(_mime_types.empty()
+			? MimeTypes::getDefault() : _mime_types);
 	}
-	return *ret;
 }
 
+void ServerConfig::openRootDirs()
+{
+	try
+	{
+		_root_dir.open(_root);
+	}
+	catch (const std::runtime_error &e)
+	{
+		print_warning("Server root: ", e.what(), "");
+	}
+	for (std::vector<Location>::iterator it = _locations.begin();
+		it != _locations.end(); ++it)
+	{
+		it->openRootDirs();
+	}
+}
+
+const RootDir &ServerConfig::getRootDir() const
+{
+	return _root_dir;
+}
+
+void ServerConfig::addMimeType(const std::string& type, const std::string& ext)
+{
+	_mime_types.add(type, ext);
+}
+
+void ServerConfig::compileMimeTypes()
+{
+	_mime_types.compile();
+}
+
+const std::string &ServerConfig::getMimeType(const std::string &path) const
+{
+	return this->getMimeTypes().lookup(path);
+}
+
+const MimeTypes &ServerConfig::getMimeTypes() const
+{
+	if (_mime_types.empty())
+	{
+		return MimeTypes::getDefault();
+	}
+	return _mime_types;
+}
+
+const std::string *ServerConfig::getErrorResponse(int status_code) const
+{
+	if (status_code < MIN_ERROR_STATUS_CODE || status_code > MAX_ERROR_STATUS_CODE
+		|| _error_responses.empty())
+	{
+		return NULL;
+	}
+	const std::string &ret = _error_responses[static_cast<size_t> (
+			status_code - MIN_ERROR_STATUS_CODE)];
+	if (ret.empty())
+	{
+		return NULL;
+	}
+	return &ret;
+}
 
 /**
  * @brief Sets default server configuration values if not explicitly provided.
@@ -215,7 +371,7 @@ void ServerConfig::validateListenEndpoint(void)
  * @return int File descriptor of the created socket on success, or -1 on failure.
  */
 int ServerConfig::createListeningSocket(const std::string& host, uint16_t port, sockaddr_in& out_addr) {
-	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
 	if (fd < 0) return -1;
 
 	// Allow socket reuse to avoid "Address already in use" on quick restart
@@ -273,50 +429,59 @@ void ServerConfig::validateRoot() {
  * `_listen_endpoints`, then creates listening sockets for all specified
  * endpoints and host-port combinations. On success, stores socket descriptors
  * and addresses. Throws if binding any socket fails.
+ *
+ * Endpoints already present in @p bound_fds were bound by another server
+ * and are shared with it (name-based virtual hosting), so they're skipped.
+ * Endpoints bound here are added to @p bound_fds.
+ *
+ * @param bound_fds Listening socket of every endpoint bound so far.
  */
-void ServerConfig::initServerSocket() {
+void ServerConfig::initServerSocket(std::map<std::pair<std::string, uint16_t>, int> &bound_fds) {
 	setDefaultsIfEmpty();
 	validateListenEndpoint();
 	validateRoot();
 	print_log("", "Initializing server sockets...", "");
 
-	// 1. Explicit host:port endpoints
-	for (size_t i = 0; i < _listen_endpoints.size(); ++i) {
-		const std::string& host = _listen_endpoints[i].first;
-		uint16_t port = _listen_endpoints[i].second;
+	const std::vector<std::pair<std::string, uint16_t> > endpoints = getAllListenEndpoints();
+
+	for (size_t i = 0; i < endpoints.size(); ++i) {
+		const std::string& host = endpoints[i].first;
+		uint16_t port = endpoints[i].second;
+		std::string endpoint = host + ":" + to_string(port);
+
+		if (bound_fds.find(endpoints[i]) != bound_fds.end()) {
+			print_log("Sharing ", endpoint, " with another server");
+			continue;
+		}
 
 		sockaddr_in addr;
 		int fd = createListeningSocket(host, port, addr);
 		if (fd < 0) {
-			std::string err_msg = "Failed to bind: " + host + ":" + to_string(port) + ": " + std::strerror(errno);
+			std::string err_msg = "Failed to bind: " + endpoint + ": " + std::strerror(errno);
 			throw std::runtime_error(err_msg);
 		}
 
-		std::string endpoint = host + ":" + to_string(port);
 		print_log("Successfully listening on ", endpoint, " (fd: " + to_string(fd) + ")");
 		_server_addresses.push_back(addr);
 		_listen_fds.push_back(fd);
+		bound_fds[endpoints[i]] = fd;
 	}
+}
+
+std::vector<std::pair<std::string, uint16_t> > ServerConfig::getAllListenEndpoints() const {
+	std::vector<std::pair<std::string, uint16_t> > ret(_listen_endpoints);
 
-	// 2. All host x port combinations
 	for (size_t i = 0; i < _hosts.size(); ++i) {
 		for (size_t j = 0; j < _ports.size(); ++j) {
-			const std::string& host = _hosts[i];
-			uint16_t port = _ports[j];
-
-			sockaddr_in addr;
-			int fd = createListeningSocket(host, port, addr);
-			if (fd < 0) {
-				std::string err_msg = "Failed to bind: " + host + ":" + to_string(port) + ": " + std::strerror(errno);
-				throw std::runtime_error(err_msg);
-			}
-
-			std::string endpoint = host + ":" + to_string(port);
-			print_log("Successfully listening on ", endpoint, " (fd: " + to_string(fd) + ")");
-			_server_addresses.push_back(addr);
-			_listen_fds.push_back(fd);
+			ret.push_back(std::make_pair(_hosts[i], _ports[j]));
 		}
 	}
+	return ret;
+}
+
+bool ServerConfig::isDefaultServer(const std::pair<std::string, uint16_t>& endpoint) const {
+	return _default_endpoints.count(endpoint) != 0
+		|| _default_endpoints.count(std::make_pair(std::string(), endpoint.second)) != 0;
 }
 
 /**
@@ -338,4 +503,10 @@ void ServerConfig::cleanupSocket() {
 	}
 	_listen_fds.clear();
 	_server_addresses.clear();
+	_root_dir.close();
+	for (std::vector<Location>::iterator it = _locations.begin();
+		it != _locations.end(); ++it)
+	{
+		it->closeRootDirs();
+	}
 }
@@ -1,17 +1,21 @@
 #include "../include/ServerManager.hpp"
+#include "../include/LogChannel.hpp"
 #include <algorithm>	// For std::find() in ServerManager::handleNewConnection().
 
 static volatile sig_atomic_t g_shutdown_requested = 0;
 
+const int ServerManager::_CGI_CHECK_INTERVAL;
+
 extern "C" void handle_signal(int sig)
 {
 	(void)sig;
-	print_log("", "Received shutdown signal, cleaning up...", "");
+	// Nothing is logged here: the log queue may be in the middle
+	// of an update (the event loop logs the shutdown instead).
 	g_shutdown_requested = 1;
 }
 
 
-ServerManager::ServerManager() : _epoll_fd(-1) {}
+ServerManager::ServerManager() : _epoll_fd(-1), _next_refresh_id(-1), _log_watched(false) {}
 
 ServerManager::~ServerManager() {
 	cleanup();
@@ -28,11 +32,13 @@ void ServerManager::loadServers(const std::vector<ServerConfig>& servers) {
  * It performs the following actions:
  * - Creates an epoll instance for event-driven I/O.
  * - Iterates through the list of configured servers.
- * - Initializes each server's socket(s) by calling `initServerSocket()`.
+ * - Initializes each server's socket(s) by calling `initServerSocket()`
+ *   (an address already bound by a previous server is shared, not bound again).
  * - Retrieves the list of file descriptors (`getListenFds()`).
  * - Sets each listening socket to non-blocking mode using `fcntl()`.
  * - Adds each listening socket to the epoll instance via `addFdToEpoll()`.
- * - Associates the socket file descriptor with its corresponding server configuration.
+ * - Registers the server in the VirtualHosts of every socket it listens on,
+ *   then builds their server name lookup tables.
  *
  * If any error occurs during socket setup or epoll registration, the specific server is cleaned up
  * and initialization continues with the next server. If no valid server sockets are initialized,
@@ -41,20 +47,27 @@ void ServerManager::loadServers(const std::vector<ServerConfig>& servers) {
  * @throws std::runtime_error if epoll creation fails or no valid servers are successfully initialized.
  */
 void ServerManager::initializeSockets() {
-	_epoll_fd = epoll_create(1);
+	// Nothing of the server may leak into CGI processes
+	// (persistent workers would keep client sockets open).
+	_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
 	if (_epoll_fd < 0) {
 		// print_err("Failed to create epoll instance: ", strerror(errno), "");
 		throw std::runtime_error("Failed to create epoll instance: " + std::string(strerror(errno)));
 	}
 
+	// Listening socket of every bound address,
+	// servers listening on the same one share it.
+	std::map<std::pair<std::string, uint16_t>, int> bound_fds;
+
 	for (size_t i = 0; i < _servers.size(); ++i) {
+		std::map<std::pair<std::string, uint16_t>, int> bound_before = bound_fds;
+
 		try {
-			_servers[i].initServerSocket();
+			_servers[i].initServerSocket(bound_fds);
+			_servers[i].openRootDirs();
+			_servers[i].prepareErrorResponses();
+			_servers[i].compileEffectiveLocations();
 			const std::vector<int>& fds = _servers[i].getListenFds();
-			if (fds.empty()) {
-				print_warning("No listening sockets found for server ", to_string(i), "");
-				continue;
-			}
 
 			for (size_t j = 0; j < fds.size(); ++j) {
 				int fd = fds[j];
@@ -68,18 +81,36 @@ void ServerManager::initializeSockets() {
 					throw std::runtime_error("Failed to add fd to epoll: " + to_string(fd));
 				}
 
-				_fd_to_server[fd] = &_servers[i];
+				_fd_to_vhosts[fd].setAddress(_servers[i].getServerAddresses().at(j));
 
 				print_log("Listening socket ", to_string(fd), " registered with epoll");
 			}
+
+			const std::vector<std::pair<std::string, uint16_t> > endpoints
+				= _servers[i].getAllListenEndpoints();
+			for (size_t j = 0; j < endpoints.size(); ++j) {
+				_fd_to_vhosts[bound_fds[endpoints[j]]].add(&_servers[i],
+					_servers[i].isDefaultServer(endpoints[j]));
+			}
 		} catch (const std::exception& e) {
+			const std::vector<int>& fds = _servers[i].getListenFds();
+
+			for (size_t j = 0; j < fds.size(); ++j) {
+				_fd_to_vhosts.erase(fds[j]);
+			}
+			bound_fds = bound_before;
 			_servers[i].cleanupSocket();
 			print_err("Server initializeSockets failed: ", e.what(), "");
 			continue;
 		}
 	}
 
-	if (_fd_to_server.empty()) {
+	for (std::map<int, VirtualHosts>::iterator it = _fd_to_vhosts.begin();
+		it != _fd_to_vhosts.end(); ++it) {
+		it->second.compile();
+	}
+
+	if (_fd_to_vhosts.empty()) {
 		throw std::runtime_error("No valid servers were initialized");
 	}
 }
@@ -92,8 +123,14 @@ void ServerManager::cleanup()
 		_servers[i].cleanupSocket();
 	}
 
-	_fd_to_server.clear();
+	_fd_to_vhosts.clear();
+	_cgi_fd_to_client.clear();
 	_client_connections.clear();
+	CGIWorkerPool::shutdown();
+	DiskCache::shutdown();
+	// Lines of scripts killed above included.
+	LogChannel::shutdown();
+	_log_watched = false;
 
 	if (_epoll_fd >= 0) {
 		print_log("", "Closing epoll file descriptor...", "");
@@ -134,6 +171,7 @@ void ServerManager::closeClientConnection(int client_fd)
 	if (it == _client_connections.end())
 		return;
 
+	unwatchCgi(client_fd);
 	if (!removeFdFromEpoll(client_fd)) {
 		print_warning("Failed to remove fd: ", to_string(client_fd), " from epoll");
 	}
@@ -190,6 +228,260 @@ bool ServerManager::removeFdFromEpoll(int fd)
 	return true;
 }
 
+/**
+ * @brief Changes events watched on a file descriptor in the epoll instance.
+ *
+ * This method wraps `epoll_ctl()` with `EPOLL_CTL_MOD`.
+ *
+ * @param fd The file descriptor to modify.
+ * @param events New bitmask of epoll events to monitor for the file descriptor.
+ * @return true if the events were successfully changed, false otherwise.
+ */
+bool ServerManager::modifyFdInEpoll(int fd, uint32_t events)
+{
+	struct epoll_event ev;
+	ev.events = events;
+	ev.data.fd = fd;
+
+	if (epoll_ctl(_epoll_fd, EPOLL_CTL_MOD, fd, &ev) < 0) {
+		print_warning("epoll_ctl(MOD) failed: ", strerror(errno), "");
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Starts watching the CGI backend (script or FastCGI request) of a client.
+ *
+ * Descriptors listed by the backend (a script's stdin, stdout and pidfd,
+ * a FastCGI connection) are added to epoll and mapped to the client.
+ * The client socket is switched to hangups only: its response
+ * can't be sent before the backend's header arrives, and watching EPOLLOUT
+ * would only wake the loop up for nothing.
+ *
+ * If the descriptors can't be watched, the backend is aborted
+ * and the client gets 500 instead.
+ *
+ * @param client_fd File descriptor of the client.
+ */
+void ServerManager::watchCgi(int client_fd)
+{
+	if (!syncCgiFds(client_fd)) {
+		unwatchCgi(client_fd);
+		_client_connections.find(client_fd)->second._response.abort_cgi(500);
+		return;
+	}
+	if (client_fd >= 0)
+		(void) modifyFdInEpoll(client_fd, EPOLLRDHUP);
+}
+
+/**
+ * @brief Matches the watched descriptors of the CGI backend of a client
+ * to the ones it lists now.
+ *
+ * New ones are added (a pooled CGI request gets its worker's descriptors
+ * only once a worker is free). Watched ones it doesn't list anymore
+ * are only removed from epoll: the backend left its output descriptor out
+ * until the client takes what was buffered (see CGIBackend).
+ *
+ * @param client_fd File descriptor of the client.
+ * @return true on success, false if a descriptor couldn't be added.
+ */
+bool ServerManager::syncCgiFds(int client_fd)
+{
+	ClientConnection &conn = _client_connections.find(client_fd)->second;
+	std::vector<CGIBackend::Watch> watches;
+	std::set<int> listed;
+	std::map<int, int>::iterator it;
+
+	conn._response.get_cgi()->get_watched_fds(watches);
+	for (size_t i = 0; i < watches.size(); ++i) {
+		listed.insert(watches[i].first);
+		if (_cgi_fd_to_client.count(watches[i].first))
+			continue;
+		if (!addFdToEpoll(watches[i].first, watches[i].second))
+			return false;
+		_cgi_fd_to_client[watches[i].first] = client_fd;
+	}
+	it = _cgi_fd_to_client.begin();
+	while (it != _cgi_fd_to_client.end()) {
+		if (it->second == client_fd && !listed.count(it->first)) {
+			(void) removeFdFromEpoll(it->first);
+			_cgi_fd_to_client.erase(it++);
+		}
+		else
+			++it;
+	}
+	return true;
+}
+
+/**
+ * @brief Stops watching every descriptor of the CGI script of a client.
+ *
+ * @param client_fd File descriptor of the client.
+ */
+void ServerManager::unwatchCgi(int client_fd)
+{
+	std::map<int, int>::iterator it = _cgi_fd_to_client.begin();
+
+	while (it != _cgi_fd_to_client.end()) {
+		if (it->second == client_fd) {
+			(void) removeFdFromEpoll(it->first);
+			_cgi_fd_to_client.erase(it++);
+		}
+		else
+			++it;
+	}
+}
+
+/**
+ * @brief Follows up on the CGI backend of a client after it made progress.
+ *
+ * Descriptors of a backend that's still running are synced,
+ * the ones of a stopped backend aren't watched anymore.
+ * A script that waited for a slot of its location is run.
+ * A local redirect the script answered with is followed
+ * (which may launch another backend). Once the response is ready,
+ * the client is switched back to reading and writing: the body
+ * is sent while the backend keeps producing it.
+ *
+ * @param client_fd File descriptor of the client.
+ */
+void ServerManager::updateCgi(int client_fd)
+{
+	HTTPResponse &response = _client_connections.find(client_fd)->second._response;
+
+	if (response.has_running_cgi() && !syncCgiFds(client_fd))
+		response.abort_cgi(500);
+	if (!response.has_running_cgi())
+		unwatchCgi(client_fd);
+	if (response.has_queued_cgi()) {
+		response.start_queued_cgi();
+		if (response.has_running_cgi())
+			watchCgi(client_fd);
+	}
+	if (client_fd < 0) {
+		// Background refresh, its response isn't sent anywhere.
+		if (!response.has_running_cgi())
+			_client_connections.erase(client_fd);
+		return;
+	}
+	if (response.has_local_redirect()) {
+		response.follow_local_redirect();
+		if (response.has_running_cgi())
+			watchCgi(client_fd);
+		startCgiCacheRefresh(client_fd);
+	}
+	if (!response.is_response_ready())
+		return;
+	if (!modifyFdInEpoll(client_fd, EPOLLIN | EPOLLOUT | EPOLLRDHUP))
+		closeClientConnection(client_fd);
+}
+
+/**
+ * @brief Refreshes the CGI cache entry a client was served stale from.
+ *
+ * The script is run again for a socketless connection under a negative id,
+ * its descriptors are watched like any other backend's. Its output
+ * refills the entry, then the connection is dropped (see `updateCgi()`).
+ *
+ * @param client_fd File descriptor of the client.
+ */
+void ServerManager::startCgiCacheRefresh(int client_fd)
+{
+	HTTPResponse &stale = _client_connections.find(client_fd)->second._response;
+	int refresh_id;
+
+	if (!stale.needs_cgi_cache_refresh())
+		return;
+	refresh_id = _next_refresh_id--;
+	HTTPResponse &refresh = _client_connections.insert(
+		std::make_pair(refresh_id, ClientConnection())).first->second._response;
+	refresh.refresh_cgi_cache(stale);
+	if (refresh.has_running_cgi())
+		watchCgi(refresh_id);
+	if (!refresh.has_running_cgi())
+		_client_connections.erase(refresh_id);
+}
+
+/**
+ * @brief Handles an event on a descriptor of a running CGI backend.
+ *
+ * Input is written, output is read (or the script is reaped)
+ * by the client's response. Descriptors the backend is done with
+ * stop being watched and are closed (that's how a script sees
+ * the end of its input), the rest is up to `updateCgi()`.
+ *
+ * @param fd CGI descriptor reported by epoll.
+ */
+void ServerManager::handleCgiEvent(int fd)
+{
+	int client_fd = _cgi_fd_to_client[fd];
+	std::map<int, ClientConnection>::iterator it = _client_connections.find(client_fd);
+
+	if (it == _client_connections.end()) {
+		(void) removeFdFromEpoll(fd);
+		_cgi_fd_to_client.erase(fd);
+		return;
+	}
+	HTTPResponse &response = it->second._response;
+	if (!response.handle_cgi_event(fd)) {
+		(void) removeFdFromEpoll(fd);
+		_cgi_fd_to_client.erase(fd);
+		response.release_cgi_fd(fd);
+	}
+	updateCgi(client_fd);
+}
+
+/**
+ * @brief Checks deadlines of running CGI scripts.
+ *
+ * Scripts (and FastCGI requests) running for too long are aborted
+ * and their clients get 504 (see `HTTPResponse::check_cgi()`).
+ */
+void ServerManager::checkCgiTimeouts()
+{
+	std::set<int> clients;
+	time_t now = std::time(NULL);
+
+	for (std::map<int, int>::const_iterator it = _cgi_fd_to_client.begin();
+		it != _cgi_fd_to_client.end(); ++it) {
+		clients.insert(it->second);
+	}
+	for (std::set<int>::const_iterator it = clients.begin(); it != clients.end(); ++it) {
+		std::map<int, ClientConnection>::iterator conn = _client_connections.find(*it);
+
+		if (conn == _client_connections.end())
+			unwatchCgi(*it);
+		else if (conn->second._response.check_cgi(now))
+			updateCgi(*it);
+	}
+}
+
+/**
+ * @brief Writes what LogChannel can to stderr, watching it for EPOLLOUT
+ * only while some lines are left.
+ *
+ * epoll_ctl() is called directly: `addFdToEpoll()` logs every call,
+ * which would queue more lines. Regular files can't be watched,
+ * but writes to them never stop short.
+ */
+void ServerManager::syncLogChannel()
+{
+	struct epoll_event ev;
+
+	LogChannel::flush();
+	if (LogChannel::pending() == _log_watched)
+		return;
+	std::memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLOUT;
+	ev.data.fd = STDERR_FILENO;
+	if (epoll_ctl(_epoll_fd, _log_watched ? EPOLL_CTL_DEL : EPOLL_CTL_ADD,
+		STDERR_FILENO, &ev) == 0) {
+		_log_watched = !_log_watched;
+	}
+}
+
 /**
  * @brief Accepts and registers new incoming client connections.
  *
@@ -200,7 +492,7 @@ bool ServerManager::removeFdFromEpoll(int fd)
  * using client_fd, EPOLLIN | EPOLLERR | EPOLLOUT | EPOLLHUP | EPOLLRDHUP.
  *
  * For each successfully accepted connection, a ClientConnection object is
- * created, initialized with socket information and associated ServerConfig,
+ * created, initialized with socket information and the servers sharing the socket,
  * and stored in the _client_connections map.
  *
  *
@@ -214,9 +506,9 @@ void ServerManager::handleNewConnection(int server_fd)
 {
 	struct sockaddr_in client_addr;
 	socklen_t client_len = sizeof(client_addr);
-	int client_fd = accept(server_fd, (struct sockaddr*)&client_addr, &client_len);
+	int client_fd = accept4(server_fd, (struct sockaddr*)&client_addr, &client_len, SOCK_CLOEXEC);
 	if (client_fd < 0) {
-		print_err("accept() failed: ", strerror(errno), "");
+		print_err("accept4() failed: ", strerror(errno), "");
 		return ;
 	}
 
@@ -247,19 +539,12 @@ void ServerManager::handleNewConnection(int server_fd)
 	conn.setSocket(client_fd);
 	conn.setAddress(client_addr);
 
-	std::map<int, ServerConfig*>::iterator sit = _fd_to_server.find(server_fd);
-	if (sit != _fd_to_server.end())
+	std::map<int, VirtualHosts>::iterator vit = _fd_to_vhosts.find(server_fd);
+	if (vit != _fd_to_vhosts.end())
 	{
-		// This looks scary, but trust me,
-		// if we got here, then this would never return
-		// in out of bounds access!
-		conn.setServerAddress(sit->second->getServerAddresses().at(
-				static_cast<size_t> (
-					std::find(sit->second->getListenFds().begin(),
-						sit->second->getListenFds().end(),
-						server_fd)
-					- sit->second->getListenFds().begin())));
-		conn.setServer(*sit->second);
+		conn.setServerAddress(vit->second.getAddress());
+		// Actual server is chosen by "Host" of each request.
+		conn.setVirtualHosts(vit->second);
 	}
 	print_log("Accepted connection: fd ", to_string(client_fd), "");
 }
@@ -324,6 +609,7 @@ void ServerManager::handleClientEvent(int client_fd, uint32_t eventFlag)
 				{
 					print_log("EPOLLOUT event for client fd: ", to_string(client_fd), " - closing connection");
 					closeClientConnection(client_fd);
+					return;
 				}
 				if (conn.getMsgSent() == true) {
 					print_log("EPOLLOUT event for client fd: ", to_string(client_fd), " - response sent");
@@ -337,9 +623,21 @@ void ServerManager::handleClientEvent(int client_fd, uint32_t eventFlag)
 					// After sending the response, we can clean up the request and response objects
 					conn.reset();
 				}
+				else if (conn._response.has_running_cgi()) {
+					// Taken output may let a paused backend go on.
+					if (!syncCgiFds(client_fd))
+						conn._response.abort_cgi(500);
+					// Nothing to send until the backend produces more.
+					else if (conn._response.waits_for_body())
+						(void) modifyFdInEpoll(client_fd, EPOLLRDHUP);
+				}
 			}
-			else {
+			else if (!conn._response.has_running_cgi()) {
 				conn._response.handle_response_routine(conn.getRequest());
+				// CGI script finishes on its own, the response waits for it.
+				if (conn._response.has_running_cgi())
+					watchCgi(client_fd);
+				startCgiCacheRefresh(client_fd);
 			}
 		}
 	}
@@ -374,8 +672,12 @@ void ServerManager::handleClientEvent(int client_fd, uint32_t eventFlag)
 void ServerManager::run() {
         struct epoll_event events[EPOLL_MAX_EVENTS];
 	print_log("", "ServerManager event loop starting...", "");
+	LogChannel::start();
         while (!g_shutdown_requested) {
-                int n = epoll_wait(_epoll_fd, events, EPOLL_MAX_EVENTS, -1);
+                int n = epoll_wait(_epoll_fd, events, EPOLL_MAX_EVENTS,
+				DiskCache::pending() ? 0
+				: (_cgi_fd_to_client.empty() && !LogChannel::pending())
+				? -1 : _CGI_CHECK_INTERVAL);
                 if (n < 0) {
 			if (errno == EINTR) {
 				// Interrupted by signal — check shutdown flag and continue
@@ -388,12 +690,21 @@ void ServerManager::run() {
                 for (int i = 0; i < n; ++i) {
                         int fd = events[i].data.fd;
 			// print_log("Event for fd ", to_string(fd), "");
-                        if (_fd_to_server.count(fd)) {
+                        if (_fd_to_vhosts.count(fd)) {
                                 handleNewConnection(fd);
+                        } else if (_cgi_fd_to_client.count(fd)) {
+                                handleCgiEvent(fd);
+                        } else if (fd == STDERR_FILENO && _log_watched) {
+				// Written below.
                         } else {
                                 handleClientEvent(fd, events[i].events);
                         }
                 }
+		if (!_cgi_fd_to_client.empty())
+			checkCgiTimeouts();
+		// Cache entries are written between the events.
+		DiskCache::write_next();
+		syncLogChannel();
         }
 	print_log("", "Shutdown requested. Cleaning up...", "");
 	cleanup();
@@ -412,6 +723,9 @@ void ServerManager::run() {
  * `extern "C"` function, which ensures compatibility with the C-based
  * signal handling API.
  *
+ * SIGPIPE is ignored, so writing to a CGI script or a client
+ * that went away fails with EPIPE instead.
+ *
  * This function should be called once during server initialization,
  * before entering the event loop.
  *
@@ -433,5 +747,11 @@ void ServerManager::setupSignalHandlers()
 	if (sigaction(SIGTERM, &sa, NULL) < 0)
 		print_err("Failed to set SIGTERM handler: ", strerror(errno), "");
 
-	print_log("", "Signal handlers installed (SIGINT, SIGTERM)", "");
+	// Writing to a CGI script (or a client) that went away
+	// must fail with EPIPE instead of killing the server.
+	sa.sa_handler = SIG_IGN;
+	if (sigaction(SIGPIPE, &sa, NULL) < 0)
+		print_err("Failed to ignore SIGPIPE: ", strerror(errno), "");
+
+	print_log("", "Signal handlers installed (SIGINT, SIGTERM; SIGPIPE ignored)", "");
 }
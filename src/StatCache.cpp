@@ -0,0 +1,132 @@
+#include "StatCache.hpp"
+#include "Stats.hpp"
+#include <cerrno>
+
+const time_t StatCache::_TTL;
+const size_t StatCache::_MAX_FOUND;
+const size_t StatCache::_MAX_MISSING;
+StatCache::Table StatCache::_found(_MAX_FOUND);
+StatCache::Table StatCache::_missing(_MAX_MISSING);
+
+StatCache::Table::Table(size_t max_entries)
+	: max_entries(max_entries)
+{
+}
+
+StatCache::Key StatCache::make_key(const RootDir &dir,
+		const std::string &relative_path)
+{
+	return std::make_pair(std::make_pair(dir.get_dev(), dir.get_ino()),
+		relative_path);
+}
+
+int StatCache::lookup(const RootDir &dir, const std::string &relative_path,
+		struct stat &sb)
+{
+	time_t now = std::time(NULL);
+	Key key = make_key(dir, relative_path);
+	Entry *cached;
+	Entry entry;
+
+	if ((cached = find(_found, key, now)) != NULL)
+	{
+		Stats::add("stat_cache_lookups_total", Stats::label("result", "hit"));
+		sb = cached->sb;
+		return 0;
+	}
+	else if ((cached = find(_missing, key, now)) != NULL)
+	{
+		Stats::add("stat_cache_lookups_total", Stats::label("result", "hit"));
+		errno = cached->error;
+		return -1;
+	}
+	Stats::add("stat_cache_lookups_total", Stats::label("result", "miss"));
+	if (dir.stat_beneath(relative_path, sb) == 0)
+	{
+		entry.error = 0;
+		entry.sb = sb;
+	}
+	else if (errno == ENOENT || errno == ENOTDIR)
+	{
+		entry.error = errno;
+	}
+	else
+	{
+		// Traversal attempts, permission errors and the like
+		// aren't worth caching.
+		return -1;
+	}
+	entry.expires = now + _TTL;
+	entry.types = NULL;
+	entry.type = NULL;
+	// Expired entry may be in the other table.
+	erase(_found, key);
+	erase(_missing, key);
+	(void) store((entry.error == 0) ? _found : _missing, key, entry);
+	errno = entry.error;
+	return (entry.error == 0) ? 0 : -1;
+}
+
+const std::string &StatCache::content_type(const RootDir &dir,
+		const std::string &relative_path, const MimeTypes &types)
+{
+	Entry *entry = find(_found, make_key(dir, relative_path), std::time(NULL));
+
+	if (entry == NULL)
+	{
+		return types.lookup(relative_path);
+	}
+	else if (entry->types != &types)
+	{
+		entry->types = &types;
+		entry->type = &types.lookup(relative_path);
+	}
+	return *entry->type;
+}
+
+void StatCache::invalidate(const RootDir &dir, const std::string &relative_path)
+{
+	Key key = make_key(dir, relative_path);
+
+	erase(_found, key);
+	erase(_missing, key);
+}
+
+StatCache::Entry *StatCache::find(Table &table, const Key &key, time_t now)
+{
+	std::map<Key, Entry>::iterator it = table.entries.find(key);
+
+	if (it == table.entries.end() || it->second.expires <= now)
+	{
+		return NULL;
+	}
+	return &(it->second);
+}
+
+StatCache::Entry &StatCache::store(Table &table, const Key &key,
+		const Entry &entry)
+{
+	std::map<Key, Entry>::iterator it;
+
+	if (table.entries.size() >= table.max_entries)
+	{
+		// Every entry lives for `_TTL`, so the oldest one
+		// is also the first to expire.
+		table.entries.erase(table.order.front());
+		table.order.pop_front();
+	}
+	it = table.entries.insert(std::make_pair(key, entry)).first;
+	it->second.age = table.order.insert(table.order.end(), key);
+	return it->second;
+}
+
+void StatCache::erase(Table &table, const Key &key)
+{
+	std::map<Key, Entry>::iterator it = table.entries.find(key);
+
+	if (it != table.entries.end())
+	{
+		table.order.erase(it->second.age);
+		table.entries.erase(it);
+	}
+}
@@ -0,0 +1,155 @@
+#include "Stats.hpp"
+#include <sstream>
+#include <iomanip>
+
+std::map<std::string, std::map<std::string, uint64_t> > Stats::_counters;
+std::map<std::string, std::map<std::string, uint64_t> > Stats::_gauges;
+std::map<std::string, std::map<std::string, Stats::Histogram> > Stats::_histograms;
+
+const double Stats::SECONDS_BUCKETS[] = { 0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1, 5, 10 };
+const double Stats::BYTES_BUCKETS[] = { 1048576.0, 4194304.0, 16777216.0,
+	67108864.0, 268435456.0, 1073741824.0 };
+
+Stats::Histogram::Histogram(enum e_unit unit)
+	: bounds((unit == BYTES) ? BYTES_BUCKETS : SECONDS_BUCKETS),
+	  bound_count((unit == BYTES) ? sizeof(BYTES_BUCKETS) / sizeof(BYTES_BUCKETS[0])
+		: sizeof(SECONDS_BUCKETS) / sizeof(SECONDS_BUCKETS[0])),
+	  buckets(bound_count + 1, 0),
+	  count(0),
+	  sum(0)
+{
+}
+
+void Stats::add(const std::string &name, const std::string &labels, uint64_t value)
+{
+	_counters[name][labels] += value;
+}
+
+void Stats::set(const std::string &name, const std::string &labels, uint64_t value)
+{
+	_gauges[name][labels] = value;
+}
+
+void Stats::observe(const std::string &name, const std::string &labels, double value,
+		enum e_unit unit)
+{
+	std::map<std::string, Histogram> &series = _histograms[name];
+	std::map<std::string, Histogram>::iterator it = series.find(labels);
+	size_t i = 0;
+
+	if (it == series.end())
+	{
+		it = series.insert(std::make_pair(labels, Histogram(unit))).first;
+	}
+	Histogram &histogram = it->second;
+	while (i < histogram.bound_count && value > histogram.bounds[i])
+	{
+		i++;
+	}
+	histogram.buckets[i]++;
+	histogram.count++;
+	histogram.sum += value;
+}
+
+std::string Stats::label(const std::string &name, const std::string &value)
+{
+	std::string out = name + "=\"";
+
+	for (size_t i = 0; i < value.length(); i++)
+	{
+		if (value[i] == '\\' || value[i] == '"')
+		{
+			out += '\\';
+		}
+		else if (value[i] == '\n')
+		{
+			out += "\\n";
+			continue;
+		}
+		out += value[i];
+	}
+	return out + '"';
+}
+
+/**
+ * Get `name{labels}`, with \p extra added to the labels.
+ */
+static std::string series_name(const std::string &name, const std::string &labels,
+		const std::string &extra = "")
+{
+	if (labels.empty() && extra.empty())
+	{
+		return name;
+	}
+	else if (labels.empty() || extra.empty())
+	{
+		return name + '{' + labels + extra + '}';
+	}
+	return name + '{' + labels + ',' + extra + '}';
+}
+
+void Stats::render_values(std::string &out, const std::string &type,
+		const std::map<std::string, std::map<std::string, uint64_t> > &series)
+{
+	std::ostringstream line;
+
+	for (std::map<std::string, std::map<std::string, uint64_t> >::const_iterator
+		metric = series.begin(); metric != series.end(); ++metric)
+	{
+		out += "# TYPE " + metric->first + ' ' + type + '\n';
+		for (std::map<std::string, uint64_t>::const_iterator it = metric->second.begin();
+			it != metric->second.end(); ++it)
+		{
+			line.str("");
+			line << series_name(metric->first, it->first) << ' ' << it->second << '\n';
+			out += line.str();
+		}
+	}
+}
+
+std::string Stats::render()
+{
+	std::ostringstream line;
+	std::string out;
+	uint64_t cumulative;
+
+	render_values(out, "counter", _counters);
+	render_values(out, "gauge", _gauges);
+	for (std::map<std::string, std::map<std::string, Histogram> >::const_iterator
+		metric = _histograms.begin(); metric != _histograms.end(); ++metric)
+	{
+		out += "# TYPE " + metric->first + " histogram\n";
+		for (std::map<std::string, Histogram>::const_iterator it = metric->second.begin();
+			it != metric->second.end(); ++it)
+		{
+			const Histogram &histogram = it->second;
+
+			line.str("");
+			// Byte counts and sums in seconds, without exponents.
+			line << std::setprecision(12);
+			cumulative = 0;
+			for (size_t i = 0; i <= histogram.bound_count; i++)
+			{
+				std::ostringstream bound;
+
+				if (i < histogram.bound_count)
+				{
+					bound << std::setprecision(12) << histogram.bounds[i];
+				}
+				else
+				{
+					bound << "+Inf";
+				}
+				cumulative += histogram.buckets[i];
+				line << series_name(metric->first + "_bucket", it->first,
+						label("le", bound.str())) << ' ' << cumulative << '\n';
+			}
+			line << series_name(metric->first + "_sum", it->first)
+				<< ' ' << histogram.sum << '\n';
+			line << series_name(metric->first + "_count", it->first)
+				<< ' ' << histogram.count << '\n';
+			out += line.str();
+		}
+	}
+	return out;
+}
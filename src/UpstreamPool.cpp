@@ -0,0 +1,139 @@
+#include "UpstreamPool.hpp"
+#include "Webserv.hpp"
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+const size_t UpstreamPool::_MAX_IDLE;
+std::map<std::string, std::vector<int> > UpstreamPool::_idle;
+
+UpstreamAddress::UpstreamAddress()
+	: length(0)
+{
+	std::memset(&addr, 0, sizeof(addr));
+}
+
+bool UpstreamPool::parse_address(const std::string &spec, UpstreamAddress &out)
+{
+	UpstreamAddress parsed;
+
+	parsed.name = spec;
+	if (spec.compare(0, 5, "unix:") == 0)
+	{
+		struct sockaddr_un *un = reinterpret_cast<struct sockaddr_un *> (&parsed.addr);
+		std::string path = spec.substr(5);
+
+		// +1 for '\0'.
+		if (path.empty() || path.length() + 1 > sizeof(un->sun_path))
+		{
+			return false;
+		}
+		un->sun_family = AF_UNIX;
+		(void) std::memcpy(un->sun_path, path.c_str(), path.length() + 1);
+		parsed.length = sizeof(struct sockaddr_un);
+	}
+	else
+	{
+		struct sockaddr_in *in = reinterpret_cast<struct sockaddr_in *> (&parsed.addr);
+		size_t colon = spec.rfind(':');
+		std::string host;
+		std::string port;
+		char *end;
+		long port_number;
+
+		if (colon == std::string::npos)
+		{
+			return false;
+		}
+		host = spec.substr(0, colon);
+		port = spec.substr(colon + 1);
+		if (host == "localhost")
+		{
+			host = "127.0.0.1";
+		}
+		if (port.empty() || port.find_first_not_of("0123456789") != std::string::npos)
+		{
+			return false;
+		}
+		port_number = std::strtol(port.c_str(), &end, 10);
+		if (port_number < 1 || port_number > 65535
+			|| inet_pton(AF_INET, host.c_str(), &in->sin_addr) != 1)
+		{
+			return false;
+		}
+		in->sin_family = AF_INET;
+		in->sin_port = htons(static_cast<uint16_t> (port_number));
+		parsed.length = sizeof(struct sockaddr_in);
+	}
+	out = parsed;
+	return true;
+}
+
+int UpstreamPool::acquire(const UpstreamAddress &upstream, bool *reused)
+{
+	std::vector<int> &idle = _idle[upstream.name];
+	char c;
+	int fd;
+
+	while (!idle.empty())
+	{
+		fd = idle.back();
+		idle.pop_back();
+		// Nothing may be pending on an idle connection:
+		// EOF (or stray data) means the upstream is done with it.
+		if (recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) == -1
+			&& (errno == EAGAIN || errno == EWOULDBLOCK))
+		{
+			if (reused != NULL)
+			{
+				*reused = true;
+			}
+			return fd;
+		}
+		(void) close(fd);
+	}
+	if (reused != NULL)
+	{
+		*reused = false;
+	}
+	return connect_new(upstream);
+}
+
+int UpstreamPool::connect_new(const UpstreamAddress &upstream)
+{
+	int fd;
+
+	fd = socket(upstream.addr.ss_family,
+			SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd == -1)
+	{
+		return -1;
+	}
+	if (connect(fd, reinterpret_cast<const struct sockaddr *> (&upstream.addr),
+		upstream.length) == -1 && errno != EINPROGRESS)
+	{
+		int saved_errno = errno;
+
+		// EAGAIN on a UNIX socket: its backlog is full.
+		(void) close(fd);
+		errno = saved_errno;
+		return -1;
+	}
+	return fd;
+}
+
+void UpstreamPool::release(const UpstreamAddress &upstream, int fd)
+{
+	std::vector<int> &idle = _idle[upstream.name];
+
+	if (idle.size() >= _MAX_IDLE)
+	{
+		(void) close(fd);
+		return;
+	}
+	idle.push_back(fd);
+}
@@ -0,0 +1,135 @@
+#include "VirtualHosts.hpp"
+#include "ServerConfig.hpp"
+#include <cstring>
+
+VirtualHosts::VirtualHosts()
+	: _default(NULL),
+	  _default_is_explicit(false)
+{
+	std::memset(&_address, 0, sizeof(_address));
+}
+
+enum VirtualHosts::e_name_type VirtualHosts::classify(const std::string &name,
+		std::string &key)
+{
+	if (name.length() > 2 && name.compare(0, 2, "*.") == 0)
+	{
+		key = name.substr(1);
+		return NAME_LEADING;
+	}
+	else if (name.length() > 2 && name.compare(name.length() - 2, 2, ".*") == 0)
+	{
+		key = name.substr(0, name.length() - 1);
+		return NAME_TRAILING;
+	}
+	key = name;
+	return NAME_EXACT;
+}
+
+void VirtualHosts::add(ServerConfig *server, bool is_default)
+{
+	const std::vector<std::string> &names = server->getServerNames();
+	enum e_name_type type;
+	std::string name, key;
+
+	if (_default == NULL || (is_default && !_default_is_explicit))
+	{
+		_default = server;
+		_default_is_explicit = is_default;
+	}
+	else if (is_default)
+	{
+		print_warning("Duplicate default server, ignoring \"default_server\"",
+			"", "");
+	}
+	for (size_t i = 0; i < names.size(); i++)
+	{
+		name = names[i];
+		for (size_t j = 0; j < name.length(); j++)
+		{
+			name[j] = static_cast<char> (std::tolower(
+					static_cast<unsigned char> (name[j])));
+		}
+		type = classify(name, key);
+		if (!_names[type].insert(std::make_pair(key, server)).second)
+		{
+			print_warning("Conflicting server name \"", names[i],
+				"\", ignored");
+		}
+	}
+}
+
+void VirtualHosts::compile()
+{
+	_exact = PerfectHash<ServerConfig *>(_names[NAME_EXACT]);
+	_leading = PerfectHash<ServerConfig *>(_names[NAME_LEADING]);
+	_trailing = PerfectHash<ServerConfig *>(_names[NAME_TRAILING]);
+}
+
+ServerConfig *VirtualHosts::find(const std::string &host) const
+{
+	ServerConfig *const *ret;
+	const char *name = host.c_str();
+	size_t length;
+
+	// Stripping the port (IPv6 literals are in brackets)
+	// and the trailing dot of a fully qualified name.
+	if (!host.empty() && host[0] == '[')
+	{
+		length = host.find(']');
+		length = (length == std::string::npos) ? host.length() : length + 1;
+	}
+	else
+	{
+		length = host.find(':');
+		length = (length == std::string::npos) ? host.length() : length;
+	}
+	if (length > 0 && name[length - 1] == '.')
+	{
+		length--;
+	}
+	if (length == 0)
+	{
+		return _default;
+	}
+	if ((ret = _exact.find(name, length)) != NULL)
+	{
+		return *ret;
+	}
+	// Longest leading wildcard: suffixes starting at each dot,
+	// from the leftmost one.
+	for (size_t i = 0; i < length && !_leading.empty(); i++)
+	{
+		if (name[i] == '.'
+			&& (ret = _leading.find(name + i, length - i)) != NULL)
+		{
+			return *ret;
+		}
+	}
+	// Longest trailing wildcard: prefixes ending at each dot,
+	// from the rightmost one.
+	for (size_t i = length; i > 0 && !_trailing.empty(); i--)
+	{
+		if (name[i - 1] == '.'
+			&& (ret = _trailing.find(name, i)) != NULL)
+		{
+			return *ret;
+		}
+	}
+	return _default;
+}
+
+ServerConfig *VirtualHosts::getDefault() const
+{
+	return _default;
+}
+
+void VirtualHosts::setAddress(const struct sockaddr_in &address)
+{
+	_address = address;
+}
+
+const struct sockaddr_in &VirtualHosts::getAddress() const
+{
+	return _address;
+}
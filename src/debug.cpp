@@ -31,6 +31,14 @@ void printServerConfig(const ServerConfig& config)
 		std::cout << " " << ports[i];
 	std::cout << std::endl;
 
+	// Server names
+	const std::vector<std::string>& names = config.getServerNames();
+	std::cout << "Server names:";
+	if (names.empty()) std::cout << " (none)";
+	else for (size_t i = 0; i < names.size(); ++i)
+		std::cout << " " << names[i];
+	std::cout << std::endl;
+
 	// Root
 	std::cout << "Root: " << config.getRoot() << std::endl;
 
@@ -91,22 +91,43 @@ std::string generateErrorBody(int status_code) {
     return body.str();
 }
 
-std::string generateErrorHeader(int status_code, size_t content_length) {
+std::string generateErrorHeader(int status_code, size_t content_length,
+		const std::string &content_type) {
     std::string reason = getReasonPhrase(status_code);
     std::ostringstream header;
 
+    // Same fields and the same (alphabetical) order
+    // as HTTPResponse::prep_payload() would produce.
     header << "HTTP/1.1 " << status_code << " " << reason << "\r\n"
-           << "Content-Length: " << content_length << "\r\n"
-           << "Content-Type: text/html\r\n"
            << "Connection: close\r\n"
+           << "Content-Length: " << content_length << "\r\n"
+           << "Content-Type: " << content_type << "\r\n"
+           << "Server: " << SERVER_NAME << "\r\n"
            << "\r\n";
     return header.str();
 }
 
-std::string generateErrorPage(int status_code) {
-    std::string reason = getReasonPhrase(status_code);
-    std::string body = generateErrorBody(status_code);
-    std::string header = generateErrorHeader(status_code, body.size());
+std::string generateErrorResponse(int status_code, const std::string &body,
+		const std::string &content_type) {
+    return generateErrorHeader(status_code, body.size(), content_type) + body;
+}
 
-    return header + body;
+std::string generateRedirectResponse(int status_code, const std::string &location) {
+    std::string body = getReasonPhrase(status_code) + ": " + location + "\n";
+    std::ostringstream response;
+
+    response << "HTTP/1.1 " << status_code << " " << getReasonPhrase(status_code) << "\r\n"
+             << "Connection: close\r\n"
+             << "Content-Length: " << body.size() << "\r\n"
+             << "Content-Type: text/plain; charset=UTF-8\r\n"
+             << "Location: " << location << "\r\n"
+             << "Server: " << SERVER_NAME << "\r\n"
+             << "\r\n"
+             << body;
+    return response.str();
+}
+
+std::string generateErrorPage(int status_code) {
+    return generateErrorResponse(status_code,
+            generateErrorBody(status_code), "text/html");
 }
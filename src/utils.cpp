@@ -1,5 +1,6 @@
 #include "Webserv.hpp"
 #include "ConfigParser.hpp"
+#include "LogChannel.hpp"
 #include <inttypes.h>	// <cinttypes> is available from C++11 onwards, but we use C++98.
 #include <string>
 #include <fstream>
@@ -26,6 +27,18 @@ std::string 	trim(const std::string& str) {
 	return str.substr(start, end - start);
 }
 
+/**
+ * @brief Writes \p message to stderr, through LogChannel while
+ * the event loop runs, so a slow terminal or pipe doesn't hold the server.
+ */
+static void	log_message(const std::string &message)
+{
+	if (LogChannel::is_started())
+		LogChannel::write(message);
+	else
+		std::cerr << message << std::endl;
+}
+
 /**
  * @brief Prints a standard log message to std::clog with a green "Warning" label.
  *
@@ -35,7 +48,7 @@ std::string 	trim(const std::string& str) {
  */
 void print_log(const std::string &desc, const std::string &line, const std::string &opt_desc)
 {
-	std::cerr << GREEN << "Log: " << RESET << desc << line << opt_desc << RESET << std::endl;
+	log_message(GREEN "Log: " RESET + desc + line + opt_desc + RESET);
 }
 
 /**
@@ -47,7 +60,7 @@ void print_log(const std::string &desc, const std::string &line, const std::stri
  */
 void print_err(const std::string &desc, const std::string &line, const std::string &opt_desc)
 {
-	std::cerr << RED << "Error: " << desc << line << opt_desc << RESET << std::endl;
+	log_message(RED "Error: " + desc + line + opt_desc + RESET);
 }
 
 /**
@@ -59,7 +72,7 @@ void print_err(const std::string &desc, const std::string &line, const std::stri
  */
 void print_warning(const std::string &desc, const std::string &line, const std::string &opt_desc)
 {
-	std::clog << YELLOW << "Warning: " << desc << line << opt_desc << RESET << std::endl;
+	log_message(YELLOW "Warning: " + desc + line + opt_desc + RESET);
 }
 
 bool 		pathExists(const std::string &path) {
@@ -200,6 +213,54 @@ void append_file(const std::string &path, const std::string &with_what)
 	}
 }
 
+std::string read_fd(int fd)
+{
+	char buffer[65536];
+	std::string ret;
+	ssize_t n;
+
+	for (;;)
+	{
+		n = read(fd, buffer, sizeof(buffer));
+		if (n == -1 && errno == EINTR)
+		{
+			continue;
+		}
+		else if (n == -1)
+		{
+			throw std::ios_base::failure(std::string("read_fd(): ")
+					+ strerror(errno));
+		}
+		else if (n == 0)
+		{
+			break;
+		}
+		ret.append(buffer, static_cast<size_t> (n));
+	}
+	return ret;
+}
+
+void write_fd(int fd, const std::string &data)
+{
+	size_t written = 0;
+	ssize_t n;
+
+	while (written < data.length())
+	{
+		n = write(fd, data.c_str() + written, data.length() - written);
+		if (n == -1 && errno == EINTR)
+		{
+			continue;
+		}
+		else if (n == -1)
+		{
+			throw std::ios_base::failure(std::string("write_fd(): ")
+					+ strerror(errno));
+		}
+		written += static_cast<size_t> (n);
+	}
+}
+
 std::string get_file_ext(const std::string &path)
 {
 	std::string::size_type dot = path.find_last_of('.');
@@ -218,37 +279,6 @@ std::string get_file_ext(const std::string &path)
 	return ret;
 }
 
-std::string get_mime_type(const std::string &path)
-{
-	static std::map<std::string, std::string> mime_map;
-	std::string ext;
-
-	if (mime_map.empty())
-	{
-		mime_map.insert(std::make_pair(".html", "text/html"));
-		mime_map.insert(std::make_pair(".htm", "text/html"));
-		mime_map.insert(std::make_pair(".css", "text/css"));
-		mime_map.insert(std::make_pair(".js", "application/javascript"));
-		mime_map.insert(std::make_pair(".png", "image/png"));
-		mime_map.insert(std::make_pair(".jpg", "image/jpeg"));
-		mime_map.insert(std::make_pair(".jpeg", "image/jpeg"));
-		mime_map.insert(std::make_pair(".webp", "image/webp"));
-		mime_map.insert(std::make_pair(".gif", "image/gif"));
-		mime_map.insert(std::make_pair(".svg", "image/svg+xml"));
-		mime_map.insert(std::make_pair(".json", "application/json"));
-		mime_map.insert(std::make_pair(".pdf", "application/pdf"));
-		mime_map.insert(std::make_pair(".txt", "text/plain"));
-		mime_map.insert(std::make_pair(".xml", "application/xml"));
-	}
-	ext = get_file_ext(path);
-	std::map<std::string, std::string>::const_iterator it = mime_map.find(ext);
-	if (it != mime_map.end())
-	{
-		return it->second;
-	}
-	return "application/octet-stream";
-}
-
 const char * our_inet_ntop4(const void * src, char * dst, socklen_t size)
 {
 	// "255.255.255.255" => 15 bytes + 1 for '\0'.
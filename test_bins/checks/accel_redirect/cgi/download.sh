@@ -0,0 +1,10 @@
+# Lets the server send files/<query> ("bad" sends a value that isn't a path).
+if [ "$QUERY_STRING" = "bad" ]; then
+	printf 'X-Accel-Redirect: files/report.txt\r\n\r\n'
+	exit 0
+fi
+printf 'X-Accel-Redirect: /protected/%s\r\n' "$QUERY_STRING"
+printf 'Content-Type: application/x-report\r\n'
+printf 'Content-Disposition: attachment; filename="%s"\r\n' "$QUERY_STRING"
+printf 'X-Script-Only: 1\r\n\r\n'
+echo "body of the script"
@@ -0,0 +1,14 @@
+# X-Accel-Redirect: a script names a file for the server to send instead
+# of its own body, from a location clients can't request ("internal").
+
+check "file named by the script is sent" 200 "^quarterly report$" \
+	"${URL}/download/download.sh?report.txt"
+check "content fields of the script are kept" 200 "^Content-Disposition: attachment; filename=\"report.txt\"$" \
+	"${URL}/download/download.sh?report.txt"
+check "content type of the script is kept" 200 "^Content-Type: application/x-report$" \
+	"${URL}/download/download.sh?report.txt"
+expect "other fields and the body of the script are dropped" -z \
+	"$(curl -s -i --max-time 5 "${URL}/download/download.sh?report.txt" | grep -E 'X-Script-Only|body of the script')"
+check "missing file" 404 "" "${URL}/download/download.sh?missing.txt"
+check "internal location can't be requested" 404 "" "${URL}/protected/report.txt"
+check "redirect to something that isn't a path" 502 "" "${URL}/download/download.sh?bad"
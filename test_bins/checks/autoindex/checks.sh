@@ -0,0 +1,19 @@
+# autoindex: listings of directories beneath the location's root,
+# in HTML or JSON, sorted and paged; symlinks leading out of the root
+# aren't followed.
+
+check "HTML listing" 200 '^<a href="alpha.txt">alpha.txt</a><br />$' "${URL}/list/"
+check "directories end with a slash" 200 '^<a href="sub/">sub/</a><br />$' "${URL}/list/"
+check "directory without its slash is redirected" 301 "^Location: /list/sub/$" \
+	"${URL}/list/sub"
+check "JSON listing sorted by size" 200 '"name":"beta.txt".*"size":11\},$' "${URL}/json/"
+check "page 2 of 3, by name" 200 '^\{"page":2,"pages":3,' "${URL}/paged/?page=2"
+expect "page holds page_size entries" \
+	"$(curl -s --max-time 5 "${URL}/paged/?page=2" | grep -c '"name"')" -eq 2
+check "repeated request is served the cached listing" 200 '"name":"empty"' \
+	"${URL}/paged/?page=2"
+check "symlink beneath the root is listed" 200 '^<a href="gamma.txt">gamma.txt</a><br />$' \
+	"${URL}/list/inside/"
+check "symlink out of the root isn't listed" 403 "" "${URL}/list/escape/"
+expect "nothing out of the root is shown" -z \
+	"$(curl -s --max-time 5 "${URL}/list/escape/" | grep 'key.txt')"
@@ -0,0 +1,2 @@
+printf 'Content-Type: text/plain\r\nCache-Control: no-store\r\n\r\n'
+echo "run $$ $(date +%s%N)"
@@ -0,0 +1,2 @@
+printf 'Content-Type: text/plain\r\n\r\n'
+echo "run $$ $(date +%s%N) ${QUERY_STRING}"
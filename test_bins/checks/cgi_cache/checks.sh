@@ -0,0 +1,49 @@
+# CGI cache: responses are kept per "cgi_cache_key" (by default the method,
+# path and query), so a repeated request gets the output of the first run.
+
+# Body of a GET of "$URL"<path>, with more curl arguments.
+body()
+{
+	URL_PATH="$1"
+	shift
+	curl -s --max-time 5 "$@" "${URL}${URL_PATH}"
+}
+
+FIRST=$(body /cached/stamp.sh?a=1)
+check "response of a script" 200 "^run [0-9]+ [0-9]+ a=1$" "${URL}/cached/stamp.sh?a=1"
+expect "repeated request is served from the cache" \
+	"$(body /cached/stamp.sh?a=1)" = "$FIRST"
+expect "other query is another entry" \
+	"$(body /cached/stamp.sh?a=2)" != "$FIRST"
+expect "query is part of the default key" \
+	"$(body /cached/stamp.sh?a=2)" = "$(body /cached/stamp.sh?a=2)"
+expect "POST isn't served from the cache" \
+	"$(body /cached/stamp.sh?a=1 -d x=1)" != "$FIRST"
+expect "uncached location runs the script every time" \
+	"$(body /uncached/stamp.sh)" != "$(body /uncached/stamp.sh)"
+expect "\"Cache-Control: no-store\" isn't cached" \
+	"$(body /cached/private.sh)" != "$(body /cached/private.sh)"
+
+BLUE=$(body /by_header/stamp.sh?a=1 -H "X-Variant: blue")
+expect "query isn't part of a key without \$args" \
+	"$(body /by_header/stamp.sh?a=2 -H "X-Variant: blue")" = "$BLUE"
+expect "header field of the key tells entries apart" \
+	"$(body /by_header/stamp.sh?a=1 -H "X-Variant: green")" != "$BLUE"
+expect "entry without the header field is apart too" \
+	"$(body /by_header/stamp.sh?a=1)" != "$BLUE"
+
+FIRST=$(body /on_disk/stamp.sh)
+expect "disk-backed entry is served from the cache" \
+	"$(body /on_disk/stamp.sh)" = "$FIRST"
+expect "entry is written to cache_path" \
+	-n "$(find "$TMP" -type f ! -name index ! -name 'webserv.*' | head -n 1)"
+# Entries on disk are still served once the server restarted.
+kill "$SERVER_PID"
+wait "$SERVER_PID"
+"$WEBSERV" "${TMP}/webserv.conf" >> "${TMP}/webserv.log" 2>&1 &
+SERVER_PID=$!
+wait_for_port "$PORT"
+expect "disk-backed entry outlives a restart" \
+	"$(body /on_disk/stamp.sh)" = "$FIRST"
+expect "memory-only entry doesn't" \
+	"$(body /by_header/stamp.sh?a=1 -H "X-Variant: blue")" != "$BLUE"
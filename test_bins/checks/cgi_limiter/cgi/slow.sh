@@ -0,0 +1,4 @@
+# Holds its slot for a second.
+sleep 1
+printf 'Content-Type: text/plain\r\n\r\n'
+echo "ran ${QUERY_STRING} until $(date +%s%N)"
@@ -0,0 +1,4 @@
+# Holds its slot for longer than the short queue waits.
+sleep 3
+printf 'Content-Type: text/plain\r\n\r\n'
+echo "ran ${QUERY_STRING}"
@@ -0,0 +1,47 @@
+# CGI limiter: past "cgi_max_concurrent" running scripts, requests wait
+# in the location's queue for a slot; past "cgi_queue_size", they get 503
+# with "Retry-After" right away.
+
+# Requests "$URL"<path> in the background, into ${TMP}/<name>;
+# `wait $CLIENTS` waits for the responses.
+CLIENTS=""
+start()
+{
+	curl -s -i --max-time 10 -o "${TMP}/$1" "${URL}$2" &
+	CLIENTS="${CLIENTS} $!"
+}
+
+REJECTED=$(counter /status 'cgi_rejected_total{location="/limited/"}')
+start running "/limited/slow.sh?running"
+sleep 0.3
+start queued "/limited/slow.sh?queued"
+sleep 0.3
+START=$(date +%s%N)
+check "request past the full queue is turned away" 503 "^Retry-After: [0-9]+$" \
+	"${URL}/limited/slow.sh?rejected"
+expect "right away" $((($(date +%s%N) - START) / 1000000)) -lt 500
+expect "it's counted" \
+	"$(counter /status 'cgi_rejected_total{location="/limited/"}')" -eq $((REJECTED + 1))
+expect "queue holds the waiting request" \
+	"$(counter /status 'cgi_queue_depth{location="/limited/"}')" -eq 1
+wait $CLIENTS
+CLIENTS=""
+check_file()
+{
+	expect "$1" -n "$(tr -d '\r' < "${TMP}/$2" | grep -E "$3")"
+}
+check_file "running request is served" running "^HTTP/1.1 200"
+check_file "queued request is served once the slot frees" queued "^HTTP/1.1 200"
+expect "after the running one" \
+	"$(sed -n 's/^ran running until //p' "${TMP}/running")" \
+	-lt "$(sed -n 's/^ran queued until //p' "${TMP}/queued")"
+expect "queue is drained" \
+	"$(counter /status 'cgi_queue_depth{location="/limited/"}')" -eq 0
+check "slot is free again" 200 "^ran free " "${URL}/limited/slow.sh?free"
+
+# Waiting is over after the queue's timeout.
+start running "/short_queue/slower.sh?running"
+sleep 0.3
+check "request waits no longer than the queue's timeout" 503 "^Retry-After: " \
+	"${URL}/short_queue/slower.sh?queued"
+wait $CLIENTS
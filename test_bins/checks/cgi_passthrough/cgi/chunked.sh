@@ -0,0 +1,5 @@
+# Body bigger than the stdout pipe, after a pause:
+# the header is parsed before the script is done.
+printf 'Content-Type: text/plain\r\n\r\n'
+sleep 0.2
+seq 1 400000
@@ -0,0 +1,4 @@
+# As chunked.sh, with a Content-Length of its own.
+printf 'Content-Type: text/plain\r\nContent-Length: %d\r\n\r\n' "$(seq 1 400000 | wc -c)"
+sleep 0.2
+seq 1 400000
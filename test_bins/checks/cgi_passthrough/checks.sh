@@ -0,0 +1,45 @@
+# CGI passthrough: once the header of a running script is parsed, the rest
+# of its output is spliced from its stdout pipe to the client, framed
+# in chunks or by the script's Content-Length.
+
+seq 1 400000 > "${TMP}/expected"
+
+# Requests "$URL"<path> with more curl arguments, into ${TMP}/header
+# and ${TMP}/body; prints curl's exit status.
+fetch()
+{
+	URL_PATH="$1"
+	shift
+	curl -s --max-time 10 -D "${TMP}/header" -o "${TMP}/body" "$@" "${URL}${URL_PATH}"
+	echo $?
+}
+
+# Bytes the server read() so far (spliced ones aren't counted).
+read_bytes()
+{
+	sed -n 's/^rchar: //p' "/proc/${SERVER_PID}/io"
+}
+
+BEFORE=$(read_bytes)
+expect "chunked body is complete" "$(fetch /cgi/chunked.sh)" -eq 0
+expect "it isn't read by the server" \
+	$(($(read_bytes) - BEFORE)) -lt $(($(wc -c < "${TMP}/expected") / 10))
+expect "it's chunked" -n "$(grep -i '^Transfer-Encoding: chunked' "${TMP}/header")"
+expect "it's the script's output" -z "$(cmp "${TMP}/body" "${TMP}/expected" 2>&1)"
+expect "chunked body is complete to a slow client" \
+	"$(fetch /cgi/chunked.sh --limit-rate 2M)" -eq 0
+expect "it's the script's output as well" -z "$(cmp "${TMP}/body" "${TMP}/expected" 2>&1)"
+
+expect "body of the script's length is complete" "$(fetch /cgi/length.sh)" -eq 0
+expect "it isn't chunked" -z "$(grep -i '^Transfer-Encoding' "${TMP}/header")"
+expect "it has the script's length" \
+	-n "$(grep -i "^Content-Length: $(wc -c < "${TMP}/expected")" "${TMP}/header")"
+expect "it's the script's output" -z "$(cmp "${TMP}/body" "${TMP}/expected" 2>&1)"
+
+# A keep-alive client gets both bodies whole, each framed as it should be:
+# a framing error would leave the one after it short or garbled.
+curl -s --max-time 10 -H "Connection: keep-alive" -o "${TMP}/first" "${URL}/cgi/length.sh" \
+	-o "${TMP}/second" "${URL}/cgi/chunked.sh"
+expect "keep-alive client gets both responses" $? -eq 0
+expect "first one whole" -z "$(cmp "${TMP}/first" "${TMP}/expected" 2>&1)"
+expect "second one whole" -z "$(cmp "${TMP}/second" "${TMP}/expected" 2>&1)"
@@ -0,0 +1,36 @@
+"""cgi_pool worker: answers every request frame with what it knows
+of itself and of the request ("?size=N" asks for N bytes of body,
+"?stderr=N" for N lines on stderr)."""
+import hashlib
+import os
+import sys
+
+stdin = sys.stdin.buffer
+stdout = sys.stdout.buffer
+
+
+def read_frame():
+    line = stdin.readline()
+    if not line:
+        sys.exit(0)
+    return stdin.read(int(line))
+
+
+served = 0
+while True:
+    env = dict(var.split(b"=", 1) for var in read_frame().split(b"\0") if var)
+    body = read_frame()
+    served += 1
+    query = dict(item.split(b"=", 1) for item in env.get(b"QUERY_STRING", b"").split(b"&")
+                 if b"=" in item)
+    for line in range(1, int(query.get(b"stderr", b"0")) + 1):
+        sys.stderr.write("stderr line %d of request %d\n" % (line, served))
+    sys.stderr.flush()
+    if b"size" in query:
+        content = b"x" * int(query[b"size"])
+    else:
+        content = b"pid=%d served=%d length=%d sha1=%s\n" % (
+            os.getpid(), served, len(body), hashlib.sha1(body).hexdigest().encode())
+    output = b"Content-Type: text/plain\r\n\r\n" + content
+    stdout.write(b"%d\n" % len(output) + output)
+    stdout.flush()
@@ -0,0 +1,61 @@
+# cgi_pool: requests are framed to warm workers, one at a time each.
+# The worker answers with its pid, how many requests it served
+# and the length and SHA-1 of the request body.
+
+# Prints <field> (pid, served, length or sha1) of the answer to "$URL"<path>,
+# requested with more curl arguments.
+worker_field()
+{
+	FIELD="$1"
+	URL_PATH="$2"
+	shift 2
+	curl -s --max-time 10 "$@" "${URL}${URL_PATH}" | tr ' ' '\n' \
+		| sed -n "s/^${FIELD}=//p"
+}
+
+PID=$(worker_field pid /pool/worker.py)
+check "request to a worker" 200 "^pid=${PID} served=2 length=0 " "${URL}/pool/worker.py"
+# Several requests on one client connection, all to the same worker.
+expect "keep-alive requests go to the same warm worker in a row" \
+	"$(curl -s --max-time 10 "${URL}/pool/worker.py" "${URL}/pool/worker.py" \
+		"${URL}/pool/worker.py" | sed -n "s/^pid=${PID} served=\([0-9]*\) .*/\1/p" \
+		| tr '\n' ' ')" = "3 4 5 "
+
+# Bigger than a pipe's buffer: the frame is written as the worker reads it.
+head -c 1048576 /dev/urandom > "${TMP}/body"
+SHA1=$(sha1sum "${TMP}/body" | cut -d ' ' -f 1)
+check "request body bigger than the pipe reaches the worker whole" 200 \
+	"^pid=${PID} served=6 length=1048576 sha1=${SHA1}$" \
+	--data-binary "@${TMP}/body" "${URL}/pool/worker.py"
+check "worker takes the next request after it" 200 "^pid=${PID} served=7 " \
+	"${URL}/pool/worker.py"
+
+# Same script, other max_requests: a pool of its own.
+RECYCLED=$(worker_field pid /recycled/worker.py)
+expect "location with other settings has its own worker" "$RECYCLED" != "$PID"
+check "its requests aren't counted by the other pool" 200 "^pid=${RECYCLED} served=2 " \
+	"${URL}/recycled/worker.py"
+check "worker serves max_requests" 200 "^pid=${RECYCLED} served=3 " \
+	"${URL}/recycled/worker.py"
+expect "then it's replaced by a new one" \
+	"$(worker_field pid /recycled/worker.py)" != "$RECYCLED"
+check "new worker starts counting again" 200 "served=2 " "${URL}/recycled/worker.py"
+check "other pool kept its worker" 200 "^pid=${PID} served=8 " "${URL}/pool/worker.py"
+
+# Response much bigger than one read: it's sent on as it comes,
+# while the rest of the frame is still awaited.
+curl -s --max-time 10 -o "${TMP}/response" "${URL}/pool/worker.py?size=4194304"
+expect "response bigger than one read comes whole" \
+	"$(wc -c < "${TMP}/response")" -eq 4194304
+curl -s --max-time 10 --limit-rate 1M -o "${TMP}/response" "${URL}/pool/worker.py?size=2097152"
+expect "so it does to a slow client" "$(wc -c < "${TMP}/response")" -eq 2097152
+check "worker takes the next request after them" 200 "^pid=${PID} served=11 " \
+	"${URL}/pool/worker.py"
+
+# Worker's stderr is logged like any script's, with its pid.
+check "worker writing to its stderr" 200 "^pid=${PID} served=12 " \
+	"${URL}/pool/worker.py?stderr=2"
+sleep 0.2
+expect "its lines are logged" \
+	"$(grep -ac "^CGI ${SUITE}/cgi/worker.py (worker ${PID}): stderr line [12] of request 12$" \
+		"${TMP}/webserv.log")" -eq 2
@@ -0,0 +1,18 @@
+"""cgi_pool worker answering every request with its own limits."""
+import resource
+import sys
+
+stdin = sys.stdin.buffer
+stdout = sys.stdout.buffer
+
+while True:
+    for frame in range(2):
+        line = stdin.readline()
+        if not line:
+            sys.exit(0)
+        stdin.read(int(line))
+    output = b"Content-Type: text/plain\r\n\r\nnofile=%d as=%d\n" % (
+        resource.getrlimit(resource.RLIMIT_NOFILE)[0],
+        resource.getrlimit(resource.RLIMIT_AS)[0])
+    stdout.write(b"%d\n" % len(output) + output)
+    stdout.flush()
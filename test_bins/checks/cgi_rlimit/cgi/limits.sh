@@ -0,0 +1,2 @@
+printf 'Content-Type: text/plain\r\n\r\n'
+echo "cpu=$(ulimit -t) nofile=$(ulimit -n)"
@@ -0,0 +1,2 @@
+# Runs until its CPU time is up.
+while :; do :; done
@@ -0,0 +1,16 @@
+# CGI resource limits ("cgi_rlimit_*"): set in the child before it
+# execve()'s, for scripts started per request and for pool workers.
+
+check "script runs with the location's limits" 200 "^cpu=1 nofile=20$" \
+	"${URL}/limited/limits.sh"
+check "other locations keep the server's" 200 "^cpu=[^ ]+ nofile=[0-9]+$" \
+	"${URL}/unlimited/limits.sh"
+expect "which are higher" \
+	"$(curl -s --max-time 5 "${URL}/unlimited/limits.sh" | sed -n 's/.*nofile=//p')" -gt 20
+START=$(date +%s)
+check "script past its CPU time is killed" 502 "" "${URL}/limited/spin.sh"
+expect "right then" $(($(date +%s) - START)) -le 3
+check "pool worker runs with the location's limits" 200 "^nofile=20 as=1073741824$" \
+	"${URL}/pooled/limits.py"
+check "interpreter that can't be started" 502 "" "${URL}/missing/limits.sh"
+check "server goes on after it" 200 "^cpu=1 nofile=20$" "${URL}/limited/limits.sh"
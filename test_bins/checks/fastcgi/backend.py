@@ -0,0 +1,81 @@
+"""FastCGI application for the fastcgi checks: answers every request
+with "ok", after "?lines=N" lines of FCGI_STDERR cut into small records
+(so lines span records)."""
+import socketserver
+import struct
+import sys
+import urllib.parse
+
+FCGI_BEGIN_REQUEST = 1
+FCGI_END_REQUEST = 3
+FCGI_PARAMS = 4
+FCGI_STDIN = 5
+FCGI_STDOUT = 6
+FCGI_STDERR = 7
+
+
+def read_record(stream):
+    header = stream.read(8)
+    if len(header) < 8:
+        return None
+    _, kind, request_id, length, padding, _ = struct.unpack(">BBHHBB", header)
+    content = stream.read(length)
+    stream.read(padding)
+    return kind, request_id, content
+
+
+def record(kind, request_id, content):
+    return struct.pack(">BBHHBB", 1, kind, request_id, len(content), 0, 0) + content
+
+
+def parse_params(data):
+    params = {}
+    pos = 0
+    while pos < len(data):
+        lengths = []
+        for _ in range(2):
+            if data[pos] < 128:
+                lengths.append(data[pos])
+                pos += 1
+            else:
+                lengths.append(struct.unpack(">I", data[pos:pos + 4])[0] & 0x7fffffff)
+                pos += 4
+        name = data[pos:pos + lengths[0]]
+        params[name] = data[pos + lengths[0]:pos + lengths[0] + lengths[1]]
+        pos += lengths[0] + lengths[1]
+    return params
+
+
+class Handler(socketserver.StreamRequestHandler):
+    def handle(self):
+        params = b""
+        while True:
+            received = read_record(self.rfile)
+            if received is None:
+                return
+            kind, request_id, content = received
+            if kind == FCGI_PARAMS:
+                params += content
+            elif kind == FCGI_STDIN and not content:
+                self.respond(request_id, parse_params(params))
+                params = b""
+
+    def respond(self, request_id, params):
+        query = urllib.parse.parse_qs(params.get(b"QUERY_STRING", b"").decode())
+        lines = int(query.get("lines", ["0"])[0])
+        stderr = b"".join(b"line %d\n" % i for i in range(1, lines + 1))
+        out = b""
+        for pos in range(0, len(stderr), 5):
+            out += record(FCGI_STDERR, request_id, stderr[pos:pos + 5])
+        out += record(FCGI_STDOUT, request_id, b"Content-Type: text/plain\r\n\r\nok\n")
+        out += record(FCGI_STDOUT, request_id, b"")
+        out += record(FCGI_END_REQUEST, request_id, b"\0\0\0\0\0\0\0\0")
+        self.wfile.write(out)
+
+
+class Server(socketserver.ThreadingTCPServer):
+    allow_reuse_address = True
+    daemon_threads = True
+
+
+Server(("127.0.0.1", int(sys.argv[1])), Handler).serve_forever()
@@ -0,0 +1,25 @@
+# FastCGI: what the application sends as FCGI_STDERR is logged line
+# by line through LogChannel, at a limited rate per application.
+
+SOURCE="FastCGI 127.0.0.1:${BACKEND_PORT}"
+
+# Prints how many lines of the application were logged so far.
+logged_lines()
+{
+	grep -ac "^${SOURCE}: line [0-9]*$" "${TMP}/webserv.log"
+}
+
+check "response of the application" 200 "^ok$" "${URL}/app/run?lines=3"
+sleep 0.2
+expect "its stderr lines are logged whole, across records" \
+	"$(grep -a "^${SOURCE}: line " "${TMP}/webserv.log" | tr '\n' ' ')" \
+	= "${SOURCE}: line 1 ${SOURCE}: line 2 ${SOURCE}: line 3 "
+
+check "chatty application is still answered" 200 "^ok$" "${URL}/app/run?lines=300"
+sleep 0.2
+LOGGED=$(logged_lines)
+# (`counter` can't tell the source apart: its label has a space.)
+SUPPRESSED=$(curl -s --max-time 5 "${URL}/status" \
+	| sed -n "s/^log_suppressed_lines_total{source=\"${SOURCE}\"} //p")
+expect "only about a burst of its lines is logged" "$LOGGED" -lt 150
+expect "the rest is counted as suppressed" $((LOGGED + SUPPRESSED)) -eq 303
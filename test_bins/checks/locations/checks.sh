@@ -0,0 +1,14 @@
+# Location matching: "=" is checked before any prefix,
+# then the longest prefix ("^~" or not) wins.
+
+check "exact root wins over the / prefix" 301 "Location: /from-exact-root" "${URL}/"
+check "/ prefix serves what exact root doesn't" 200 "^root index" "${URL}/index.html"
+check "exact location only matches its path" 301 "Location: /from-exact-docs" "${URL}/docs"
+check "prefix serves below an exact path" 200 "^docs index" "${URL}/docs/"
+check "longest prefix wins" 301 "Location: /from-docs-old" "${URL}/docs/old/page.html"
+check "shorter prefix for other paths" 404 "" "${URL}/docs/missing.html"
+check "^~ prefix serves its files" 200 "^static file" "${URL}/static/app.js"
+check "longest ^~ prefix wins" 301 "Location: /from-static-legacy" "${URL}/static/legacy/app.js"
+check "exact location may name a file" 200 "^favicon" "${URL}/favicon.ico"
+check "exact file doesn't match longer paths" 404 "" "${URL}/favicon.ico/x"
+check "exact match is case-sensitive" 404 "" "${URL}/FAVICON.ICO"
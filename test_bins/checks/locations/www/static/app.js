@@ -0,0 +1 @@
+static file
@@ -0,0 +1,88 @@
+"""Upstream of the proxy suite: each path (its last segment, the proxy
+passes "/upstream/<name>" as it is) answers with another framing.
+
+Connections are kept alive unless a response says otherwise;
+"/first-only" is only answered as the first request of a connection.
+"""
+import socket
+import sys
+import threading
+
+
+def respond(path, method, body, first):
+    if path == "/length":
+        return b"HTTP/1.1 200 OK\r\nContent-Length: 12\r\nX-Upstream: length\r\n\r\nfixed length"
+    if path == "/chunked":
+        return (b"HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\nTrailer: X-Sum\r\n\r\n"
+                b"5\r\nchunk\r\n7;ext=1\r\ned body\r\n1\r\n!\r\n0\r\nX-Sum: 13\r\n\r\n")
+    if path == "/close":
+        return b"HTTP/1.1 200 OK\r\nConnection: close\r\n\r\nbody until close"
+    if path == "/http10":
+        return b"HTTP/1.0 200 OK\r\n\r\nold style body"
+    if path == "/interim":
+        return (b"HTTP/1.1 100 Continue\r\n\r\n"
+                b"HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\nfinal")
+    if path == "/no-content":
+        return b"HTTP/1.1 204 No Content\r\nX-Upstream: empty\r\n\r\n"
+    if path == "/echo":
+        out = b"%s %d" % (method, len(body))
+        return b"HTTP/1.1 200 OK\r\nContent-Length: %d\r\n\r\n%s" % (len(out), out)
+    if path == "/first-only":
+        if not first:
+            return None
+        return b"HTTP/1.1 200 OK\r\nContent-Length: 10\r\n\r\nfirst only"
+    if path == "/never":
+        return None
+    if path == "/bad-status":
+        return b"HTTP/1.1 2000 OK\r\n\r\n"
+    return b"HTTP/1.1 404 Not Found\r\nContent-Length: 9\r\n\r\nnot found"
+
+
+def serve(conn):
+    buffer = b""
+    first = True
+    while True:
+        while b"\r\n\r\n" not in buffer:
+            data = conn.recv(65536)
+            if not data:
+                conn.close()
+                return
+            buffer += data
+        head, buffer = buffer.split(b"\r\n\r\n", 1)
+        lines = head.split(b"\r\n")
+        method, target = lines[0].split(b" ")[:2]
+        length = 0
+        for line in lines[1:]:
+            name, _, value = line.partition(b":")
+            if name.strip().lower() == b"content-length":
+                length = int(value)
+        while len(buffer) < length:
+            data = conn.recv(65536)
+            if not data:
+                conn.close()
+                return
+            buffer += data
+        body, buffer = buffer[:length], buffer[length:]
+        path = "/" + target.decode().split("?")[0].rsplit("/", 1)[-1]
+        response = respond(path, method, body, first)
+        first = False
+        if response is None:
+            conn.close()
+            return
+        conn.sendall(response)
+        if b"Connection: close" in response or response.startswith(b"HTTP/1.0"):
+            conn.close()
+            return
+
+
+def main():
+    server = socket.socket()
+    server.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    server.bind(("127.0.0.1", int(sys.argv[1])))
+    server.listen(64)
+    while True:
+        conn, _ = server.accept()
+        threading.Thread(target=serve, args=(conn,), daemon=True).start()
+
+
+main()
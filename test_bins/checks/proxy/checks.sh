@@ -0,0 +1,31 @@
+# proxy_pass: responses of every framing are decoded and sent framed
+# by the server; pooled connections the upstream closed are retried.
+
+check "Content-Length body" 200 "^fixed length$" "${URL}/upstream/length"
+check "end-to-end fields are passed" 200 "^X-Upstream: length$" "${URL}/upstream/length"
+check "chunked body is decoded" 200 "^chunked body!$" "${URL}/upstream/chunked"
+expect "trailer fields aren't passed" -z \
+	"$(curl -s -i --max-time 5 "${URL}/upstream/chunked" | grep -i '^X-Sum')"
+check "body delimited by closing the connection" 200 "^body until close$" \
+	"${URL}/upstream/close"
+check "HTTP/1.0 response" 200 "^old style body$" "${URL}/upstream/http10"
+check "interim response is skipped" 200 "^final$" "${URL}/upstream/interim"
+check "204 has no body" 204 "^X-Upstream: empty$" "${URL}/upstream/no-content"
+check "request body is passed" 200 "^POST 5$" -d hello "${URL}/upstream/echo"
+head -c 3000000 /dev/zero > "${TMP}/body"
+check "spooled request body is passed" 200 "^POST 3000000$" \
+	--data-binary "@${TMP}/body" "${URL}/upstream/echo"
+check "malformed status line" 502 "" "${URL}/upstream/bad-status"
+check "upstream closing without a response" 502 "" "${URL}/upstream/never"
+
+# "/first-only" closes a connection that already served a request,
+# as if it timed out just as the proxy reused it.
+curl -s -o /dev/null --max-time 5 "${URL}/upstream/length"
+check "GET is retried once on a new connection" 200 "^first only$" \
+	"${URL}/upstream/first-only"
+check "so is a request with a spooled body" 200 "^first only$" \
+	--data-binary "@${TMP}/body" "${URL}/upstream/first-only"
+curl -s -o /dev/null --max-time 5 "${URL}/upstream/length"
+check "POST with a body in memory isn't retried" 502 "" -d hello "${URL}/upstream/first-only"
+expect "both retries were on reused connections" \
+	"$(grep -c 'Reused connection .* was closed' "${TMP}/webserv.log")" -eq 2
@@ -0,0 +1,31 @@
+# try_files: candidates are tried in order, the last one is a fallback
+# URI or a status; every candidate is looked up through the stat cache.
+
+check "first candidate that exists" 200 "^about page" "${URL}/about.html"
+check "\$uri.html candidate" 200 "^about page" "${URL}/about"
+check "\$uri/index.html candidate" 200 "^blog index" "${URL}/blog"
+check "fallback URI when nothing exists" 200 "^front controller" "${URL}/no/such/page"
+check "file in a nested location" 200 "^style" "${URL}/assets/site.css"
+check "=404 fallback" 404 "" "${URL}/assets/missing.css"
+
+# Misses (stat() calls) are cached too: repeating a request that goes
+# down the whole chain hits the cache, instead of stat()'ing
+# its 3 missing candidates every time.
+REQUESTS=50
+MISSES=$(counter /status 'stat_cache_lookups_total{result="miss"}')
+HITS=$(counter /status 'stat_cache_lookups_total{result="hit"}')
+START=$(date +%s)
+I=0
+while [ "$I" -lt "$REQUESTS" ]; do
+	curl -s -o /dev/null --max-time 5 "${URL}/no/such/page"
+	I=$((I + 1))
+done
+SECONDS_TAKEN=$(($(date +%s) - START))
+MISSES=$(($(counter /status 'stat_cache_lookups_total{result="miss"}') - MISSES))
+HITS=$(($(counter /status 'stat_cache_lookups_total{result="hit"}') - HITS))
+# Entries live for a second: at most 4 stat() calls per second
+# (3 candidates and the fallback), instead of 4 per request.
+expect "${REQUESTS} fallback requests took ${MISSES} stat() calls" \
+	"$MISSES" -le $((4 * (SECONDS_TAKEN + 1)))
+expect "${REQUESTS} fallback requests had ${HITS} cached lookups" \
+	"$HITS" -ge $((3 * REQUESTS - 4 * (SECONDS_TAKEN + 1)))
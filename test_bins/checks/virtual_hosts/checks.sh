@@ -0,0 +1,21 @@
+# Name-based virtual hosts on one address: an exact name wins over
+# the longest leading wildcard, which wins over the longest trailing
+# wildcard; anything else goes to the first server.
+
+check "port and letter case of Host are ignored" 200 "^exact server" \
+	-H "Host: WWW.Example.COM:${PORT}" "${URL}/"
+check "leading wildcard" 200 "^leading server" -H "Host: shop.example.com" "${URL}/"
+check "leading wildcard matches several labels" 200 "^leading server" \
+	-H "Host: a.b.example.com" "${URL}/"
+check "longest leading wildcard wins" 200 "^longer server" \
+	-H "Host: v1.api.example.com" "${URL}/"
+check "leading wildcard doesn't match the bare domain" 200 "^default server" \
+	-H "Host: example.com" "${URL}/"
+check "exact name wins over trailing wildcard" 200 "^exact server" \
+	-H "Host: www.example.com" "${URL}/"
+check "trailing wildcard" 200 "^trailing server" -H "Host: www.example.org" "${URL}/"
+check "second name of a server" 200 "^trailing server" -H "Host: mail.example.net" "${URL}/"
+check "leading wildcard wins over trailing wildcard" 200 "^leading server" \
+	-H "Host: mail.example.com" "${URL}/"
+check "unknown name goes to the default server" 200 "^default server" \
+	-H "Host: unknown.test" "${URL}/"
@@ -0,0 +1,137 @@
+#!/bin/sh
+#
+# Runs the request/response checks in test_bins/checks/, from the root
+# of the repository (after make):
+#
+#	test_bins/run_checks.sh [suite ...]
+#
+# Every suite is a directory holding a webserv.conf and a checks.sh.
+# In webserv.conf, @SUITE@ is replaced by the suite's directory, @TMP@ by
+# a scratch directory, @PORT@ by the port the server listens on and
+# @BACKEND@ by the port of the suite's backend.py, if it has one
+# (started with that port before the server).
+# checks.sh is sourced once the server is up; it calls `check`:
+#
+#	check <description> <status> <pattern> [curl arguments ...]
+#
+# which requests "$URL"<path> as curl is told to and expects <status>
+# and a response (header and body) matching the extended regex <pattern>
+# ("" matches anything), or `expect` for anything else:
+#
+#	expect <description> <test(1) expression ...>
+
+WEBSERV="./webserv"
+PORT="${CHECKS_PORT:-18080}"
+BACKEND_PORT="${CHECKS_BACKEND_PORT:-18081}"
+URL="http://127.0.0.1:${PORT}"
+CHECKS_DIR="test_bins/checks"
+
+PASSED=0
+FAILED=0
+
+pass()
+{
+	PASSED=$((PASSED + 1))
+	echo "  ok    $1"
+}
+
+fail()
+{
+	FAILED=$((FAILED + 1))
+	echo "  FAIL  $1"
+}
+
+check()
+{
+	DESCRIPTION="$1"
+	EXPECTED_STATUS="$2"
+	PATTERN="$3"
+	shift 3
+	RESPONSE=$(curl -s -i --max-time 5 "$@" | tr -d '\r')
+	STATUS=$(printf '%s\n' "$RESPONSE" | head -n 1 | cut -d ' ' -f 2)
+	if [ "$STATUS" = "$EXPECTED_STATUS" ] \
+		&& { [ -z "$PATTERN" ] || printf '%s\n' "$RESPONSE" | grep -Eq -- "$PATTERN"; }
+	then
+		pass "$DESCRIPTION"
+	else
+		fail "${DESCRIPTION}: got ${STATUS:-nothing}, expected ${EXPECTED_STATUS} ${PATTERN}"
+	fi
+}
+
+expect()
+{
+	DESCRIPTION="$1"
+	shift
+	if [ "$@" ]; then
+		pass "$DESCRIPTION"
+	else
+		fail "${DESCRIPTION}: $*"
+	fi
+}
+
+# Prints the value of Prometheus sample <name>{<labels>} of "$URL"<path>
+# (0 if there is none yet).
+counter()
+{
+	curl -s --max-time 5 "${URL}$1" | awk -v name="$2" \
+		'$1 == name { value = $2 } END { print value + 0 }'
+}
+
+wait_for_port()
+{
+	TRIES=0
+	until curl -s -o /dev/null --max-time 1 "http://127.0.0.1:$1/"; do
+		TRIES=$((TRIES + 1))
+		if [ "$TRIES" -ge 50 ]; then
+			return 1
+		fi
+		sleep 0.1
+	done
+}
+
+run_suite()
+{
+	SUITE="$(pwd)/${CHECKS_DIR}/$1"
+	TMP=$(mktemp -d)
+	SERVER_PID=""
+	BACKEND_PID=""
+
+	echo "$1"
+	sed -e "s|@SUITE@|${SUITE}|g" -e "s|@TMP@|${TMP}|g"	\
+		-e "s|@PORT@|${PORT}|g" -e "s|@BACKEND@|${BACKEND_PORT}|g"	\
+		"${SUITE}/webserv.conf" > "${TMP}/webserv.conf"
+	if [ -f "${SUITE}/backend.py" ]; then
+		python3 "${SUITE}/backend.py" "$BACKEND_PORT" &
+		BACKEND_PID=$!
+		wait_for_port "$BACKEND_PORT"
+	fi
+	"$WEBSERV" "${TMP}/webserv.conf" > "${TMP}/webserv.log" 2>&1 &
+	SERVER_PID=$!
+	if wait_for_port "$PORT"; then
+		. "${SUITE}/checks.sh"
+	else
+		fail "server didn't start, see ${TMP}/webserv.log"
+	fi
+	kill "$SERVER_PID" 2> /dev/null
+	wait "$SERVER_PID" 2> /dev/null
+	if [ -n "$BACKEND_PID" ]; then
+		kill "$BACKEND_PID" 2> /dev/null
+		wait "$BACKEND_PID" 2> /dev/null
+	fi
+	if [ "$FAILED" -eq 0 ]; then
+		rm -rf "$TMP"
+	fi
+}
+
+if [ ! -x "$WEBSERV" ]; then
+	echo "${WEBSERV} not found: run make first, from the root of the repository"
+	exit 1
+fi
+if [ $# -eq 0 ]; then
+	set -- $(ls "$CHECKS_DIR")
+fi
+for NAME in "$@"; do
+	run_suite "$NAME"
+done
+echo "${PASSED} passed, ${FAILED} failed"
+[ "$FAILED" -eq 0 ]